@@ -7,10 +7,36 @@
 #include <osgDB/FileNameUtils>
 #include <iostream>
 #include <sstream>
+#include "BillboardLayerOptimizer.h"
 #include "BillboardQuadTreeScattering.h"
 #include "MeshQuadTreeScattering.h"
 #include "Serializer.h"
 #include "TerrainQuery.h"
+#include "RasterTerrainQuery.h"
+#include "MemoizedTerrainQuery.h"
+#include "VectorMask.h"
+#include "TerrainSampleCache.h"
+#include "VegetationBVHWriter.h"
+#include "VegetationDensityGridWriter.h"
+
+namespace
+{
+	/**
+		Forward scattered instances to several sinks
+	*/
+	class InstanceSinkGroup : public osgVegetation::ScatterInstanceSink
+	{
+	public:
+		void addSink(osgVegetation::ScatterInstanceSink* sink) {m_Sinks.push_back(sink);}
+		void addInstance(const osg::Vec3d &position, float radius, float height, unsigned int layer)
+		{
+			for(size_t i = 0; i < m_Sinks.size(); i++)
+				m_Sinks[i]->addInstance(position, radius, height, layer);
+		}
+	private:
+		std::vector<osg::ref_ptr<osgVegetation::ScatterInstanceSink> > m_Sinks;
+	};
+}
 
 int main( int argc, char **argv )
 {
@@ -33,12 +59,21 @@ int main( int argc, char **argv )
 	arguments.getApplicationUsage()->addCommandLineOption("--terrain_query_config <filename>", "Terrain query config file");
 	
 	arguments.getApplicationUsage()->addCommandLineOption("--out","out file");
-	arguments.getApplicationUsage()->addCommandLineOption("--terrain","Terrain file");
+	arguments.getApplicationUsage()->addCommandLineOption("--terrain","Terrain file, optional if raster terrain query is used");
 	arguments.getApplicationUsage()->addCommandLineOption("--seed_value","Seed value");
 
 	arguments.getApplicationUsage()->addCommandLineOption("--bounding_box <x.min x-max y-min y-max>","Optional bounding box");
 	arguments.getApplicationUsage()->addCommandLineOption("--paged_lod","Optional save paged LOD database");
 	arguments.getApplicationUsage()->addCommandLineOption("--save_terrain","Optional inject terrain in database");
+	arguments.getApplicationUsage()->addCommandLineOption("--terrain_cache <directory> <cell_size>","Optional bake terrain query samples to cache directory and reuse them in later runs");
+	arguments.getApplicationUsage()->addCommandLineOption("--memoize_terrain <tolerance>","Optional reuse terrain query answers for locations closer than tolerance");
+	arguments.getApplicationUsage()->addCommandLineOption("--aoi <filename>","Optional polygon area of interest (vector mask file), only tiles overlapping the area are generated");
+	arguments.getApplicationUsage()->addCommandLineOption("--global_tiling <root_size> <min_z> <max_z>","Optional world anchored tiling, regions built with same settings share tile boundaries and border tiles");
+	arguments.getApplicationUsage()->addCommandLineOption("--optimize <max_instances> <max_draw_calls>","Optimizer mode, propose layer tile sizes, densities and tile pixel size meeting per view budget (no generation)");
+	arguments.getApplicationUsage()->addCommandLineOption("--optimize_out <filename>","Optional write optimized vegetation config to file");
+	arguments.getApplicationUsage()->addCommandLineOption("--optimize_eye_height <height>","Optional eye height above ground used by optimizer views, default 2");
+	arguments.getApplicationUsage()->addCommandLineOption("--export_bvh <filename> <tile_size>","Optional export instance BVH tiles and index file for simulation queries (see VegetationQuery)");
+	arguments.getApplicationUsage()->addCommandLineOption("--export_density <filename> <cell_size>","Optional export vegetation density grid (canopy height, stem density and cover per cell) for line of sight models (see VegetationDensityGrid)");
 
 	unsigned int helpType = 0;
 	if ((helpType = arguments.readHelpType()))
@@ -76,8 +111,43 @@ int main( int argc, char **argv )
 		save_terrain = true;
 	}
 
+	std::string cache_dir;
+	double cache_cell_size = 1.0;
+	bool use_cache = false;
+	if(arguments.read("--terrain_cache", cache_dir, cache_cell_size))
+	{
+		use_cache = true;
+	}
+
+	double memoize_tolerance = 0;
+	arguments.read("--memoize_terrain", memoize_tolerance);
+
+	std::string aoi_file;
+	arguments.read("--aoi", aoi_file);
+
+	double global_tile_size = 0;
+	double global_min_z = 0;
+	double global_max_z = 0;
+	arguments.read("--global_tiling", global_tile_size, global_min_z, global_max_z);
+
+	double optimize_max_instances = 0;
+	unsigned int optimize_max_draw_calls = 0;
+	const bool optimize = arguments.read("--optimize", optimize_max_instances, optimize_max_draw_calls);
+	std::string optimize_out_file;
+	arguments.read("--optimize_out", optimize_out_file);
+	osgVegetation::BillboardLayerOptimizer::ViewSettings optimize_settings;
+	arguments.read("--optimize_eye_height", optimize_settings.EyeHeight);
+
+	std::string bvh_file;
+	double bvh_tile_size = 0;
+	arguments.read("--export_bvh", bvh_file, bvh_tile_size);
+
+	std::string density_file;
+	double density_cell_size = 0;
+	arguments.read("--export_density", density_file, density_cell_size);
+
 	std::string out_file;
-	if(!arguments.read("--out", out_file))
+	if(!arguments.read("--out", out_file) && !optimize)
 	{
 		std::cerr << "No out file specified\n";
 		return 0;
@@ -89,6 +159,14 @@ int main( int argc, char **argv )
 		std::cout << "Using seed" << seed_value << "\n";
 	}
 
+	//record files read by terrain and terrain query, the terrain cache is only valid while they are unchanged
+	osg::ref_ptr<osgVegetation::TerrainInputRecorder> input_recorder;
+	if(use_cache)
+	{
+		input_recorder = new osgVegetation::TerrainInputRecorder();
+		input_recorder->start();
+	}
+
 	//Load terrain
 	osg::ref_ptr<osg::Group> group = new osg::Group;
 	osg::Node* terrain = NULL;
@@ -146,19 +224,122 @@ int main( int argc, char **argv )
 		osgDB::Registry::instance()->getDataFilePathList().push_back(config_path); 
 
 		osg::ref_ptr<osgVegetation::ITerrainQuery> tq = serializer.loadTerrainQuery(terrain, tq_filename);
+
+		//no terrain model, use raster extent
+		osgVegetation::RasterTerrainQuery* rtq = dynamic_cast<osgVegetation::RasterTerrainQuery*>(tq.get());
+		if(terrain == NULL && rtq)
+		{
+			bounding_box = rtq->getBoundingBox();
+			if(useBBox)
+			{
+				bounding_box._min.set(xmin,ymin,bounding_box._min.z());
+				bounding_box._max.set(xmax,ymax,bounding_box._max.z());
+			}
+		}
+
+		if(use_cache)
+		{
+			//cache is keyed by terrain and terrain query config content, files read while
+			//baking are checked by size and modification time when the cache is reused
+			std::vector<std::string> cache_files;
+			if(terrain_file != "")
+				cache_files.push_back(terrain_file);
+			cache_files.push_back(tq_filename);
+			const std::string cache_key = osgVegetation::TerrainSampleCache::computeKey(cache_files, bounding_box, cache_cell_size);
+			const std::string cache_prefix = osgDB::concatPaths(cache_dir, "terrain_" + cache_key);
+			if(!osgVegetation::TerrainSampleCache::exists(cache_prefix))
+			{
+				osgDB::makeDirectory(cache_dir);
+				osgVegetation::TerrainSampleCache::bake(tq.get(), bounding_box, cache_cell_size, cache_prefix);
+				osgVegetation::TerrainSampleCache::saveInputs(cache_prefix, input_recorder->getFiles());
+			}
+			input_recorder->stop();
+			std::cout << "Using terrain sample cache:" << cache_prefix << "\n";
+			tq = osgVegetation::TerrainSampleCache::load(cache_prefix);
+		}
+
+		osg::ref_ptr<osgVegetation::MemoizedTerrainQuery> memoized_tq;
+		if(memoize_tolerance > 0)
+		{
+			memoized_tq = new osgVegetation::MemoizedTerrainQuery(tq.get(), memoize_tolerance);
+			tq = memoized_tq;
+		}
 		osgVegetation::EnvironmentSettings env_settings;
 		if(env_filename != "")
 			env_settings = serializer.loadEnvironmentSettings(env_filename);
+		osg::ref_ptr<osgVegetation::VectorMask> aoi;
+		if(aoi_file != "")
+		{
+			aoi = osgVegetation::VectorMask::load(aoi_file);
+			//shrink generation area to area of interest
+			const osg::BoundingBoxd& aoi_bb = aoi->getBounds();
+			bounding_box._min.set(std::max(bounding_box.xMin(), aoi_bb.xMin()), std::max(bounding_box.yMin(), aoi_bb.yMin()), bounding_box.zMin());
+			bounding_box._max.set(std::min(bounding_box.xMax(), aoi_bb.xMax()), std::min(bounding_box.yMax(), aoi_bb.yMax()), bounding_box.zMax());
+		}
+		if(optimize)
+		{
+			osgVegetation::BillboardLayerOptimizer optimizer(bounding_box, optimize_settings);
+			//evaluate the same quad tree roots as generation
+			optimizer.setRootLayout(aoi.get(), global_tile_size);
+			const osgVegetation::BillboardLayerOptimizer::ViewStatistics before = optimizer.evaluate(bb_vector);
+			std::cout << "Current settings, max visible instances:" << before.Instances << " max draw calls:" << before.DrawCalls << "\n";
+			const bool budget_met = optimizer.optimize(bb_vector, optimize_max_instances, optimize_max_draw_calls);
+			const osgVegetation::BillboardLayerOptimizer::ViewStatistics after = optimizer.evaluate(bb_vector);
+			std::cout << "Proposed settings, max visible instances:" << after.Instances << " max draw calls:" << after.DrawCalls << (budget_met ? "" : " (budget not met)") << "\n";
+			for(size_t i = 0; i < bb_vector.size(); i++)
+			{
+				std::cout << "BillboardData " << i << " TilePixelSize:" << bb_vector[i].TilePixelSize << "\n";
+				for(size_t j = 0; j < bb_vector[i].Layers.size(); j++)
+				{
+					const osgVegetation::BillboardLayer& layer = bb_vector[i].Layers[j];
+					std::cout << "  " << layer.TextureName << " MinTileSize:" << layer.MinTileSize << " Density:" << layer.Density << "\n";
+				}
+			}
+			if(optimize_out_file != "")
+			{
+				serializer.saveBillboardLayerSettings(config_file, bb_vector, optimize_out_file);
+				std::cout << "Optimized config written to:" << optimize_out_file << "\n";
+			}
+			return 0;
+		}
+
 		osgVegetation::BillboardQuadTreeScattering scattering(tq, env_settings);
+		scattering.setAreaOfInterest(aoi.get());
+		if(global_tile_size > 0)
+		{
+			std::cout << "Using global tiling, root size:" << global_tile_size << "\n";
+			scattering.setGlobalTiling(global_tile_size, global_min_z, global_max_z, static_cast<unsigned int>(seed_value));
+		}
+		osg::ref_ptr<InstanceSinkGroup> sinks = new InstanceSinkGroup();
+		osg::ref_ptr<osgVegetation::VegetationBVHWriter> bvh_writer;
+		if(bvh_file != "")
+		{
+			bvh_writer = new osgVegetation::VegetationBVHWriter(bvh_file, bvh_tile_size);
+			sinks->addSink(bvh_writer.get());
+		}
+		osg::ref_ptr<osgVegetation::VegetationDensityGridWriter> density_writer;
+		if(density_file != "")
+		{
+			density_writer = new osgVegetation::VegetationDensityGridWriter(density_file, bounding_box, density_cell_size);
+			sinks->addSink(density_writer.get());
+		}
+		if(bvh_writer.valid() || density_writer.valid())
+			scattering.setInstanceSink(sinks.get());
 		std::cout << "Using bounding box:" << bounding_box.xMin() << " " << bounding_box.yMin() << " "<< bounding_box.xMax() << " " << bounding_box.yMax() << "\n";
 		std::cout << "Start Scattering...\n";
 
 		srand(seed_value); //reset random numbers, TODO: support layer seed
 
 		osg::Node* bb_node = scattering.generate(bounding_box, bb_vector, out_file, pagedLOD);
+		if(memoized_tq.valid())
+			std::cout << "Terrain query hit rate:" << 100.0*memoized_tq->getHitRate() << "% (" << memoized_tq->getNumHits() << " of " << memoized_tq->getNumQueries() << ")\n";
 		group->addChild(bb_node);
+		if(bvh_writer.valid())
+			bvh_writer->write();
+		if(density_writer.valid())
+			density_writer->write();
 		
-		if(save_terrain)
+		if(save_terrain && terrain)
 		{
 			osg::ProxyNode* pn = dynamic_cast<osg::ProxyNode*>(bb_node);
 			if(pn)
@@ -0,0 +1,137 @@
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <osg/Vec4>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include "BillboardLayer.h"
+#include "ScatterKernels.h"
+#include "VegetationUtils.h"
+
+//Compare scalar per-instance attribute generation (as done before the batch kernels) with the SIMD batch kernels
+
+namespace
+{
+	struct ScalarInstance
+	{
+		float X, Y;
+		float Width, Height;
+		osg::Vec4 Color;
+	};
+
+	void runScalar(const osgVegetation::BillboardLayer &layer, const std::vector<osg::Vec4> &terrain_colors, std::vector<ScalarInstance> &out)
+	{
+		out.resize(terrain_colors.size());
+		for(size_t i = 0; i < terrain_colors.size(); i++)
+		{
+			ScalarInstance& inst = out[i];
+			inst.X = static_cast<float>(osgVegetation::Utils::random(0.0, 1000.0));
+			inst.Y = static_cast<float>(osgVegetation::Utils::random(0.0, 1000.0));
+			float rand_int = osgVegetation::Utils::random(layer.ColorIntensity.x(),layer.ColorIntensity.y());
+			float tree_scale = osgVegetation::Utils::random(layer.Scale.x() ,layer.Scale.y());
+			inst.Width = osgVegetation::Utils::random(layer.Width.x(), layer.Width.y())*tree_scale;
+			inst.Height = osgVegetation::Utils::random(layer.Height.x(), layer.Height.y())*tree_scale;
+			osg::Vec4 terrain_color = terrain_colors[i];
+			if(layer.UseTerrainIntensity)
+			{
+				float terrain_intensity = (terrain_color.r() + terrain_color.g() + terrain_color.b())/3.0;
+				terrain_color.set(terrain_intensity,terrain_intensity,terrain_intensity,terrain_color.a());
+			}
+			inst.Color = terrain_color*(layer.TerrainColorRatio*rand_int);
+			inst.Color += osg::Vec4(1,1,1,1)*(rand_int * (1.0 - layer.TerrainColorRatio));
+			inst.Color.set(inst.Color.r(), inst.Color.g(), inst.Color.b(), 1.0);
+		}
+	}
+
+	void runBatch(const osgVegetation::BillboardLayer &layer, const std::vector<osg::Vec4> &terrain_colors, unsigned int batch_size,
+		osgVegetation::CandidateBatch &candidates, osgVegetation::BillboardAttributeBatch &attributes, float &checksum)
+	{
+		osgVegetation::BatchRandom rng(1);
+		const unsigned int num_samples = static_cast<unsigned int>(terrain_colors.size());
+		for(unsigned int first = 0; first < num_samples; first += batch_size)
+		{
+			const unsigned int n = std::min(batch_size, num_samples - first);
+			osgVegetation::ScatterKernels::generatePositions(rng, 1000.0f, 1000.0f, n, candidates);
+			attributes.clear();
+			for(unsigned int i = 0; i < n; i++)
+				attributes.addSample(terrain_colors[first + i]);
+			osgVegetation::ScatterKernels::synthesizeBillboardAttributes(rng, layer, attributes);
+			//keep results alive
+			checksum += attributes.Width[n-1] + attributes.ColorR[n-1] + candidates.X[n-1];
+		}
+	}
+}
+
+int main( int argc, char **argv )
+{
+	osg::ArgumentParser arguments(&argc,argv);
+	arguments.getApplicationUsage()->addCommandLineOption("--samples <count>","Number of instances to generate, default 4000000");
+	arguments.getApplicationUsage()->addCommandLineOption("--batch_size <count>","Kernel batch size, default 1024");
+	arguments.getApplicationUsage()->addCommandLineOption("--iterations <count>","Number of runs, best run is reported, default 5");
+
+	unsigned int helpType = 0;
+	if ((helpType = arguments.readHelpType()))
+	{
+		arguments.getApplicationUsage()->write(std::cout, helpType);
+		return 1;
+	}
+
+	unsigned int num_samples = 4000000;
+	arguments.read("--samples", num_samples);
+	unsigned int batch_size = 1024;
+	arguments.read("--batch_size", batch_size);
+	unsigned int iterations = 5;
+	arguments.read("--iterations", iterations);
+	if(num_samples == 0 || batch_size == 0 || iterations == 0)
+	{
+		std::cerr << "Invalid arguments\n";
+		return 1;
+	}
+
+	osgVegetation::BillboardLayer layer("bench", 100);
+	layer.Scale.set(0.8, 1.2);
+	layer.Width.set(1.0, 2.0);
+	layer.Height.set(2.0, 4.0);
+	layer.ColorIntensity.set(0.6, 1.0);
+	layer.TerrainColorRatio = 0.4;
+	layer.UseTerrainIntensity = true;
+
+	std::vector<osg::Vec4> terrain_colors(num_samples);
+	for(unsigned int i = 0; i < num_samples; i++)
+		terrain_colors[i].set((i % 255)/255.0f, (i % 127)/127.0f, (i % 63)/63.0f, 1.0f);
+
+	std::vector<ScalarInstance> scalar_out;
+	osgVegetation::CandidateBatch candidates;
+	osgVegetation::BillboardAttributeBatch attributes;
+	float checksum = 0;
+	double best_scalar = 0;
+	double best_batch = 0;
+	for(unsigned int i = 0; i < iterations; i++)
+	{
+		osg::Timer_t start = osg::Timer::instance()->tick();
+		runScalar(layer, terrain_colors, scalar_out);
+		const double scalar_time = osg::Timer::instance()->delta_m(start, osg::Timer::instance()->tick());
+
+		start = osg::Timer::instance()->tick();
+		runBatch(layer, terrain_colors, batch_size, candidates, attributes, checksum);
+		const double batch_time = osg::Timer::instance()->delta_m(start, osg::Timer::instance()->tick());
+
+		if(i == 0 || scalar_time < best_scalar)
+			best_scalar = scalar_time;
+		if(i == 0 || batch_time < best_batch)
+			best_batch = batch_time;
+	}
+
+#if defined(OSGV_USE_AVX2)
+	const char* simd_path = "AVX2";
+#elif defined(OSGV_USE_SSE2)
+	const char* simd_path = "SSE2";
+#else
+	const char* simd_path = "scalar fallback";
+#endif
+	std::cout << "Samples:" << num_samples << " Batch size:" << batch_size << " Kernel path:" << simd_path << "\n";
+	std::cout << "Scalar:" << best_scalar << " ms\n";
+	std::cout << "Batch:" << best_batch << " ms\n";
+	std::cout << "Speedup:" << (best_batch > 0 ? best_scalar / best_batch : 0) << "x (checksum " << checksum << ")\n";
+	return 0;
+}
@@ -0,0 +1,184 @@
+#include "BCnDecoder.h"
+
+namespace osgVegetation
+{
+	namespace
+	{
+		inline unsigned int readUInt16(const unsigned char* data)
+		{
+			return static_cast<unsigned int>(data[0]) | (static_cast<unsigned int>(data[1]) << 8);
+		}
+
+		inline unsigned int readUInt32(const unsigned char* data)
+		{
+			return readUInt16(data) | (readUInt16(data + 2) << 16);
+		}
+
+		inline void unpack565(unsigned int color, unsigned char* rgba)
+		{
+			const unsigned int r = (color >> 11) & 31;
+			const unsigned int g = (color >> 5) & 63;
+			const unsigned int b = color & 31;
+			rgba[0] = static_cast<unsigned char>((r << 3) | (r >> 2));
+			rgba[1] = static_cast<unsigned char>((g << 2) | (g >> 4));
+			rgba[2] = static_cast<unsigned char>((b << 3) | (b >> 2));
+			rgba[3] = 255;
+		}
+	}
+
+	bool BCnDecoder::isSupportedFormat(GLenum pixel_format)
+	{
+		return getBlockSize(pixel_format) > 0;
+	}
+
+	unsigned int BCnDecoder::getBlockSize(GLenum pixel_format)
+	{
+		switch (pixel_format)
+		{
+		case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+		case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+			return 8;
+		case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+		case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+			return 16;
+		default:
+			return 0;
+		}
+	}
+
+	void BCnDecoder::decodeBlock(GLenum pixel_format, const unsigned char* block, unsigned char* rgba)
+	{
+		switch (pixel_format)
+		{
+		case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+			decodeDXT1(block, rgba, false);
+			break;
+		case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+			decodeDXT1(block, rgba, true);
+			break;
+		case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+			decodeDXT3(block, rgba);
+			break;
+		case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+			decodeDXT5(block, rgba);
+			break;
+		default:
+			OSGV_EXCEPT(std::string("BCnDecoder::decodeBlock - Unsupported compressed format").c_str());
+		}
+	}
+
+	void BCnDecoder::_decodeColorBlock(const unsigned char* block, unsigned char* rgba, bool allow_three_color, bool has_alpha)
+	{
+		const unsigned int c0 = readUInt16(block);
+		const unsigned int c1 = readUInt16(block + 2);
+		unsigned char palette[4][4];
+		unpack565(c0, palette[0]);
+		unpack565(c1, palette[1]);
+		if (c0 > c1 || !allow_three_color)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				palette[2][c] = static_cast<unsigned char>((2 * palette[0][c] + palette[1][c]) / 3);
+				palette[3][c] = static_cast<unsigned char>((palette[0][c] + 2 * palette[1][c]) / 3);
+			}
+			palette[2][3] = 255;
+			palette[3][3] = 255;
+		}
+		else
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				palette[2][c] = static_cast<unsigned char>((palette[0][c] + palette[1][c]) / 2);
+				palette[3][c] = 0;
+			}
+			palette[2][3] = 255;
+			palette[3][3] = has_alpha ? 0 : 255;
+		}
+
+		const unsigned int indices = readUInt32(block + 4);
+		for (int i = 0; i < 16; i++)
+		{
+			const unsigned char* color = palette[(indices >> (2 * i)) & 3];
+			rgba[i * 4] = color[0];
+			rgba[i * 4 + 1] = color[1];
+			rgba[i * 4 + 2] = color[2];
+			rgba[i * 4 + 3] = color[3];
+		}
+	}
+
+	void BCnDecoder::decodeDXT1(const unsigned char* block, unsigned char* rgba, bool has_alpha)
+	{
+		_decodeColorBlock(block, rgba, true, has_alpha);
+	}
+
+	void BCnDecoder::decodeDXT3(const unsigned char* block, unsigned char* rgba)
+	{
+		_decodeColorBlock(block + 8, rgba, false, false);
+		//explicit 4-bit alpha
+		for (int i = 0; i < 16; i++)
+		{
+			const unsigned int alpha = (block[i / 2] >> (4 * (i & 1))) & 15;
+			rgba[i * 4 + 3] = static_cast<unsigned char>(alpha * 17);
+		}
+	}
+
+	void BCnDecoder::decodeDXT5(const unsigned char* block, unsigned char* rgba)
+	{
+		_decodeColorBlock(block + 8, rgba, false, false);
+
+		//interpolated alpha
+		const unsigned int a0 = block[0];
+		const unsigned int a1 = block[1];
+		unsigned char alpha[8];
+		alpha[0] = static_cast<unsigned char>(a0);
+		alpha[1] = static_cast<unsigned char>(a1);
+		if (a0 > a1)
+		{
+			for (unsigned int i = 1; i < 7; i++)
+				alpha[i + 1] = static_cast<unsigned char>(((7 - i) * a0 + i * a1) / 7);
+		}
+		else
+		{
+			for (unsigned int i = 1; i < 5; i++)
+				alpha[i + 1] = static_cast<unsigned char>(((5 - i) * a0 + i * a1) / 5);
+			alpha[6] = 0;
+			alpha[7] = 255;
+		}
+
+		//48 bits of 3-bit indices
+		unsigned int bits_low = block[2] | (block[3] << 8) | (block[4] << 16);
+		unsigned int bits_high = block[5] | (block[6] << 8) | (block[7] << 16);
+		for (int i = 0; i < 8; i++)
+		{
+			rgba[i * 4 + 3] = alpha[(bits_low >> (3 * i)) & 7];
+			rgba[(i + 8) * 4 + 3] = alpha[(bits_high >> (3 * i)) & 7];
+		}
+	}
+
+	BCnBlockCache::BCnBlockCache(const unsigned char* data, int width, int height, GLenum pixel_format, unsigned int num_cache_blocks) : m_Data(data),
+		m_PixelFormat(pixel_format),
+		m_BlockSize(BCnDecoder::getBlockSize(pixel_format)),
+		m_BlocksPerRow((width + 3) / 4),
+		m_NumSlots(num_cache_blocks > 0 ? num_cache_blocks : 1),
+		m_NumDecodedBlocks(0)
+	{
+		if (m_BlockSize == 0)
+			OSGV_EXCEPT(std::string("BCnBlockCache::BCnBlockCache - Unsupported compressed format").c_str());
+
+		//no need to reserve more slots than blocks
+		const unsigned int num_blocks = static_cast<unsigned int>(m_BlocksPerRow * ((height + 3) / 4));
+		if (m_NumSlots > num_blocks)
+			m_NumSlots = num_blocks > 0 ? num_blocks : 1;
+
+		//mark all slots as empty
+		m_SlotBlock.resize(m_NumSlots, 0xFFFFFFFF);
+		m_Texels.resize(m_NumSlots * 64);
+	}
+
+	void BCnBlockCache::_decode(unsigned int block_index, unsigned int slot) const
+	{
+		BCnDecoder::decodeBlock(m_PixelFormat, m_Data + block_index * m_BlockSize, &m_Texels[slot * 64]);
+		m_SlotBlock[slot] = block_index;
+		m_NumDecodedBlocks++;
+	}
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include "Common.h"
+#include <osg/Referenced>
+#include <osg/Image>
+#include <vector>
+
+namespace osgVegetation
+{
+	/**
+		CPU decoder for BC1-3 (DXT1/3/5) compressed blocks.
+		All decode functions output 4x4 RGBA8 texels in row major order (64 bytes).
+	*/
+	class osgvExport BCnDecoder
+	{
+	public:
+		/**
+			Check if pixel format is a supported compressed format
+		*/
+		static bool isSupportedFormat(GLenum pixel_format);
+
+		/**
+			Get size in bytes of one compressed 4x4 block
+		*/
+		static unsigned int getBlockSize(GLenum pixel_format);
+
+		/**
+			Decode single block of pixel_format type.
+		*/
+		static void decodeBlock(GLenum pixel_format, const unsigned char* block, unsigned char* rgba);
+
+		static void decodeDXT1(const unsigned char* block, unsigned char* rgba, bool has_alpha);
+		static void decodeDXT3(const unsigned char* block, unsigned char* rgba);
+		static void decodeDXT5(const unsigned char* block, unsigned char* rgba);
+	private:
+		static void _decodeColorBlock(const unsigned char* block, unsigned char* rgba, bool allow_three_color, bool has_alpha);
+	};
+
+	/**
+		On demand block decompression of BCn compressed image data.
+		Blocks are decoded first time a texel inside the block is requested
+		and stored in a direct mapped cache, i.e only touched blocks are decompressed.
+	*/
+	class osgvExport BCnBlockCache : public osg::Referenced
+	{
+	public:
+		/**
+			@param data Compressed data (first mipmap level), not owned by the cache.
+			@param num_cache_blocks Number of decoded blocks to keep in cache (64 bytes each)
+		*/
+		BCnBlockCache(const unsigned char* data, int width, int height, GLenum pixel_format, unsigned int num_cache_blocks = 4096);
+
+		/**
+			Get pointer to decoded RGBA8 texel
+		*/
+		const unsigned char* getTexel(int s, int t) const
+		{
+			const unsigned int block_index = static_cast<unsigned int>((t >> 2) * m_BlocksPerRow + (s >> 2));
+			const unsigned int slot = block_index % m_NumSlots;
+			if (m_SlotBlock[slot] != block_index)
+				_decode(block_index, slot);
+			return &m_Texels[slot * 64 + ((t & 3) * 4 + (s & 3)) * 4];
+		}
+
+		/**
+			Get number of block decodes done so far, including re-decodes of evicted blocks.
+		*/
+		unsigned int getNumDecodedBlocks() const { return m_NumDecodedBlocks; }
+	private:
+		void _decode(unsigned int block_index, unsigned int slot) const;
+		const unsigned char* m_Data;
+		GLenum m_PixelFormat;
+		unsigned int m_BlockSize;
+		int m_BlocksPerRow;
+		unsigned int m_NumSlots;
+		mutable std::vector<unsigned int> m_SlotBlock;
+		mutable std::vector<unsigned char> m_Texels;
+		mutable unsigned int m_NumDecodedBlocks;
+	};
+}
@@ -11,6 +11,7 @@ namespace osgVegetation
 {
 	/**
 		IBillboardRenderingTech implementation that use a shader instancing based technique to generate vegetation billboars.
+		Instance buffers of created tiles can be edited at runtime with BillboardInstanceEditor.
 	*/
 	class osgvExport BRTShaderInstancing :  public IBillboardRenderingTech
 	{
@@ -0,0 +1,560 @@
+#include "BillboardInstanceEditor.h"
+#include "BillboardScatterPolicies.h"
+#include <osg/Geode>
+#include <osg/NodeVisitor>
+#include <osg/StateSet>
+#include <osg/Version>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace osgVegetation
+{
+	namespace
+	{
+		//position, color and size/texture texels, see BRTShaderInstancing::create
+		const unsigned int TEXELS_PER_INSTANCE = 3;
+		const size_t SLOT_BYTES = TEXELS_PER_INSTANCE * sizeof(osg::Vec4f);
+
+		float GetTileSize(const osg::BoundingBox &bb)
+		{
+			return bb.xMax() - bb.xMin();
+		}
+	}
+
+	/**
+		Upload dirty instance slots before the tile is drawn. Slots are tracked per
+		graphics context, contexts that have not drawn the tile yet compile the whole
+		buffer on first use.
+	*/
+	class BillboardInstanceEditor::UploadCallback : public osg::Drawable::DrawCallback
+	{
+	public:
+		UploadCallback(osg::Image* image) : m_Image(image) {}
+
+		void setImage(osg::Image* image)
+		{
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_Mutex);
+			//new image is uploaded as a whole
+			m_Image = image;
+			m_Pending.clear();
+		}
+
+		void addDirtySlots(const std::set<unsigned int> &slots)
+		{
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_Mutex);
+			for(std::map<unsigned int, std::set<unsigned int> >::iterator iter = m_Pending.begin(); iter != m_Pending.end(); ++iter)
+				iter->second.insert(slots.begin(), slots.end());
+		}
+
+		void drawImplementation(osg::RenderInfo& render_info, const osg::Drawable* drawable) const
+		{
+#if OSG_VERSION_GREATER_OR_EQUAL(3,5,6)
+			_upload(render_info);
+#endif
+			drawable->drawImplementation(render_info);
+		}
+	private:
+#if OSG_VERSION_GREATER_OR_EQUAL(3,5,6)
+		void _upload(osg::RenderInfo& render_info) const
+		{
+			const unsigned int context_id = render_info.getContextID();
+			std::vector<unsigned int> slots;
+			osg::ref_ptr<osg::Image> image;
+			{
+				OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_Mutex);
+				std::map<unsigned int, std::set<unsigned int> >::iterator iter = m_Pending.find(context_id);
+				if(iter == m_Pending.end())
+				{
+					//first draw in this context, buffer is compiled from current image
+					m_Pending[context_id];
+					return;
+				}
+				slots.assign(iter->second.begin(), iter->second.end());
+				iter->second.clear();
+				image = m_Image;
+			}
+			if(slots.empty() || image->getBufferObject() == NULL)
+				return;
+
+			//buffer not compiled yet or waiting for full upload
+			osg::GLBufferObject* buffer = image->getBufferObject()->getGLBufferObject(context_id);
+			if(buffer == NULL || buffer->isDirty())
+				return;
+
+			const osg::GLExtensions* extensions = osg::GLExtensions::Get(context_id, true);
+			const size_t offset = buffer->getOffset(image->getBufferIndex());
+			const unsigned char* data = image->data();
+			osg::State& state = *render_info.getState();
+			state.bindVertexBufferObject(buffer);
+			size_t i = 0;
+			while(i < slots.size())
+			{
+				//upload consecutive slots in one call
+				size_t j = i + 1;
+				while(j < slots.size() && slots[j] == slots[j - 1] + 1)
+					j++;
+				extensions->glBufferSubData(GL_ARRAY_BUFFER_ARB,
+					static_cast<GLintptr>(offset + slots[i] * SLOT_BYTES),
+					static_cast<GLsizeiptr>((j - i) * SLOT_BYTES),
+					data + slots[i] * SLOT_BYTES);
+				i = j;
+			}
+			state.unbindVertexBufferObject();
+		}
+#endif
+		mutable OpenThreads::Mutex m_Mutex;
+		osg::ref_ptr<osg::Image> m_Image;
+		mutable std::map<unsigned int, std::set<unsigned int> > m_Pending;
+	};
+
+	class BillboardInstanceEditor::TileCollector : public osg::NodeVisitor
+	{
+	public:
+		TileCollector(BillboardInstanceEditor &editor, bool add) : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN),
+			m_Editor(editor),
+			m_Add(add)
+		{
+
+		}
+
+		void apply(osg::Geode& geode)
+		{
+			const osg::Vec3d offset = osg::computeLocalToWorld(getNodePath()).getTrans();
+			const osg::StateSet* technique = NULL;
+			bool interior = false;
+			if(m_Add)
+				_getIdentity(geode, technique, interior);
+			for(unsigned int i = 0; i < geode.getNumDrawables(); i++)
+			{
+				osg::Geometry* geometry = geode.getDrawable(i)->asGeometry();
+				if(geometry == NULL)
+					continue;
+				if(m_Add)
+					m_Editor._addTile(geometry, offset, technique, interior);
+				else
+					m_Editor._removeTile(geometry);
+			}
+		}
+	private:
+		/**
+			Find generation state set and interior flag from the full parental path, the
+			visited sub graph may be a paged tile that doesn't include the generation root.
+		*/
+		static void _getIdentity(osg::Geode& geode, const osg::StateSet* &technique, bool &interior)
+		{
+			const osg::NodePathList paths = geode.getParentalNodePaths();
+			if(paths.size() == 0)
+				return;
+			const osg::NodePath& path = paths[0];
+			//path ends with the geode itself
+			interior = path.size() > 1 && path[path.size() - 2]->getName() == BillboardRenderPolicy::INTERIOR_LOD_NAME;
+			for(size_t i = path.size(); i > 0; i--)
+			{
+				const osg::StateSet* state_set = path[i - 1]->getStateSet();
+				if(state_set && state_set->getTextureAttribute(0, osg::StateAttribute::TEXTURE))
+				{
+					technique = state_set;
+					return;
+				}
+			}
+		}
+
+		BillboardInstanceEditor& m_Editor;
+		bool m_Add;
+	};
+
+	BillboardInstanceEditor::BillboardInstanceEditor()
+	{
+
+	}
+
+	BillboardInstanceEditor::~BillboardInstanceEditor()
+	{
+		flush();
+	}
+
+	void BillboardInstanceEditor::addTiles(osg::Node* node)
+	{
+		if(node == NULL)
+			return;
+		TileCollector collector(*this, true);
+		node->accept(collector);
+	}
+
+	void BillboardInstanceEditor::removeTiles(osg::Node* node)
+	{
+		if(node == NULL)
+			return;
+		TileCollector collector(*this, false);
+		node->accept(collector);
+	}
+
+	void BillboardInstanceEditor::_addTile(osg::Geometry* geometry, const osg::Vec3d &offset, const osg::StateSet* technique, bool interior)
+	{
+		if(m_TileIndex.find(geometry) != m_TileIndex.end())
+			return;
+
+		//only accept tiles using the BRTShaderInstancing buffer layout
+		osg::StateSet* state_set = geometry->getStateSet();
+		if(state_set == NULL || state_set->getUniform("DataBufferTexture") == NULL)
+			return;
+		osg::TextureBuffer* tbo = dynamic_cast<osg::TextureBuffer*>(state_set->getTextureAttribute(1, osg::StateAttribute::TEXTURE));
+		osg::Image* image = tbo ? tbo->getImage() : NULL;
+		if(image == NULL || image->getPixelFormat() != GL_RGBA || image->getDataType() != GL_FLOAT || image->s() % TEXELS_PER_INSTANCE != 0)
+			return;
+		osg::DrawArrays* primitives = geometry->getNumPrimitiveSets() > 0 ? dynamic_cast<osg::DrawArrays*>(geometry->getPrimitiveSet(0)) : NULL;
+		if(primitives == NULL)
+			return;
+
+		unsigned int index = static_cast<unsigned int>(m_Tiles.size());
+		if(m_FreeTiles.size() > 0)
+		{
+			index = m_FreeTiles.back();
+			m_FreeTiles.pop_back();
+		}
+		else
+			m_Tiles.push_back(Tile());
+
+		Tile& tile = m_Tiles[index];
+		tile.Geometry = geometry;
+		tile.TBO = tbo;
+		tile.Image = image;
+		tile.Primitives = primitives;
+		tile.Technique = technique;
+		tile.Interior = interior;
+		tile.Count = primitives->getCount();
+		tile.Offset = offset;
+		tile.Bounds = geometry->getInitialBound();
+		tile.NumSlots = std::min(static_cast<unsigned int>(primitives->getNumInstances()), static_cast<unsigned int>(image->s()) / TEXELS_PER_INSTANCE);
+		tile.NumVisible = tile.NumSlots;
+		tile.SlotIDs.resize(tile.NumSlots);
+		for(unsigned int i = 0; i < tile.NumSlots; i++)
+		{
+			const unsigned int id = _newID();
+			m_Locations[id].Tile = index;
+			m_Locations[id].Slot = i;
+			tile.SlotIDs[i] = id;
+		}
+
+		//edits are done between frames, make draw thread finish tile before next update
+		geometry->setDataVariance(osg::Object::DYNAMIC);
+		tile.Upload = new UploadCallback(image);
+		geometry->setDrawCallback(tile.Upload.get());
+		m_TileIndex[geometry] = index;
+	}
+
+	void BillboardInstanceEditor::_removeTile(osg::Geometry* geometry)
+	{
+		std::map<osg::Geometry*, unsigned int>::iterator iter = m_TileIndex.find(geometry);
+		if(iter == m_TileIndex.end())
+			return;
+		const unsigned int index = iter->second;
+		Tile& tile = m_Tiles[index];
+		for(unsigned int i = 0; i < tile.NumSlots; i++)
+			_freeID(tile.SlotIDs[i]);
+		geometry->setDrawCallback(NULL);
+		tile = Tile();
+		m_TileIndex.erase(iter);
+		m_FreeTiles.push_back(index);
+	}
+
+	unsigned int BillboardInstanceEditor::_newID()
+	{
+		if(m_FreeIDs.size() > 0)
+		{
+			const unsigned int id = m_FreeIDs.back();
+			m_FreeIDs.pop_back();
+			return id;
+		}
+		m_Locations.push_back(Location());
+		return static_cast<unsigned int>(m_Locations.size() - 1);
+	}
+
+	void BillboardInstanceEditor::_freeID(unsigned int id)
+	{
+		m_Locations[id] = Location();
+		m_FreeIDs.push_back(id);
+	}
+
+	const BillboardInstanceEditor::Location* BillboardInstanceEditor::_getLocation(unsigned int id) const
+	{
+		if(id >= m_Locations.size() || m_Locations[id].Tile == INVALID_ID)
+			return NULL;
+		return &m_Locations[id];
+	}
+
+	unsigned int BillboardInstanceEditor::_findTile(const osg::Vec3d &position, const Tile* reference) const
+	{
+		const float tile_size = reference ? GetTileSize(reference->Bounds) : 0.0f;
+		unsigned int best = INVALID_ID;
+		float best_size = 0;
+		for(std::map<osg::Geometry*, unsigned int>::const_iterator iter = m_TileIndex.begin(); iter != m_TileIndex.end(); ++iter)
+		{
+			const Tile& tile = m_Tiles[iter->second];
+			//texture indices are only valid inside the same generation, interior tiles are only drawn near the viewer
+			if(reference ? (tile.Technique != reference->Technique || tile.Interior != reference->Interior) : tile.Interior)
+				continue;
+			const osg::Vec3d local = position - tile.Offset;
+			if(local.x() < tile.Bounds.xMin() || local.x() >= tile.Bounds.xMax() || local.y() < tile.Bounds.yMin() || local.y() >= tile.Bounds.yMax())
+				continue;
+			const float size = GetTileSize(tile.Bounds);
+			if(reference)
+			{
+				if(fabs(size - tile_size) <= 1e-3f * tile_size)
+					return iter->second;
+			}
+			else if(best == INVALID_ID || size < best_size)
+			{
+				best = iter->second;
+				best_size = size;
+			}
+		}
+		return best;
+	}
+
+	unsigned int BillboardInstanceEditor::find(const osg::Vec3d &position, double max_distance) const
+	{
+		unsigned int best = INVALID_ID;
+		double best_d2 = max_distance * max_distance;
+		for(std::map<osg::Geometry*, unsigned int>::const_iterator iter = m_TileIndex.begin(); iter != m_TileIndex.end(); ++iter)
+		{
+			const Tile& tile = m_Tiles[iter->second];
+			const osg::Vec3d local = position - tile.Offset;
+			if(local.x() < tile.Bounds.xMin() - max_distance || local.x() > tile.Bounds.xMax() + max_distance ||
+				local.y() < tile.Bounds.yMin() - max_distance || local.y() > tile.Bounds.yMax() + max_distance)
+				continue;
+			for(unsigned int i = 0; i < tile.NumVisible; i++)
+			{
+				const osg::Vec4f* ptr = reinterpret_cast<const osg::Vec4f*>(tile.Image->data(TEXELS_PER_INSTANCE * i));
+				const double dx = ptr[0].x() - local.x();
+				const double dy = ptr[0].y() - local.y();
+				const double d2 = dx * dx + dy * dy;
+				if(d2 <= best_d2)
+				{
+					best_d2 = d2;
+					best = tile.SlotIDs[i];
+				}
+			}
+		}
+		return best;
+	}
+
+	bool BillboardInstanceEditor::getInstance(unsigned int id, Instance &instance) const
+	{
+		const Location* location = _getLocation(id);
+		if(location == NULL)
+			return false;
+		const Tile& tile = m_Tiles[location->Tile];
+		const osg::Vec4f* ptr = reinterpret_cast<const osg::Vec4f*>(tile.Image->data(TEXELS_PER_INSTANCE * location->Slot));
+		instance.Position = osg::Vec3d(ptr[0].x(), ptr[0].y(), ptr[0].z()) + tile.Offset;
+		instance.Color = ptr[1];
+		instance.Width = ptr[2].x();
+		instance.Height = ptr[2].y();
+		instance.TextureIndex = static_cast<unsigned int>(ptr[2].z() + 0.5f);
+		return true;
+	}
+
+	bool BillboardInstanceEditor::isVisible(unsigned int id) const
+	{
+		const Location* location = _getLocation(id);
+		return location && location->Slot < m_Tiles[location->Tile].NumVisible;
+	}
+
+	bool BillboardInstanceEditor::setVisible(unsigned int id, bool visible)
+	{
+		const Location* location = _getLocation(id);
+		if(location == NULL)
+			return false;
+		Tile& tile = m_Tiles[location->Tile];
+		const unsigned int slot = location->Slot;
+		if((slot < tile.NumVisible) == visible)
+			return true;
+		if(visible)
+			_show(tile, slot);
+		else
+			_hide(tile, slot);
+		_updateInstanceCount(tile);
+		return true;
+	}
+
+	bool BillboardInstanceEditor::move(unsigned int id, const osg::Vec3d &position)
+	{
+		Instance instance;
+		if(!getInstance(id, instance))
+			return false;
+		instance.Position = position;
+		const Location location = m_Locations[id];
+		Tile& tile = m_Tiles[location.Tile];
+		const osg::Vec3d local = position - tile.Offset;
+		if(local.x() >= tile.Bounds.xMin() && local.x() < tile.Bounds.xMax() && local.y() >= tile.Bounds.yMin() && local.y() < tile.Bounds.yMax())
+		{
+			_write(tile, location.Slot, instance);
+			return true;
+		}
+
+		//transfer to covering tile of same layer, id is kept
+		const unsigned int new_tile_index = _findTile(position, &tile);
+		if(new_tile_index == INVALID_ID)
+			return false;
+		const bool visible = location.Slot < tile.NumVisible;
+		_erase(tile, location.Slot);
+		_updateInstanceCount(tile);
+		Tile& new_tile = m_Tiles[new_tile_index];
+		const unsigned int slot = _append(new_tile_index, instance, id);
+		if(!visible)
+			_hide(new_tile, slot);
+		_updateInstanceCount(new_tile);
+		return true;
+	}
+
+	unsigned int BillboardInstanceEditor::add(const Instance &instance, unsigned int reference_id)
+	{
+		const Location* reference = _getLocation(reference_id);
+		const unsigned int tile_index = _findTile(instance.Position, reference ? &m_Tiles[reference->Tile] : NULL);
+		if(tile_index == INVALID_ID)
+			return INVALID_ID;
+		const unsigned int id = _newID();
+		_append(tile_index, instance, id);
+		_updateInstanceCount(m_Tiles[tile_index]);
+		return id;
+	}
+
+	bool BillboardInstanceEditor::remove(unsigned int id)
+	{
+		const Location* location = _getLocation(id);
+		if(location == NULL)
+			return false;
+		Tile& tile = m_Tiles[location->Tile];
+		_erase(tile, location->Slot);
+		_freeID(id);
+		_updateInstanceCount(tile);
+		return true;
+	}
+
+	void BillboardInstanceEditor::flush()
+	{
+		for(std::map<osg::Geometry*, unsigned int>::iterator iter = m_TileIndex.begin(); iter != m_TileIndex.end(); ++iter)
+		{
+			Tile& tile = m_Tiles[iter->second];
+			if(tile.DirtySlots.empty())
+				continue;
+#if OSG_VERSION_GREATER_OR_EQUAL(3,5,6)
+			tile.Upload->addDirtySlots(tile.DirtySlots);
+#else
+			//no sub range upload support, upload whole tile buffer
+			tile.Image->dirty();
+#endif
+			tile.DirtySlots.clear();
+		}
+	}
+
+	void BillboardInstanceEditor::_swapSlots(Tile &tile, unsigned int a, unsigned int b)
+	{
+		tile.DirtySlots.insert(a);
+		if(a == b)
+			return;
+		tile.DirtySlots.insert(b);
+		unsigned char* data_a = tile.Image->data(TEXELS_PER_INSTANCE * a);
+		unsigned char* data_b = tile.Image->data(TEXELS_PER_INSTANCE * b);
+		unsigned char temp[SLOT_BYTES];
+		memcpy(temp, data_a, SLOT_BYTES);
+		memcpy(data_a, data_b, SLOT_BYTES);
+		memcpy(data_b, temp, SLOT_BYTES);
+		std::swap(tile.SlotIDs[a], tile.SlotIDs[b]);
+		m_Locations[tile.SlotIDs[a]].Slot = a;
+		m_Locations[tile.SlotIDs[b]].Slot = b;
+	}
+
+	void BillboardInstanceEditor::_hide(Tile &tile, unsigned int slot)
+	{
+		//swap with last visible
+		_swapSlots(tile, slot, tile.NumVisible - 1);
+		tile.NumVisible--;
+	}
+
+	void BillboardInstanceEditor::_show(Tile &tile, unsigned int slot)
+	{
+		//swap with first hidden
+		_swapSlots(tile, slot, tile.NumVisible);
+		tile.NumVisible++;
+	}
+
+	void BillboardInstanceEditor::_erase(Tile &tile, unsigned int slot)
+	{
+		if(slot < tile.NumVisible)
+		{
+			_hide(tile, slot);
+			slot = tile.NumVisible;
+		}
+		//swap with last slot and drop it
+		_swapSlots(tile, slot, tile.NumSlots - 1);
+		tile.NumSlots--;
+		tile.SlotIDs.pop_back();
+		tile.DirtySlots.erase(tile.NumSlots);
+	}
+
+	unsigned int BillboardInstanceEditor::_append(unsigned int tile_index, const Instance &instance, unsigned int id)
+	{
+		Tile& tile = m_Tiles[tile_index];
+		const unsigned int capacity = static_cast<unsigned int>(tile.Image->s()) / TEXELS_PER_INSTANCE;
+		if(tile.NumSlots == capacity)
+		{
+			//grow buffer, the new image is uploaded as a whole
+			const unsigned int new_capacity = std::max(16u, capacity * 2);
+			osg::ref_ptr<osg::Image> image = new osg::Image();
+			image->allocateImage(TEXELS_PER_INSTANCE * new_capacity, 1, 1, GL_RGBA, GL_FLOAT);
+			memset(image->data(), 0, image->getImageSizeInBytes());
+			if(tile.NumSlots > 0)
+				memcpy(image->data(), tile.Image->data(), tile.NumSlots * SLOT_BYTES);
+			tile.TBO->setImage(image.get());
+			tile.Image = image;
+			tile.Upload->setImage(image.get());
+			tile.DirtySlots.clear();
+		}
+		const unsigned int slot = tile.NumSlots++;
+		tile.SlotIDs.push_back(id);
+		m_Locations[id].Tile = tile_index;
+		m_Locations[id].Slot = slot;
+		_write(tile, slot, instance);
+		_show(tile, slot);
+		return tile.NumVisible - 1;
+	}
+
+	void BillboardInstanceEditor::_write(Tile &tile, unsigned int slot, const Instance &instance)
+	{
+		const osg::Vec3 local = instance.Position - tile.Offset;
+		osg::Vec4f* ptr = reinterpret_cast<osg::Vec4f*>(tile.Image->data(TEXELS_PER_INSTANCE * slot));
+		ptr[0] = osg::Vec4f(local.x(), local.y(), local.z(), 1.0f);
+		ptr[1] = osg::Vec4f(instance.Color.r(), instance.Color.g(), instance.Color.b(), 1.0f);
+		ptr[2] = osg::Vec4f(instance.Width, instance.Height, static_cast<float>(instance.TextureIndex), 1.0f);
+		tile.DirtySlots.insert(slot);
+
+		//keep culling bounds valid if instance is moved above or below tile
+		const osg::Vec3 top = local + osg::Vec3(0, 0, instance.Height);
+		if(!tile.Bounds.contains(local) || !tile.Bounds.contains(top))
+		{
+			tile.Bounds.expandBy(local);
+			tile.Bounds.expandBy(top);
+			tile.Geometry->setInitialBound(tile.Bounds);
+			tile.Geometry->dirtyBound();
+		}
+	}
+
+	void BillboardInstanceEditor::_updateInstanceCount(Tile &tile)
+	{
+		//zero instances would fall back to a non instanced draw
+		if(tile.NumVisible == 0)
+		{
+			tile.Primitives->setCount(0);
+			tile.Primitives->setNumInstances(1);
+		}
+		else
+		{
+			tile.Primitives->setCount(tile.Count);
+			tile.Primitives->setNumInstances(tile.NumVisible);
+		}
+	}
+}
@@ -0,0 +1,165 @@
+#pragma once
+#include "Common.h"
+#include <osg/Referenced>
+#include <osg/ref_ptr>
+#include <osg/BoundingBox>
+#include <osg/Geometry>
+#include <osg/Image>
+#include <osg/Node>
+#include <osg/TextureBuffer>
+#include <osg/Vec3d>
+#include <osg/Vec4>
+#include <map>
+#include <set>
+#include <vector>
+
+namespace osgVegetation
+{
+	/**
+		Runtime editing of billboard instances created by BRTShaderInstancing, ie. to remove
+		destroyed or cleared trees without regenerating tiles. Instances are addressed by ids
+		that stay valid until the instance is removed or its tile is unregistered (ids are
+		reused afterwards).
+
+		Each tile keeps visible instances first in its instance buffer. Hiding or removing an
+		instance swaps it with the last visible one and decrements the instance count, so an
+		edit touches at most a few buffer slots. Touched slots are uploaded by flush, with
+		OSG 3.5.6 or later (TextureBuffer backed by BufferData) only the dirty slot ranges
+		are written (glBufferSubData), older versions upload the whole tile buffer.
+
+		Edits are done on the tile data directly, call all methods from the update traversal
+		(or between frames). Edits are lost when a paged tile is expired, register new tiles
+		with addTiles and expired tiles with removeTiles.
+
+		Instances are only transferred between tiles of the same generation (the state set
+		holding the texture array) and of the same kind (interior culled or not), tiles should
+		be registered when attached to the scene so that the generation root is found.
+	*/
+	class osgvExport BillboardInstanceEditor : public osg::Referenced
+	{
+	public:
+		static const unsigned int INVALID_ID = 0xFFFFFFFFu;
+
+		struct Instance
+		{
+			Instance() : Color(1, 1, 1, 1), Width(1), Height(1), TextureIndex(0) {}
+			//terrain space
+			osg::Vec3d Position;
+			osg::Vec4 Color;
+			float Width;
+			float Height;
+			unsigned int TextureIndex;
+		};
+
+		BillboardInstanceEditor();
+
+		/**
+			Register all billboard tiles in sub graph, already registered tiles are skipped.
+			Tile transforms are included in instance positions.
+		*/
+		void addTiles(osg::Node* node);
+
+		/**
+			Unregister all billboard tiles in sub graph, ids of their instances are invalidated
+		*/
+		void removeTiles(osg::Node* node);
+
+		/**
+			Find visible instance closest to position (horizontal distance)
+			@return instance id or INVALID_ID if no instance within max_distance
+		*/
+		unsigned int find(const osg::Vec3d &position, double max_distance) const;
+
+		bool getInstance(unsigned int id, Instance &instance) const;
+		bool isVisible(unsigned int id) const;
+
+		/**
+			Show or hide instance, hidden instances keep their id and data
+			@return false if id is not valid
+		*/
+		bool setVisible(unsigned int id, bool visible);
+
+		/**
+			Move instance, instances moved outside their tile are transferred to the
+			covering tile of same size
+			@return false if id is not valid or no tile covers position
+		*/
+		bool move(unsigned int id, const osg::Vec3d &position);
+
+		/**
+			Add instance to the covering tile of same size, generation and kind as the tile holding
+			reference_id (ie. an instance of the same layer) or to the smallest covering tile that is
+			not interior culled if no reference is given
+			@return id of new instance or INVALID_ID if no tile covers position
+		*/
+		unsigned int add(const Instance &instance, unsigned int reference_id = INVALID_ID);
+
+		/**
+			Remove instance, the id is invalidated
+			@return false if id is not valid
+		*/
+		bool remove(unsigned int id);
+
+		/**
+			Upload touched buffer slots, call once per frame after edits
+		*/
+		void flush();
+
+		unsigned int getNumTiles() const {return static_cast<unsigned int>(m_TileIndex.size());}
+	protected:
+		virtual ~BillboardInstanceEditor();
+	private:
+		class UploadCallback;
+		struct Tile
+		{
+			Tile() : Technique(NULL), Interior(false), Count(0), NumVisible(0), NumSlots(0) {}
+			osg::ref_ptr<osg::Geometry> Geometry;
+			osg::ref_ptr<osg::TextureBuffer> TBO;
+			osg::ref_ptr<osg::Image> Image;
+			osg::ref_ptr<osg::DrawArrays> Primitives;
+			osg::ref_ptr<UploadCallback> Upload;
+			//state set holding the texture array of the generation, identifies texture indices
+			const osg::StateSet* Technique;
+			//geometry of interior culled instances, see BillboardRenderPolicy::INTERIOR_LOD_NAME
+			bool Interior;
+			//tile transform translation
+			osg::Vec3d Offset;
+			//local tile bounds
+			osg::BoundingBox Bounds;
+			//template geometry vertex count
+			int Count;
+			//visible slots first, then hidden
+			unsigned int NumVisible;
+			unsigned int NumSlots;
+			std::vector<unsigned int> SlotIDs;
+			std::set<unsigned int> DirtySlots;
+		};
+		struct Location
+		{
+			Location() : Tile(INVALID_ID), Slot(0) {}
+			unsigned int Tile;
+			unsigned int Slot;
+		};
+		class TileCollector;
+
+		void _addTile(osg::Geometry* geometry, const osg::Vec3d &offset, const osg::StateSet* technique, bool interior);
+		void _removeTile(osg::Geometry* geometry);
+		unsigned int _newID();
+		void _freeID(unsigned int id);
+		const Location* _getLocation(unsigned int id) const;
+		unsigned int _findTile(const osg::Vec3d &position, const Tile* reference) const;
+		void _swapSlots(Tile &tile, unsigned int a, unsigned int b);
+		void _hide(Tile &tile, unsigned int slot);
+		void _show(Tile &tile, unsigned int slot);
+		unsigned int _append(unsigned int tile_index, const Instance &instance, unsigned int id);
+		void _erase(Tile &tile, unsigned int slot);
+		void _write(Tile &tile, unsigned int slot, const Instance &instance);
+		void _updateInstanceCount(Tile &tile);
+
+		std::vector<Tile> m_Tiles;
+		std::map<osg::Geometry*, unsigned int> m_TileIndex;
+		std::vector<unsigned int> m_FreeTiles;
+		std::vector<Location> m_Locations;
+		std::vector<unsigned int> m_FreeIDs;
+	};
+}
@@ -1,7 +1,11 @@
 #pragma once
 #include "Common.h"
 #include <osg/Vec2>
+#include <osg/ref_ptr>
 #include <vector>
+#include "VectorMask.h"
+#include "PlacementRule.h"
+#include "InstanceImporter.h"
 
 namespace osgVegetation
 {
@@ -20,6 +24,10 @@ namespace osgVegetation
 			Density(1.0),
 			TerrainColorRatio(0.0),
 			UseTerrainIntensity(false),
+			InteriorCullRadius(0),
+			InteriorCullDistance(min_tile_size),
+			ImportSpecies(-1),
+			RegroundImport(false),
 			_TextureIndex(-1),
 			_QTLevel(-1)
 		{
@@ -80,6 +88,53 @@ namespace osgVegetation
 		*/
 		std::vector<std::string> CoverageMaterials;
 
+		/**
+			Optional vector mask, no billboards are placed inside mask shapes
+		*/
+		osg::ref_ptr<VectorMask> ExclusionMask;
+
+		/**
+			Optional vector mask, billboards are only placed inside mask shapes
+		*/
+		osg::ref_ptr<VectorMask> InclusionMask;
+
+		/**
+			Optional placement rule that modulate density, see PlacementRule
+		*/
+		osg::ref_ptr<PlacementRule> Rule;
+
+		/**
+			Instances that are surrounded by taller instances (in all directions) within this
+			radius, ie. the interior of dense forest patches, are only rendered when the viewer
+			is near the tile (see InteriorCullDistance). Canopy edges and trees rising above their
+			neighbours are rendered at all distances. Zero (default) disable interior culling.
+		*/
+		double InteriorCullRadius;
+
+		/**
+			Interior instances are rendered when the viewer is within this distance of the tile
+			bounds, default is the layer min tile size.
+		*/
+		double InteriorCullDistance;
+
+		/**
+			Optional surveyed instances used instead of random scattering, instance
+			height and crown width from file is used if larger than zero.
+			Several layers can share the same importer, see ImportSpecies.
+		*/
+		osg::ref_ptr<InstanceImporter> Import;
+
+		/**
+			Only use imported instances of this species, -1 (default) use all species
+		*/
+		int ImportSpecies;
+
+		/**
+			Snap imported instances to terrain and use terrain color and coverage materials,
+			false (default) use imported heights and bypass terrain queries.
+		*/
+		bool RegroundImport;
+
 
 		//internal data holding texture index inside texture array
 		int _TextureIndex;
@@ -0,0 +1,244 @@
+#include "BillboardLayerOptimizer.h"
+#include <osg/Math>
+#include <algorithm>
+#include <cmath>
+
+namespace osgVegetation
+{
+	BillboardLayerOptimizer::BillboardLayerOptimizer(const osg::BoundingBoxd &bb, const ViewSettings &settings) : m_BB(bb),
+		m_Settings(settings),
+		m_MinScale(0.1),
+		m_MaxScale(4.0),
+		m_GlobalTileSize(0)
+	{
+		if (bb.xMax() <= bb.xMin() || bb.yMax() <= bb.yMin())
+			OSGV_EXCEPT(std::string("BillboardLayerOptimizer::BillboardLayerOptimizer - Invalid bounding box").c_str());
+	}
+
+	BillboardLayerOptimizer::ViewStatistics BillboardLayerOptimizer::evaluate(const std::vector<BillboardData> &data) const
+	{
+		ViewStatistics worst;
+		const unsigned int num_views = std::max(1u, m_Settings.NumViews);
+		const double dx = (m_BB.xMax() - m_BB.xMin()) / static_cast<double>(num_views);
+		const double dy = (m_BB.yMax() - m_BB.yMin()) / static_cast<double>(num_views);
+		for (unsigned int i = 0; i < num_views; i++)
+		{
+			for (unsigned int j = 0; j < num_views; j++)
+			{
+				const osg::Vec3d eye(m_BB.xMin() + (i + 0.5) * dx, m_BB.yMin() + (j + 0.5) * dy, m_Settings.EyeHeight);
+				//all billboard data is generated to separate quad trees but rendered in same view
+				ViewStatistics view;
+				for (size_t k = 0; k < data.size(); k++)
+					_evaluateView(data[k], eye, view);
+				worst.Instances = std::max(worst.Instances, view.Instances);
+				worst.DrawCalls = std::max(worst.DrawCalls, view.DrawCalls);
+			}
+		}
+		return worst;
+	}
+
+	void BillboardLayerOptimizer::_evaluateView(const BillboardData &data, const osg::Vec3d &eye, ViewStatistics &stats) const
+	{
+		if (data.Layers.size() == 0)
+			return;
+
+		//same root layout and level assignment as billboard scattering, see QuadTreeScatterer::begin
+		double max_tile_size = 0;
+		for (size_t i = 0; i < data.Layers.size(); i++)
+			max_tile_size = std::max(max_tile_size, data.Layers[i].MinTileSize);
+		double root_size = m_GlobalTileSize;
+		if (m_GlobalTileSize <= 0)
+		{
+			//area of interest use forest of roots sized by coarsest layer
+			root_size = std::max(m_BB.xMax() - m_BB.xMin(), m_BB.yMax() - m_BB.yMin());
+			if (m_AreaOfInterest.valid() && max_tile_size > 0)
+				root_size = 0;
+			root_size = std::max(root_size, max_tile_size);
+		}
+
+		std::vector<int> levels(data.Layers.size());
+		int final_level = 0;
+		for (size_t i = 0; i < data.Layers.size(); i++)
+		{
+			double temp_size = root_size;
+			int ld = 0;
+			while (temp_size > data.Layers[i].MinTileSize)
+			{
+				ld++;
+				temp_size *= 0.5;
+			}
+			levels[i] = ld;
+			final_level = std::max(final_level, ld);
+		}
+
+		if (m_GlobalTileSize > 0)
+		{
+			//world grid roots overlapping the area, whole roots are generated
+			const int x0 = static_cast<int>(floor(m_BB.xMin() / root_size));
+			const int y0 = static_cast<int>(floor(m_BB.yMin() / root_size));
+			const int x1 = std::max(x0, static_cast<int>(ceil(m_BB.xMax() / root_size)) - 1);
+			const int y1 = std::max(y0, static_cast<int>(ceil(m_BB.yMax() / root_size)) - 1);
+			for (int j = y0; j <= y1; j++)
+			{
+				for (int i = x0; i <= x1; i++)
+				{
+					const osg::BoundingBoxd root(i * root_size, j * root_size, 0, (i + 1) * root_size, (j + 1) * root_size, 0);
+					_evaluateTileRec(data, levels, final_level, root, root, 0, eye, stats);
+				}
+			}
+		}
+		else
+		{
+			const int num_roots_x = std::max(1, static_cast<int>(ceil((m_BB.xMax() - m_BB.xMin()) / root_size)));
+			const int num_roots_y = std::max(1, static_cast<int>(ceil((m_BB.yMax() - m_BB.yMin()) / root_size)));
+			for (int j = 0; j < num_roots_y; j++)
+			{
+				for (int i = 0; i < num_roots_x; i++)
+				{
+					const double x = m_BB.xMin() + i * root_size;
+					const double y = m_BB.yMin() + j * root_size;
+					_evaluateTileRec(data, levels, final_level, m_BB, osg::BoundingBoxd(x, y, 0, x + root_size, y + root_size, 0), 0, eye, stats);
+				}
+			}
+		}
+	}
+
+	void BillboardLayerOptimizer::_evaluateTileRec(const BillboardData &data, const std::vector<int> &levels, int final_level, const osg::BoundingBoxd &area_bb, const osg::BoundingBoxd &tile, int level, const osg::Vec3d &eye, ViewStatistics &stats) const
+	{
+		//tiles outside generation area or area of interest are never created
+		const double area = std::max(0.0, std::min(tile.xMax(), area_bb.xMax()) - std::max(tile.xMin(), area_bb.xMin())) *
+			std::max(0.0, std::min(tile.yMax(), area_bb.yMax()) - std::max(tile.yMin(), area_bb.yMin()));
+		if (area <= 0)
+			return;
+		if (m_AreaOfInterest.valid())
+		{
+			std::vector<unsigned int> shapes;
+			m_AreaOfInterest->query(tile, shapes);
+			if (!m_AreaOfInterest->intersectsBox(tile, shapes))
+				return;
+		}
+
+		const double size = tile.xMax() - tile.xMin();
+		const double radius = size * 0.5 * sqrt(2.0);
+		const double distance = std::max((tile.center() - eye).length(), 1e-3);
+
+		if (data.TilePixelSize > 0)
+		{
+			//projected tile diameter in pixels, geometry and children share range
+			const double pixel_size = radius * m_Settings.ScreenHeight / (distance * tan(osg::DegreesToRadians(m_Settings.FieldOfView) * 0.5));
+			if (pixel_size < data.TilePixelSize)
+				return;
+		}
+
+		//all layers at this level are merged to one geometry per tile
+		double instances = 0;
+		for (size_t i = 0; i < data.Layers.size(); i++)
+		{
+			if (levels[i] == level)
+				instances += data.Layers[i].Density * area * m_Settings.CoverageFraction;
+		}
+		if (instances > 0)
+		{
+			stats.Instances += instances;
+			stats.DrawCalls++;
+		}
+
+		if (level == final_level)
+			return;
+
+		//distance mode, children replace nothing but are only shown inside tile cutoff
+		if (data.TilePixelSize <= 0 && distance >= radius * 2.0)
+			return;
+
+		const double half = size * 0.5;
+		for (int i = 0; i < 4; i++)
+		{
+			const double x = tile.xMin() + (i % 2) * half;
+			const double y = tile.yMin() + (i / 2) * half;
+			_evaluateTileRec(data, levels, final_level, area_bb, osg::BoundingBoxd(x, y, 0, x + half, y + half, 0), level + 1, eye, stats);
+		}
+	}
+
+	void BillboardLayerOptimizer::_scaleTileSizes(std::vector<BillboardData> &data, const std::vector<BillboardData> &original, double scale)
+	{
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			for (size_t j = 0; j < data[i].Layers.size(); j++)
+				data[i].Layers[j].MinTileSize = original[i].Layers[j].MinTileSize * scale;
+		}
+	}
+
+	void BillboardLayerOptimizer::_setTilePixelSize(std::vector<BillboardData> &data, int pixel_size)
+	{
+		for (size_t i = 0; i < data.size(); i++)
+			data[i].TilePixelSize = pixel_size;
+	}
+
+	bool BillboardLayerOptimizer::optimize(std::vector<BillboardData> &data, double max_instances, unsigned int max_draw_calls) const
+	{
+		const std::vector<BillboardData> original = data;
+
+		//largest tile size scale meeting instance budget, instances grow with scale (view distance)
+		double scale = m_MaxScale;
+		_scaleTileSizes(data, original, scale);
+		if (evaluate(data).Instances > max_instances)
+		{
+			double lo = m_MinScale;
+			double hi = m_MaxScale;
+			_scaleTileSizes(data, original, lo);
+			if (evaluate(data).Instances <= max_instances)
+			{
+				//bisect in log space, lo is always feasible
+				for (int i = 0; i < 24; i++)
+				{
+					const double mid = sqrt(lo * hi);
+					_scaleTileSizes(data, original, mid);
+					if (evaluate(data).Instances <= max_instances)
+						lo = mid;
+					else
+						hi = mid;
+				}
+			}
+			scale = lo;
+			_scaleTileSizes(data, original, scale);
+		}
+
+		//tile sizes at min scale, thin all layers
+		ViewStatistics stats = evaluate(data);
+		if (stats.Instances > max_instances)
+		{
+			const double density_scale = max_instances / stats.Instances;
+			for (size_t i = 0; i < data.size(); i++)
+			{
+				for (size_t j = 0; j < data[i].Layers.size(); j++)
+					data[i].Layers[j].Density *= density_scale;
+			}
+			stats = evaluate(data);
+		}
+
+		if (stats.DrawCalls > max_draw_calls)
+		{
+			//smallest pixel size meeting draw call budget
+			int lo = 0;
+			for (size_t i = 0; i < data.size(); i++)
+				lo = std::max(lo, data[i].TilePixelSize);
+			int hi = static_cast<int>(m_Settings.ScreenHeight);
+			_setTilePixelSize(data, hi);
+			if (evaluate(data).DrawCalls <= max_draw_calls)
+			{
+				while (hi - lo > 1)
+				{
+					const int mid = (lo + hi) / 2;
+					_setTilePixelSize(data, mid);
+					if (evaluate(data).DrawCalls <= max_draw_calls)
+						hi = mid;
+					else
+						lo = mid;
+				}
+			}
+			_setTilePixelSize(data, hi);
+			stats = evaluate(data);
+		}
+		return stats.Instances <= max_instances && stats.DrawCalls <= max_draw_calls;
+	}
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include "Common.h"
+#include <osg/BoundingBox>
+#include <osg/ref_ptr>
+#include <vector>
+#include "BillboardData.h"
+#include "VectorMask.h"
+
+namespace osgVegetation
+{
+	/**
+		Estimate per view rendering load of billboard layers and adjust layer settings to a budget.
+		Views are sampled on a regular grid over the generation area, each view walk the virtual
+		quad tree using the same root size, level assignment and LOD ranges as billboard scattering.
+		Views are omnidirectional (conservative) and full coverage is assumed unless a coverage
+		fraction is supplied, i.e no terrain query or generation is needed.
+	*/
+	class osgvExport BillboardLayerOptimizer
+	{
+	public:
+		struct ViewSettings
+		{
+			ViewSettings() : EyeHeight(2.0),
+				ScreenHeight(1080),
+				FieldOfView(60.0),
+				NumViews(8),
+				CoverageFraction(1.0)
+			{
+
+			}
+			//Eye height above ground
+			double EyeHeight;
+			//Screen height in pixels, used for TilePixelSize
+			double ScreenHeight;
+			//Vertical field of view in degrees, used for TilePixelSize
+			double FieldOfView;
+			//Number of sampled views along each side of the area
+			unsigned int NumViews;
+			//Fraction of area covered by layer materials (0-1)
+			double CoverageFraction;
+		};
+
+		/**
+			Worst case load over sampled views
+		*/
+		struct ViewStatistics
+		{
+			ViewStatistics() : Instances(0), DrawCalls(0) {}
+			double Instances;
+			unsigned int DrawCalls;
+		};
+
+		BillboardLayerOptimizer(const osg::BoundingBoxd &bb, const ViewSettings &settings = ViewSettings());
+
+		/**
+			Get worst case visible instances and draw calls over sampled views
+		*/
+		ViewStatistics evaluate(const std::vector<BillboardData> &data) const;
+
+		/**
+			Adjust layer settings to budget. Layer tile sizes (i.e view distances) are scaled
+			uniformly to the largest scale meeting the instance budget. If the tile sizes reach
+			the min scale, densities are scaled down instead. Draw calls above budget are then
+			reduced by raising TilePixelSize.
+			@return true if budget is met
+		*/
+		bool optimize(std::vector<BillboardData> &data, double max_instances, unsigned int max_draw_calls) const;
+
+		/**
+			Range for tile size scale used by optimize, default 0.1 - 4.0
+		*/
+		void setTileSizeScaleRange(double min_scale, double max_scale) {m_MinScale = min_scale; m_MaxScale = max_scale;}
+
+		/**
+			Use the same root layout as the scatterer, see BillboardQuadTreeScattering::setAreaOfInterest
+			and setGlobalTiling. Default is a single root covering the area.
+			@param aoi Area of interest, NULL disable
+			@param global_tile_size Global tiling root size, zero disable
+		*/
+		void setRootLayout(VectorMask* aoi, double global_tile_size) {m_AreaOfInterest = aoi; m_GlobalTileSize = global_tile_size;}
+	private:
+		void _evaluateView(const BillboardData &data, const osg::Vec3d &eye, ViewStatistics &stats) const;
+		void _evaluateTileRec(const BillboardData &data, const std::vector<int> &levels, int final_level, const osg::BoundingBoxd &area_bb, const osg::BoundingBoxd &tile, int level, const osg::Vec3d &eye, ViewStatistics &stats) const;
+		static void _scaleTileSizes(std::vector<BillboardData> &data, const std::vector<BillboardData> &original, double scale);
+		static void _setTilePixelSize(std::vector<BillboardData> &data, int pixel_size);
+		osg::BoundingBoxd m_BB;
+		ViewSettings m_Settings;
+		double m_MinScale;
+		double m_MaxScale;
+		osg::ref_ptr<VectorMask> m_AreaOfInterest;
+		double m_GlobalTileSize;
+	};
+}
@@ -6,10 +6,12 @@
 #include <osg/ref_ptr>
 
 #include <vector>
-#include "IBillboardRenderingTech.h"
 #include "BillboardLayer.h"
 #include "BillboardData.h"
+#include "BillboardScatterPolicies.h"
 #include "EnvironmentSettings.h"
+#include "QuadTreeScatterer.h"
+#include "VectorMask.h"
 
 namespace osgVegetation
 {
@@ -20,7 +22,8 @@ namespace osgVegetation
 		structure based on the osg::LOD node. The start tile use the supplied
 		bounding box which is then recursively divided into four new tiles until
 		the cutoff tile size is reached. The cutoff tile size i calculated based
-		on the shortest vegetation layer distance.
+		on the shortest vegetation layer distance. The quad tree walk is done by
+		QuadTreeScatterer using the billboard policies.
 	*/
 
 	class osgvExport BillboardQuadTreeScattering : public osg::Referenced
@@ -41,33 +44,69 @@ namespace osgVegetation
 		osg::Node* generate(const osg::BoundingBoxd &bb, BillboardData &data, const std::string &output_file = "", bool use_paged_lod = false, const std::string &filename_prefix = "");
 
 		osg::Node* generate(const osg::BoundingBoxd &bb,std::vector<osgVegetation::BillboardData> &data, const std::string &output_file, bool use_paged_lod);
-	private:
-		int m_FinalLOD;
 
-		//data used for progress report
-		int m_CurrentTile;
-		int m_NumberOfTiles;
+		/**
+			Restrict generation to polygon area of interest (terrain space), ie. a rail line or river valley.
+			The area is covered by a forest of quad tree roots sized by the coarsest layer and tiles not
+			overlapping the area are clipped, i.e build time scale with the area instead of its bounding square.
+			NULL (default) use a single root covering the bounding box.
+		*/
+		void setAreaOfInterest(VectorMask* aoi) {m_Scatterer.setAreaOfInterest(aoi);}
+		VectorMask* getAreaOfInterest() const {return m_Scatterer.getAreaOfInterest();}
+
+		/**
+			Use world anchored tiling, ie. tile keys are fixed addresses in a global grid
+			instead of being relative to the bounding box. Root tiles are aligned to multiples of
+			root_size and each root is generated completely (not clipped by the bounding box),
+			with its own offset and file name, so separately built regions share tile boundaries
+			and border roots come out identical if the same settings are used. Each tile layer
+			is seeded from seed and the tile key. Tile bounds use the supplied height range.
+			@param root_size Size of level zero tiles, zero (default) disable global tiling
+			@param min_z Minimum terrain height of the whole world database
+			@param max_z Maximum terrain height of the whole world database
+			@param seed Base random seed
+		*/
+		void setGlobalTiling(double root_size, double min_z, double max_z, unsigned int seed = 0) {m_Scatterer.setGlobalTiling(root_size, min_z, max_z, seed);}
+		double getGlobalTileSize() const {return m_Scatterer.getGlobalTileSize();}
+
+		/**
+			Start incremental generation, ie. for interactive editing where generation is spread
+			over frames. Arguments as generate, data must stay valid until generation is finished
+			or cancelled. Any running generation is cancelled.
+		*/
+		void begin(const osg::BoundingBoxd &bb, BillboardData &data, const std::string &output_file = "", bool use_paged_lod = false, const std::string &filename_prefix = "") {m_Scatterer.begin(bb, data, output_file, use_paged_lod, filename_prefix);}
+
+		/**
+			Process tiles until time budget (milliseconds) is used, ie. step(2.0) each frame.
+			The budget is checked between tiles only, see QuadTreeScatterer::step.
+			@return true when generation is finished, result is then available from getResult
+		*/
+		bool step(double time_budget_ms) {return m_Scatterer.step(time_budget_ms);}
+
+		void cancel() {m_Scatterer.cancel();}
+		bool isGenerating() const {return m_Scatterer.isGenerating();}
+		float getProgress() const {return m_Scatterer.getProgress();}
+		osg::Node* getResult() const {return m_Scatterer.getResult();}
 
-		//Area bounding box
-		osg::BoundingBoxd m_InitBB;
-		
-		IBillboardRenderingTech* m_BRT;
-		
-		//Offset based on initial bounding box, used to avoid floating point precision problem 
-		osg::Vec3d m_Offset; 
-	
-		ITerrainQuery* m_TerrainQuery;
-		EnvironmentSettings m_EnvironmentSettings;
-		bool m_UsePagedLOD;
+		/**
+			Set callback for progress and finished tiles, NULL (default) print progress to console
+		*/
+		void setCallback(ScatterCallback* callback) {m_Scatterer.setCallback(callback);}
+		ScatterCallback* getCallback() const {return m_Scatterer.getCallback();}
 
-		//Output stuff
-		std::string m_SavePath;
-		std::string m_FilenamePrefix;
-		std::string m_SaveExt;
+		/**
+			Report all scattered instances to sink, ie. VegetationBVHWriter for simulation queries.
+			layer_base is added to layer indices so that several generations can share one sink.
+			NULL (default) disable.
+		*/
+		void setInstanceSink(ScatterInstanceSink* sink, unsigned int layer_base = 0) {m_Scatterer.setInstanceSink(sink, layer_base);}
+		ScatterInstanceSink* getInstanceSink() const {return m_Scatterer.getInstanceSink();}
 
-		//Helpers
-		std::string _createFileName(unsigned int lv,	unsigned int x, unsigned int y) const;
-		void _populateVegetationTile(const BillboardLayer& layer,const osg::BoundingBoxd &box, BillboardVegetationObjectVector& instances, osg::BoundingBoxd& out_bb) const;
-		osg::Node* _createLODRec(int ld, BillboardData &data, BillboardVegetationObjectVector trees, const osg::BoundingBoxd &box ,int x, int y);
+		/**
+			Create state set for generated billboard nodes, ie. for tiles from ScatterCallback::tileFinished
+		*/
+		osg::StateSet* createStateSet() const {return m_Scatterer.createStateSet();}
+	private:
+		QuadTreeScatterer<BillboardInstancePolicy, BillboardRenderPolicy> m_Scatterer;
 	};
-}
+}
\ No newline at end of file
@@ -0,0 +1,392 @@
+#include "BillboardScatterPolicies.h"
+#include <osg/Math>
+#include <osg/StateSet>
+#include <algorithm>
+#include <cfloat>
+#include <iostream>
+#include "BRTGeometryShader.h"
+#include "BRTShaderInstancing.h"
+#include "ScatterKernels.h"
+
+namespace osgVegetation
+{
+	namespace
+	{
+		bool BillboardSortPredicate(const BillboardLayer &lhs, const BillboardLayer &rhs)
+		{
+			return lhs.MinTileSize > rhs.MinTileSize;
+		}
+	}
+
+	void BillboardInstancePolicy::prepare(BillboardData &data)
+	{
+		//sort by tile size
+		std::sort(data.Layers.begin(), data.Layers.end(), BillboardSortPredicate);
+		m_NumInteriorCandidates = 0;
+		m_NumInteriorCulled = 0;
+	}
+
+	double BillboardInstancePolicy::getMaxTileSize(const BillboardData &data) const
+	{
+		double max_tile_size = 0;
+		for(size_t i = 0; i < data.Layers.size(); i++)
+		{
+			max_tile_size = std::max(max_tile_size, data.Layers[i].MinTileSize);
+		}
+		return max_tile_size;
+	}
+
+	int BillboardInstancePolicy::assignLevels(BillboardData &data, double root_size)
+	{
+		//set quad tree LOD level for each billboard layer
+		int final_lod = 0;
+		for(size_t i = 0; i < data.Layers.size(); i++)
+		{
+			double temp_size = root_size;
+			int ld = 0;
+			while(temp_size > data.Layers[i].MinTileSize)
+			{
+				ld++;
+				temp_size *= 0.5;
+			}
+			data.Layers[i]._QTLevel = ld;
+			if(final_lod < ld)
+				final_lod = ld;
+		}
+		return final_lod;
+	}
+
+	bool BillboardInstancePolicy::populatesLevel(const BillboardData &data, int level) const
+	{
+		for(size_t i = 0; i < data.Layers.size(); i++)
+		{
+			if(level == data.Layers[i]._QTLevel)
+				return true;
+		}
+		return false;
+	}
+
+	void BillboardInstancePolicy::populateTile(const ScatterContext &context, BillboardData &data, const ScatterTile &tile, TileData &tile_data)
+	{
+		for(size_t i = 0; i < data.Layers.size(); i++)
+		{
+			if(tile.Level == data.Layers[i]._QTLevel)
+			{
+				context.seedTile(tile, static_cast<unsigned int>(i));
+				const size_t first = tile_data.Instances.size();
+				_populateLayer(context, data.Layers[i], tile.BB, tile_data);
+				//all instances are reported, interior culling only affect rendering
+				if(context.InstanceSink)
+				{
+					for(size_t j = first; j < tile_data.Instances.size(); j++)
+					{
+						const BillboardObject& obj = *tile_data.Instances[j];
+						context.InstanceSink->addInstance(osg::Vec3d(obj.Position) + context.Offset, obj.Width * 0.5f, obj.Height, context.SinkLayerBase + static_cast<unsigned int>(i));
+					}
+				}
+				if(data.Layers[i].InteriorCullRadius > 0)
+				{
+					m_NumInteriorCandidates += static_cast<unsigned int>(tile_data.Instances.size() - first);
+					const unsigned int num_culled = _cullInterior(data.Layers[i], tile.BB, tile_data.Instances, first, tile_data.InteriorInstances);
+					m_NumInteriorCulled += num_culled;
+					if(num_culled > 0)
+						tile_data.InteriorDistance = std::max(tile_data.InteriorDistance, data.Layers[i].InteriorCullDistance);
+				}
+			}
+		}
+
+		//use instance height range for tile bounds
+		if(tile_data.Instances.size() > 0 || tile_data.InteriorInstances.size() > 0)
+		{
+			double min_z = FLT_MAX;
+			double max_z = -FLT_MAX;
+			for(size_t i = 0; i < tile_data.Instances.size(); i++)
+			{
+				min_z = std::min(min_z, static_cast<double>(tile_data.Instances[i]->Position.z()));
+				max_z = std::max(max_z, static_cast<double>(tile_data.Instances[i]->Position.z()));
+			}
+			for(size_t i = 0; i < tile_data.InteriorInstances.size(); i++)
+			{
+				min_z = std::min(min_z, static_cast<double>(tile_data.InteriorInstances[i]->Position.z()));
+				max_z = std::max(max_z, static_cast<double>(tile_data.InteriorInstances[i]->Position.z()));
+			}
+			tile_data.Bounds._min.z() = min_z;
+			tile_data.Bounds._max.z() = max_z;
+		}
+	}
+
+	void BillboardInstancePolicy::finish(BillboardData &/*data*/)
+	{
+		if(m_NumInteriorCandidates > 0)
+		{
+			std::cout << "BillboardInstancePolicy - Interior culling moved " << m_NumInteriorCulled << " of " << m_NumInteriorCandidates
+				<< " instances (" << static_cast<int>(100.0*static_cast<double>(m_NumInteriorCulled)/static_cast<double>(m_NumInteriorCandidates)) << "%)\n";
+		}
+	}
+
+	unsigned int BillboardInstancePolicy::_cullInterior(const BillboardLayer &layer, const osg::BoundingBoxd &bb, BillboardVegetationObjectVector &instances, size_t first, BillboardVegetationObjectVector &interior) const
+	{
+		//height field of max instance top height, two cells per cull radius so that
+		//each of the eight directions is tested by the two nearest cells
+		const double cell_size = layer.InteriorCullRadius*0.5;
+		const int num_x = std::max(1, static_cast<int>(ceil((bb._max.x() - bb._min.x())/cell_size)));
+		const int num_y = std::max(1, static_cast<int>(ceil((bb._max.y() - bb._min.y())/cell_size)));
+		std::vector<double> height_field(num_x*num_y, -DBL_MAX);
+		std::vector<int> cells(instances.size() - first);
+		for(size_t i = first; i < instances.size(); i++)
+		{
+			const BillboardObject* obj = instances[i].get();
+			const int x = osg::clampBetween(static_cast<int>((obj->Position.x() - bb._min.x())/cell_size), 0, num_x - 1);
+			const int y = osg::clampBetween(static_cast<int>((obj->Position.y() - bb._min.y())/cell_size), 0, num_y - 1);
+			const int cell = y*num_x + x;
+			cells[i - first] = cell;
+			height_field[cell] = std::max(height_field[cell], static_cast<double>(obj->Position.z() + obj->Height));
+		}
+
+		const int dir_x[8] = {1, 1, 0, -1, -1, -1, 0, 1};
+		const int dir_y[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+		size_t num_kept = first;
+		for(size_t i = first; i < instances.size(); i++)
+		{
+			const BillboardObject* obj = instances[i].get();
+			const double top = obj->Position.z() + obj->Height;
+			const int x = cells[i - first] % num_x;
+			const int y = cells[i - first] / num_x;
+			bool is_interior = true;
+			//directions reaching outside the tile are treated as open, i.e tile borders are kept
+			for(int d = 0; d < 8 && is_interior; d++)
+			{
+				bool covered = false;
+				for(int step = 1; step <= 2 && !covered; step++)
+				{
+					const int nx = x + dir_x[d]*step;
+					const int ny = y + dir_y[d]*step;
+					if(nx >= 0 && nx < num_x && ny >= 0 && ny < num_y)
+						covered = height_field[ny*num_x + nx] >= top;
+				}
+				is_interior = covered;
+			}
+			if(is_interior)
+				interior.push_back(instances[i]);
+			else
+				instances[num_kept++] = instances[i];
+		}
+		const unsigned int num_culled = static_cast<unsigned int>(instances.size() - num_kept);
+		instances.resize(num_kept);
+		return num_culled;
+	}
+
+	void BillboardInstancePolicy::_populateLayer(const ScatterContext &context, const BillboardLayer &layer, const osg::BoundingBoxd &bb, TileData &tile_data) const
+	{
+		if(layer.Import.valid())
+		{
+			_importLayer(context, layer, bb, tile_data);
+			return;
+		}
+
+		const osg::Vec3d origin = bb._min;
+		const osg::Vec3d size = bb._max - bb._min;
+		const unsigned int num_objects_to_create = size.x()*size.y()*layer.Density;
+		//let terrain query match terrain detail to mean distance between instances
+		if(layer.Density > 0)
+			context.TerrainQuery->setGroundResolution(1.0/sqrt(layer.Density));
+
+		const TileSampleFilter<BillboardLayer> filter(context, layer, bb);
+		if(filter.isEmpty())
+			return;
+		tile_data.Instances.reserve(tile_data.Instances.size() + num_objects_to_create);
+
+		//candidates and attributes are generated in batches by the SIMD kernels,
+		//the batch random generator is seeded from rand() to respect srand/tile seeding
+		BatchRandom rng(static_cast<unsigned int>(rand()));
+		CandidateBatch candidates;
+		BillboardAttributeBatch attributes;
+		std::vector<osg::Vec3d> accepted;
+		std::vector<osg::Vec3d> rule_positions;
+		std::vector<unsigned char> keep;
+		const double normal_step = layer.Density > 0 ? 1.0/sqrt(layer.Density) : 1.0;
+		//rules that don't depend on terrain data thin candidates before the terrain is queried
+		const bool pre_select = layer.Rule.valid() && layer.Rule->isTerrainIndependent();
+		const unsigned int batch_size = 1024;
+		for(unsigned int first = 0; first < num_objects_to_create; first += batch_size)
+		{
+			const unsigned int num_candidates = std::min(batch_size, num_objects_to_create - first);
+			ScatterKernels::generatePositions(rng, static_cast<float>(size.x()), static_cast<float>(size.y()), num_candidates, candidates);
+			attributes.clear();
+			accepted.clear();
+			if(pre_select)
+			{
+				rule_positions.resize(num_candidates);
+				for(unsigned int i = 0; i < num_candidates; i++)
+					rule_positions[i] = osg::Vec3d(origin.x() + candidates.X[i], origin.y() + candidates.Y[i], 0) + context.Offset;
+				layer.Rule->select(context.TerrainQuery, rule_positions, normal_step, rng, keep);
+			}
+			for(unsigned int i = 0; i < num_candidates; i++)
+			{
+				if(pre_select && !keep[i])
+					continue;
+				const osg::Vec3d pos(origin.x() + candidates.X[i], origin.y() + candidates.Y[i], 0);
+				osg::Vec4 terrain_color;
+				osg::Vec3d inter;
+				if(filter.sample(pos, terrain_color, inter))
+				{
+					accepted.push_back(inter);
+					attributes.addSample(terrain_color);
+				}
+			}
+
+			if(layer.Rule.valid() && !pre_select && accepted.size() > 0)
+			{
+				//thin accepted samples by rule density, compact samples in place
+				rule_positions.resize(accepted.size());
+				for(unsigned int i = 0; i < accepted.size(); i++)
+					rule_positions[i] = accepted[i] + context.Offset;
+				layer.Rule->select(context.TerrainQuery, rule_positions, normal_step, rng, keep);
+				unsigned int num_kept = 0;
+				for(unsigned int i = 0; i < accepted.size(); i++)
+				{
+					if(keep[i])
+					{
+						accepted[num_kept] = accepted[i];
+						attributes.TerrainR[num_kept] = attributes.TerrainR[i];
+						attributes.TerrainG[num_kept] = attributes.TerrainG[i];
+						attributes.TerrainB[num_kept] = attributes.TerrainB[i];
+						num_kept++;
+					}
+				}
+				accepted.resize(num_kept);
+				attributes.TerrainR.resize(num_kept);
+				attributes.TerrainG.resize(num_kept);
+				attributes.TerrainB.resize(num_kept);
+			}
+
+			ScatterKernels::synthesizeBillboardAttributes(rng, layer, attributes);
+			for(unsigned int i = 0; i < accepted.size(); i++)
+			{
+				BillboardObject* veg_obj = new BillboardObject;
+				veg_obj->Width = attributes.Width[i];
+				veg_obj->Height = attributes.Height[i];
+				veg_obj->TextureIndex = layer._TextureIndex;
+				veg_obj->Position = accepted[i];
+				veg_obj->Color = attributes.getColor(i);
+				tile_data.Instances.push_back(veg_obj);
+			}
+		}
+	}
+
+	void BillboardInstancePolicy::_importLayer(const ScatterContext &context, const BillboardLayer &layer, const osg::BoundingBoxd &bb, TileData &tile_data) const
+	{
+		const TileSampleFilter<BillboardLayer> filter(context, layer, bb);
+		if(filter.isEmpty())
+			return;
+
+		std::vector<ImportedInstance> records;
+		layer.Import->query(osg::BoundingBoxd(bb._min + context.Offset, bb._max + context.Offset), records);
+		if(layer.RegroundImport && records.size() > 0)
+		{
+			//match terrain detail to mean distance between instances
+			const double area = (bb._max.x() - bb._min.x())*(bb._max.y() - bb._min.y());
+			context.TerrainQuery->setGroundResolution(sqrt(area/static_cast<double>(records.size())));
+		}
+
+		for(size_t i = 0; i < records.size(); i++)
+		{
+			const ImportedInstance& record = records[i];
+			if(layer.ImportSpecies >= 0 && record.Species != static_cast<unsigned int>(layer.ImportSpecies))
+				continue;
+			const osg::Vec3d pos(record.X - context.Offset.x(), record.Y - context.Offset.y(), 0);
+			osg::Vec4 terrain_color(1,1,1,1);
+			osg::Vec3d inter;
+			if(layer.RegroundImport)
+			{
+				if(!filter.sample(pos, terrain_color, inter))
+					continue;
+			}
+			else
+			{
+				if(!filter.sampleArea(pos))
+					continue;
+				inter.set(pos.x(), pos.y(), record.Z - context.Offset.z());
+			}
+
+			BillboardObject* veg_obj = new BillboardObject;
+			const float scale = Utils::random(layer.Scale.x(), layer.Scale.y());
+			veg_obj->Width = record.Width > 0 ? record.Width : Utils::random(layer.Width.x(), layer.Width.y())*scale;
+			veg_obj->Height = record.Height > 0 ? record.Height : Utils::random(layer.Height.x(), layer.Height.y())*scale;
+			veg_obj->TextureIndex = layer._TextureIndex;
+			veg_obj->Position = inter;
+			const float rand_int = Utils::random(layer.ColorIntensity.x(), layer.ColorIntensity.y());
+			if(layer.UseTerrainIntensity)
+			{
+				const float intensity = (terrain_color.r() + terrain_color.g() + terrain_color.b())/3.0;
+				terrain_color.set(intensity, intensity, intensity, terrain_color.a());
+			}
+			veg_obj->Color = terrain_color*(layer.TerrainColorRatio*rand_int);
+			veg_obj->Color += osg::Vec4(1,1,1,1)*(rand_int * (1.0 - layer.TerrainColorRatio));
+			veg_obj->Color.set(veg_obj->Color.r(), veg_obj->Color.g(), veg_obj->Color.b(), 1.0);
+			tile_data.Instances.push_back(veg_obj);
+		}
+	}
+
+	void BillboardRenderPolicy::begin(BillboardData &data, const ScatterOutput &/*output*/)
+	{
+		if(data.Technique == BRT_SHADER_INSTANCING)
+			m_BRT = new BRTShaderInstancing(data, m_EnvironmentSettings);
+		else if (data.Technique == BRT_GEOMETRY_SHADER)
+			m_BRT = new BRTGeometryShader(data, m_EnvironmentSettings);
+		else
+			OSGV_EXCEPT(std::string("BillboardRenderPolicy::begin - unkown rendering tech").c_str());
+	}
+
+	const char* const BillboardRenderPolicy::INTERIOR_LOD_NAME = "BillboardInteriorLOD";
+
+	osg::Node* BillboardRenderPolicy::createGeometry(BillboardData &/*data*/, const ScatterTile &/*tile*/, const BillboardInstancePolicy::TileData &tile_data)
+	{
+		osg::Node* exterior = tile_data.Instances.size() > 0 ? m_BRT->create(tile_data.Instances, tile_data.Bounds) : NULL;
+		if(tile_data.InteriorInstances.size() == 0)
+			return exterior;
+
+		//interior instances are shown when the viewer is within the interior distance
+		//of the tile bounds, independent of the tile range mode
+		osg::Group* group = new osg::Group;
+		if(exterior)
+			group->addChild(exterior);
+		osg::LOD* interior_lod = new osg::LOD;
+		interior_lod->setName(INTERIOR_LOD_NAME);
+		interior_lod->setCenterMode(osg::LOD::USER_DEFINED_CENTER);
+		interior_lod->setCenter(tile_data.Bounds.center());
+		interior_lod->setRadius(tile_data.Bounds.radius());
+		interior_lod->addChild(m_BRT->create(tile_data.InteriorInstances, tile_data.Bounds), 0, tile_data.InteriorDistance + tile_data.Bounds.radius());
+		group->addChild(interior_lod);
+		return group;
+	}
+
+	void BillboardRenderPolicy::setupLOD(const BillboardData &data, const ScatterTile &/*tile*/, const BillboardInstancePolicy::TileData &tile_data, osg::LOD &lod, int geometry_index, int children_index) const
+	{
+		//center and radius from tile content
+		const double tile_radius = tile_data.Bounds.radius();
+		const double tile_cutoff = tile_radius*2.0;
+		lod.setCenterMode(osg::LOD::USER_DEFINED_CENTER);
+		lod.setCenter(tile_data.Bounds.center());
+		lod.setRadius(tile_radius);
+
+		if(data.TilePixelSize > 0)
+		{
+			lod.setRangeMode(osg::LOD::PIXEL_SIZE_ON_SCREEN);
+			if(geometry_index >= 0)
+				lod.setRange(geometry_index, data.TilePixelSize, FLT_MAX);
+			lod.setRange(children_index, data.TilePixelSize, FLT_MAX);
+		}
+		else
+		{
+			if(geometry_index >= 0)
+				lod.setRange(geometry_index, 0, FLT_MAX);
+			lod.setRange(children_index, 0, tile_cutoff);
+		}
+	}
+
+	osg::StateSet* BillboardRenderPolicy::createStateSet() const
+	{
+		return dynamic_cast<osg::StateSet*>(m_BRT->getStateSet()->clone(osg::CopyOp::DEEP_COPY_STATESETS));
+	}
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include "Common.h"
+#include <osg/BoundingBox>
+#include <osg/LOD>
+#include <osg/ref_ptr>
+#include "BillboardData.h"
+#include "BillboardObject.h"
+#include "EnvironmentSettings.h"
+#include "IBillboardRenderingTech.h"
+#include "QuadTreeScatterer.h"
+
+namespace osgVegetation
+{
+	/**
+		QuadTreeScatterer instance policy for billboard layers. Each layer is populated at the
+		quad tree level matching its min tile size, instances are kept in the tile they were created in.
+	*/
+	class osgvExport BillboardInstancePolicy
+	{
+	public:
+		typedef BillboardData DataType;
+
+		BillboardInstancePolicy() : m_NumInteriorCandidates(0), m_NumInteriorCulled(0) {}
+
+		struct TileData
+		{
+			TileData() : InteriorDistance(0) {}
+			BillboardVegetationObjectVector Instances;
+			//interior culled instances, only rendered within InteriorDistance
+			BillboardVegetationObjectVector InteriorInstances;
+			double InteriorDistance;
+			//tile bounds, height from instances if any
+			osg::BoundingBoxd Bounds;
+		};
+
+		void prepare(BillboardData &data);
+		double getMaxTileSize(const BillboardData &data) const;
+		int assignLevels(BillboardData &data, double root_size);
+		bool populatesLevel(const BillboardData &data, int level) const;
+		void populateTile(const ScatterContext &context, BillboardData &data, const ScatterTile &tile, TileData &tile_data);
+		void finish(BillboardData &data);
+
+		/**
+			Interior culling statistics from last generation, number of instances
+			generated in layers using interior culling and number of those that was
+			moved to near range geometry.
+		*/
+		unsigned int getNumInteriorCandidates() const {return m_NumInteriorCandidates;}
+		unsigned int getNumInteriorCulled() const {return m_NumInteriorCulled;}
+	private:
+		void _populateLayer(const ScatterContext &context, const BillboardLayer &layer, const osg::BoundingBoxd &bb, TileData &tile_data) const;
+		void _importLayer(const ScatterContext &context, const BillboardLayer &layer, const osg::BoundingBoxd &bb, TileData &tile_data) const;
+		unsigned int _cullInterior(const BillboardLayer &layer, const osg::BoundingBoxd &bb, BillboardVegetationObjectVector &instances, size_t first, BillboardVegetationObjectVector &interior) const;
+		unsigned int m_NumInteriorCandidates;
+		unsigned int m_NumInteriorCulled;
+	};
+
+	/**
+		QuadTreeScatterer render policy for billboards, geometry is created by the
+		rendering technique selected in BillboardData. Interior culled instances get
+		their own geometry below a distance LOD.
+	*/
+	class osgvExport BillboardRenderPolicy
+	{
+	public:
+		/**
+			Name of the distance LOD holding interior geometry, used to tell tiles apart (see BillboardInstanceEditor)
+		*/
+		static const char* const INTERIOR_LOD_NAME;
+
+		BillboardRenderPolicy(const EnvironmentSettings &env_settings = EnvironmentSettings()) : m_EnvironmentSettings(env_settings) {}
+		void begin(BillboardData &data, const ScatterOutput &output);
+		osg::Node* createGeometry(BillboardData &data, const ScatterTile &tile, const BillboardInstancePolicy::TileData &tile_data);
+		void setupLOD(const BillboardData &data, const ScatterTile &tile, const BillboardInstancePolicy::TileData &tile_data, osg::LOD &lod, int geometry_index, int children_index) const;
+		osg::StateSet* createStateSet() const;
+	private:
+		osg::ref_ptr<IBillboardRenderingTech> m_BRT;
+		EnvironmentSettings m_EnvironmentSettings;
+	};
+}
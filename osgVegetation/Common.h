@@ -17,3 +17,12 @@
 #include <stdexcept>
 #define OSGV_EXCEPT(a) throw std::runtime_error(a)
 
+//Enable SSE2 code paths when the target supports it, all SIMD code must provide a scalar fallback
+#if !defined(OSGV_DISABLE_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+	#define OSGV_USE_SSE2
+#endif
+
+//AVX2 code paths require compiler support (see OSGV_ENABLE_AVX2 cmake option)
+#if defined(OSGV_USE_SSE2) && defined(__AVX2__)
+	#define OSGV_USE_AVX2
+#endif
@@ -13,14 +13,17 @@ namespace osgVegetation
 	public:
 		struct CoverageMaterial
 		{
-			CoverageMaterial(const std::string &name, const CoverageColor& color, CoverageColor tolerance = CoverageColor(0,0,0,0)):Name(name),
-				Tolerance(tolerance)
+			CoverageMaterial(const std::string &name, const CoverageColor& color, CoverageColor tolerance = CoverageColor(0,0,0,0), int id = -1):Name(name),
+				Tolerance(tolerance),
+				ID(id)
 			{
 				Colors.push_back(color);
 			}
 			std::string Name;
 			std::vector<CoverageColor> Colors;
 			CoverageColor Tolerance;
+			//Landcover class id used by raster based terrain queries, -1 if not used
+			int ID;
 
 			bool hasColor(const CoverageColor& color) const
 			{
@@ -67,5 +70,17 @@ namespace osgVegetation
 			//cast exception?
 			return "";
 		}
+
+		std::string getCoverageMaterialName(int id)
+		{
+			for(size_t i = 0; i < CoverageMaterials.size(); i++)
+			{
+				if(id >= 0 && CoverageMaterials[i].ID == id)
+				{
+					return CoverageMaterials[i].Name;
+				}
+			}
+			return "";
+		}
 	};
 }
@@ -4,6 +4,7 @@
 #include <osg/Geometry>
 #include <osg/Node>
 #include "MeshObject.h"
+#include "MeshInstanceBuffer.h"
 
 namespace osgVegetation
 {
@@ -12,6 +13,11 @@ namespace osgVegetation
 	public:
 		virtual ~IMeshRenderingTech(){}
 		virtual osg::Node* create(const MeshVegetationObjectVector &trees, const std::string &mesh_name, const osg::BoundingBoxd &bb) = 0;
+		/**
+			Create geometry for instance range [first, first + count) of buffer,
+			render data is shared by all ranges of the same buffer.
+		*/
+		virtual osg::Node* create(MeshInstanceBuffer &buffer, unsigned int first, unsigned int count, const std::string &mesh_name, const osg::BoundingBoxd &bb) = 0;
 		virtual osg::StateSet* getStateSet() const = 0;
 	};
 }
@@ -1,7 +1,9 @@
 #pragma once
 #include "Common.h"
 #include <osg/Referenced>
+#include <osg/Vec3d>
 #include <osg/Vec4>
+#include <osg/BoundingBox>
 #include "CoverageColor.h"
 
 namespace osgVegetation
@@ -17,5 +19,56 @@ namespace osgVegetation
 			Get terrain data for provided location
 		*/
 		virtual bool getTerrainData(osg::Vec3d& location, osg::Vec4 &color, std::string &coverage_name , CoverageColor &coverage_color, osg::Vec3d &inter) = 0;
+
+		/**
+			Hint that terrain data inside bb (terrain space) will soon be requested.
+			Implementations may start loading the data asynchronously, default do nothing.
+		*/
+		virtual void prefetch(const osg::BoundingBoxd &/*bb*/) {}
+
+		/**
+			Set target ground resolution (distance between samples in terrain units) for following
+			queries. Implementations may use it to select matching terrain level of detail,
+			zero means finest available. Default do nothing.
+		*/
+		virtual void setGroundResolution(double /*resolution*/) {}
+
+		/**
+			Refine position returned by getTerrainData, called for accepted instances only so that
+			implementations using coarse terrain data can snap final heights to finest terrain.
+			Return false if refinement failed, position is then left untouched. Default do nothing.
+		*/
+		virtual bool refineHeight(osg::Vec3d &/*position*/) {return true;}
+
+		/**
+			Get coverage for location from 2D lookup without terrain intersection, used by scatterers to
+			reject candidates before the full query. Return false if coverage can't be resolved this
+			way for location, default always return false.
+		*/
+		virtual bool getCoverage(const osg::Vec3d &/*location*/, std::string &/*coverage_name*/) {return false;}
+
+		/**
+			Get terrain normal at location (terrain space), step is the sample distance used
+			to match terrain detail. Default use central differences of getTerrainData heights.
+		*/
+		virtual bool getTerrainNormal(const osg::Vec3d &location, double step, osg::Vec3d &normal)
+		{
+			const osg::Vec3d offsets[4] = {osg::Vec3d(-step, 0, 0), osg::Vec3d(step, 0, 0), osg::Vec3d(0, -step, 0), osg::Vec3d(0, step, 0)};
+			double heights[4];
+			for (int i = 0; i < 4; i++)
+			{
+				osg::Vec3d sample_location = location + offsets[i];
+				osg::Vec4 color;
+				std::string coverage_name;
+				CoverageColor coverage_color;
+				osg::Vec3d inter;
+				if (!getTerrainData(sample_location, color, coverage_name, coverage_color, inter))
+					return false;
+				heights[i] = inter.z();
+			}
+			normal.set(heights[0] - heights[1], heights[2] - heights[3], 2.0 * step);
+			normal.normalize();
+			return true;
+		}
 	};
 }
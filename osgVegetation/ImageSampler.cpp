@@ -0,0 +1,324 @@
+#include "ImageSampler.h"
+#include <osg/Math>
+#include <cmath>
+#ifdef OSGV_USE_SSE2
+	#include <emmintrin.h>
+#endif
+
+namespace osgVegetation
+{
+	namespace
+	{
+		inline float clampCoord(float value)
+		{
+			return value < 0.0f ? 0.0f : (value > 1.0f ? 1.0f : value);
+		}
+
+		inline osg::Vec4 bilerp(const osg::Vec4& c00, const osg::Vec4& c10, const osg::Vec4& c01, const osg::Vec4& c11, float fx, float fy)
+		{
+#ifdef OSGV_USE_SSE2
+			const __m128 v00 = _mm_loadu_ps(c00.ptr());
+			const __m128 v10 = _mm_loadu_ps(c10.ptr());
+			const __m128 v01 = _mm_loadu_ps(c01.ptr());
+			const __m128 v11 = _mm_loadu_ps(c11.ptr());
+			const __m128 wx = _mm_set1_ps(fx);
+			const __m128 wy = _mm_set1_ps(fy);
+			const __m128 bottom = _mm_add_ps(v00, _mm_mul_ps(_mm_sub_ps(v10, v00), wx));
+			const __m128 top = _mm_add_ps(v01, _mm_mul_ps(_mm_sub_ps(v11, v01), wx));
+			osg::Vec4 result;
+			_mm_storeu_ps(result.ptr(), _mm_add_ps(bottom, _mm_mul_ps(_mm_sub_ps(top, bottom), wy)));
+			return result;
+#else
+			const osg::Vec4 bottom = c00 + (c10 - c00) * fx;
+			const osg::Vec4 top = c01 + (c11 - c01) * fx;
+			return bottom + (top - bottom) * fy;
+#endif
+		}
+
+		/**
+			Texel indices and weights for bilinear lookup
+		*/
+		struct BilinearTexels
+		{
+			int X0, X1, Y0, Y1;
+			float FX, FY;
+		};
+
+		inline void computeBilinearTexels(const ImageSampler::TexelData& td, const osg::Vec2& tc, BilinearTexels& texels)
+		{
+			const float x = clampCoord(tc.x()) * static_cast<float>(td.Width) - 0.5f;
+			const float y = clampCoord(tc.y()) * static_cast<float>(td.Height) - 0.5f;
+			const float fl_x = floorf(x);
+			const float fl_y = floorf(y);
+			texels.FX = x - fl_x;
+			texels.FY = y - fl_y;
+			const int ix = static_cast<int>(fl_x);
+			const int iy = static_cast<int>(fl_y);
+			texels.X0 = osg::clampTo(ix, 0, td.Width - 1);
+			texels.X1 = osg::clampTo(ix + 1, 0, td.Width - 1);
+			texels.Y0 = osg::clampTo(iy, 0, td.Height - 1);
+			texels.Y1 = osg::clampTo(iy + 1, 0, td.Height - 1);
+		}
+
+#ifdef OSGV_USE_SSE2
+		/**
+			Split four interleaved texture coordinates into clamped u and v vectors
+		*/
+		inline void loadCoords4(const osg::Vec2* tc, __m128& u, __m128& v)
+		{
+			const __m128 a = _mm_loadu_ps(reinterpret_cast<const float*>(tc));
+			const __m128 b = _mm_loadu_ps(reinterpret_cast<const float*>(tc + 2));
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 one = _mm_set1_ps(1.0f);
+			u = _mm_min_ps(_mm_max_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)), zero), one);
+			v = _mm_min_ps(_mm_max_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)), zero), one);
+		}
+
+		inline void computeBilinearTexels4(const ImageSampler::TexelData& td, const osg::Vec2* tc, BilinearTexels* texels)
+		{
+			__m128 u, v;
+			loadCoords4(tc, u, v);
+			const __m128 half = _mm_set1_ps(0.5f);
+			const __m128 one = _mm_set1_ps(1.0f);
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 max_x = _mm_set1_ps(static_cast<float>(td.Width - 1));
+			const __m128 max_y = _mm_set1_ps(static_cast<float>(td.Height - 1));
+			const __m128 x = _mm_sub_ps(_mm_mul_ps(u, _mm_set1_ps(static_cast<float>(td.Width))), half);
+			const __m128 y = _mm_sub_ps(_mm_mul_ps(v, _mm_set1_ps(static_cast<float>(td.Height))), half);
+
+			//floor = truncate and adjust negative values
+			__m128 fl_x = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+			fl_x = _mm_sub_ps(fl_x, _mm_and_ps(_mm_cmpgt_ps(fl_x, x), one));
+			__m128 fl_y = _mm_cvtepi32_ps(_mm_cvttps_epi32(y));
+			fl_y = _mm_sub_ps(fl_y, _mm_and_ps(_mm_cmpgt_ps(fl_y, y), one));
+
+			float fx[4], fy[4];
+			int x0[4], x1[4], y0[4], y1[4];
+			_mm_storeu_ps(fx, _mm_sub_ps(x, fl_x));
+			_mm_storeu_ps(fy, _mm_sub_ps(y, fl_y));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(x0), _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(fl_x, zero), max_x)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(x1), _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_add_ps(fl_x, one), zero), max_x)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(y0), _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(fl_y, zero), max_y)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(y1), _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_add_ps(fl_y, one), zero), max_y)));
+			for (int j = 0; j < 4; j++)
+			{
+				texels[j].X0 = x0[j];
+				texels[j].X1 = x1[j];
+				texels[j].Y0 = y0[j];
+				texels[j].Y1 = y1[j];
+				texels[j].FX = fx[j];
+				texels[j].FY = fy[j];
+			}
+		}
+#endif
+
+		template<class FETCH>
+		inline osg::Vec4 fetchTexel(const ImageSampler::TexelData& td, int s, int t)
+		{
+			return FETCH::fetch(td.Data + t * td.RowStep + s * FETCH::TexelSize);
+		}
+
+		//Tag used to select block cache texel fetch for compressed images
+		struct TexelFetchBCn
+		{
+		};
+
+		template<>
+		inline osg::Vec4 fetchTexel<TexelFetchBCn>(const ImageSampler::TexelData& td, int s, int t)
+		{
+			return TexelFetchRGBA8::fetch(td.BlockCache->getTexel(s, t));
+		}
+
+		template<class FETCH>
+		void sampleNearest(const ImageSampler::TexelData& td, const osg::Vec2* tc, osg::Vec4* colors, unsigned int count)
+		{
+			const float max_s = static_cast<float>(td.Width - 1);
+			const float max_t = static_cast<float>(td.Height - 1);
+			unsigned int i = 0;
+#ifdef OSGV_USE_SSE2
+			const __m128 v_max_s = _mm_set1_ps(max_s);
+			const __m128 v_max_t = _mm_set1_ps(max_t);
+			int s[4], t[4];
+			for (; i + 4 <= count; i += 4)
+			{
+				__m128 u, v;
+				loadCoords4(tc + i, u, v);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(s), _mm_cvttps_epi32(_mm_mul_ps(u, v_max_s)));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(t), _mm_cvttps_epi32(_mm_mul_ps(v, v_max_t)));
+				colors[i] = fetchTexel<FETCH>(td, s[0], t[0]);
+				colors[i + 1] = fetchTexel<FETCH>(td, s[1], t[1]);
+				colors[i + 2] = fetchTexel<FETCH>(td, s[2], t[2]);
+				colors[i + 3] = fetchTexel<FETCH>(td, s[3], t[3]);
+			}
+#endif
+			for (; i < count; i++)
+			{
+				const int s = static_cast<int>(clampCoord(tc[i].x()) * max_s);
+				const int t = static_cast<int>(clampCoord(tc[i].y()) * max_t);
+				colors[i] = fetchTexel<FETCH>(td, s, t);
+			}
+		}
+
+		template<class FETCH>
+		inline osg::Vec4 sampleBilinearTexels(const ImageSampler::TexelData& td, const BilinearTexels& texels)
+		{
+			return bilerp(fetchTexel<FETCH>(td, texels.X0, texels.Y0),
+				fetchTexel<FETCH>(td, texels.X1, texels.Y0),
+				fetchTexel<FETCH>(td, texels.X0, texels.Y1),
+				fetchTexel<FETCH>(td, texels.X1, texels.Y1),
+				texels.FX, texels.FY);
+		}
+
+		template<class FETCH>
+		void sampleBilinear(const ImageSampler::TexelData& td, const osg::Vec2* tc, osg::Vec4* colors, unsigned int count)
+		{
+			unsigned int i = 0;
+#ifdef OSGV_USE_SSE2
+			BilinearTexels texels[4];
+			for (; i + 4 <= count; i += 4)
+			{
+				computeBilinearTexels4(td, tc + i, texels);
+				for (int j = 0; j < 4; j++)
+					colors[i + j] = sampleBilinearTexels<FETCH>(td, texels[j]);
+			}
+#endif
+			for (; i < count; i++)
+			{
+				BilinearTexels texels;
+				computeBilinearTexels(td, tc[i], texels);
+				colors[i] = sampleBilinearTexels<FETCH>(td, texels);
+			}
+		}
+
+		//Fallback for unsupported formats
+		void sampleGenericNearest(const ImageSampler::TexelData& td, const osg::Vec2* tc, osg::Vec4* colors, unsigned int count)
+		{
+			for (unsigned int i = 0; i < count; i++)
+			{
+				const unsigned int s = static_cast<unsigned int>(clampCoord(tc[i].x()) * static_cast<float>(td.Width - 1));
+				const unsigned int t = static_cast<unsigned int>(clampCoord(tc[i].y()) * static_cast<float>(td.Height - 1));
+				colors[i] = td.Image->getColor(s, t);
+			}
+		}
+
+		void sampleGenericBilinear(const ImageSampler::TexelData& td, const osg::Vec2* tc, osg::Vec4* colors, unsigned int count)
+		{
+			for (unsigned int i = 0; i < count; i++)
+			{
+				BilinearTexels texels;
+				computeBilinearTexels(td, tc[i], texels);
+				colors[i] = bilerp(td.Image->getColor(texels.X0, texels.Y0),
+					td.Image->getColor(texels.X1, texels.Y0),
+					td.Image->getColor(texels.X0, texels.Y1),
+					td.Image->getColor(texels.X1, texels.Y1),
+					texels.FX, texels.FY);
+			}
+		}
+
+		void sampleEmpty(const ImageSampler::TexelData& /*td*/, const osg::Vec2* /*tc*/, osg::Vec4* colors, unsigned int count)
+		{
+			for (unsigned int i = 0; i < count; i++)
+				colors[i].set(0, 0, 0, 0);
+		}
+
+		template<class FETCH>
+		ImageSampler::SampleFunc getSampleFunc(TexelFilter filter)
+		{
+			if (filter == TF_BILINEAR)
+				return &sampleBilinear<FETCH>;
+			return &sampleNearest<FETCH>;
+		}
+
+		int getNumComponents(GLenum pixel_format)
+		{
+			switch (pixel_format)
+			{
+			case GL_LUMINANCE: return 1;
+			case GL_RGB: return 3;
+			case GL_RGBA: return 4;
+			default: return 0;
+			}
+		}
+	}
+
+	ImageSampler::ImageSampler(osg::Image* image, TexelFilter filter, unsigned int mipmap_level) : m_Image(image),
+		m_Filter(filter),
+		m_SampleFunc(&sampleEmpty),
+		m_Specialised(false)
+	{
+		if (image && image->data())
+		{
+			m_TexelData.Data = image->data();
+			m_TexelData.Width = image->s();
+			m_TexelData.Height = image->t();
+			m_TexelData.RowStep = image->getRowSizeInBytes();
+			m_TexelData.Image = image;
+
+			//generic fallback sample through osg::Image and can't access mipmap data
+			const bool specialised = BCnDecoder::isSupportedFormat(image->getPixelFormat()) ||
+				isSpecialisedFormat(image->getPixelFormat(), image->getDataType());
+			const unsigned int level = image->isMipmap() ? osg::minimum(mipmap_level, image->getNumMipmapLevels() - 1) : 0;
+			if (level > 0 && specialised)
+			{
+				m_TexelData.Data = image->getMipmapData(level);
+				m_TexelData.Width = osg::maximum(image->s() >> level, 1);
+				m_TexelData.Height = osg::maximum(image->t() >> level, 1);
+				m_TexelData.RowStep = osg::Image::computeRowWidthInBytes(m_TexelData.Width, image->getPixelFormat(), image->getDataType(), image->getPacking());
+			}
+			_init(image->getPixelFormat(), image->getDataType());
+		}
+	}
+
+	ImageSampler::ImageSampler(const unsigned char* data, int width, int height, GLenum pixel_format, GLenum data_type, unsigned int row_step, TexelFilter filter) : m_Filter(filter),
+		m_SampleFunc(&sampleEmpty),
+		m_Specialised(false)
+	{
+		if (!isSpecialisedFormat(pixel_format, data_type))
+			OSGV_EXCEPT(std::string("ImageSampler::ImageSampler - Unsupported raw texel format").c_str());
+
+		const unsigned int texel_size = getNumComponents(pixel_format) * (data_type == GL_FLOAT ? sizeof(float) : 1);
+		m_TexelData.Data = data;
+		m_TexelData.Width = width;
+		m_TexelData.Height = height;
+		m_TexelData.RowStep = row_step > 0 ? row_step : width * texel_size;
+		_init(pixel_format, data_type);
+	}
+
+	bool ImageSampler::isSpecialisedFormat(GLenum pixel_format, GLenum data_type)
+	{
+		return getNumComponents(pixel_format) > 0 && (data_type == GL_UNSIGNED_BYTE || data_type == GL_FLOAT);
+	}
+
+	void ImageSampler::_init(GLenum pixel_format, GLenum data_type)
+	{
+		if (m_TexelData.Width <= 0 || m_TexelData.Height <= 0)
+			return;
+
+		m_Specialised = true;
+		const int num_comp = getNumComponents(pixel_format);
+		if (BCnDecoder::isSupportedFormat(pixel_format))
+		{
+			m_BlockCache = new BCnBlockCache(m_TexelData.Data, m_TexelData.Width, m_TexelData.Height, pixel_format);
+			m_TexelData.BlockCache = m_BlockCache.get();
+			m_SampleFunc = getSampleFunc<TexelFetchBCn>(m_Filter);
+		}
+		else if (data_type == GL_UNSIGNED_BYTE && num_comp == 1)
+			m_SampleFunc = getSampleFunc<TexelFetchL8>(m_Filter);
+		else if (data_type == GL_UNSIGNED_BYTE && num_comp == 3)
+			m_SampleFunc = getSampleFunc<TexelFetchRGB8>(m_Filter);
+		else if (data_type == GL_UNSIGNED_BYTE && num_comp == 4)
+			m_SampleFunc = getSampleFunc<TexelFetchRGBA8>(m_Filter);
+		else if (data_type == GL_FLOAT && num_comp == 1)
+			m_SampleFunc = getSampleFunc<TexelFetchL32F>(m_Filter);
+		else if (data_type == GL_FLOAT && num_comp == 3)
+			m_SampleFunc = getSampleFunc<TexelFetchRGB32F>(m_Filter);
+		else if (data_type == GL_FLOAT && num_comp == 4)
+			m_SampleFunc = getSampleFunc<TexelFetchRGBA32F>(m_Filter);
+		else
+		{
+			m_Specialised = false;
+			if (m_TexelData.Image)
+				m_SampleFunc = (m_Filter == TF_BILINEAR) ? &sampleGenericBilinear : &sampleGenericNearest;
+		}
+	}
+}
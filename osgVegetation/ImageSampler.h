@@ -0,0 +1,163 @@
+#pragma once
+#include "Common.h"
+#include <osg/Referenced>
+#include <osg/ref_ptr>
+#include <osg/Image>
+#include <osg/Vec2>
+#include <osg/Vec4>
+#include "BCnDecoder.h"
+
+namespace osgVegetation
+{
+	/**
+		Texel filter used when sampling images
+	*/
+	enum TexelFilter
+	{
+		TF_NEAREST,
+		TF_BILINEAR
+	};
+
+	/**
+		Texel fetch specialised for component type and component count.
+		The returned color is normalized in the same way as osg::Image::getColor.
+	*/
+	template<typename T, int NUM_COMPONENTS>
+	struct TexelFetch
+	{
+	};
+
+	template<typename T> struct TexelNormalization { static float scale() { return 1.0f; } };
+	template<> struct TexelNormalization<unsigned char> { static float scale() { return 1.0f / 255.0f; } };
+
+	template<typename T>
+	struct TexelFetch<T, 1>
+	{
+		enum { TexelSize = sizeof(T) };
+		static osg::Vec4 fetch(const unsigned char* texel)
+		{
+			const float l = static_cast<float>(*reinterpret_cast<const T*>(texel)) * TexelNormalization<T>::scale();
+			return osg::Vec4(l, l, l, 1.0f);
+		}
+	};
+
+	template<typename T>
+	struct TexelFetch<T, 3>
+	{
+		enum { TexelSize = 3 * sizeof(T) };
+		static osg::Vec4 fetch(const unsigned char* texel)
+		{
+			const T* c = reinterpret_cast<const T*>(texel);
+			const float s = TexelNormalization<T>::scale();
+			return osg::Vec4(static_cast<float>(c[0]) * s, static_cast<float>(c[1]) * s, static_cast<float>(c[2]) * s, 1.0f);
+		}
+	};
+
+	template<typename T>
+	struct TexelFetch<T, 4>
+	{
+		enum { TexelSize = 4 * sizeof(T) };
+		static osg::Vec4 fetch(const unsigned char* texel)
+		{
+			const T* c = reinterpret_cast<const T*>(texel);
+			const float s = TexelNormalization<T>::scale();
+			return osg::Vec4(static_cast<float>(c[0]) * s, static_cast<float>(c[1]) * s, static_cast<float>(c[2]) * s, static_cast<float>(c[3]) * s);
+		}
+	};
+
+	typedef TexelFetch<unsigned char, 1> TexelFetchL8;
+	typedef TexelFetch<unsigned char, 3> TexelFetchRGB8;
+	typedef TexelFetch<unsigned char, 4> TexelFetchRGBA8;
+	typedef TexelFetch<float, 1> TexelFetchL32F;
+	typedef TexelFetch<float, 3> TexelFetchRGB32F;
+	typedef TexelFetch<float, 4> TexelFetchRGBA32F;
+
+	/**
+		Image sampler used in the terrain query hot path as replacement for osg::Image::getColor.
+		The pixel format is resolved once at construction and all lookups are then done through
+		format specialised (compile time) sample functions. Texture coordinates are clamped to [0,1].
+		Nearest sampling select texel in the same way as osg::Image::getColor.
+		Supported formats: RGB8, RGBA8, L8, float L, RGB, RGBA and BCn (DXT1/3/5) compressed images.
+		Compressed images are decoded on demand at block granularity (see BCnBlockCache).
+		Other formats fallback to osg::Image::getColor.
+	*/
+	class osgvExport ImageSampler : public osg::Referenced
+	{
+	public:
+		/**
+			Raw texel data description
+		*/
+		struct TexelData
+		{
+			TexelData() : Data(NULL), Width(0), Height(0), RowStep(0), Image(NULL), BlockCache(NULL) {}
+			const unsigned char* Data;
+			int Width;
+			int Height;
+			unsigned int RowStep;
+			//only used by generic fallback
+			const osg::Image* Image;
+			//only used by compressed images
+			const BCnBlockCache* BlockCache;
+		};
+
+		typedef void (*SampleFunc)(const TexelData& data, const osg::Vec2* tc, osg::Vec4* colors, unsigned int count);
+
+		/**
+			Create sampler for image, the image is referenced by the sampler.
+			@param mipmap_level Mipmap level to sample, clamped to available levels. Levels above
+			zero are only used for formats with specialised sample functions.
+		*/
+		ImageSampler(osg::Image* image, TexelFilter filter = TF_NEAREST, unsigned int mipmap_level = 0);
+
+		/**
+			Create sampler for raw texel data (not owned by the sampler).
+			@param row_step Bytes between rows, 0 means tightly packed
+		*/
+		ImageSampler(const unsigned char* data, int width, int height, GLenum pixel_format, GLenum data_type, unsigned int row_step = 0, TexelFilter filter = TF_NEAREST);
+
+		/**
+			Sample single texture coordinate
+		*/
+		osg::Vec4 sample(const osg::Vec2& tc) const
+		{
+			osg::Vec4 color;
+			m_SampleFunc(m_TexelData, &tc, &color, 1);
+			return color;
+		}
+
+		/**
+			Sample array of texture coordinates, SIMD is used if available.
+		*/
+		void sample(const osg::Vec2* tc, osg::Vec4* colors, unsigned int count) const
+		{
+			m_SampleFunc(m_TexelData, tc, colors, count);
+		}
+
+		TexelFilter getFilter() const { return m_Filter; }
+
+		osg::Image* getImage() const { return m_Image.get(); }
+
+		/**
+			Check if specialised sample function was found for the image format.
+		*/
+		bool isSpecialised() const { return m_Specialised; }
+
+		/**
+			Check if format is supported by the specialised sample functions
+		*/
+		static bool isSpecialisedFormat(GLenum pixel_format, GLenum data_type);
+
+		/**
+			Get block cache used for compressed images, NULL if image is uncompressed
+		*/
+		const BCnBlockCache* getBlockCache() const { return m_BlockCache.get(); }
+	private:
+		void _init(GLenum pixel_format, GLenum data_type);
+		osg::ref_ptr<osg::Image> m_Image;
+		osg::ref_ptr<BCnBlockCache> m_BlockCache;
+		TexelData m_TexelData;
+		TexelFilter m_Filter;
+		SampleFunc m_SampleFunc;
+		bool m_Specialised;
+	};
+}
@@ -0,0 +1,236 @@
+#include "ImpostorBaker.h"
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/NodeVisitor>
+#include <osg/StateSet>
+#include <osg/Texture2D>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace osgVegetation
+{
+	namespace
+	{
+		const osg::Image* GetTexture(const osg::StateSet* state_set)
+		{
+			if(state_set == NULL)
+				return NULL;
+			const osg::Texture2D* tex = dynamic_cast<const osg::Texture2D*>(state_set->getTextureAttribute(0, osg::StateAttribute::TEXTURE));
+			return tex ? tex->getImage() : NULL;
+		}
+
+		class TriangleCollector : public osg::NodeVisitor
+		{
+		public:
+			TriangleCollector(ImpostorBaker::TriangleVector &triangles) : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN),
+				m_Triangles(triangles)
+			{
+
+			}
+
+			void apply(osg::Geode& geode)
+			{
+				const osg::Matrix matrix = osg::computeLocalToWorld(getNodePath());
+				//closest texture along path
+				const osg::Image* path_texture = NULL;
+				for(int i = static_cast<int>(getNodePath().size()) - 1; i >= 0 && path_texture == NULL; i--)
+					path_texture = GetTexture(getNodePath()[i]->getStateSet());
+
+				for(unsigned int i = 0; i < geode.getNumDrawables(); i++)
+				{
+					osg::Geometry* geom = geode.getDrawable(i)->asGeometry();
+					if(geom == NULL)
+						continue;
+					const osg::Vec3Array* vertices = dynamic_cast<const osg::Vec3Array*>(geom->getVertexArray());
+					if(vertices == NULL)
+						continue;
+					const osg::Vec2Array* tex_coords = dynamic_cast<const osg::Vec2Array*>(geom->getTexCoordArray(0));
+					const osg::Image* texture = GetTexture(geom->getStateSet());
+					if(texture == NULL)
+						texture = path_texture;
+
+					for(unsigned int j = 0; j < geom->getNumPrimitiveSets(); j++)
+					{
+						const osg::PrimitiveSet* ps = geom->getPrimitiveSet(j);
+						const unsigned int num = ps->getNumIndices();
+						switch(ps->getMode())
+						{
+						case osg::PrimitiveSet::TRIANGLES:
+							for(unsigned int k = 0; k + 2 < num; k += 3)
+								_add(*vertices, tex_coords, texture, matrix, ps->index(k), ps->index(k+1), ps->index(k+2));
+							break;
+						case osg::PrimitiveSet::TRIANGLE_STRIP:
+						case osg::PrimitiveSet::QUAD_STRIP:
+							for(unsigned int k = 0; k + 2 < num; k++)
+								_add(*vertices, tex_coords, texture, matrix, ps->index(k), ps->index(k+1), ps->index(k+2));
+							break;
+						case osg::PrimitiveSet::TRIANGLE_FAN:
+						case osg::PrimitiveSet::POLYGON:
+							for(unsigned int k = 1; k + 1 < num; k++)
+								_add(*vertices, tex_coords, texture, matrix, ps->index(0), ps->index(k), ps->index(k+1));
+							break;
+						case osg::PrimitiveSet::QUADS:
+							for(unsigned int k = 0; k + 3 < num; k += 4)
+							{
+								_add(*vertices, tex_coords, texture, matrix, ps->index(k), ps->index(k+1), ps->index(k+2));
+								_add(*vertices, tex_coords, texture, matrix, ps->index(k), ps->index(k+2), ps->index(k+3));
+							}
+							break;
+						default:
+							//points and lines are not baked
+							break;
+						}
+					}
+				}
+			}
+		private:
+			void _add(const osg::Vec3Array &vertices, const osg::Vec2Array* tex_coords, const osg::Image* texture, const osg::Matrix &matrix, unsigned int i0, unsigned int i1, unsigned int i2)
+			{
+				const unsigned int indices[3] = {i0, i1, i2};
+				ImpostorBaker::Triangle tri;
+				tri.Texture = texture;
+				for(int i = 0; i < 3; i++)
+				{
+					if(indices[i] >= vertices.size())
+						return;
+					tri.Vertices[i] = vertices[indices[i]] * matrix;
+					tri.TexCoords[i] = (tex_coords && indices[i] < tex_coords->size()) ? (*tex_coords)[indices[i]] : osg::Vec2(0, 0);
+				}
+				m_Triangles.push_back(tri);
+			}
+			ImpostorBaker::TriangleVector &m_Triangles;
+		};
+	}
+
+	ImpostorBaker::ImpostorBaker(unsigned int texture_size) : m_TextureSize(texture_size)
+	{
+		if(texture_size == 0)
+			OSGV_EXCEPT(std::string("ImpostorBaker::ImpostorBaker - Invalid texture size").c_str());
+	}
+
+	void ImpostorBaker::collectTriangles(osg::Node* mesh, TriangleVector &triangles)
+	{
+		TriangleCollector collector(triangles);
+		mesh->accept(collector);
+	}
+
+	void ImpostorBaker::_getExtent(const TriangleVector &triangles, float &width, float &height)
+	{
+		float radius = 0;
+		height = 0;
+		for(size_t i = 0; i < triangles.size(); i++)
+		{
+			for(int j = 0; j < 3; j++)
+			{
+				const osg::Vec3& v = triangles[i].Vertices[j];
+				radius = std::max(radius, static_cast<float>(std::max(fabs(v.x()), fabs(v.y()))));
+				height = std::max(height, v.z());
+			}
+		}
+		width = radius * 2.0f;
+	}
+
+	void ImpostorBaker::getExtent(osg::Node* mesh, float &width, float &height)
+	{
+		TriangleVector triangles;
+		collectTriangles(mesh, triangles);
+		_getExtent(triangles, width, height);
+	}
+
+	osg::Vec4 ImpostorBaker::_sample(const osg::Image* image, const osg::Vec2 &tc)
+	{
+		if(image == NULL || image->s() == 0 || image->t() == 0)
+			return osg::Vec4(1, 1, 1, 1);
+		//repeat wrap, nearest texel
+		const float s = tc.x() - floor(tc.x());
+		const float t = tc.y() - floor(tc.y());
+		const int x = std::min(static_cast<int>(s * image->s()), image->s() - 1);
+		const int y = std::min(static_cast<int>(t * image->t()), image->t() - 1);
+		return image->getColor(x, y);
+	}
+
+	osg::Image* ImpostorBaker::bake(osg::Node* mesh, const osg::Image* default_texture) const
+	{
+		TriangleVector triangles;
+		collectTriangles(mesh, triangles);
+		float width = 0;
+		float height = 0;
+		_getExtent(triangles, width, height);
+		if(width <= 0 || height <= 0)
+			OSGV_EXCEPT(std::string("ImpostorBaker::bake - Mesh has no geometry above ground").c_str());
+
+		const int size = static_cast<int>(m_TextureSize);
+		const float scale_x = size / width;
+		const float scale_z = size / height;
+		std::vector<float> depth(size * size, FLT_MAX);
+		std::vector<osg::Vec4> color(size * size, osg::Vec4(0, 0, 0, 0));
+
+		for(size_t i = 0; i < triangles.size(); i++)
+		{
+			const Triangle& tri = triangles[i];
+			const osg::Image* texture = tri.Texture ? tri.Texture : default_texture;
+			//texture space, viewer on negative y-axis, depth along y
+			osg::Vec2 p[3];
+			for(int j = 0; j < 3; j++)
+				p[j].set((tri.Vertices[j].x() + width * 0.5f) * scale_x, tri.Vertices[j].z() * scale_z);
+
+			const float area = (p[1].x() - p[0].x()) * (p[2].y() - p[0].y()) - (p[2].x() - p[0].x()) * (p[1].y() - p[0].y());
+			//edge on triangles cover no texels
+			if(fabs(area) < 1e-12f)
+				continue;
+
+			const int x0 = std::max(0, static_cast<int>(floor(std::min(p[0].x(), std::min(p[1].x(), p[2].x())))));
+			const int x1 = std::min(size - 1, static_cast<int>(ceil(std::max(p[0].x(), std::max(p[1].x(), p[2].x())))));
+			const int y0 = std::max(0, static_cast<int>(floor(std::min(p[0].y(), std::min(p[1].y(), p[2].y())))));
+			const int y1 = std::min(size - 1, static_cast<int>(ceil(std::max(p[0].y(), std::max(p[1].y(), p[2].y())))));
+			for(int y = y0; y <= y1; y++)
+			{
+				for(int x = x0; x <= x1; x++)
+				{
+					//barycentric coordinates at texel center
+					const float px = x + 0.5f;
+					const float py = y + 0.5f;
+					const float w0 = ((p[1].x() - px) * (p[2].y() - py) - (p[2].x() - px) * (p[1].y() - py)) / area;
+					const float w1 = ((p[2].x() - px) * (p[0].y() - py) - (p[0].x() - px) * (p[2].y() - py)) / area;
+					const float w2 = 1.0f - w0 - w1;
+					if(w0 < 0 || w1 < 0 || w2 < 0)
+						continue;
+					const float d = tri.Vertices[0].y() * w0 + tri.Vertices[1].y() * w1 + tri.Vertices[2].y() * w2;
+					const int index = y * size + x;
+					if(d >= depth[index])
+						continue;
+					const osg::Vec2 tc = tri.TexCoords[0] * w0 + tri.TexCoords[1] * w1 + tri.TexCoords[2] * w2;
+					const osg::Vec4 c = _sample(texture, tc);
+					//alpha test
+					if(c.a() < 0.5f)
+						continue;
+					depth[index] = d;
+					color[index] = osg::Vec4(c.r(), c.g(), c.b(), 1.0f);
+				}
+			}
+		}
+
+		//fill uncovered texels with mean color to avoid dark fringes when mipmapped
+		osg::Vec4 mean(0, 0, 0, 0);
+		for(size_t i = 0; i < color.size(); i++)
+			mean += color[i];
+		if(mean.a() > 0)
+			mean = mean * (1.0f / mean.a());
+
+		osg::Image* image = new osg::Image;
+		image->allocateImage(size, size, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+		for(int y = 0; y < size; y++)
+		{
+			for(int x = 0; x < size; x++)
+			{
+				const osg::Vec4& c = color[y * size + x];
+				const osg::Vec4 out = c.a() > 0 ? c : osg::Vec4(mean.r(), mean.g(), mean.b(), 0.0f);
+				unsigned char* ptr = image->data(x, y);
+				for(int k = 0; k < 4; k++)
+					ptr[k] = static_cast<unsigned char>(std::min(255.0f, std::max(0.0f, out[k] * 255.0f + 0.5f)));
+			}
+		}
+		return image;
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include "Common.h"
+#include <osg/Image>
+#include <osg/Node>
+#include <osg/Vec2>
+#include <osg/Vec3>
+#include <vector>
+
+namespace osgVegetation
+{
+	/**
+		Bake impostor (billboard) textures from meshes without a graphics context, ie. in
+		batch builders. The mesh is rasterized in software using an orthographic side view
+		along the y-axis, textures are sampled nearest and alpha tested. The texture is centered
+		on the mesh origin and cover the mesh from ground (z = 0) to top, which match the quad
+		layout used by billboard rendering techniques.
+	*/
+	class osgvExport ImpostorBaker
+	{
+	public:
+		/**
+			@param texture_size Width and height of baked textures (all textures in billboard
+			texture arrays must share size)
+		*/
+		ImpostorBaker(unsigned int texture_size = 256);
+
+		/**
+			Bake impostor texture of mesh, throws if mesh has no triangles above ground.
+			@param mesh Mesh node, transforms are applied
+			@param default_texture Texture used for geometry without own texture (ie. the
+			texture shared by all meshes in MRTShaderInstancing), NULL use white
+			@return RGBA image, transparent where not covered
+		*/
+		osg::Image* bake(osg::Node* mesh, const osg::Image* default_texture) const;
+
+		/**
+			Get impostor size in mesh units, ie. billboard width and height for instance scale 1.
+			Width is the diameter of the mesh around the z-axis.
+		*/
+		static void getExtent(osg::Node* mesh, float &width, float &height);
+
+		/**
+			Triangle collected from mesh
+		*/
+		struct Triangle
+		{
+			osg::Vec3 Vertices[3];
+			osg::Vec2 TexCoords[3];
+			const osg::Image* Texture;
+		};
+		typedef std::vector<Triangle> TriangleVector;
+
+		/**
+			Collect mesh triangles with transforms applied
+		*/
+		static void collectTriangles(osg::Node* mesh, TriangleVector &triangles);
+	private:
+		static void _getExtent(const TriangleVector &triangles, float &width, float &height);
+		static osg::Vec4 _sample(const osg::Image* image, const osg::Vec2 &tc);
+		unsigned int m_TextureSize;
+	};
+}
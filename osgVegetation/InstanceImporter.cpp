@@ -0,0 +1,258 @@
+#include "InstanceImporter.h"
+#include "MemoryMappedFile.h"
+#include <osg/ref_ptr>
+#include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
+#include <cctype>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace osgVegetation
+{
+	InstanceImporter::InstanceImporter(const std::string &filename, double bucket_size, size_t memory_budget) : m_FileName(filename),
+		m_SpillDirectory(filename + "_buckets"),
+		m_BucketSize(bucket_size),
+		m_MemoryBudget(memory_budget),
+		m_Built(false),
+		m_NumRecords(0),
+		m_NumBufferedRecords(0),
+		m_NumCachedRecords(0),
+		m_AccessCounter(0)
+	{
+		if (bucket_size <= 0)
+			OSGV_EXCEPT(std::string("InstanceImporter::InstanceImporter - Invalid bucket size for file:" + filename).c_str());
+	}
+
+	InstanceImporter::~InstanceImporter()
+	{
+		for (std::map<BucketKey, Bucket>::const_iterator iter = m_Buckets.begin(); iter != m_Buckets.end(); ++iter)
+			remove(iter->second.FileName.c_str());
+	}
+
+	void InstanceImporter::build()
+	{
+		if (m_Built)
+			return;
+		if (!osgDB::makeDirectory(m_SpillDirectory))
+			OSGV_EXCEPT(std::string("InstanceImporter::build - Failed to create spill directory:" + m_SpillDirectory).c_str());
+
+		std::cout << "InstanceImporter - Importing " << m_FileName << "\n";
+		const std::string ext = osgDB::getLowerCaseFileExtension(m_FileName);
+		if (ext == "csv" || ext == "txt")
+			_importCSV();
+		else
+			_importBinary();
+		_spill();
+		m_Built = true;
+		std::cout << "InstanceImporter - Imported " << m_NumRecords << " records to " << m_Buckets.size() << " buckets\n";
+	}
+
+	void InstanceImporter::_importCSV()
+	{
+		std::ifstream file(m_FileName.c_str());
+		if (!file.is_open())
+			OSGV_EXCEPT(std::string("InstanceImporter::_importCSV - Failed to open file:" + m_FileName).c_str());
+
+		std::string line;
+		unsigned int line_number = 0;
+		unsigned int num_skipped = 0;
+		unsigned int num_malformed = 0;
+		while (std::getline(file, line))
+		{
+			line_number++;
+			const size_t start = line.find_first_not_of(" \t\r");
+			if (start == std::string::npos)
+				continue;
+			const char c = line[start];
+			//skip comments and header lines
+			if (!(isdigit(static_cast<unsigned char>(c)) || c == '-' || c == '+' || c == '.'))
+				continue;
+			for (size_t i = start; i < line.size(); i++)
+			{
+				if (line[i] == ',' || line[i] == ';')
+					line[i] = ' ';
+			}
+
+			double values[6] = {0, 0, 0, 0, 0, 0};
+			int num_values = 0;
+			const char* ptr = line.c_str() + start;
+			while (num_values < 6)
+			{
+				char* end = NULL;
+				const double value = strtod(ptr, &end);
+				if (end == ptr)
+					break;
+				values[num_values++] = value;
+				ptr = end;
+			}
+			//truncated lines don't abort the import
+			if (num_values < 3)
+			{
+				if (num_malformed == 0)
+					std::cout << "InstanceImporter - Warning: Skipping malformed record at line " << line_number << " in " << m_FileName << "\n";
+				num_malformed++;
+				continue;
+			}
+
+			//species is matched against BillboardLayer::ImportSpecies (int), reject values that can't be represented
+			const double species = values[5];
+			if (!(species >= 0 && species <= INT_MAX) || floor(species) != species)
+			{
+				if (num_skipped == 0)
+					std::cout << "InstanceImporter - Warning: Skipping record with invalid species at line " << line_number << " in " << m_FileName << "\n";
+				num_skipped++;
+				continue;
+			}
+
+			ImportedInstance record;
+			record.X = values[0];
+			record.Y = values[1];
+			record.Z = static_cast<float>(values[2]);
+			record.Height = static_cast<float>(values[3]);
+			record.Width = static_cast<float>(values[4]);
+			record.Species = static_cast<unsigned int>(species);
+			_addRecord(record);
+		}
+		if (num_malformed > 0)
+			std::cout << "InstanceImporter - Warning: Skipped " << num_malformed << " malformed records in " << m_FileName << "\n";
+		if (num_skipped > 0)
+			std::cout << "InstanceImporter - Warning: Skipped " << num_skipped << " records with invalid species in " << m_FileName << "\n";
+	}
+
+	void InstanceImporter::_importBinary()
+	{
+		osg::ref_ptr<MemoryMappedFile> file = new MemoryMappedFile;
+		if (!file->open(m_FileName))
+			OSGV_EXCEPT(std::string("InstanceImporter::_importBinary - Failed to map file:" + m_FileName).c_str());
+		if (file->getSize() % sizeof(ImportedInstance) != 0)
+			OSGV_EXCEPT(std::string("InstanceImporter::_importBinary - File size is not a multiple of record size:" + m_FileName).c_str());
+
+		//pages are touched sequentially and can be released by the OS after use
+		const size_t num_records = file->getSize() / sizeof(ImportedInstance);
+		const unsigned char* data = file->getData();
+		for (size_t i = 0; i < num_records; i++)
+		{
+			ImportedInstance record;
+			memcpy(&record, data + i * sizeof(ImportedInstance), sizeof(ImportedInstance));
+			_addRecord(record);
+		}
+	}
+
+	InstanceImporter::BucketKey InstanceImporter::_getBucketKey(double x, double y) const
+	{
+		return BucketKey(static_cast<int>(floor(x / m_BucketSize)), static_cast<int>(floor(y / m_BucketSize)));
+	}
+
+	void InstanceImporter::_addRecord(const ImportedInstance &record)
+	{
+		const BucketKey key = _getBucketKey(record.X, record.Y);
+		std::map<BucketKey, Bucket>::iterator iter = m_Buckets.find(key);
+		if (iter == m_Buckets.end())
+		{
+			std::stringstream ss;
+			ss << m_SpillDirectory << "/bucket_X" << key.first << "_Y" << key.second << ".bin";
+			Bucket bucket;
+			bucket.FileName = ss.str();
+			//remove spill file from previous runs
+			remove(bucket.FileName.c_str());
+			iter = m_Buckets.insert(std::make_pair(key, bucket)).first;
+		}
+		iter->second.Buffer.push_back(record);
+		iter->second.NumRecords++;
+		m_NumRecords++;
+		m_NumBufferedRecords++;
+
+		if (m_NumBufferedRecords * sizeof(ImportedInstance) > m_MemoryBudget)
+			_spill();
+
+		if (m_NumRecords % 10000000 == 0)
+			std::cout << "InstanceImporter - " << m_NumRecords << " records\n";
+	}
+
+	void InstanceImporter::_spill()
+	{
+		for (std::map<BucketKey, Bucket>::iterator iter = m_Buckets.begin(); iter != m_Buckets.end(); ++iter)
+		{
+			Bucket& bucket = iter->second;
+			if (bucket.Buffer.size() == 0)
+				continue;
+			FILE* file = fopen(bucket.FileName.c_str(), "ab");
+			if (file == NULL)
+				OSGV_EXCEPT(std::string("InstanceImporter::_spill - Failed to open file:" + bucket.FileName).c_str());
+			const size_t written = fwrite(&bucket.Buffer[0], sizeof(ImportedInstance), bucket.Buffer.size(), file);
+			fclose(file);
+			if (written != bucket.Buffer.size())
+				OSGV_EXCEPT(std::string("InstanceImporter::_spill - Failed to write file:" + bucket.FileName).c_str());
+			//release buffer memory
+			std::vector<ImportedInstance>().swap(bucket.Buffer);
+		}
+		m_NumBufferedRecords = 0;
+	}
+
+	const std::vector<ImportedInstance>& InstanceImporter::_loadBucket(const BucketKey &key, const Bucket &bucket)
+	{
+		m_AccessCounter++;
+		std::map<BucketKey, CacheEntry>::iterator iter = m_Cache.find(key);
+		if (iter != m_Cache.end())
+		{
+			iter->second.LastAccess = m_AccessCounter;
+			return iter->second.Records;
+		}
+
+		//evict least recently used buckets to stay inside budget
+		while (m_Cache.size() > 0 && (m_NumCachedRecords + bucket.NumRecords) * sizeof(ImportedInstance) > m_MemoryBudget)
+		{
+			std::map<BucketKey, CacheEntry>::iterator oldest = m_Cache.begin();
+			for (std::map<BucketKey, CacheEntry>::iterator c_iter = m_Cache.begin(); c_iter != m_Cache.end(); ++c_iter)
+			{
+				if (c_iter->second.LastAccess < oldest->second.LastAccess)
+					oldest = c_iter;
+			}
+			m_NumCachedRecords -= oldest->second.Records.size();
+			m_Cache.erase(oldest);
+		}
+
+		CacheEntry& entry = m_Cache[key];
+		entry.LastAccess = m_AccessCounter;
+		entry.Records.resize(bucket.NumRecords);
+		FILE* file = fopen(bucket.FileName.c_str(), "rb");
+		if (file == NULL)
+			OSGV_EXCEPT(std::string("InstanceImporter::_loadBucket - Failed to open file:" + bucket.FileName).c_str());
+		const size_t read = fread(&entry.Records[0], sizeof(ImportedInstance), entry.Records.size(), file);
+		fclose(file);
+		if (read != entry.Records.size())
+			OSGV_EXCEPT(std::string("InstanceImporter::_loadBucket - Failed to read file:" + bucket.FileName).c_str());
+		m_NumCachedRecords += entry.Records.size();
+		return entry.Records;
+	}
+
+	void InstanceImporter::query(const osg::BoundingBoxd &bb, std::vector<ImportedInstance> &instances)
+	{
+		build();
+		const BucketKey min_key = _getBucketKey(bb.xMin(), bb.yMin());
+		const BucketKey max_key = _getBucketKey(bb.xMax(), bb.yMax());
+		for (int y = min_key.second; y <= max_key.second; y++)
+		{
+			for (int x = min_key.first; x <= max_key.first; x++)
+			{
+				const BucketKey key(x, y);
+				std::map<BucketKey, Bucket>::const_iterator iter = m_Buckets.find(key);
+				if (iter == m_Buckets.end())
+					continue;
+				const std::vector<ImportedInstance>& records = _loadBucket(key, iter->second);
+				for (size_t i = 0; i < records.size(); i++)
+				{
+					const ImportedInstance& record = records[i];
+					if (record.X >= bb.xMin() && record.X < bb.xMax() && record.Y >= bb.yMin() && record.Y < bb.yMax())
+						instances.push_back(record);
+				}
+			}
+		}
+	}
+}
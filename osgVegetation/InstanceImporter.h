@@ -0,0 +1,118 @@
+#pragma once
+#include "Common.h"
+#include <osg/Referenced>
+#include <osg/BoundingBox>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace osgVegetation
+{
+	/**
+		Externally surveyed instance (ie. from LiDAR segmentation or forest inventory), terrain space.
+		Also the record layout of binary import files (32 bytes, little endian).
+	*/
+	struct ImportedInstance
+	{
+		double X;
+		double Y;
+		float Z;
+		float Height;
+		//crown width
+		float Width;
+		unsigned int Species;
+	};
+
+	/**
+		Streaming importer for surveyed instance positions, used as scatter source instead
+		of random scattering (see BillboardLayer::Import).
+		Records are streamed once from file and bucketed in a grid anchored at the world origin,
+		buckets are buffered in memory and spilled to one file per bucket when the memory budget is
+		exceeded. Queries then only read the buckets overlapping the requested tile, recently used
+		buckets are cached inside the same budget. This way the number of records is only limited
+		by disk space.
+
+		Supported files:
+		.csv/.txt: one record per line "x y z height width species", separated by comma, semicolon
+		or whitespace. Lines starting with # or a non numeric character (header) are ignored,
+		records with less than three values or a species that is not a non-negative integer are
+		skipped with a warning.
+		Any other extension: binary file of packed ImportedInstance records, memory mapped.
+	*/
+	class osgvExport InstanceImporter : public osg::Referenced
+	{
+	public:
+		/**
+			@param filename Instance file
+			@param bucket_size Bucket grid cell size in terrain units, ie. matching the layer tile size
+			@param memory_budget Max number of bytes used for record buffers and bucket cache
+		*/
+		InstanceImporter(const std::string &filename, double bucket_size, size_t memory_budget = 256*1024*1024);
+
+		const std::string& getFileName() const {return m_FileName;}
+		double getBucketSize() const {return m_BucketSize;}
+		size_t getMemoryBudget() const {return m_MemoryBudget;}
+
+		/**
+			Directory used for bucket spill files, default to import file name + "_buckets".
+			Spill files are removed when importer is destroyed.
+		*/
+		void setSpillDirectory(const std::string &path) {m_SpillDirectory = path;}
+		const std::string& getSpillDirectory() const {return m_SpillDirectory;}
+
+		/**
+			Stream import file and write bucket files, called by first query if not called before.
+			Throws if file can't be read.
+		*/
+		void build();
+		bool isBuilt() const {return m_Built;}
+
+		/**
+			Get all records inside bb (terrain space, XY only, max edges exclusive
+			so that adjacent tiles never share records)
+		*/
+		void query(const osg::BoundingBoxd &bb, std::vector<ImportedInstance> &instances);
+
+		unsigned int getNumRecords() const {return m_NumRecords;}
+		unsigned int getNumBuckets() const {return static_cast<unsigned int>(m_Buckets.size());}
+	protected:
+		virtual ~InstanceImporter();
+	private:
+		typedef std::pair<int, int> BucketKey;
+		struct Bucket
+		{
+			Bucket() : NumRecords(0) {}
+			std::string FileName;
+			unsigned int NumRecords;
+			//records not yet spilled to file, only used during build
+			std::vector<ImportedInstance> Buffer;
+		};
+
+		struct CacheEntry
+		{
+			CacheEntry() : LastAccess(0) {}
+			std::vector<ImportedInstance> Records;
+			unsigned int LastAccess;
+		};
+
+		void _importCSV();
+		void _importBinary();
+		void _addRecord(const ImportedInstance &record);
+		void _spill();
+		BucketKey _getBucketKey(double x, double y) const;
+		const std::vector<ImportedInstance>& _loadBucket(const BucketKey &key, const Bucket &bucket);
+
+		std::string m_FileName;
+		std::string m_SpillDirectory;
+		double m_BucketSize;
+		size_t m_MemoryBudget;
+		bool m_Built;
+		unsigned int m_NumRecords;
+		size_t m_NumBufferedRecords;
+		std::map<BucketKey, Bucket> m_Buckets;
+		std::map<BucketKey, CacheEntry> m_Cache;
+		size_t m_NumCachedRecords;
+		unsigned int m_AccessCounter;
+	};
+}
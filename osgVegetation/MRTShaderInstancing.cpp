@@ -13,6 +13,7 @@
 #include <osg/Texture2DArray>
 #include <osg/Multisample>
 #include <osgDB/ReadFile>
+#include <osgDB/WriteFile>
 
 namespace osgVegetation
 {
@@ -105,7 +106,7 @@ namespace osgVegetation
 		std::list<osg::PrimitiveSet*> _primitiveSets;
 	};
 
-	MRTShaderInstancing::MRTShaderInstancing(MeshData &data,const EnvironmentSettings& env_settings)
+	MRTShaderInstancing::MRTShaderInstancing(MeshData &data,const EnvironmentSettings& env_settings) : m_ExternalBuffers(false)
 	{
 		m_StateSet = _createStateSet(data,env_settings);
 	}
@@ -145,6 +146,7 @@ namespace osgVegetation
 			vertexShaderSource <<
 				"#extension GL_ARB_uniform_buffer_object : enable\n"
 				"uniform samplerBuffer dataBuffer;\n"
+				"uniform int instanceOffset;\n"
 				"varying vec2 TexCoord;\n"
 				"varying vec4 Color;\n"
 				"varying vec3 Normal;\n"
@@ -164,7 +166,7 @@ namespace osgVegetation
 
 				"void main()\n"
 				"{\n"
-				"   int instanceAddress = gl_InstanceID * 4;\n"
+				"   int instanceAddress = (instanceOffset + gl_InstanceID) * 4;\n"
 				"   vec4 v1 = texelFetch(dataBuffer, instanceAddress);\n"
 				"   vec4 v2 = texelFetch(dataBuffer, instanceAddress + 1);\n"
 				"   vec4 v3 = texelFetch(dataBuffer, instanceAddress + 2);\n"
@@ -235,6 +237,10 @@ namespace osgVegetation
 			osg::Uniform* baseTextureSampler = new osg::Uniform("baseTexture",0);
 			dstate->addUniform(baseTextureSampler);
 
+			//first instance in data buffer, overridden by geodes using shared buffers
+			osg::Uniform* instanceOffset = new osg::Uniform("instanceOffset",0);
+			dstate->addUniform(instanceOffset);
+
 
 			if (data.UseMultiSample)
 			{ 
@@ -247,50 +253,93 @@ namespace osgVegetation
 	
 	}
 
-	osg::Node* MRTShaderInstancing::create(const MeshVegetationObjectVector &trees, const std::string &mesh_name, const osg::BoundingBoxd &bb)
+	osg::Node* MRTShaderInstancing::_createInstancedNode(unsigned int num_instances, const std::string &mesh_name, const osg::BoundingBoxd &bb)
 	{
-		osg::Node* geode = 0;
-		//osg::Group* group = 0;
+		osg::Node* geode = dynamic_cast<osg::Node*>(m_MeshNodeMap[mesh_name]->clone( osg::CopyOp::DEEP_COPY_NODES | osg::CopyOp::DEEP_COPY_DRAWABLES | osg::CopyOp::DEEP_COPY_PRIMITIVES));
+		ConvertToDrawInstanced cdi(num_instances, bb, true);
+		geode->accept( cdi );
+		geode->setInitialBound(osg::BoundingBox(bb._min, bb._max));
+		osg::Uniform* dataBufferSampler = new osg::Uniform("dataBuffer",1);
+		geode->getOrCreateStateSet()->addUniform(dataBufferSampler);
+		return geode;
+	}
 
-		if(trees.size() > 0)
+	osg::Image* MRTShaderInstancing::_createInstanceImage(const MeshVegetationObjectVector &trees) const
+	{
+		osg::Image* treeParamsImage = new osg::Image;
+		treeParamsImage->allocateImage( 4*trees.size(), 1, 1, GL_RGBA, GL_FLOAT );
+		unsigned int i=0;
+		for(MeshVegetationObjectVector::const_iterator itr= trees.begin();
+			itr!= trees.end();
+			++itr,++i)
 		{
-			geode = dynamic_cast<osg::Node*>(m_MeshNodeMap[mesh_name]->clone( osg::CopyOp::DEEP_COPY_NODES | osg::CopyOp::DEEP_COPY_DRAWABLES | osg::CopyOp::DEEP_COPY_PRIMITIVES));
-			ConvertToDrawInstanced cdi(trees.size(), bb, true);
-			geode->accept( cdi );
-
-			osg::ref_ptr<osg::Image> treeParamsImage = new osg::Image;
-			treeParamsImage->allocateImage( 4*trees.size(), 1, 1, GL_RGBA, GL_FLOAT );
-			unsigned int i=0;
-			for(MeshVegetationObjectVector::const_iterator itr= trees.begin();
-				itr!= trees.end();
-				++itr,++i)
-			{
-				//generate matrix
+			//generate matrix
 
-				osg::Vec4f* ptr = (osg::Vec4f*)treeParamsImage->data(4*i);
-				MeshObject& tree = **itr;
+			osg::Vec4f* ptr = (osg::Vec4f*)treeParamsImage->data(4*i);
+			MeshObject& tree = **itr;
 
-				osg::Matrixd trans_mat;
-				trans_mat.identity();
-				trans_mat.makeTranslate(tree.Position);
-				trans_mat =  osg::Matrixd::rotate(tree.Rotation) * osg::Matrixd::scale(tree.Width, tree.Width, tree.Height)* trans_mat;
-				double* m = trans_mat.ptr();
+			osg::Matrixd trans_mat;
+			trans_mat.identity();
+			trans_mat.makeTranslate(tree.Position);
+			trans_mat =  osg::Matrixd::rotate(tree.Rotation) * osg::Matrixd::scale(tree.Width, tree.Width, tree.Height)* trans_mat;
+			double* m = trans_mat.ptr();
 
-				ptr[0] = osg::Vec4f(m[0],m[1],m[2],tree.Color.r());
-				ptr[1] = osg::Vec4f(m[4],m[5],m[6],tree.Color.g());
-				ptr[2] = osg::Vec4f(m[8],m[9],m[10],tree.Color.b());
-				ptr[3] = osg::Vec4f(m[12],m[13],m[14],1.0);
-			}
+			ptr[0] = osg::Vec4f(m[0],m[1],m[2],tree.Color.r());
+			ptr[1] = osg::Vec4f(m[4],m[5],m[6],tree.Color.g());
+			ptr[2] = osg::Vec4f(m[8],m[9],m[10],tree.Color.b());
+			ptr[3] = osg::Vec4f(m[12],m[13],m[14],1.0);
+		}
+		return treeParamsImage;
+	}
+
+	osg::Node* MRTShaderInstancing::create(const MeshVegetationObjectVector &trees, const std::string &mesh_name, const osg::BoundingBoxd &bb)
+	{
+		osg::Node* geode = 0;
+		if(trees.size() > 0)
+		{
+			geode = _createInstancedNode(trees.size(), mesh_name, bb);
 			osg::ref_ptr<osg::TextureBuffer> tbo = new osg::TextureBuffer;
-			tbo->setImage( treeParamsImage.get() );
+			tbo->setImage(_createInstanceImage(trees));
 			tbo->setInternalFormat(GL_RGBA32F_ARB);
 			geode->getOrCreateStateSet()->setTextureAttribute(1, tbo.get(),osg::StateAttribute::ON);
+		}
+		return geode;
+	}
+
+	osg::TextureBuffer* MRTShaderInstancing::_getSharedTextureBuffer(MeshInstanceBuffer &buffer)
+	{
+		osg::TextureBuffer* tbo = dynamic_cast<osg::TextureBuffer*>(buffer.getRenderData());
+		if(tbo)
+			return tbo;
 
-			geode->setInitialBound(osg::BoundingBox(bb._min, bb._max));
-			osg::Uniform* dataBufferSampler = new osg::Uniform("dataBuffer",1);
-			geode->getOrCreateStateSet()->addUniform(dataBufferSampler);
+		osg::ref_ptr<osg::Image> image = _createInstanceImage(buffer.getInstances());
+		if(m_ExternalBuffers)
+		{
+			//write once, tile files only hold the file name
+			const std::string filename = m_FilenamePrefix + "instances_" + buffer.getName() + ".osgb";
+			image->setFileName(filename);
+			image->setWriteHint(osg::Image::EXTERNAL_FILE);
+			if(!osgDB::writeImageFile(*image, m_SavePath + filename))
+				OSGV_EXCEPT(std::string("MRTShaderInstancing::_getSharedTextureBuffer - Failed to write file:" + m_SavePath + filename).c_str());
+		}
+		tbo = new osg::TextureBuffer;
+		tbo->setImage(image.get());
+		tbo->setInternalFormat(GL_RGBA32F_ARB);
+		buffer.setRenderData(tbo);
+		return tbo;
+	}
+
+	osg::Node* MRTShaderInstancing::create(MeshInstanceBuffer &buffer, unsigned int first, unsigned int count, const std::string &mesh_name, const osg::BoundingBoxd &bb)
+	{
+		osg::Node* geode = 0;
+		if(count > 0)
+		{
+			geode = _createInstancedNode(count, mesh_name, bb);
+			geode->getOrCreateStateSet()->setTextureAttribute(1, _getSharedTextureBuffer(buffer),osg::StateAttribute::ON);
+			osg::Uniform* instanceOffset = new osg::Uniform("instanceOffset",static_cast<int>(first));
+			geode->getOrCreateStateSet()->addUniform(instanceOffset);
 		}
 		return geode;
 	}
 
-}
+}
\ No newline at end of file
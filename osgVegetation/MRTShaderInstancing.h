@@ -2,6 +2,7 @@
 #include "Common.h"
 #include <osg/StateSet>
 #include <osg/Geometry>
+#include <osg/TextureBuffer>
 #include "IMeshRenderingTech.h"
 #include "MeshData.h"
 #include "EnvironmentSettings.h"
@@ -14,11 +15,26 @@ namespace osgVegetation
 	public:
 		MRTShaderInstancing(MeshData &data, const EnvironmentSettings& env_settings);
 		osg::Node* create(const MeshVegetationObjectVector &trees, const std::string &mesh_name, const osg::BoundingBoxd &bb);
+		osg::Node* create(MeshInstanceBuffer &buffer, unsigned int first, unsigned int count, const std::string &mesh_name, const osg::BoundingBoxd &bb);
 		osg::StateSet* getStateSet() const {return m_StateSet;}
+
+		/**
+			Save shared instance buffers as external image files, tile files written
+			separately (paged lod) then only reference the file instead of holding a copy.
+			@param save_path Path with trailing slash
+			@param prefix Added to file names
+		*/
+		void setExternalBufferPath(const std::string &save_path, const std::string &prefix) {m_ExternalBuffers = true; m_SavePath = save_path; m_FilenamePrefix = prefix;}
 	protected:
 		osg::StateSet* _createStateSet(MeshData &data,const EnvironmentSettings& env_settings);
+		osg::Node* _createInstancedNode(unsigned int num_instances, const std::string &mesh_name, const osg::BoundingBoxd &bb);
+		osg::Image* _createInstanceImage(const MeshVegetationObjectVector &trees) const;
+		osg::TextureBuffer* _getSharedTextureBuffer(MeshInstanceBuffer &buffer);
 		osg::StateSet* m_StateSet; 
 		std::map<std::string, osg::ref_ptr<osg::Node>  > m_MeshNodeMap;
 		std::vector<osg::Geometry*> m_Geometries;
+		bool m_ExternalBuffers;
+		std::string m_SavePath;
+		std::string m_FilenamePrefix;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,50 @@
+#include "MemoizedTerrainQuery.h"
+#include <cmath>
+#include <iostream>
+
+namespace osgVegetation
+{
+	MemoizedTerrainQuery::MemoizedTerrainQuery(ITerrainQuery* tq, double tolerance) : m_TerrainQuery(tq),
+		m_Tolerance(tolerance),
+		m_MaxSamples(1000000),
+		m_NumQueries(0),
+		m_NumHits(0)
+	{
+		if (tq == NULL)
+			OSGV_EXCEPT(std::string("MemoizedTerrainQuery::MemoizedTerrainQuery - Terrain query is NULL").c_str());
+		if (tolerance <= 0)
+			OSGV_EXCEPT(std::string("MemoizedTerrainQuery::MemoizedTerrainQuery - Tolerance must be larger than zero").c_str());
+	}
+
+	bool MemoizedTerrainQuery::getTerrainData(osg::Vec3d& location, osg::Vec4 &color, std::string &coverage_name, CoverageColor &coverage_color, osg::Vec3d &inter)
+	{
+		m_NumQueries++;
+		const SampleKey key(static_cast<long long>(floor(location.x() / m_Tolerance)),
+			static_cast<long long>(floor(location.y() / m_Tolerance)));
+		SampleMap::iterator iter = m_Samples.find(key);
+		if (iter == m_Samples.end())
+		{
+			if (m_Samples.size() >= m_MaxSamples)
+			{
+				std::cout << "MemoizedTerrainQuery - Sample cache cleared\n";
+				m_Samples.clear();
+			}
+			Sample sample;
+			osg::Vec3d sample_inter;
+			sample.Valid = m_TerrainQuery->getTerrainData(location, sample.Color, sample.CoverageName, sample.Coverage, sample_inter);
+			sample.Height = sample_inter.z();
+			iter = m_Samples.insert(std::make_pair(key, sample)).first;
+		}
+		else
+			m_NumHits++;
+
+		const Sample& sample = iter->second;
+		if (!sample.Valid)
+			return false;
+		color = sample.Color;
+		coverage_name = sample.CoverageName;
+		coverage_color = sample.Coverage;
+		inter.set(location.x(), location.y(), sample.Height);
+		return true;
+	}
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include "Common.h"
+#include <osg/ref_ptr>
+#include <osg/Vec3d>
+#include <osg/Vec4>
+#include <map>
+#include <string>
+#include "ITerrainQuery.h"
+#include "CoverageColor.h"
+
+namespace osgVegetation
+{
+	/**
+		Terrain query wrapper that memoise answers of another terrain query.
+		Locations are quantised to a XY grid with cell size equal to the tolerance, a query
+		inside a cell that already has been sampled return the cached answer (the returned
+		intersection keep the queried XY and use cached height). Share one instance between
+		scatterers working on the same region to avoid repeated terrain intersections.
+		Note that ground resolution hints are forwarded but not part of the cache key.
+	*/
+	class osgvExport MemoizedTerrainQuery : public ITerrainQuery
+	{
+	public:
+		/**
+			@param tq Terrain query to memoise
+			@param tolerance Quantisation cell size in terrain units
+		*/
+		MemoizedTerrainQuery(ITerrainQuery* tq, double tolerance);
+
+		//ITerrainQuery interface
+		bool getTerrainData(osg::Vec3d& location, osg::Vec4 &color, std::string &coverage_name, CoverageColor &coverage_color, osg::Vec3d &inter);
+		void prefetch(const osg::BoundingBoxd &bb) {m_TerrainQuery->prefetch(bb);}
+		void setGroundResolution(double resolution) {m_TerrainQuery->setGroundResolution(resolution);}
+		bool refineHeight(osg::Vec3d &position) {return m_TerrainQuery->refineHeight(position);}
+		bool getCoverage(const osg::Vec3d &location, std::string &coverage_name) {return m_TerrainQuery->getCoverage(location, coverage_name);}
+		bool getTerrainNormal(const osg::Vec3d &location, double step, osg::Vec3d &normal) {return m_TerrainQuery->getTerrainNormal(location, step, normal);}
+	public:
+		/**
+			Set max number of cached samples, the cache is cleared when the limit is reached.
+			Default to 1000000.
+		*/
+		void setMaxSamples(unsigned int value) {m_MaxSamples=value;}
+		unsigned int getMaxSamples() const {return m_MaxSamples;}
+
+		double getTolerance() const {return m_Tolerance;}
+
+		/**
+			Number of queries since construction or last statistics reset
+		*/
+		unsigned int getNumQueries() const {return m_NumQueries;}
+
+		/**
+			Number of queries answered from cache
+		*/
+		unsigned int getNumHits() const {return m_NumHits;}
+
+		/**
+			Get ratio of queries answered from cache (0-1)
+		*/
+		double getHitRate() const {return m_NumQueries > 0 ? static_cast<double>(m_NumHits) / static_cast<double>(m_NumQueries) : 0.0;}
+
+		void resetStatistics() {m_NumQueries = 0; m_NumHits = 0;}
+
+		/**
+			Remove all cached samples
+		*/
+		void clear() {m_Samples.clear();}
+	private:
+		struct Sample
+		{
+			Sample() : Valid(false), Height(0) {}
+			bool Valid;
+			osg::Vec4 Color;
+			std::string CoverageName;
+			CoverageColor Coverage;
+			double Height;
+		};
+		typedef std::pair<long long, long long> SampleKey;
+		typedef std::map<SampleKey, Sample> SampleMap;
+		SampleMap m_Samples;
+		osg::ref_ptr<ITerrainQuery> m_TerrainQuery;
+		double m_Tolerance;
+		unsigned int m_MaxSamples;
+		unsigned int m_NumQueries;
+		unsigned int m_NumHits;
+	};
+}
@@ -0,0 +1,98 @@
+#include "MemoryMappedFile.h"
+#if defined ( WIN32 )
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+namespace osgVegetation
+{
+	MemoryMappedFile::MemoryMappedFile() : m_Data(NULL),
+		m_Size(0)
+#if defined ( WIN32 )
+		, m_FileHandle(NULL),
+		m_MappingHandle(NULL)
+#endif
+	{
+
+	}
+
+	MemoryMappedFile::~MemoryMappedFile()
+	{
+		close();
+	}
+
+	bool MemoryMappedFile::open(const std::string &filename)
+	{
+		close();
+#if defined ( WIN32 )
+		HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+		{
+			CloseHandle(file);
+			return false;
+		}
+		HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping == NULL)
+		{
+			CloseHandle(file);
+			return false;
+		}
+		void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (data == NULL)
+		{
+			CloseHandle(mapping);
+			CloseHandle(file);
+			return false;
+		}
+		m_FileHandle = file;
+		m_MappingHandle = mapping;
+		m_Size = static_cast<size_t>(size.QuadPart);
+		m_Data = static_cast<const unsigned char*>(data);
+#else
+		const int fd = ::open(filename.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0)
+		{
+			::close(fd);
+			return false;
+		}
+		void* data = mmap(NULL, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+		//the mapping stays valid after the descriptor is closed
+		::close(fd);
+		if (data == MAP_FAILED)
+			return false;
+		m_Size = static_cast<size_t>(st.st_size);
+		m_Data = static_cast<const unsigned char*>(data);
+#endif
+		m_FileName = filename;
+		return true;
+	}
+
+	void MemoryMappedFile::close()
+	{
+		if (m_Data == NULL)
+			return;
+#if defined ( WIN32 )
+		UnmapViewOfFile(m_Data);
+		CloseHandle(m_MappingHandle);
+		CloseHandle(m_FileHandle);
+		m_FileHandle = NULL;
+		m_MappingHandle = NULL;
+#else
+		munmap(const_cast<unsigned char*>(m_Data), m_Size);
+#endif
+		m_Data = NULL;
+		m_Size = 0;
+		m_FileName = "";
+	}
+}
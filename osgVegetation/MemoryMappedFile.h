@@ -0,0 +1,50 @@
+#pragma once
+#include "Common.h"
+#include <osg/Referenced>
+#include <string>
+
+namespace osgVegetation
+{
+	/**
+		Read only memory mapped file. Pages are loaded lazily by the OS when touched
+		which makes it possible to work with files larger than available memory.
+	*/
+	class osgvExport MemoryMappedFile : public osg::Referenced
+	{
+	public:
+		MemoryMappedFile();
+
+		/**
+			Map file, any previous mapping is released.
+			@return false if file could not be opened or mapped
+		*/
+		bool open(const std::string &filename);
+
+		/**
+			Release mapping
+		*/
+		void close();
+
+		bool isOpen() const {return m_Data != NULL;}
+
+		const unsigned char* getData() const {return m_Data;}
+
+		size_t getSize() const {return m_Size;}
+
+		const std::string& getFileName() const {return m_FileName;}
+	protected:
+		virtual ~MemoryMappedFile();
+	private:
+		//not copyable
+		MemoryMappedFile(const MemoryMappedFile&);
+		MemoryMappedFile& operator=(const MemoryMappedFile&);
+
+		const unsigned char* m_Data;
+		size_t m_Size;
+		std::string m_FileName;
+#if defined ( WIN32 )
+		void* m_FileHandle;
+		void* m_MappingHandle;
+#endif
+	};
+}
@@ -11,7 +11,8 @@ namespace osgVegetation
 	struct MeshData
 	{
 		MeshData() : ReceiveShadows(false),
-			UseMultiSample(false)
+			UseMultiSample(false),
+			ImpostorTextureSize(256)
 		{
 
 		}
@@ -26,6 +27,11 @@ namespace osgVegetation
 		*/
 		bool UseMultiSample;
 
+		/**
+			Size of baked impostor textures, see MeshLayer::ImpostorDistance
+		*/
+		unsigned int ImpostorTextureSize;
+
 
 		/**
 			The mesh layer collection
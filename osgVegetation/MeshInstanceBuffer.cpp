@@ -0,0 +1,111 @@
+#include "MeshInstanceBuffer.h"
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace osgVegetation
+{
+	MeshInstanceBuffer::MeshInstanceBuffer(const std::string &name, const osg::BoundingBoxd &bb, int level, int depth, MeshVegetationObjectVector &instances) : m_Name(name),
+		m_BB(bb),
+		m_Level(level),
+		m_Depth(depth)
+	{
+		if(depth < 0 || depth > MAX_DEPTH)
+			OSGV_EXCEPT(std::string("MeshInstanceBuffer::MeshInstanceBuffer - Invalid depth for buffer:" + name).c_str());
+
+		const unsigned int num_cells = 1u << depth;
+		const double cell_size_x = (bb.xMax() - bb.xMin()) / static_cast<double>(num_cells);
+		const double cell_size_y = (bb.yMax() - bb.yMin()) / static_cast<double>(num_cells);
+		const unsigned int num_sub_cells = 1u << MAX_DEPTH;
+		std::vector<std::pair<std::pair<unsigned int, unsigned int>, unsigned int> > sort_keys(instances.size());
+		for(size_t i = 0; i < instances.size(); i++)
+		{
+			const osg::Vec3d position = instances[i]->Position;
+			const unsigned int x = _getCell(position.x(), bb.xMin(), cell_size_x, num_cells);
+			const unsigned int y = _getCell(position.y(), bb.yMin(), cell_size_y, num_cells);
+			const unsigned int sub_x = _getCell(position.x(), bb.xMin() + x * cell_size_x, cell_size_x / num_sub_cells, num_sub_cells);
+			const unsigned int sub_y = _getCell(position.y(), bb.yMin() + y * cell_size_y, cell_size_y / num_sub_cells, num_sub_cells);
+			sort_keys[i] = std::make_pair(std::make_pair(_interleave(x, y), _interleave(sub_x, sub_y)), static_cast<unsigned int>(i));
+		}
+		//index is part of key, keep populate order inside sub cells
+		std::sort(sort_keys.begin(), sort_keys.end());
+
+		m_Instances.resize(instances.size());
+		m_Keys.resize(instances.size());
+		m_SubKeys.resize(instances.size());
+		for(size_t i = 0; i < sort_keys.size(); i++)
+		{
+			m_Keys[i] = sort_keys[i].first.first;
+			m_SubKeys[i] = sort_keys[i].first.second;
+			m_Instances[i] = instances[sort_keys[i].second];
+		}
+		instances.clear();
+	}
+
+	unsigned int MeshInstanceBuffer::_getCell(double value, double min_value, double cell_size, unsigned int num_cells) const
+	{
+		if(cell_size <= 0)
+			return 0;
+		const double cell = floor((value - min_value) / cell_size);
+		//instances on max edge belong to last cell
+		if(cell < 0)
+			return 0;
+		if(cell >= num_cells)
+			return num_cells - 1;
+		return static_cast<unsigned int>(cell);
+	}
+
+	unsigned int MeshInstanceBuffer::_interleave(unsigned int x, unsigned int y)
+	{
+		unsigned int key = 0;
+		for(unsigned int i = 0; i < MAX_DEPTH; i++)
+		{
+			key |= ((x >> i) & 1u) << (2 * i);
+			key |= ((y >> i) & 1u) << (2 * i + 1);
+		}
+		return key;
+	}
+
+	void MeshInstanceBuffer::getRange(int level, const osg::BoundingBoxd &tile_bb, unsigned int &first, unsigned int &count) const
+	{
+		const int rel_level = level - m_Level;
+		if(rel_level < 0 || rel_level > m_Depth + MAX_DEPTH)
+			OSGV_EXCEPT(std::string("MeshInstanceBuffer::getRange - Level outside subtree of buffer:" + m_Name).c_str());
+
+		//tile cell at its own level, or the cell at full depth containing the tile,
+		//located by center to be robust to rounding
+		const int cell_level = std::min(rel_level, m_Depth);
+		const unsigned int num_cells = 1u << cell_level;
+		const double cell_size_x = (m_BB.xMax() - m_BB.xMin()) / static_cast<double>(num_cells);
+		const double cell_size_y = (m_BB.yMax() - m_BB.yMin()) / static_cast<double>(num_cells);
+		const osg::Vec3d center = tile_bb.center();
+		const unsigned int x = _getCell(center.x(), m_BB.xMin(), cell_size_x, num_cells);
+		const unsigned int y = _getCell(center.y(), m_BB.yMin(), cell_size_y, num_cells);
+
+		//all keys at full depth with tile key as prefix
+		const unsigned int shift = 2 * static_cast<unsigned int>(m_Depth - cell_level);
+		const unsigned int min_key = _interleave(x, y) << shift;
+		const unsigned int max_key = min_key + ((1u << shift) - 1u);
+		const std::vector<unsigned int>::const_iterator lower = std::lower_bound(m_Keys.begin(), m_Keys.end(), min_key);
+		const std::vector<unsigned int>::const_iterator upper = std::upper_bound(lower, m_Keys.end(), max_key);
+		first = static_cast<unsigned int>(lower - m_Keys.begin());
+		count = static_cast<unsigned int>(upper - lower);
+
+		if(rel_level > m_Depth)
+		{
+			//tile is smaller than the cell, narrow cell range to the sub cells inside the tile
+			const int sub_level = rel_level - m_Depth;
+			const unsigned int num_sub_cells = 1u << sub_level;
+			const unsigned int sub_x = _getCell(center.x(), m_BB.xMin() + x * cell_size_x, cell_size_x / num_sub_cells, num_sub_cells);
+			const unsigned int sub_y = _getCell(center.y(), m_BB.yMin() + y * cell_size_y, cell_size_y / num_sub_cells, num_sub_cells);
+			const unsigned int sub_shift = 2 * static_cast<unsigned int>(MAX_DEPTH - sub_level);
+			const unsigned int min_sub_key = _interleave(sub_x, sub_y) << sub_shift;
+			const unsigned int max_sub_key = min_sub_key + ((1u << sub_shift) - 1u);
+			const std::vector<unsigned int>::const_iterator sub_begin = m_SubKeys.begin() + first;
+			const std::vector<unsigned int>::const_iterator sub_lower = std::lower_bound(sub_begin, sub_begin + count, min_sub_key);
+			const std::vector<unsigned int>::const_iterator sub_upper = std::upper_bound(sub_lower, sub_begin + count, max_sub_key);
+			first = static_cast<unsigned int>(sub_lower - m_SubKeys.begin());
+			count = static_cast<unsigned int>(sub_upper - sub_lower);
+		}
+	}
+}
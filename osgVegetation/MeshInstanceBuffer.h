@@ -0,0 +1,69 @@
+#pragma once
+#include "Common.h"
+#include <osg/Referenced>
+#include <osg/BoundingBox>
+#include <osg/ref_ptr>
+#include <string>
+#include <vector>
+#include "MeshObject.h"
+
+namespace osgVegetation
+{
+	/**
+		Instances of one mesh layer populated in a quad tree tile, shared by all mesh LOD tiles
+		in the subtree below that tile. Instances are sorted by Morton (Z-order) key of their
+		cell in the subtree, which makes the instances of every descendant tile a contiguous
+		index range, i.e. descendant tiles only store first index and count instead of a copy.
+		Instances inside a cell at full depth are sorted by a second Morton key of their
+		sub cell, so tiles below the buffer depth are also contiguous ranges.
+	*/
+	class osgvExport MeshInstanceBuffer : public osg::Referenced
+	{
+	public:
+		/**
+			Max subtree depth, keys are 2*depth bits
+		*/
+		enum {MAX_DEPTH = 15};
+
+		/**
+			@param name Unique name, used for shared render data files
+			@param bb Bounding box of populated tile
+			@param level Quad tree level of populated tile
+			@param depth Number of levels below populated tile where ranges are requested
+			@param instances Instances inside bb, moved into this buffer (vector is cleared)
+		*/
+		MeshInstanceBuffer(const std::string &name, const osg::BoundingBoxd &bb, int level, int depth, MeshVegetationObjectVector &instances);
+
+		const std::string& getName() const {return m_Name;}
+		const MeshVegetationObjectVector& getInstances() const {return m_Instances;}
+		int getLevel() const {return m_Level;}
+		int getDepth() const {return m_Depth;}
+
+		/**
+			Get index range of instances inside tile, tile must be inside the subtree.
+			Tiles more than depth levels below populated tile are located inside their cell at
+			full depth by the sub cell key, at most MAX_DEPTH levels further down.
+		*/
+		void getRange(int level, const osg::BoundingBoxd &tile_bb, unsigned int &first, unsigned int &count) const;
+
+		/**
+			Render technique data shared by all ranges (ie. texture buffer)
+		*/
+		osg::Referenced* getRenderData() const {return m_RenderData.get();}
+		void setRenderData(osg::Referenced* data) {m_RenderData = data;}
+	protected:
+		virtual ~MeshInstanceBuffer() {}
+	private:
+		unsigned int _getCell(double value, double min_value, double cell_size, unsigned int num_cells) const;
+		static unsigned int _interleave(unsigned int x, unsigned int y);
+		std::string m_Name;
+		osg::BoundingBoxd m_BB;
+		int m_Level;
+		int m_Depth;
+		MeshVegetationObjectVector m_Instances;
+		std::vector<unsigned int> m_Keys;
+		//key of sub cell inside the cell at full depth, MAX_DEPTH levels
+		std::vector<unsigned int> m_SubKeys;
+		osg::ref_ptr<osg::Referenced> m_RenderData;
+	};
+}
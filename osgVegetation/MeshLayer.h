@@ -1,7 +1,11 @@
 #pragma once
 #include "Common.h"
 #include "MeshObject.h"
+#include "VectorMask.h"
+#include "PlacementRule.h"
+#include "MeshInstanceBuffer.h"
 #include <osg/Vec2>
+#include <osg/ref_ptr>
 
 namespace osgVegetation
 {
@@ -32,7 +36,9 @@ namespace osgVegetation
 	*/
 	struct MeshLayer
 	{
-		MeshLayer(const MeshLODVector &mesh_lods) : MeshLODs(mesh_lods)
+		MeshLayer(const MeshLODVector &mesh_lods) : MeshLODs(mesh_lods),
+			ImpostorDistance(0),
+			_ImpostorQTLevel(-1)
 		{
 
 		}
@@ -77,6 +83,38 @@ namespace osgVegetation
 		*/
 		std::vector<std::string> CoverageMaterials;
 
+		/**
+			Optional vector mask, no models are placed inside mask shapes
+		*/
+		osg::ref_ptr<VectorMask> ExclusionMask;
+
+		/**
+			Optional vector mask, models are only placed inside mask shapes
+		*/
+		osg::ref_ptr<VectorMask> InclusionMask;
+
+		/**
+			Optional placement rule that modulate density, see PlacementRule
+		*/
+		osg::ref_ptr<PlacementRule> Rule;
+
+		/**
+			Max distance for billboard impostors of the same instances, drawn beyond the first
+			(longest distance) mesh LOD. Zero (default) disable impostors. Instances are then
+			populated at the impostor level to keep positions consistent between stages.
+			Impostors use the quad tree level above the first mesh LOD if both distances give the
+			same level, mesh LOD levels are never changed. If the first mesh LOD already use the
+			root level (ie. global tiling root size below the mesh distance) impostors are disabled
+			with a warning.
+		*/
+		double ImpostorDistance;
+
+		/**
+			Optional pre-baked impostor texture, must have same size as MeshData::ImpostorTextureSize.
+			If empty the first mesh LOD is baked by ImpostorBaker when generation starts.
+		*/
+		std::string ImpostorTexture;
+
 		/**
 			Helper function to check is this layer hold coverage material
 		*/
@@ -94,6 +132,16 @@ namespace osgVegetation
 			Internal data used during scattering
 		*/
 		MeshVegetationObjectVector _Instances;
+
+		/*
+			Internal data holding the quad tree level where impostors start (-1 if none)
+		*/
+		int _ImpostorQTLevel;
+
+		/*
+			Internal data, instances of current subtree shared by all mesh LOD tiles
+		*/
+		osg::ref_ptr<MeshInstanceBuffer> _InstanceBuffer;
 	};
 
 	typedef std::vector<MeshLayer> MeshLayerVector;
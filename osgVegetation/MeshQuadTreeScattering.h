@@ -4,10 +4,12 @@
 #include <osg/Referenced>
 #include <osg/Node>
 #include <osg/ref_ptr>
-#include "IMeshRenderingTech.h"
 #include "MeshLayer.h"
 #include "MeshData.h"
+#include "MeshScatterPolicies.h"
 #include "EnvironmentSettings.h"
+#include "QuadTreeScatterer.h"
+#include "VectorMask.h"
 
 namespace osgVegetation
 {
@@ -18,7 +20,8 @@ namespace osgVegetation
 		structure based on the osg::LOD node. The start tile use the supplied
 		bounding box which is then recursively divided into four new tiles until
 		the cutoff tile size is reached. The cutoff tile size i calculated based
-		on the shortest vegetation layer distance.
+		on the shortest vegetation layer distance. The quad tree walk is done by
+		QuadTreeScatterer using the mesh policies.
 	*/
 	class osgvExport MeshQuadTreeScattering : public osg::Referenced
 	{
@@ -36,32 +39,72 @@ namespace osgVegetation
 			@param filename_prefix Added to all files (only relevant if out_put_file is defined)
 			*/
 		osg::Node* generate(const osg::BoundingBoxd &bb, MeshData &data, const std::string &output_file = "", bool use_paged_lod = false, const std::string &filename_prefix = "");
-	private:
-		int m_FinalLOD;
 
-		//data used for progress report
-		int m_CurrentTile;
-		int m_NumberOfTiles;
+		/**
+			Restrict generation to polygon area of interest (terrain space), ie. a rail line or river valley.
+			The area is covered by a forest of quad tree roots sized by the coarsest layer and tiles not
+			overlapping the area are clipped, i.e build time scale with the area instead of its bounding square.
+			NULL (default) use a single root covering the bounding box.
+		*/
+		void setAreaOfInterest(VectorMask* aoi) {m_Scatterer.setAreaOfInterest(aoi);}
+		VectorMask* getAreaOfInterest() const {return m_Scatterer.getAreaOfInterest();}
+
+		/**
+			Use world anchored tiling, ie. tile keys are fixed addresses in a global grid
+			instead of being relative to the bounding box. Root tiles are aligned to multiples
+			of root_size and generated completely, with own offset and file name, so regions built
+			separately share tile boundaries. Each layer tile is seeded from seed and the tile key.
+			@param root_size Size of level zero tiles, zero (default) disable global tiling
+			@param min_z Minimum terrain height of the whole world database
+			@param max_z Maximum terrain height of the whole world database
+			@param seed Base random seed
+		*/
+		void setGlobalTiling(double root_size, double min_z, double max_z, unsigned int seed = 0) {m_Scatterer.setGlobalTiling(root_size, min_z, max_z, seed);}
+		double getGlobalTileSize() const {return m_Scatterer.getGlobalTileSize();}
+
+		/**
+			Start incremental generation, ie. for interactive editing where generation is spread
+			over frames. Arguments as generate, data must stay valid until generation is finished
+			or cancelled. Any running generation is cancelled.
+		*/
+		void begin(const osg::BoundingBoxd &bb, MeshData &data, const std::string &output_file = "", bool use_paged_lod = false, const std::string &filename_prefix = "") {m_Scatterer.begin(bb, data, output_file, use_paged_lod, filename_prefix);}
 
-		//Area bounding box
-		osg::BoundingBoxd m_InitBB;
+		/**
+			Process tiles until time budget (milliseconds) is used, ie. step(2.0) each frame.
+			The budget is checked between tiles only, see QuadTreeScatterer::step.
+			@return true when generation is finished, result is then available from getResult
+		*/
+		bool step(double time_budget_ms) {return m_Scatterer.step(time_budget_ms);}
 
-		IMeshRenderingTech* m_MRT;
-		osg::Vec3d m_Offset;
-		ITerrainQuery* m_TerrainQuery;
+		void cancel() {m_Scatterer.cancel();}
+		bool isGenerating() const {return m_Scatterer.isGenerating();}
+		float getProgress() const {return m_Scatterer.getProgress();}
+		osg::Node* getResult() const {return m_Scatterer.getResult();}
 
-		bool m_UsePagedLOD;
+		/**
+			Set callback for progress and finished tiles, NULL (default) print progress to console
+		*/
+		void setCallback(ScatterCallback* callback) {m_Scatterer.setCallback(callback);}
+		ScatterCallback* getCallback() const {return m_Scatterer.getCallback();}
 
-		//Output stuff
-		std::string m_SavePath;
-		std::string m_FilenamePrefix;
-		std::string m_SaveExt;
+		/**
+			Report all scattered instances to sink, ie. VegetationBVHWriter for simulation queries.
+			layer_base is added to layer indices so that several generations can share one sink.
+			NULL (default) disable.
+		*/
+		void setInstanceSink(ScatterInstanceSink* sink, unsigned int layer_base = 0) {m_Scatterer.setInstanceSink(sink, layer_base);}
+		ScatterInstanceSink* getInstanceSink() const {return m_Scatterer.getInstanceSink();}
 
-		EnvironmentSettings m_EnvSettings;
+		/**
+			Create state set for generated mesh nodes, ie. for tiles from ScatterCallback::tileFinished
+		*/
+		osg::StateSet* createStateSet() const {return m_Scatterer.createStateSet();}
 
-		//Helpers
-		std::string _createFileName(unsigned int lv, unsigned int x, unsigned int y) const;
-		void _populateVegetationTile(MeshLayer& layer,const osg::BoundingBoxd &box);
-		osg::Node* _createLODRec(int ld, MeshData &data, MeshVegetationObjectVector trees, const osg::BoundingBoxd &box ,int x, int y);
+		/**
+			Options for loading saved paged databases, see MeshRenderPolicy::createDatabaseOptions
+		*/
+		static osgDB::Options* createDatabaseOptions() {return MeshRenderPolicy::createDatabaseOptions();}
+	private:
+		QuadTreeScatterer<MeshInstancePolicy, MeshRenderPolicy> m_Scatterer;
 	};
-}
+}
\ No newline at end of file
@@ -0,0 +1,457 @@
+#include "MeshScatterPolicies.h"
+#include <osg/PagedLOD>
+#include <osg/StateSet>
+#include <osg/Texture2DArray>
+#include <osgDB/FileNameUtils>
+#include <osgDB/ReadFile>
+#include <osgDB/WriteFile>
+#include <algorithm>
+#include <cfloat>
+#include <iostream>
+#include <sstream>
+#include "BRTShaderInstancing.h"
+#include "ImpostorBaker.h"
+#include "MRTShaderInstancing.h"
+#include "ScatterKernels.h"
+
+namespace osgVegetation
+{
+	namespace
+	{
+		bool MeshSortPredicate(const MeshLOD &lhs, const MeshLOD &rhs)
+		{
+			return lhs.MaxDistance > rhs.MaxDistance;
+		}
+
+		bool HasImpostors(const MeshLayer &layer)
+		{
+			return layer.MeshLODs.size() > 0 && layer.ImpostorDistance > layer.MeshLODs[0].MaxDistance;
+		}
+
+		//level where layer instances are created
+		int GetPopulateLevel(const MeshLayer &layer)
+		{
+			return layer._ImpostorQTLevel >= 0 ? layer._ImpostorQTLevel : layer.MeshLODs[0]._StartQTLevel;
+		}
+	}
+
+	void MeshInstancePolicy::prepare(MeshData &data)
+	{
+		//sort mesh LODs by view distance
+		for(size_t i = 0; i < data.Layers.size(); i++)
+		{
+			std::sort(data.Layers[i].MeshLODs.begin(), data.Layers[i].MeshLODs.end(), MeshSortPredicate);
+		}
+
+		//instance width and height are scale factors for the mesh model, get model
+		//size (at scale 1) from the first mesh LOD to report instance sizes in terrain units
+		m_MeshExtents.assign(data.Layers.size(), osg::Vec2(0, 0));
+		for(size_t i = 0; i < data.Layers.size(); i++)
+		{
+			if(data.Layers[i].MeshLODs.size() == 0)
+				continue;
+			const std::string mesh_name = data.Layers[i].MeshLODs[0].MeshName;
+			osg::ref_ptr<osg::Node> mesh = osgDB::readNodeFile(mesh_name);
+			if(!mesh.valid())
+				OSGV_EXCEPT(std::string("MeshInstancePolicy::prepare - Failed to load mesh:" + mesh_name).c_str());
+			ImpostorBaker::getExtent(mesh.get(), m_MeshExtents[i].x(), m_MeshExtents[i].y());
+		}
+	}
+
+	double MeshInstancePolicy::getMaxTileSize(const MeshData &data) const
+	{
+		double max_tile_size = 0;
+		for(size_t i = 0; i < data.Layers.size(); i++)
+		{
+			for(size_t j = 0; j < data.Layers[i].MeshLODs.size(); j++)
+			{
+				max_tile_size = std::max(max_tile_size, data.Layers[i].MeshLODs[j].MaxDistance);
+			}
+			if(HasImpostors(data.Layers[i]))
+				max_tile_size = std::max(max_tile_size, data.Layers[i].ImpostorDistance);
+		}
+		return max_tile_size;
+	}
+
+	int MeshInstancePolicy::assignLevels(MeshData &data, double root_size)
+	{
+		//set start quad tree level for each mesh LOD, i.e. the LOD level to start mesh injection
+		int final_lod = 0;
+		for(size_t i = 0; i < data.Layers.size(); i++)
+		{
+			for(size_t j = 0; j < data.Layers[i].MeshLODs.size(); j++)
+			{
+				double temp_size = root_size;
+				int ld = 0;
+				//Get first QT level that can hold mesh LOD distance
+				while(temp_size > data.Layers[i].MeshLODs[j].MaxDistance)
+				{
+					ld++;
+					temp_size *= 0.5;
+				}
+				//Check that we don't get same LOD level as previous mesh LOD
+				if(j > 0 && ld <= data.Layers[i].MeshLODs[j-1]._StartQTLevel)
+				{
+					//push down this mesh-LOD down the quad tree
+					ld = data.Layers[i].MeshLODs[j-1]._StartQTLevel + 1;
+				}
+
+				data.Layers[i].MeshLODs[j]._StartQTLevel = ld;
+
+				if(final_lod < ld)
+					final_lod = ld;
+			}
+
+			data.Layers[i]._ImpostorQTLevel = -1;
+			if(HasImpostors(data.Layers[i]))
+			{
+				double temp_size = root_size;
+				int ld = 0;
+				while(temp_size > data.Layers[i].ImpostorDistance)
+				{
+					ld++;
+					temp_size *= 0.5;
+				}
+				//mesh LOD levels are kept as configured, impostors are clamped to the level above the first mesh LOD
+				const MeshLODVector& lods = data.Layers[i].MeshLODs;
+				if(ld >= lods[0]._StartQTLevel)
+					ld = lods[0]._StartQTLevel - 1;
+				if(ld < 0)
+				{
+					std::cout << "MeshInstancePolicy - Warning: no quad tree level above first mesh LOD for impostors (root tile size " << root_size
+						<< "), impostors disabled for layer " << i << "\n";
+				}
+				data.Layers[i]._ImpostorQTLevel = ld;
+			}
+		}
+		m_FinalLevel = final_lod;
+		return final_lod;
+	}
+
+	bool MeshInstancePolicy::populatesLevel(const MeshData &data, int level) const
+	{
+		for(size_t i = 0; i < data.Layers.size(); i++)
+		{
+			if(data.Layers[i].MeshLODs.size() > 0 && level == GetPopulateLevel(data.Layers[i]))
+				return true;
+		}
+		return false;
+	}
+
+	void MeshInstancePolicy::populateTile(const ScatterContext &context, MeshData &data, const ScatterTile &tile, TileData &tile_data)
+	{
+		tile_data.MeshLODs.resize(data.Layers.size(), -1);
+		tile_data.Impostors.resize(data.Layers.size(), false);
+		tile_data.Instances.resize(data.Layers.size());
+		for(size_t i = 0; i < data.Layers.size(); i++)
+		{
+			MeshLayer& layer = data.Layers[i];
+			int max_lod = -1;
+			for(size_t j = 0; j < layer.MeshLODs.size(); j++)
+			{
+				if(tile.Level >= layer.MeshLODs[j]._StartQTLevel && layer.MeshLODs[j]._StartQTLevel > max_lod)
+				{
+					tile_data.MeshLODs[i] = static_cast<int>(j);
+					max_lod = layer.MeshLODs[j]._StartQTLevel;
+				}
+			}
+
+			if(layer._ImpostorQTLevel >= 0 && tile.Level >= layer._ImpostorQTLevel && tile.Level < layer.MeshLODs[0]._StartQTLevel)
+				tile_data.Impostors[i] = true;
+
+			if(layer.MeshLODs.size() > 0 && tile.Level == GetPopulateLevel(layer))
+			{
+				//remove any previous data
+				layer._Instances.clear();
+				context.seedTile(tile, static_cast<unsigned int>(i));
+				_populateLayer(context, layer, tile.BB);
+
+				//instances are shared by all mesh LOD tiles in this subtree
+				std::stringstream ss;
+				ss << "layer" << i << "_" << tile.Level << "_X" << tile.X << "_Y" << tile.Y;
+				const int depth = std::min(m_FinalLevel - tile.Level, static_cast<int>(MeshInstanceBuffer::MAX_DEPTH));
+				layer._InstanceBuffer = new MeshInstanceBuffer(ss.str(), tile.BB, tile.Level, depth, layer._Instances);
+				if(context.InstanceSink)
+				{
+					//mesh instances are scale factors for the mesh model, extent width is the model diameter
+					const MeshVegetationObjectVector& instances = layer._InstanceBuffer->getInstances();
+					const osg::Vec2& extent = m_MeshExtents[i];
+					for(size_t j = 0; j < instances.size(); j++)
+						context.InstanceSink->addInstance(osg::Vec3d(instances[j]->Position) + context.Offset, instances[j]->Width * extent.x() * 0.5f, instances[j]->Height * extent.y(), context.SinkLayerBase + static_cast<unsigned int>(i));
+				}
+			}
+
+			if((tile_data.MeshLODs[i] >= 0 || tile_data.Impostors[i]) && layer._InstanceBuffer.valid())
+			{
+				InstanceRange& range = tile_data.Instances[i];
+				range.Buffer = layer._InstanceBuffer;
+				layer._InstanceBuffer->getRange(tile.Level, tile.BB, range.First, range.Count);
+			}
+		}
+	}
+
+	void MeshInstancePolicy::finish(MeshData &data)
+	{
+		for(size_t i = 0; i < data.Layers.size(); i++)
+		{
+			data.Layers[i]._Instances.clear();
+			data.Layers[i]._InstanceBuffer = NULL;
+		}
+	}
+
+	void MeshInstancePolicy::_populateLayer(const ScatterContext &context, MeshLayer &layer, const osg::BoundingBoxd &bb) const
+	{
+		const osg::Vec3d origin = bb._min;
+		const osg::Vec3d size = bb._max - bb._min;
+		const unsigned int num_objects_to_create = size.x()*size.y()*layer.Density;
+		//let terrain query match terrain detail to mean distance between instances
+		if(layer.Density > 0)
+			context.TerrainQuery->setGroundResolution(1.0/sqrt(layer.Density));
+
+		const TileSampleFilter<MeshLayer> filter(context, layer, bb);
+		if(filter.isEmpty())
+			return;
+		layer._Instances.reserve(layer._Instances.size() + num_objects_to_create);
+		const size_t first_instance = layer._Instances.size();
+
+		//random generator for the rule random variable and thinning, layers without rule don't consume rand()
+		BatchRandom rng(layer.Rule.valid() ? static_cast<unsigned int>(rand()) : 0u);
+		const double normal_step = 1.0/sqrt(layer.Density);
+		//rules that don't depend on terrain data thin candidates in batches before the terrain is queried
+		const bool pre_select = layer.Rule.valid() && layer.Rule->isTerrainIndependent();
+		const unsigned int batch_size = 1024;
+		std::vector<osg::Vec3d> candidates;
+		std::vector<osg::Vec3d> rule_positions;
+		std::vector<unsigned char> keep;
+		for(unsigned int i = 0; i < num_objects_to_create; ++i)
+		{
+			if(pre_select && i % batch_size == 0)
+			{
+				const unsigned int num_candidates = std::min(batch_size, num_objects_to_create - i);
+				candidates.resize(num_candidates);
+				rule_positions.resize(num_candidates);
+				for(unsigned int j = 0; j < num_candidates; j++)
+				{
+					candidates[j].set(Utils::random(origin.x(),origin.x()+size.x()),Utils::random(origin.y(),origin.y()+size.y()),0);
+					rule_positions[j] = candidates[j] + context.Offset;
+				}
+				layer.Rule->select(context.TerrainQuery, rule_positions, normal_step, rng, keep);
+			}
+			if(pre_select && !keep[i % batch_size])
+				continue;
+			const osg::Vec3d pos = pre_select ? candidates[i % batch_size] : osg::Vec3d(Utils::random(origin.x(),origin.x()+size.x()),Utils::random(origin.y(),origin.y()+size.y()),0);
+			float rand_int = Utils::random(layer.ColorIntensity.x(),layer.ColorIntensity.y());
+			osg::Vec4 terrain_color;
+			osg::Vec3d inter;
+			if(filter.sample(pos, terrain_color, inter))
+			{
+				MeshObject* veg_obj = new MeshObject;
+				float tree_scale = Utils::random(layer.Scale.x() ,layer.Scale.y());
+				veg_obj->Width = Utils::random(layer.Width.x(),layer.Width.y())*tree_scale;
+				veg_obj->Height = Utils::random(layer.Height.x(),layer.Height.y())*tree_scale;
+				veg_obj->Position = inter;
+				veg_obj->Rotation.makeRotate(Utils::random(0.0, osg::PI_2),osg::Vec3(0,0,1));
+				if(layer.UseTerrainIntensity)
+				{
+					float intensity = (terrain_color.r() + terrain_color.g() + terrain_color.b())/3.0;
+					terrain_color.set(intensity,intensity,intensity,terrain_color.a());
+				}
+				veg_obj->Color = terrain_color*(layer.TerrainColorRatio*rand_int);
+				veg_obj->Color += osg::Vec4(1,1,1,1)*(rand_int * (1.0 - layer.TerrainColorRatio));
+				veg_obj->Color.set(veg_obj->Color.r(), veg_obj->Color.g(), veg_obj->Color.b(), 1.0);
+				layer._Instances.push_back(veg_obj);
+			}
+		}
+
+		if(layer.Rule.valid() && !pre_select && layer._Instances.size() > first_instance)
+		{
+			//thin new instances by rule density
+			rule_positions.clear();
+			rule_positions.reserve(layer._Instances.size() - first_instance);
+			for(size_t i = first_instance; i < layer._Instances.size(); i++)
+				rule_positions.push_back(osg::Vec3d(layer._Instances[i]->Position) + context.Offset);
+			layer.Rule->select(context.TerrainQuery, rule_positions, normal_step, rng, keep);
+			size_t num_kept = first_instance;
+			for(size_t i = first_instance; i < layer._Instances.size(); i++)
+			{
+				if(keep[i - first_instance])
+					layer._Instances[num_kept++] = layer._Instances[i];
+			}
+			layer._Instances.resize(num_kept);
+		}
+	}
+
+	void MeshRenderPolicy::begin(MeshData &data, const ScatterOutput &output)
+	{
+		MRTShaderInstancing* mrt = new MRTShaderInstancing(data, m_EnvironmentSettings);
+		//tiles are written to separate files, save shared instance buffers once
+		if(output.UsePagedLOD)
+			mrt->setExternalBufferPath(output.SavePath, output.FilenamePrefix);
+		m_DatabaseOptions = output.UsePagedLOD ? createDatabaseOptions() : NULL;
+		m_MRT = mrt;
+		_setupImpostors(data, output);
+	}
+
+	void MeshRenderPolicy::_setupImpostors(MeshData &data, const ScatterOutput &output)
+	{
+		m_ImpostorBRT = NULL;
+		m_ImpostorTextureIndices.assign(data.Layers.size(), -1);
+		m_ImpostorSizes.assign(data.Layers.size(), osg::Vec2(0, 0));
+
+		BillboardLayerVector impostor_layers;
+		std::vector<size_t> impostor_layer_index;
+		std::vector<std::string> baked_files;
+		const ImpostorBaker baker(data.ImpostorTextureSize);
+		osg::ref_ptr<osg::Image> default_texture;
+		for(size_t i = 0; i < data.Layers.size(); i++)
+		{
+			const MeshLayer& layer = data.Layers[i];
+			if(!HasImpostors(layer))
+				continue;
+
+			//impostor replace the first (longest distance) mesh LOD
+			const std::string mesh_name = layer.MeshLODs[0].MeshName;
+			osg::ref_ptr<osg::Node> mesh = osgDB::readNodeFile(mesh_name);
+			if(!mesh.valid())
+				OSGV_EXCEPT(std::string("MeshRenderPolicy::_setupImpostors - Failed to load mesh:" + mesh_name).c_str());
+			float width = 0;
+			float height = 0;
+			ImpostorBaker::getExtent(mesh.get(), width, height);
+			m_ImpostorSizes[i].set(width, height);
+
+			std::string texture_name = layer.ImpostorTexture;
+			if(texture_name == "")
+			{
+				//same default texture as MRTShaderInstancing
+				if(!default_texture.valid())
+					default_texture = osgDB::readImageFile("Images/tree0.rgba");
+				const std::string filename = output.FilenamePrefix + "impostor_" + osgDB::getStrippedName(mesh_name) + ".png";
+				texture_name = output.SavePath + filename;
+				if(std::find(baked_files.begin(), baked_files.end(), filename) == baked_files.end())
+				{
+					std::cout << "MeshRenderPolicy - Baking impostor " << texture_name << "\n";
+					osg::ref_ptr<osg::Image> image = baker.bake(mesh.get(), default_texture.get());
+					if(!osgDB::writeImageFile(*image, texture_name))
+						OSGV_EXCEPT(std::string("MeshRenderPolicy::_setupImpostors - Failed to write file:" + texture_name).c_str());
+					baked_files.push_back(filename);
+				}
+			}
+			impostor_layers.push_back(BillboardLayer(texture_name, layer.ImpostorDistance));
+			impostor_layer_index.push_back(i);
+		}
+		if(impostor_layers.size() == 0)
+			return;
+
+		BillboardData impostor_data(impostor_layers, false, 0.5f, false);
+		impostor_data.Type = BT_CROSS_QUADS;
+		impostor_data.ReceiveShadows = data.ReceiveShadows;
+		impostor_data.UseMultiSample = data.UseMultiSample;
+		m_ImpostorBRT = new BRTShaderInstancing(impostor_data, m_EnvironmentSettings);
+		for(size_t i = 0; i < impostor_layer_index.size(); i++)
+			m_ImpostorTextureIndices[impostor_layer_index[i]] = impostor_data.Layers[i]._TextureIndex;
+
+		if(output.UsePagedLOD)
+		{
+			//impostor tiles are spread over many files, reference baked textures by relative name
+			osg::Texture2DArray* tex = dynamic_cast<osg::Texture2DArray*>(m_ImpostorBRT->getStateSet()->getTextureAttribute(0, osg::StateAttribute::TEXTURE));
+			for(unsigned int i = 0; tex && i < tex->getNumImages(); i++)
+			{
+				osg::Image* image = tex->getImage(i);
+				const std::string simple_name = image ? osgDB::getSimpleFileName(image->getFileName()) : "";
+				if(image && std::find(baked_files.begin(), baked_files.end(), simple_name) != baked_files.end())
+				{
+					image->setFileName(simple_name);
+					image->setWriteHint(osg::Image::EXTERNAL_FILE);
+				}
+			}
+		}
+	}
+
+	osg::Node* MeshRenderPolicy::_createImpostors(const MeshData &data, const MeshInstancePolicy::TileData &tile_data, const osg::BoundingBoxd &bb) const
+	{
+		//all impostor layers share texture array, i.e one draw call per tile
+		BillboardVegetationObjectVector impostors;
+		for(size_t i = 0; i < data.Layers.size(); i++)
+		{
+			const MeshInstancePolicy::InstanceRange& range = tile_data.Instances[i];
+			if(!tile_data.Impostors[i] || range.Count == 0)
+				continue;
+			const MeshVegetationObjectVector& instances = range.Buffer->getInstances();
+			for(unsigned int j = range.First; j < range.First + range.Count; j++)
+			{
+				const MeshObject& mesh_obj = *instances[j];
+				BillboardObject* obj = new BillboardObject;
+				obj->Position = mesh_obj.Position;
+				obj->Color = mesh_obj.Color;
+				obj->Width = mesh_obj.Width * m_ImpostorSizes[i].x();
+				obj->Height = mesh_obj.Height * m_ImpostorSizes[i].y();
+				obj->TextureIndex = static_cast<unsigned int>(m_ImpostorTextureIndices[i]);
+				impostors.push_back(obj);
+			}
+		}
+		if(impostors.size() == 0)
+			return NULL;
+		osg::Group* group = new osg::Group;
+		group->setStateSet(m_ImpostorBRT->getStateSet());
+		group->addChild(m_ImpostorBRT->create(impostors, bb));
+		return group;
+	}
+
+	osg::Node* MeshRenderPolicy::createGeometry(MeshData &data, const ScatterTile &tile, const MeshInstancePolicy::TileData &tile_data)
+	{
+		osg::Group* group = NULL;
+		for(size_t i = 0; i < data.Layers.size(); i++)
+		{
+			const int mesh_lod = tile_data.MeshLODs[i];
+			const MeshInstancePolicy::InstanceRange& range = tile_data.Instances[i];
+			if(mesh_lod >= 0 && range.Count > 0)
+			{
+				if(group == NULL)
+					group = new osg::Group;
+				group->addChild(m_MRT->create(*range.Buffer, range.First, range.Count, data.Layers[i].MeshLODs[mesh_lod].MeshName, tile.BB));
+			}
+		}
+
+		if(m_ImpostorBRT.valid())
+		{
+			osg::Node* impostors = _createImpostors(data, tile_data, tile.BB);
+			if(impostors)
+			{
+				if(group == NULL)
+					group = new osg::Group;
+				group->addChild(impostors);
+			}
+		}
+		return group;
+	}
+
+	void MeshRenderPolicy::setupLOD(const MeshData &/*data*/, const ScatterTile &tile, const MeshInstancePolicy::TileData &/*tile_data*/, osg::LOD &lod, int geometry_index, int children_index) const
+	{
+		//regular terrain LOD setup, tile geometry replaced by children inside cutoff
+		const double tile_radius = tile.BB._max.x() - tile.BB._min.x();
+		const double tile_cutoff = tile_radius*2.0;
+		lod.setCenterMode(osg::LOD::USER_DEFINED_CENTER);
+		lod.setCenter(tile.BB.center());
+		lod.setRadius(tile_radius);
+		if(geometry_index >= 0)
+			lod.setRange(geometry_index, tile_cutoff, FLT_MAX);
+		lod.setRange(children_index, 0, tile_cutoff);
+
+		//load child tiles through the object cache to share external instance buffers
+		osg::PagedLOD* plod = dynamic_cast<osg::PagedLOD*>(&lod);
+		if(plod && m_DatabaseOptions.valid())
+			plod->setDatabaseOptions(m_DatabaseOptions.get());
+	}
+
+	osgDB::Options* MeshRenderPolicy::createDatabaseOptions()
+	{
+		osgDB::Options* options = new osgDB::Options();
+		options->setObjectCacheHint(osgDB::Options::CACHE_IMAGES);
+		return options;
+	}
+
+	osg::StateSet* MeshRenderPolicy::createStateSet() const
+	{
+		return dynamic_cast<osg::StateSet*>(m_MRT->getStateSet()->clone(osg::CopyOp::DEEP_COPY_STATESETS));
+	}
+}
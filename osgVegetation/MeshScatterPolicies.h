@@ -0,0 +1,101 @@
+#pragma once
+#include "Common.h"
+#include <osg/BoundingBox>
+#include <osg/LOD>
+#include <osg/ref_ptr>
+#include <osgDB/Options>
+#include <vector>
+#include "MeshData.h"
+#include "MeshObject.h"
+#include "EnvironmentSettings.h"
+#include "IMeshRenderingTech.h"
+#include "IBillboardRenderingTech.h"
+#include "QuadTreeScatterer.h"
+
+namespace osgVegetation
+{
+	/**
+		QuadTreeScatterer instance policy for mesh layers. Each layer is populated at the start
+		level of its first (most detailed view distance) mesh LOD, deeper tiles use a subset of
+		those instances and the mesh LOD matching the tile level. Instances are stored once per
+		populated tile in a MeshInstanceBuffer, deeper tiles only reference an index range.
+		Layers with impostors are populated at the impostor level instead, tiles above the first
+		mesh LOD then draw the same instances as billboards.
+	*/
+	class osgvExport MeshInstancePolicy
+	{
+	public:
+		typedef MeshData DataType;
+
+		/**
+			Instances of one layer inside tile
+		*/
+		struct InstanceRange
+		{
+			InstanceRange() : First(0), Count(0) {}
+			osg::ref_ptr<MeshInstanceBuffer> Buffer;
+			unsigned int First;
+			unsigned int Count;
+		};
+
+		struct TileData
+		{
+			//per layer, index of mesh LOD to use in this tile (-1 if none)
+			std::vector<int> MeshLODs;
+			//per layer, draw impostors in this tile
+			std::vector<bool> Impostors;
+			//per layer instances inside tile
+			std::vector<InstanceRange> Instances;
+			osg::BoundingBoxd Bounds;
+		};
+
+		MeshInstancePolicy() : m_FinalLevel(0) {}
+
+		void prepare(MeshData &data);
+		double getMaxTileSize(const MeshData &data) const;
+		int assignLevels(MeshData &data, double root_size);
+		bool populatesLevel(const MeshData &data, int level) const;
+		void populateTile(const ScatterContext &context, MeshData &data, const ScatterTile &tile, TileData &tile_data);
+		void finish(MeshData &data);
+	private:
+		void _populateLayer(const ScatterContext &context, MeshLayer &layer, const osg::BoundingBoxd &bb) const;
+		int m_FinalLevel;
+		//per layer, model width and height at instance scale 1
+		std::vector<osg::Vec2> m_MeshExtents;
+	};
+
+	/**
+		QuadTreeScatterer render policy for meshes, tile geometry is only shown
+		outside the tile cutoff distance where it is replaced by the children.
+		Impostor tiles are rendered by BRTShaderInstancing using one baked texture per layer.
+	*/
+	class osgvExport MeshRenderPolicy
+	{
+	public:
+		MeshRenderPolicy(const EnvironmentSettings &env_settings = EnvironmentSettings()) : m_EnvironmentSettings(env_settings) {}
+		void begin(MeshData &data, const ScatterOutput &output);
+		osg::Node* createGeometry(MeshData &data, const ScatterTile &tile, const MeshInstancePolicy::TileData &tile_data);
+		void setupLOD(const MeshData &data, const ScatterTile &tile, const MeshInstancePolicy::TileData &tile_data, osg::LOD &lod, int geometry_index, int children_index) const;
+		osg::StateSet* createStateSet() const;
+
+		/**
+			Options for loading paged mesh databases, instance buffers shared by tiles are read
+			through the object cache so that all tiles reference the same image. The options are set
+			on generated PagedLOD nodes but they are not stored in tile files, viewers loading saved
+			databases should also use them as osgDB::Registry options (used by the database pager for
+			PagedLOD nodes without own options).
+		*/
+		static osgDB::Options* createDatabaseOptions();
+	private:
+		void _setupImpostors(MeshData &data, const ScatterOutput &output);
+		osg::Node* _createImpostors(const MeshData &data, const MeshInstancePolicy::TileData &tile_data, const osg::BoundingBoxd &bb) const;
+		osg::ref_ptr<IMeshRenderingTech> m_MRT;
+		osg::ref_ptr<IBillboardRenderingTech> m_ImpostorBRT;
+		//per layer, impostor texture index and size at instance scale 1
+		std::vector<int> m_ImpostorTextureIndices;
+		std::vector<osg::Vec2> m_ImpostorSizes;
+		EnvironmentSettings m_EnvironmentSettings;
+		//paged output only
+		osg::ref_ptr<osgDB::Options> m_DatabaseOptions;
+	};
+}
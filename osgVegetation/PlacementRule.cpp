@@ -0,0 +1,565 @@
+#include "PlacementRule.h"
+#include "ITerrainQuery.h"
+#include "ScatterKernels.h"
+#include <osg/Math>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+
+namespace osgVegetation
+{
+	namespace
+	{
+		enum TokenType
+		{
+			TOKEN_NUMBER,
+			TOKEN_IDENTIFIER,
+			TOKEN_OPERATOR,
+			TOKEN_END
+		};
+
+		struct Token
+		{
+			Token(TokenType type, const std::string &text, double value = 0) : Type(type), Text(text), Value(value) {}
+			TokenType Type;
+			std::string Text;
+			double Value;
+		};
+
+		inline unsigned int hashLattice(int x, int y)
+		{
+			unsigned int h = static_cast<unsigned int>(x) * 0x8da6b343u ^ static_cast<unsigned int>(y) * 0xd8163841u;
+			h ^= h >> 16;
+			h *= 0x85ebca6bu;
+			h ^= h >> 13;
+			h *= 0xc2b2ae35u;
+			h ^= h >> 16;
+			return h;
+		}
+
+		inline double latticeValue(int x, int y)
+		{
+			return static_cast<double>(hashLattice(x, y) >> 8) / 16777216.0;
+		}
+	}
+
+	/**
+		Recursive descent parser emitting postfix bytecode
+	*/
+	class PlacementRule::Parser
+	{
+	public:
+		Parser(PlacementRule &rule) : m_Rule(rule), m_Pos(0)
+		{
+			_tokenize(rule.m_Expression);
+		}
+
+		void parseProgram()
+		{
+			while (m_Tokens[m_Pos].Type != TOKEN_END)
+			{
+				_parseStatement();
+				if (_accept(";"))
+					continue;
+				if (m_Tokens[m_Pos].Type != TOKEN_END)
+					_error("expected ';' before '" + m_Tokens[m_Pos].Text + "'");
+			}
+		}
+	private:
+		void _error(const std::string &msg) const
+		{
+			OSGV_EXCEPT(std::string("PlacementRule - " + msg + " in expression: " + m_Rule.m_Expression).c_str());
+		}
+
+		void _tokenize(const std::string &text)
+		{
+			size_t i = 0;
+			while (i < text.size())
+			{
+				const char c = text[i];
+				if (isspace(static_cast<unsigned char>(c)))
+				{
+					i++;
+				}
+				else if (isdigit(static_cast<unsigned char>(c)) || (c == '.' && i + 1 < text.size() && isdigit(static_cast<unsigned char>(text[i + 1]))))
+				{
+					const char* start = text.c_str() + i;
+					char* end = NULL;
+					const double value = strtod(start, &end);
+					const size_t length = static_cast<size_t>(end - start);
+					m_Tokens.push_back(Token(TOKEN_NUMBER, text.substr(i, length), value));
+					i += length;
+				}
+				else if (isalpha(static_cast<unsigned char>(c)) || c == '_')
+				{
+					size_t j = i;
+					while (j < text.size() && (isalnum(static_cast<unsigned char>(text[j])) || text[j] == '_'))
+						j++;
+					m_Tokens.push_back(Token(TOKEN_IDENTIFIER, text.substr(i, j - i)));
+					i = j;
+				}
+				else
+				{
+					//two character operators first
+					const std::string two = text.substr(i, 2);
+					if (two == "<=" || two == ">=" || two == "*=")
+					{
+						m_Tokens.push_back(Token(TOKEN_OPERATOR, two));
+						i += 2;
+					}
+					else if (std::string("+-*/()<>,;=").find(c) != std::string::npos)
+					{
+						m_Tokens.push_back(Token(TOKEN_OPERATOR, std::string(1, c)));
+						i++;
+					}
+					else
+						_error(std::string("unexpected character '") + c + "'");
+				}
+			}
+			m_Tokens.push_back(Token(TOKEN_END, "end of expression"));
+		}
+
+		bool _accept(const std::string &op)
+		{
+			if (m_Tokens[m_Pos].Type == TOKEN_OPERATOR && m_Tokens[m_Pos].Text == op)
+			{
+				m_Pos++;
+				return true;
+			}
+			return false;
+		}
+
+		void _expect(const std::string &op)
+		{
+			if (!_accept(op))
+				_error("expected '" + op + "' before '" + m_Tokens[m_Pos].Text + "'");
+		}
+
+		void _parseStatement()
+		{
+			const Token& token = m_Tokens[m_Pos];
+			const Token& next = m_Tokens[m_Pos + 1 < m_Tokens.size() ? m_Pos + 1 : m_Pos];
+			if (token.Type == TOKEN_IDENTIFIER && token.Text == "density" && next.Type == TOKEN_OPERATOR && (next.Text == "=" || next.Text == "*="))
+			{
+				m_Pos += 2;
+				_parseExpression();
+				m_Rule._emit(next.Text == "=" ? OP_STORE_DENSITY : OP_MUL_DENSITY);
+			}
+			else
+			{
+				_parseExpression();
+				m_Rule._emit(OP_MUL_DENSITY);
+			}
+		}
+
+		void _parseExpression()
+		{
+			_parseAdditive();
+			if (_accept("<"))
+			{
+				_parseAdditive();
+				m_Rule._emit(OP_LESS);
+			}
+			else if (_accept(">"))
+			{
+				_parseAdditive();
+				m_Rule._emit(OP_GREATER);
+			}
+			else if (_accept("<="))
+			{
+				_parseAdditive();
+				m_Rule._emit(OP_LESS_EQUAL);
+			}
+			else if (_accept(">="))
+			{
+				_parseAdditive();
+				m_Rule._emit(OP_GREATER_EQUAL);
+			}
+		}
+
+		void _parseAdditive()
+		{
+			_parseTerm();
+			while (true)
+			{
+				if (_accept("+"))
+				{
+					_parseTerm();
+					m_Rule._emit(OP_ADD);
+				}
+				else if (_accept("-"))
+				{
+					_parseTerm();
+					m_Rule._emit(OP_SUB);
+				}
+				else
+					break;
+			}
+		}
+
+		void _parseTerm()
+		{
+			_parseUnary();
+			while (true)
+			{
+				if (_accept("*"))
+				{
+					_parseUnary();
+					m_Rule._emit(OP_MUL);
+				}
+				else if (_accept("/"))
+				{
+					_parseUnary();
+					m_Rule._emit(OP_DIV);
+				}
+				else
+					break;
+			}
+		}
+
+		void _parseUnary()
+		{
+			if (_accept("-"))
+			{
+				_parseUnary();
+				m_Rule._emit(OP_NEG);
+			}
+			else
+				_parsePrimary();
+		}
+
+		void _parsePrimary()
+		{
+			const Token token = m_Tokens[m_Pos];
+			if (token.Type == TOKEN_NUMBER)
+			{
+				m_Pos++;
+				m_Rule.m_Constants.push_back(token.Value);
+				m_Rule._emit(OP_CONST, static_cast<int>(m_Rule.m_Constants.size() - 1));
+			}
+			else if (token.Type == TOKEN_IDENTIFIER)
+			{
+				m_Pos++;
+				if (_accept("("))
+					_parseCall(token.Text);
+				else if (token.Text == "x")
+					m_Rule._emit(OP_VARIABLE, VAR_X);
+				else if (token.Text == "y")
+					m_Rule._emit(OP_VARIABLE, VAR_Y);
+				else if (token.Text == "z" || token.Text == "altitude")
+					m_Rule._emit(OP_VARIABLE, VAR_Z);
+				else if (token.Text == "slope")
+					m_Rule._emit(OP_VARIABLE, VAR_SLOPE);
+				else if (token.Text == "random")
+					m_Rule._emit(OP_VARIABLE, VAR_RANDOM);
+				else if (token.Text == "density")
+					m_Rule._emit(OP_DENSITY);
+				else
+					_error("unknown variable '" + token.Text + "'");
+			}
+			else if (_accept("("))
+			{
+				_parseExpression();
+				_expect(")");
+			}
+			else
+				_error("unexpected '" + token.Text + "'");
+		}
+
+		void _parseCall(const std::string &name)
+		{
+			OpCode op;
+			int num_args;
+			if (name == "min") {op = OP_MIN; num_args = 2;}
+			else if (name == "max") {op = OP_MAX; num_args = 2;}
+			else if (name == "clamp") {op = OP_CLAMP; num_args = 3;}
+			else if (name == "abs") {op = OP_ABS; num_args = 1;}
+			else if (name == "sqrt") {op = OP_SQRT; num_args = 1;}
+			else if (name == "step") {op = OP_STEP; num_args = 2;}
+			else if (name == "smoothstep") {op = OP_SMOOTHSTEP; num_args = 3;}
+			else if (name == "mix") {op = OP_MIX; num_args = 3;}
+			else if (name == "noise") {op = OP_NOISE; num_args = 3;}
+			else
+			{
+				_error("unknown function '" + name + "'");
+				return;
+			}
+
+			for (int i = 0; i < num_args; i++)
+			{
+				if (i > 0)
+					_expect(",");
+				_parseExpression();
+			}
+			_expect(")");
+			m_Rule._emit(op);
+		}
+
+		PlacementRule &m_Rule;
+		std::vector<Token> m_Tokens;
+		size_t m_Pos;
+	};
+
+	void PlacementRule::Batch::resize(unsigned int n)
+	{
+		X.resize(n);
+		Y.resize(n);
+		Z.resize(n);
+		Slope.resize(n);
+		Random.resize(n);
+		Density.resize(n);
+	}
+
+	PlacementRule::PlacementRule(const std::string &expression) : m_Expression(expression),
+		m_MaxStackDepth(0),
+		m_StackDepth(0)
+	{
+		for (int i = 0; i < NUM_VARIABLES; i++)
+			m_UsedVariables[i] = false;
+		Parser parser(*this);
+		parser.parseProgram();
+	}
+
+	void PlacementRule::_emit(OpCode op, int arg)
+	{
+		m_Code.push_back(Instruction(op, arg));
+		switch (op)
+		{
+		case OP_VARIABLE:
+			m_UsedVariables[arg] = true;
+			m_StackDepth++;
+			break;
+		case OP_CONST:
+		case OP_DENSITY:
+			m_StackDepth++;
+			break;
+		case OP_NEG:
+		case OP_ABS:
+		case OP_SQRT:
+			break;
+		case OP_CLAMP:
+		case OP_SMOOTHSTEP:
+		case OP_MIX:
+		case OP_NOISE:
+			m_StackDepth -= 2;
+			break;
+		default:
+			//binary operators and density stores
+			m_StackDepth--;
+			break;
+		}
+		m_MaxStackDepth = osg::maximum(m_MaxStackDepth, m_StackDepth);
+	}
+
+	double PlacementRule::_noise(double x, double y)
+	{
+		const double fx = floor(x);
+		const double fy = floor(y);
+		const int ix = static_cast<int>(fx);
+		const int iy = static_cast<int>(fy);
+		double tx = x - fx;
+		double ty = y - fy;
+		tx = tx * tx * (3.0 - 2.0 * tx);
+		ty = ty * ty * (3.0 - 2.0 * ty);
+		const double v0 = latticeValue(ix, iy) + (latticeValue(ix + 1, iy) - latticeValue(ix, iy)) * tx;
+		const double v1 = latticeValue(ix, iy + 1) + (latticeValue(ix + 1, iy + 1) - latticeValue(ix, iy + 1)) * tx;
+		return v0 + (v1 - v0) * ty;
+	}
+
+	void PlacementRule::evaluate(Batch &batch) const
+	{
+		const unsigned int n = batch.size();
+		batch.Density.assign(n, 1.0);
+		if (n == 0)
+			return;
+		batch.resize(n);
+
+		const double* variables[NUM_VARIABLES] = {&batch.X[0], &batch.Y[0], &batch.Z[0], &batch.Slope[0], &batch.Random[0]};
+		double* density = &batch.Density[0];
+
+		//one array of n values per stack slot
+		std::vector<double> stack(static_cast<size_t>(osg::maximum(m_MaxStackDepth, 1)) * n);
+		int top = 0;
+		for (size_t c = 0; c < m_Code.size(); c++)
+		{
+			const Instruction& inst = m_Code[c];
+			double* a = top > 0 ? &stack[(top - 1) * n] : NULL;
+			double* b = top > 1 ? &stack[(top - 2) * n] : NULL;
+			double* d = top > 2 ? &stack[(top - 3) * n] : NULL;
+			switch (inst.Op)
+			{
+			case OP_CONST:
+			{
+				double* out = &stack[top * n];
+				const double value = m_Constants[inst.Arg];
+				for (unsigned int i = 0; i < n; i++)
+					out[i] = value;
+				top++;
+				break;
+			}
+			case OP_VARIABLE:
+			case OP_DENSITY:
+			{
+				double* out = &stack[top * n];
+				const double* in = inst.Op == OP_DENSITY ? density : variables[inst.Arg];
+				for (unsigned int i = 0; i < n; i++)
+					out[i] = in[i];
+				top++;
+				break;
+			}
+			case OP_STORE_DENSITY:
+				for (unsigned int i = 0; i < n; i++)
+					density[i] = a[i];
+				top--;
+				break;
+			case OP_MUL_DENSITY:
+				for (unsigned int i = 0; i < n; i++)
+					density[i] *= a[i];
+				top--;
+				break;
+			//binary operators, b is left hand side and receives the result
+			case OP_ADD:
+				for (unsigned int i = 0; i < n; i++)
+					b[i] += a[i];
+				top--;
+				break;
+			case OP_SUB:
+				for (unsigned int i = 0; i < n; i++)
+					b[i] -= a[i];
+				top--;
+				break;
+			case OP_MUL:
+				for (unsigned int i = 0; i < n; i++)
+					b[i] *= a[i];
+				top--;
+				break;
+			case OP_DIV:
+				for (unsigned int i = 0; i < n; i++)
+					b[i] = a[i] != 0.0 ? b[i] / a[i] : 0.0;
+				top--;
+				break;
+			case OP_LESS:
+				for (unsigned int i = 0; i < n; i++)
+					b[i] = b[i] < a[i] ? 1.0 : 0.0;
+				top--;
+				break;
+			case OP_GREATER:
+				for (unsigned int i = 0; i < n; i++)
+					b[i] = b[i] > a[i] ? 1.0 : 0.0;
+				top--;
+				break;
+			case OP_LESS_EQUAL:
+				for (unsigned int i = 0; i < n; i++)
+					b[i] = b[i] <= a[i] ? 1.0 : 0.0;
+				top--;
+				break;
+			case OP_GREATER_EQUAL:
+				for (unsigned int i = 0; i < n; i++)
+					b[i] = b[i] >= a[i] ? 1.0 : 0.0;
+				top--;
+				break;
+			case OP_MIN:
+				for (unsigned int i = 0; i < n; i++)
+					b[i] = a[i] < b[i] ? a[i] : b[i];
+				top--;
+				break;
+			case OP_MAX:
+				for (unsigned int i = 0; i < n; i++)
+					b[i] = a[i] > b[i] ? a[i] : b[i];
+				top--;
+				break;
+			case OP_STEP:
+				//step(v, edge)
+				for (unsigned int i = 0; i < n; i++)
+					b[i] = b[i] >= a[i] ? 1.0 : 0.0;
+				top--;
+				break;
+			case OP_NEG:
+				for (unsigned int i = 0; i < n; i++)
+					a[i] = -a[i];
+				break;
+			case OP_ABS:
+				for (unsigned int i = 0; i < n; i++)
+					a[i] = fabs(a[i]);
+				break;
+			case OP_SQRT:
+				for (unsigned int i = 0; i < n; i++)
+					a[i] = a[i] > 0.0 ? sqrt(a[i]) : 0.0;
+				break;
+			//three argument functions, d is first argument and receives the result
+			case OP_CLAMP:
+				for (unsigned int i = 0; i < n; i++)
+					d[i] = d[i] < b[i] ? b[i] : (d[i] > a[i] ? a[i] : d[i]);
+				top -= 2;
+				break;
+			case OP_SMOOTHSTEP:
+				//smoothstep(v, e0, e1)
+				for (unsigned int i = 0; i < n; i++)
+				{
+					const double range = a[i] - b[i];
+					double t = range != 0.0 ? (d[i] - b[i]) / range : (d[i] >= a[i] ? 1.0 : 0.0);
+					t = t < 0.0 ? 0.0 : (t > 1.0 ? 1.0 : t);
+					d[i] = t * t * (3.0 - 2.0 * t);
+				}
+				top -= 2;
+				break;
+			case OP_MIX:
+				//mix(a, b, t)
+				for (unsigned int i = 0; i < n; i++)
+					d[i] = d[i] + (b[i] - d[i]) * a[i];
+				top -= 2;
+				break;
+			case OP_NOISE:
+				//noise(x, y, scale)
+				for (unsigned int i = 0; i < n; i++)
+				{
+					const double scale = a[i] != 0.0 ? 1.0 / a[i] : 1.0;
+					d[i] = _noise(d[i] * scale, b[i] * scale);
+				}
+				top -= 2;
+				break;
+			}
+		}
+	}
+
+	void PlacementRule::select(ITerrainQuery* tq, const std::vector<osg::Vec3d> &positions, double normal_step, BatchRandom &rng, std::vector<unsigned char> &keep) const
+	{
+		const unsigned int n = static_cast<unsigned int>(positions.size());
+		keep.assign(n, 1);
+		if (n == 0)
+			return;
+
+		Batch batch;
+		batch.resize(n);
+		for (unsigned int i = 0; i < n; i++)
+		{
+			batch.X[i] = positions[i].x();
+			batch.Y[i] = positions[i].y();
+			batch.Z[i] = positions[i].z();
+		}
+
+		if (usesVariable(VAR_SLOPE))
+		{
+			for (unsigned int i = 0; i < n; i++)
+			{
+				osg::Vec3d normal;
+				batch.Slope[i] = tq->getTerrainNormal(positions[i], normal_step, normal) ? 1.0 - fabs(normal.z()) : 0.0;
+			}
+		}
+
+		std::vector<float> random(n);
+		if (usesVariable(VAR_RANDOM))
+		{
+			rng.uniform(0.0f, 1.0f, &random[0], n);
+			for (unsigned int i = 0; i < n; i++)
+				batch.Random[i] = random[i];
+		}
+
+		evaluate(batch);
+
+		//thin by density
+		rng.uniform(0.0f, 1.0f, &random[0], n);
+		for (unsigned int i = 0; i < n; i++)
+			keep[i] = random[i] < batch.Density[i] ? 1 : 0;
+	}
+}
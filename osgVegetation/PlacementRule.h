@@ -0,0 +1,146 @@
+#pragma once
+#include "Common.h"
+#include <osg/Referenced>
+#include <osg/ref_ptr>
+#include <osg/Vec3d>
+#include <string>
+#include <vector>
+
+namespace osgVegetation
+{
+	class ITerrainQuery;
+	class BatchRandom;
+
+	/**
+		Per-layer placement rule, an expression that modulate layer density from terrain
+		properties, ie. "density *= smoothstep(slope, 0.3, 0.6) * noise(x, y, 50)".
+		The expression is compiled once to stack bytecode that is evaluated instruction
+		by instruction over batches of samples (structure of arrays), so the inner loops are
+		straight arithmetic over contiguous arrays.
+
+		Syntax, statements separated by ';':
+			density = expr
+			density *= expr
+			expr                     (same as density *= expr)
+		Operators: + - * / < > <= >= (comparisons give 0 or 1), unary minus and parentheses.
+		Variables: x, y (terrain space), z (altitude is an alias), slope (0 flat, 1 vertical,
+		ie. 1 - normal z), random (uniform [0,1) per sample) and density (current value, starts at 1).
+		Functions: min(a,b) max(a,b) clamp(v,lo,hi) abs(v) sqrt(v) step(v,edge) smoothstep(v,e0,e1)
+		mix(a,b,t) noise(x,y,scale) (smooth value noise in [0,1], scale is the feature size).
+		Note that step and smoothstep take the value first, unlike GLSL step(edge,x) and
+		smoothstep(edge0,edge1,x).
+
+		Final density is the probability (clamped to [0,1]) of keeping a sample,
+		i.e the layer Density attribute is the max density.
+	*/
+	class osgvExport PlacementRule : public osg::Referenced
+	{
+	public:
+		enum Variable
+		{
+			VAR_X,
+			VAR_Y,
+			VAR_Z,
+			VAR_SLOPE,
+			VAR_RANDOM,
+			NUM_VARIABLES
+		};
+
+		/**
+			Input and output buffers for evaluate, terrain space
+		*/
+		struct Batch
+		{
+			std::vector<double> X;
+			std::vector<double> Y;
+			std::vector<double> Z;
+			std::vector<double> Slope;
+			std::vector<double> Random;
+			//output
+			std::vector<double> Density;
+
+			void resize(unsigned int n);
+			unsigned int size() const {return static_cast<unsigned int>(X.size());}
+		};
+
+		/**
+			Compile expression, throws on syntax errors
+		*/
+		PlacementRule(const std::string &expression);
+
+		const std::string& getExpression() const {return m_Expression;}
+
+		/**
+			Check if expression use variable, used to skip expensive inputs (ie. slope)
+		*/
+		bool usesVariable(Variable var) const {return m_UsedVariables[var];}
+
+		/**
+			Check if expression only use x, y and random, i.e the rule can be evaluated on
+			candidate positions before the terrain is queried.
+		*/
+		bool isTerrainIndependent() const {return !m_UsedVariables[VAR_Z] && !m_UsedVariables[VAR_SLOPE];}
+
+		/**
+			Evaluate rule for all samples in batch
+		*/
+		void evaluate(Batch &batch) const;
+
+		/**
+			Evaluate rule for terrain space positions and thin samples by resulting density.
+			@param tq Terrain query used for normals if slope is used
+			@param positions Sample positions (terrain space), z is not used by terrain independent rules
+			@param normal_step Finite difference step for terrain normals
+			@param rng Random generator for the random variable and thinning
+			@param keep Output, non-zero for samples to keep
+		*/
+		void select(ITerrainQuery* tq, const std::vector<osg::Vec3d> &positions, double normal_step, BatchRandom &rng, std::vector<unsigned char> &keep) const;
+	private:
+		enum OpCode
+		{
+			OP_CONST,
+			OP_VARIABLE,
+			OP_DENSITY,
+			OP_STORE_DENSITY,
+			OP_MUL_DENSITY,
+			OP_ADD,
+			OP_SUB,
+			OP_MUL,
+			OP_DIV,
+			OP_NEG,
+			OP_LESS,
+			OP_GREATER,
+			OP_LESS_EQUAL,
+			OP_GREATER_EQUAL,
+			OP_MIN,
+			OP_MAX,
+			OP_CLAMP,
+			OP_ABS,
+			OP_SQRT,
+			OP_STEP,
+			OP_SMOOTHSTEP,
+			OP_MIX,
+			OP_NOISE
+		};
+
+		struct Instruction
+		{
+			Instruction(OpCode op, int arg = 0) : Op(op), Arg(arg) {}
+			OpCode Op;
+			//constant index or variable
+			int Arg;
+		};
+
+		class Parser;
+		friend class Parser;
+		void _emit(OpCode op, int arg = 0);
+		static double _noise(double x, double y);
+
+		std::string m_Expression;
+		std::vector<Instruction> m_Code;
+		std::vector<double> m_Constants;
+		bool m_UsedVariables[NUM_VARIABLES];
+		int m_MaxStackDepth;
+		int m_StackDepth;
+	};
+}
@@ -0,0 +1,759 @@
+#pragma once
+#include "Common.h"
+#include <osg/BoundingBox>
+#include <osg/MatrixTransform>
+#include <osg/PagedLOD>
+#include <osg/Referenced>
+#include <osg/ProxyNode>
+#include <osg/StateSet>
+#include <osg/Timer>
+#include <osgDB/WriteFile>
+#include <osgDB/FileNameUtils>
+#include <cfloat>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "ITerrainQuery.h"
+#include "VectorMask.h"
+#include "VegetationUtils.h"
+
+namespace osgVegetation
+{
+	/**
+		Quad tree tile key and bounds (local, ie. relative to ScatterContext::Offset)
+	*/
+	struct ScatterTile
+	{
+		ScatterTile(int level, int x, int y, const osg::BoundingBoxd &bb) : Level(level), X(x), Y(y), BB(bb) {}
+		int Level;
+		int X;
+		int Y;
+		osg::BoundingBoxd BB;
+	};
+
+	/**
+		Output settings passed to render policy, render data shared between
+		tiles can be saved next to the tile files in paged databases
+	*/
+	struct ScatterOutput
+	{
+		ScatterOutput() : UsePagedLOD(false) {}
+		bool UsePagedLOD;
+		//path with trailing slash, empty if not saved
+		std::string SavePath;
+		std::string FilenamePrefix;
+	};
+
+	/**
+		Receiver of all created instances, ie. for export to simulation data bases.
+		Instances are reported once (at the level they are populated), in terrain space.
+	*/
+	class ScatterInstanceSink : public osg::Referenced
+	{
+	public:
+		/**
+			@param position Instance base position
+			@param radius Crown radius, half instance width
+			@param height Instance height
+			@param layer Layer index in data plus layer base set with the sink
+		*/
+		virtual void addInstance(const osg::Vec3d &position, float radius, float height, unsigned int layer) = 0;
+	protected:
+		virtual ~ScatterInstanceSink() {}
+	};
+
+	/**
+		State shared by the quad tree walk and the instance policies
+	*/
+	struct ScatterContext
+	{
+		ScatterContext() : TerrainQuery(NULL), AreaOfInterest(NULL), GlobalTiling(false), GlobalSeed(0), InstanceSink(NULL), SinkLayerBase(0) {}
+
+		/**
+			Check that local bb overlap the generation area and the area of interest
+		*/
+		bool intersectsArea(const osg::BoundingBoxd &bb) const
+		{
+			if(!bb.intersects(InitBB))
+				return false;
+			if(AreaOfInterest == NULL)
+				return true;
+			const osg::BoundingBoxd terrain_bb(bb._min + Offset, bb._max + Offset);
+			std::vector<unsigned int> shapes;
+			AreaOfInterest->query(terrain_bb, shapes);
+			return AreaOfInterest->intersectsBox(terrain_bb, shapes);
+		}
+
+		/**
+			Seed rand() for layer population, only done for global tiling where
+			tile content must not depend on build area or processing order
+		*/
+		void seedTile(const ScatterTile &tile, unsigned int layer) const
+		{
+			if(GlobalTiling)
+				srand(Utils::getTileSeed(GlobalSeed, tile.Level, tile.X, tile.Y, layer));
+		}
+
+		ITerrainQuery* TerrainQuery;
+		//Offset based on initial bounding box, used to avoid floating point precision problem
+		osg::Vec3d Offset;
+		//Area bounding box
+		osg::BoundingBoxd InitBB;
+		VectorMask* AreaOfInterest;
+		bool GlobalTiling;
+		unsigned int GlobalSeed;
+		//optional receiver of created instances
+		ScatterInstanceSink* InstanceSink;
+		unsigned int SinkLayerBase;
+	};
+
+	/**
+		Per-sample acceptance test shared by all instance policies: area of interest,
+		layer masks, coverage pre-test and terrain query. Mask shapes are pre-filtered per tile.
+	*/
+	template<class LayerType>
+	class TileSampleFilter
+	{
+	public:
+		TileSampleFilter(const ScatterContext &context, const LayerType &layer, const osg::BoundingBoxd &bb) : m_Context(context),
+			m_Layer(layer),
+			m_Empty(false)
+		{
+			const osg::BoundingBoxd terrain_bb(bb._min + context.Offset, bb._max + context.Offset);
+			if(context.AreaOfInterest)
+				context.AreaOfInterest->query(terrain_bb, m_AOIShapes);
+			if(layer.ExclusionMask.valid())
+			{
+				layer.ExclusionMask->query(terrain_bb, m_ExclusionShapes);
+				if(layer.ExclusionMask->containsBox(terrain_bb, m_ExclusionShapes))
+					m_Empty = true;
+			}
+			if(layer.InclusionMask.valid())
+			{
+				layer.InclusionMask->query(terrain_bb, m_InclusionShapes);
+				if(m_InclusionShapes.size() == 0)
+					m_Empty = true;
+			}
+		}
+
+		/**
+			True if no sample in tile can pass
+		*/
+		bool isEmpty() const {return m_Empty;}
+
+		/**
+			Test local position (z ignored) against area and masks only, ie. no terrain query
+		*/
+		bool sampleArea(const osg::Vec3d &pos) const
+		{
+			if(!m_Context.InitBB.contains(osg::Vec3d(pos.x(), pos.y(), m_Context.InitBB._min.z())))
+				return false;
+			const osg::Vec3d offset_pos = pos + m_Context.Offset;
+			if(m_Context.AreaOfInterest && !m_Context.AreaOfInterest->contains(offset_pos, m_AOIShapes))
+				return false;
+			if(m_Layer.ExclusionMask.valid() && m_Layer.ExclusionMask->contains(offset_pos, m_ExclusionShapes))
+				return false;
+			if(m_Layer.InclusionMask.valid() && !m_Layer.InclusionMask->contains(offset_pos, m_InclusionShapes))
+				return false;
+			return true;
+		}
+
+		/**
+			Test local position, on success inter hold local terrain position
+		*/
+		bool sample(const osg::Vec3d &pos, osg::Vec4 &terrain_color, osg::Vec3d &inter) const
+		{
+			if(!sampleArea(pos))
+				return false;
+			osg::Vec3d offset_pos = pos + m_Context.Offset;
+			std::string coverage_name;
+			//reject by coverage before the more expensive terrain query if possible
+			if(m_Context.TerrainQuery->getCoverage(offset_pos, coverage_name) && !m_Layer.hasCoverage(coverage_name))
+				return false;
+			CoverageColor coverage_color;
+			if(!m_Context.TerrainQuery->getTerrainData(offset_pos, terrain_color, coverage_name, coverage_color, inter))
+				return false;
+			if(!m_Layer.hasCoverage(coverage_name))
+				return false;
+			m_Context.TerrainQuery->refineHeight(inter);
+			inter -= m_Context.Offset;
+			return true;
+		}
+	private:
+		const ScatterContext &m_Context;
+		const LayerType &m_Layer;
+		std::vector<unsigned int> m_AOIShapes;
+		std::vector<unsigned int> m_ExclusionShapes;
+		std::vector<unsigned int> m_InclusionShapes;
+		bool m_Empty;
+	};
+
+	/**
+		Callback for incremental generation (see QuadTreeScatterer::step), ie. used by
+		editors to show progress and swap finished tiles into a live scene graph.
+	*/
+	class ScatterCallback : public osg::Referenced
+	{
+	public:
+		/**
+			Called before each tile is processed
+		*/
+		virtual void progress(int /*current_tile*/, int /*num_tiles*/) {}
+
+		/**
+			Called when tile and all its children are finished. Node is in tile local
+			coordinates, ie. translate by offset to get terrain space. Root tiles have level zero.
+		*/
+		virtual void tileFinished(const ScatterTile &/*tile*/, const osg::Vec3d &/*offset*/, osg::Node* /*node*/) {}
+
+		/**
+			Called when generation is finished, result is also available from getResult
+		*/
+		virtual void finished(osg::Node* /*result*/) {}
+
+		virtual void cancelled() {}
+	};
+
+	/**
+		Quad tree scattering core shared by billboard and mesh scattering. The start tile use the
+		supplied bounding box (or a forest of roots) which is recursively divided into four new tiles
+		until the finest layer level is reached. Tiles are stored as LOD or PagedLOD nodes.
+		Policies are resolved at compile time, ie. no virtual calls per tile or instance.
+
+		InstancePolicy must provide:
+			typedef ... DataType;  //layers and settings
+			struct TileData {osg::BoundingBoxd Bounds; ...};  //Bounds is tile content bounds
+			void prepare(DataType &data);
+			double getMaxTileSize(const DataType &data) const;  //coarsest layer tile size, zero if no layers
+			int assignLevels(DataType &data, double root_size);  //return finest level
+			bool populatesLevel(const DataType &data, int level) const;
+			void populateTile(const ScatterContext &context, DataType &data, const ScatterTile &tile, TileData &tile_data);  //report new instances to context.InstanceSink if set
+			void finish(DataType &data);
+
+		RenderPolicy must provide:
+			void begin(InstancePolicy::DataType &data, const ScatterOutput &output);  //setup render technique
+			osg::Node* createGeometry(InstancePolicy::DataType &data, const ScatterTile &tile, const InstancePolicy::TileData &tile_data);  //NULL if empty
+			void setupLOD(const InstancePolicy::DataType &data, const ScatterTile &tile, const InstancePolicy::TileData &tile_data, osg::LOD &lod, int geometry_index, int children_index) const;
+			osg::StateSet* createStateSet() const;
+	*/
+	template<class InstancePolicy, class RenderPolicy>
+	class QuadTreeScatterer
+	{
+	public:
+		typedef typename InstancePolicy::DataType DataType;
+		typedef typename InstancePolicy::TileData TileData;
+
+		QuadTreeScatterer(ITerrainQuery* tq, const InstancePolicy &instance_policy = InstancePolicy(), const RenderPolicy &render_policy = RenderPolicy()) :
+			m_InstancePolicy(instance_policy),
+			m_RenderPolicy(render_policy),
+			m_Data(NULL),
+			m_NextRoot(0),
+			m_Generating(false),
+			m_FinalLOD(0),
+			m_CurrentTile(0),
+			m_NumberOfTiles(0),
+			m_GlobalTileSize(0),
+			m_GlobalMinZ(0),
+			m_GlobalMaxZ(0),
+			m_UsePagedLOD(false),
+			m_FilenamePrefix("quadtree_")
+		{
+			m_Context.TerrainQuery = tq;
+		}
+
+		/**
+			Generate vegetation data, blocking version of begin/step
+			@param bb Generation area
+			@param data Layers and settings
+			@param output_file Decide format and path for all Paged LOD files
+			@param use_paged_lod Use PagedLOD instead of regular LOD nodes (output_file must be defined)
+			@param filename_prefix Added to all files
+		*/
+		osg::Node* generate(const osg::BoundingBoxd &bb, DataType &data, const std::string &output_file, bool use_paged_lod, const std::string &filename_prefix)
+		{
+			begin(bb, data, output_file, use_paged_lod, filename_prefix);
+			while(!step(DBL_MAX)) {}
+			//hand over ownership to caller
+			osg::ref_ptr<osg::Node> result = m_Result;
+			m_Result = NULL;
+			return result.release();
+		}
+
+		/**
+			Start incremental generation, see generate for arguments. Any running generation is cancelled.
+			data must stay valid until generation is finished or cancelled.
+		*/
+		void begin(const osg::BoundingBoxd &bb, DataType &data, const std::string &output_file, bool use_paged_lod, const std::string &filename_prefix)
+		{
+			cancel();
+			if(output_file != "")
+			{
+				m_UsePagedLOD = use_paged_lod;
+				m_SavePath = osgDB::getFilePath(output_file);
+				if(m_SavePath != "")
+					m_SavePath += "/";
+				m_SaveExt = osgDB::getFileExtension(output_file);
+			}
+			else if(use_paged_lod)
+				OSGV_EXCEPT(std::string("QuadTreeScatterer::begin - paged lod requested but no output file supplied").c_str());
+			else
+				m_UsePagedLOD = false;
+			m_FilenamePrefix = filename_prefix;
+
+			ScatterOutput output;
+			output.UsePagedLOD = m_UsePagedLOD;
+			output.SavePath = output_file != "" ? m_SavePath : "";
+			output.FilenamePrefix = m_FilenamePrefix;
+			m_RenderPolicy.begin(data, output);
+			m_InstancePolicy.prepare(data);
+
+			//reset
+			m_Data = &data;
+			m_Result = NULL;
+			m_FinalLOD = 0;
+			m_NumberOfTiles = 1; //at least one LOD tile
+			m_CurrentTile = 0;
+			m_Roots.clear();
+			m_RootOffsets.clear();
+			m_NextRoot = 0;
+			m_Forest = new osg::Group;
+
+			if(m_GlobalTileSize > 0)
+			{
+				m_FinalLOD = m_InstancePolicy.assignLevels(data, m_GlobalTileSize);
+				_setupGlobalRoots(bb);
+			}
+			else
+			{
+				//get max bb side, we want square area for to begin quad tree splitting
+				double root_size = std::max(bb._max.x() - bb._min.x(), bb._max.y() - bb._min.y());
+				//area of interest use forest of roots sized by coarsest layer
+				const double max_tile_size = m_InstancePolicy.getMaxTileSize(data);
+				if(m_Context.AreaOfInterest && max_tile_size > 0)
+					root_size = 0;
+				root_size = std::max(root_size, max_tile_size);
+				m_FinalLOD = m_InstancePolicy.assignLevels(data, root_size);
+				_setupRoots(bb, root_size);
+			}
+			//one frame per level, frames are never reallocated during the walk
+			m_Stack.reserve(m_FinalLOD + 1);
+			m_Generating = true;
+		}
+
+		/**
+			Process tiles until time budget (milliseconds) is used, at least one tile is processed.
+			The budget is best-effort and only checked between tiles, a tile is never split, i.e.
+			populating a coarse tile of a dense layer can take far longer than the budget.
+			Tiles are processed depth first, i.e a tile is finished (see ScatterCallback::tileFinished)
+			directly after its last child.
+			@return true when generation is finished (see getResult) or if nothing is generating
+		*/
+		bool step(double time_budget_ms)
+		{
+			if(!m_Generating)
+				return true;
+			const osg::Timer_t start_tick = osg::Timer::instance()->tick();
+			do
+			{
+				_processNext();
+			}
+			while(m_Generating && osg::Timer::instance()->delta_m(start_tick, osg::Timer::instance()->tick()) < time_budget_ms);
+			return !m_Generating;
+		}
+
+		/**
+			Abort running generation, already written paged files are left on disk
+		*/
+		void cancel()
+		{
+			if(!m_Generating)
+				return;
+			m_Stack.clear();
+			m_Roots.clear();
+			m_RootOffsets.clear();
+			m_Forest = NULL;
+			m_Generating = false;
+			m_InstancePolicy.finish(*m_Data);
+			m_Data = NULL;
+			if(m_Callback.valid())
+				m_Callback->cancelled();
+		}
+
+		bool isGenerating() const {return m_Generating;}
+
+		/**
+			Progress of running generation (0-1), based on the full quad tree tile count
+		*/
+		float getProgress() const
+		{
+			if(!m_Generating)
+				return m_Result.valid() ? 1.0f : 0.0f;
+			return m_NumberOfTiles > 0 ? static_cast<float>(m_CurrentTile)/static_cast<float>(m_NumberOfTiles) : 0.0f;
+		}
+
+		/**
+			Result of last finished incremental generation, NULL while generating
+		*/
+		osg::Node* getResult() const {return m_Result.get();}
+
+		/**
+			Set callback for progress and partial results, NULL (default) print progress to console
+		*/
+		void setCallback(ScatterCallback* callback) {m_Callback = callback;}
+		ScatterCallback* getCallback() const {return m_Callback.get();}
+
+		/**
+			Create state set matching generated nodes, ie. for tiles swapped into a live scene graph
+		*/
+		osg::StateSet* createStateSet() const {return m_RenderPolicy.createStateSet();}
+
+		void setAreaOfInterest(VectorMask* aoi) {m_AreaOfInterest = aoi; m_Context.AreaOfInterest = aoi;}
+		VectorMask* getAreaOfInterest() const {return m_AreaOfInterest.get();}
+
+		/**
+			Report created instances to sink, layer_base is added to layer indices
+			so that several generations can share one sink. NULL (default) disable.
+		*/
+		void setInstanceSink(ScatterInstanceSink* sink, unsigned int layer_base = 0) {m_InstanceSink = sink; m_Context.InstanceSink = sink; m_Context.SinkLayerBase = layer_base;}
+		ScatterInstanceSink* getInstanceSink() const {return m_InstanceSink.get();}
+		unsigned int getInstanceSinkLayerBase() const {return m_Context.SinkLayerBase;}
+
+		void setGlobalTiling(double root_size, double min_z, double max_z, unsigned int seed)
+		{
+			m_GlobalTileSize = root_size;
+			m_GlobalMinZ = min_z;
+			m_GlobalMaxZ = max_z;
+			m_Context.GlobalTiling = root_size > 0;
+			m_Context.GlobalSeed = seed;
+		}
+		double getGlobalTileSize() const {return m_GlobalTileSize;}
+
+		InstancePolicy& getInstancePolicy() {return m_InstancePolicy;}
+		RenderPolicy& getRenderPolicy() {return m_RenderPolicy;}
+	private:
+		/**
+			Tile under construction, the stack of frames replace the recursion
+		*/
+		struct TileFrame
+		{
+			TileFrame(const ScatterTile &tile) : Tile(tile), NextChild(0) {}
+			ScatterTile Tile;
+			TileData Data;
+			osg::ref_ptr<osg::Node> Geometry;
+			osg::ref_ptr<osg::Group> Children;
+			//children to process, in traversal order
+			std::vector<ScatterTile> ChildTiles;
+			size_t NextChild;
+		};
+
+		std::string _createFileName(int lv, int x, int y) const
+		{
+			std::stringstream sstream;
+			sstream << m_FilenamePrefix << lv << "_X" << x << "_Y" << y << "." << m_SaveExt;
+			return sstream.str();
+		}
+
+		std::string _createRootFileName(int x, int y) const
+		{
+			std::stringstream sstream;
+			sstream << m_FilenamePrefix << "root_X" << x << "_Y" << y << "." << m_SaveExt;
+			return sstream.str();
+		}
+
+		void _addTileCount(int num_roots)
+		{
+			//get total number of tiles to process, used for progress report
+			int ld = 0;
+			while(ld < m_FinalLOD)
+			{
+				int side_tile_count = 2 << ld;
+				m_NumberOfTiles += side_tile_count*side_tile_count;
+				ld++;
+			}
+			m_NumberOfTiles *= num_roots;
+		}
+
+		void _setupRoots(const osg::BoundingBoxd &bb, double root_size)
+		{
+			//Offset vegetation by using new origin at bb._min
+			m_Context.Offset = bb._min;
+
+			//Create initial bounding box at new origin
+			m_Context.InitBB._min.set(0,0,0);
+			m_Context.InitBB._max = bb._max - bb._min;
+
+			//Create squared bounding boxes for top level quad tree tiles, skip roots outside area of interest
+			const int num_roots_x = std::max(1, static_cast<int>(ceil(m_Context.InitBB._max.x() / root_size)));
+			const int num_roots_y = std::max(1, static_cast<int>(ceil(m_Context.InitBB._max.y() / root_size)));
+			for(int j = 0; j < num_roots_y; j++)
+			{
+				for(int i = 0; i < num_roots_x; i++)
+				{
+					osg::BoundingBoxd qt_bb;
+					qt_bb._min.set(i*root_size, j*root_size, 0);
+					qt_bb._max.set((i+1)*root_size, (j+1)*root_size, bb._max.z() - bb._min.z());
+					//same index convention as child tiles, x follow y-axis
+					if(m_Context.intersectsArea(qt_bb))
+						m_Roots.push_back(ScatterTile(0, j, i, qt_bb));
+				}
+			}
+			_addTileCount(static_cast<int>(m_Roots.size()));
+		}
+
+		void _setupGlobalRoots(const osg::BoundingBoxd &bb)
+		{
+			//world grid roots overlapping the generation area
+			const int x0 = static_cast<int>(floor(bb._min.x() / m_GlobalTileSize));
+			const int y0 = static_cast<int>(floor(bb._min.y() / m_GlobalTileSize));
+			const int x1 = std::max(x0, static_cast<int>(ceil(bb._max.x() / m_GlobalTileSize)) - 1);
+			const int y1 = std::max(y0, static_cast<int>(ceil(bb._max.y() / m_GlobalTileSize)) - 1);
+
+			//whole roots are generated, tile content should not depend on the generation area
+			m_Context.InitBB._min.set(0, 0, 0);
+			m_Context.InitBB._max.set(m_GlobalTileSize, m_GlobalTileSize, m_GlobalMaxZ - m_GlobalMinZ);
+
+			for(int j = y0; j <= y1; j++)
+			{
+				for(int i = x0; i <= x1; i++)
+				{
+					m_Context.Offset.set(i*m_GlobalTileSize, j*m_GlobalTileSize, m_GlobalMinZ);
+					if(m_Context.intersectsArea(m_Context.InitBB))
+					{
+						m_RootOffsets.push_back(m_Context.Offset);
+						//same index convention as child tiles, x follow y-axis
+						m_Roots.push_back(ScatterTile(0, j, i, m_Context.InitBB));
+					}
+				}
+			}
+			_addTileCount(static_cast<int>(m_Roots.size()));
+		}
+
+		/**
+			Process one unit of work: start next root, enter next child or finish top tile
+		*/
+		void _processNext()
+		{
+			if(m_Stack.empty())
+			{
+				if(m_NextRoot == m_Roots.size())
+				{
+					_finishGeneration();
+					return;
+				}
+				//each global root has its own world anchored origin
+				if(m_GlobalTileSize > 0)
+					m_Context.Offset = m_RootOffsets[m_NextRoot];
+				_enterTile(m_Roots[m_NextRoot++]);
+			}
+			else if(m_Stack.back().NextChild < m_Stack.back().ChildTiles.size())
+			{
+				const ScatterTile child = m_Stack.back().ChildTiles[m_Stack.back().NextChild++];
+				_enterTile(child);
+			}
+			else
+				_leaveTile();
+		}
+
+		void _enterTile(const ScatterTile &tile)
+		{
+			if(m_Callback.valid())
+				m_Callback->progress(m_CurrentTile, m_NumberOfTiles);
+			else if(tile.Level < 6) //only show progress above level 6, we don't want to spam the console
+				std::cout << "Progress:" << static_cast<int>(100.0f*(static_cast<float>(m_CurrentTile)/ static_cast<float>(m_NumberOfTiles))) <<  "% Tile:" << m_CurrentTile << " of:" << m_NumberOfTiles << std::endl;
+			m_CurrentTile++;
+
+			m_Stack.push_back(TileFrame(tile));
+			TileFrame& frame = m_Stack.back();
+			frame.Data.Bounds = tile.BB;
+			m_InstancePolicy.populateTile(m_Context, *m_Data, tile, frame.Data);
+			frame.Geometry = m_RenderPolicy.createGeometry(*m_Data, tile, frame.Data);
+
+			if(tile.Level == m_FinalLOD)
+				return;
+
+			//split bounding box into four new children, height from tile content
+			const osg::BoundingBoxd& bb = tile.BB;
+			const double min_z = frame.Data.Bounds._min.z();
+			const double max_z = frame.Data.Bounds._max.z();
+			const double sx = (bb._max.x() - bb._min.x())*0.5;
+			const double sy = (bb._max.y() - bb._min.y())*0.5;
+			const osg::BoundingBoxd child_bb[4] = {
+				osg::BoundingBoxd(bb._min.x(),      bb._min.y(),      min_z, bb._min.x() + sx, bb._min.y() + sy, max_z),
+				osg::BoundingBoxd(bb._min.x() + sx, bb._min.y(),      min_z, bb._max.x(),      bb._min.y() + sy, max_z),
+				osg::BoundingBoxd(bb._min.x() + sx, bb._min.y() + sy, min_z, bb._max.x(),      bb._max.y(),      max_z),
+				osg::BoundingBoxd(bb._min.x(),      bb._min.y() + sy, min_z, bb._min.x() + sx, bb._max.y(),      max_z)};
+			const int x = tile.X;
+			const int y = tile.Y;
+			const int child_x[4] = {x*2, x*2, x*2+1, x*2+1};
+			const int child_y[4] = {y*2, y*2+1, y*2+1, y*2};
+			int child_order[4];
+			Utils::getHilbertChildOrder(tile.Level+1, m_FinalLOD, child_x, child_y, child_order);
+
+			//first check that we are inside initial bounding box and area of interest
+			for(int i = 0; i < 4; i++)
+			{
+				const int c = child_order[i];
+				if(m_Context.intersectsArea(child_bb[c]))
+					frame.ChildTiles.push_back(ScatterTile(tile.Level+1, child_x[c], child_y[c], child_bb[c]));
+			}
+			frame.Children = new osg::Group;
+
+			//request terrain data for children that will be populated, the terrain query
+			//can load pages and textures while we process the first child
+			if(m_InstancePolicy.populatesLevel(*m_Data, tile.Level+1))
+			{
+				for(size_t i = 0; i < frame.ChildTiles.size(); i++)
+				{
+					const osg::BoundingBoxd& cbb = frame.ChildTiles[i].BB;
+					m_Context.TerrainQuery->prefetch(osg::BoundingBoxd(cbb._min + m_Context.Offset, cbb._max + m_Context.Offset));
+				}
+			}
+		}
+
+		void _leaveTile()
+		{
+			osg::ref_ptr<osg::Node> node = _createTileNode(m_Stack.back());
+			const ScatterTile tile = m_Stack.back().Tile;
+			m_Stack.pop_back();
+			if(m_Callback.valid())
+				m_Callback->tileFinished(tile, m_Context.Offset, node.get());
+			if(m_Stack.empty())
+				_finishRoot(tile, node.get());
+			else
+				m_Stack.back().Children->addChild(node.get());
+		}
+
+		osg::Node* _createTileNode(const TileFrame &frame)
+		{
+			const ScatterTile& tile = frame.Tile;
+			//geometry_group is returned as raw pointer
+			osg::Group* geometry_group = new osg::Group;
+			if(frame.Geometry.valid())
+				geometry_group->addChild(frame.Geometry.get());
+
+			if(tile.Level == m_FinalLOD)
+				return geometry_group;
+
+			const int geometry_index = frame.Geometry.valid() ? 0 : -1;
+			const int children_index = frame.Geometry.valid() ? 1 : 0;
+			if(m_UsePagedLOD)
+			{
+				osg::PagedLOD* plod = new osg::PagedLOD;
+				if(frame.Geometry.valid())
+					plod->addChild(geometry_group);
+				const std::string filename = _createFileName(tile.Level, tile.X, tile.Y);
+				plod->setFileName(children_index, filename);
+				m_RenderPolicy.setupLOD(*m_Data, tile, frame.Data, *plod, geometry_index, children_index);
+				osgDB::writeNodeFile(*frame.Children, m_SavePath + filename);
+				return plod;
+			}
+			else
+			{
+				osg::LOD* lod = new osg::LOD;
+				if(frame.Geometry.valid())
+					lod->addChild(geometry_group);
+				lod->addChild(frame.Children.get());
+				m_RenderPolicy.setupLOD(*m_Data, tile, frame.Data, *lod, geometry_index, children_index);
+				return lod;
+			}
+		}
+
+		void _finishRoot(const ScatterTile &root, osg::Node* node)
+		{
+			if(m_GlobalTileSize <= 0)
+			{
+				m_Forest->addChild(node);
+				return;
+			}
+
+			osg::MatrixTransform* transform = new osg::MatrixTransform;
+			transform->setMatrix(osg::Matrix::translate(m_Context.Offset));
+			transform->addChild(node);
+			if(m_UsePagedLOD)
+			{
+				osgDB::ReaderWriter::Options *options = new osgDB::ReaderWriter::Options();
+				options->setOptionString(std::string("OutputTextureFiles OutputShaderFiles"));
+				//root files are named by world key, regions built separately reference the same files
+				const std::string filename = _createRootFileName(root.X, root.Y);
+				osgDB::writeNodeFile(*transform, m_SavePath + filename, options);
+				osg::ProxyNode* pn = new osg::ProxyNode;
+				pn->setFileName(0, filename);
+				pn->setCenterMode(osg::ProxyNode::USER_DEFINED_CENTER);
+				pn->setCenter(m_Context.Offset + m_Context.InitBB.center());
+				pn->setRadius(m_Context.InitBB.radius());
+				m_Forest->addChild(pn);
+			}
+			else
+				m_Forest->addChild(transform);
+		}
+
+		void _finishGeneration()
+		{
+			osg::ref_ptr<osg::Node> outnode;
+			if(m_GlobalTileSize > 0)
+			{
+				m_Forest->setStateSet(m_RenderPolicy.createStateSet());
+				outnode = m_Forest.get();
+			}
+			else
+			{
+				osg::Node* root = m_Forest.get();
+				if(m_Forest->getNumChildren() == 1)
+					root = m_Forest->getChild(0);
+				//Add state set to top node
+				root->setStateSet(m_RenderPolicy.createStateSet());
+
+				//add offset matrix
+				osg::MatrixTransform* transform = new osg::MatrixTransform;
+				transform->setMatrix(osg::Matrix::translate(m_Context.Offset));
+				transform->addChild(root);
+				outnode = transform;
+			}
+			m_Forest = NULL;
+			m_Generating = false;
+			m_InstancePolicy.finish(*m_Data);
+			m_Data = NULL;
+			m_Result = outnode;
+			if(m_Callback.valid())
+				m_Callback->finished(m_Result.get());
+		}
+
+		InstancePolicy m_InstancePolicy;
+		RenderPolicy m_RenderPolicy;
+		ScatterContext m_Context;
+		osg::ref_ptr<VectorMask> m_AreaOfInterest;
+		osg::ref_ptr<ScatterInstanceSink> m_InstanceSink;
+		osg::ref_ptr<ScatterCallback> m_Callback;
+
+		//incremental generation state
+		DataType* m_Data;
+		std::vector<ScatterTile> m_Roots;
+		//per root offset, global tiling only
+		std::vector<osg::Vec3d> m_RootOffsets;
+		size_t m_NextRoot;
+		std::vector<TileFrame> m_Stack;
+		osg::ref_ptr<osg::Group> m_Forest;
+		osg::ref_ptr<osg::Node> m_Result;
+		bool m_Generating;
+
+		int m_FinalLOD;
+
+		//data used for progress report
+		int m_CurrentTile;
+		int m_NumberOfTiles;
+
+		//Global tiling
+		double m_GlobalTileSize;
+		double m_GlobalMinZ;
+		double m_GlobalMaxZ;
+
+		bool m_UsePagedLOD;
+
+		//Output stuff
+		std::string m_SavePath;
+		std::string m_FilenamePrefix;
+		std::string m_SaveExt;
+	};
+}
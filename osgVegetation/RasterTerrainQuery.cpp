@@ -0,0 +1,85 @@
+#include "RasterTerrainQuery.h"
+#include <osg/Math>
+#include <cmath>
+
+namespace osgVegetation
+{
+	RasterTerrainQuery::RasterTerrainQuery(const CoverageData &cd) : m_ColorFilter(TF_NEAREST),
+		m_CoverageData(cd)
+	{
+
+	}
+
+	bool RasterTerrainQuery::getTerrainData(osg::Vec3d& location, osg::Vec4 &color, std::string &coverage_name, CoverageColor &coverage_color, osg::Vec3d &inter)
+	{
+		if (!m_HeightLayer.valid())
+			OSGV_EXCEPT(std::string("RasterTerrainQuery::getTerrainData - No height raster provided").c_str());
+
+		double x, y;
+		if (!m_HeightLayer.getTexelCoord(location, x, y))
+			return false;
+
+		const float height = m_HeightLayer.Raster->getColor(x, y, TF_BILINEAR).r();
+		//NaN is used to mark missing data (see TerrainSampleCache)
+		if (osg::isNaN(height))
+			return false;
+		inter.set(location.x(), location.y(), height);
+
+		color.set(1, 1, 1, 1);
+		if (m_ColorLayer.valid() && m_ColorLayer.getTexelCoord(location, x, y))
+			color = m_ColorLayer.Raster->getColor(x, y, m_ColorFilter);
+
+		if (m_LandcoverLayer.valid())
+		{
+			coverage_name = "";
+			coverage_color = CoverageColor(0, 0, 0, 0);
+			if (m_LandcoverLayer.getTexelCoord(location, x, y))
+			{
+				coverage_color = m_LandcoverLayer.Raster->getColor(x, y, TF_NEAREST);
+				coverage_name = m_CoverageData.getCoverageMaterialName(_getLandcoverID(coverage_color));
+			}
+		}
+		else
+		{
+			coverage_color = color;
+			coverage_name = m_CoverageData.getCoverageMaterialName(coverage_color);
+		}
+		return true;
+	}
+
+	bool RasterTerrainQuery::getCoverage(const osg::Vec3d &location, std::string &coverage_name)
+	{
+		if (!m_LandcoverLayer.valid())
+			return false;
+
+		coverage_name = "";
+		double x, y;
+		if (m_LandcoverLayer.getTexelCoord(location, x, y))
+			coverage_name = m_CoverageData.getCoverageMaterialName(_getLandcoverID(m_LandcoverLayer.Raster->getColor(x, y, TF_NEAREST)));
+		return true;
+	}
+
+	int RasterTerrainQuery::_getLandcoverID(const osg::Vec4 &value) const
+	{
+		//8-bit rasters are normalized by the texel fetch
+		if (m_LandcoverLayer.Raster->getDataType() == GL_UNSIGNED_BYTE)
+			return static_cast<int>(value.r() * 255.0f + 0.5f);
+		return static_cast<int>(floor(value.r() + 0.5f));
+	}
+
+	osg::BoundingBoxd RasterTerrainQuery::getBoundingBox() const
+	{
+		osg::BoundingBoxd bb;
+		if (m_HeightLayer.valid())
+		{
+			const TiledRaster* raster = m_HeightLayer.Raster.get();
+			bb.set(m_HeightLayer.Origin.x(),
+				m_HeightLayer.Origin.y(),
+				raster->getMinValue(),
+				m_HeightLayer.Origin.x() + m_HeightLayer.CellSize.x() * raster->getWidth(),
+				m_HeightLayer.Origin.y() + m_HeightLayer.CellSize.y() * raster->getHeight(),
+				raster->getMaxValue());
+		}
+		return bb;
+	}
+}
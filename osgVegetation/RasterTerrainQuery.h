@@ -0,0 +1,103 @@
+#pragma once
+#include "Common.h"
+#include <osg/Vec2d>
+#include <osg/Vec3d>
+#include <osg/Vec4>
+#include <osg/BoundingBox>
+#include <osg/ref_ptr>
+#include "ITerrainQuery.h"
+#include "CoverageColor.h"
+#include "CoverageData.h"
+#include "TiledRaster.h"
+
+namespace osgVegetation
+{
+	/**
+		Georeferenced raster, texel (0,0) cover the area [Origin, Origin + CellSize]
+	*/
+	struct RasterLayer
+	{
+		RasterLayer() : Origin(0, 0), CellSize(1, 1) {}
+		RasterLayer(TiledRaster* raster, const osg::Vec2d &origin, const osg::Vec2d &cell_size) : Raster(raster),
+			Origin(origin),
+			CellSize(cell_size) {}
+
+		bool valid() const {return Raster.valid();}
+
+		/**
+			Convert world xy to continuous texel coordinate (texel centers at integer coordinates)
+			@return false if location is outside raster extent
+		*/
+		bool getTexelCoord(const osg::Vec3d &location, double &x, double &y) const
+		{
+			x = (location.x() - Origin.x()) / CellSize.x() - 0.5;
+			y = (location.y() - Origin.y()) / CellSize.y() - 0.5;
+			return x >= -0.5 && y >= -0.5 && x <= Raster->getWidth() - 0.5 && y <= Raster->getHeight() - 0.5;
+		}
+
+		osg::ref_ptr<TiledRaster> Raster;
+		osg::Vec2d Origin;
+		osg::Vec2d CellSize;
+	};
+
+	/**
+		Terrain query that sample height, landcover and color rasters directly without any scene graph.
+		Heights are bilinear interpolated, landcover ids are mapped to coverage materials by
+		CoverageMaterial::ID. If no landcover raster is provided the coverage material is
+		resolved from the color raster in the same way as TerrainQuery does without coverage texture.
+	*/
+	class osgvExport RasterTerrainQuery : public ITerrainQuery
+	{
+	public:
+		RasterTerrainQuery(const CoverageData &cd);
+
+		//ITerrainQuery interface
+		/**
+			Get terrain data for provided location, return false if location is outside height raster
+			or if height is missing (NaN)
+		*/
+		bool getTerrainData(osg::Vec3d& location, osg::Vec4 &texture_color, std::string &coverage_name, CoverageColor &coverage_color, osg::Vec3d &inter);
+
+		/**
+			Get coverage from landcover raster, return false if no landcover raster is provided
+		*/
+		bool getCoverage(const osg::Vec3d &location, std::string &coverage_name);
+	public:
+		/**
+			Set elevation raster (required), first component is used as height.
+			Load 8-bit DEMs with TiledRaster::load raw_values, L8 rasters are normalized to 0-1.
+		*/
+		void setHeightLayer(const RasterLayer &layer) {m_HeightLayer=layer;}
+		const RasterLayer& getHeightLayer() const {return m_HeightLayer;}
+
+		/**
+			Set landcover id raster (optional), 8-bit rasters are expected to hold id in range 0-255
+		*/
+		void setLandcoverLayer(const RasterLayer &layer) {m_LandcoverLayer=layer;}
+		const RasterLayer& getLandcoverLayer() const {return m_LandcoverLayer;}
+
+		/**
+			Set color raster (optional), white is returned if not provided.
+		*/
+		void setColorLayer(const RasterLayer &layer) {m_ColorLayer=layer;}
+		const RasterLayer& getColorLayer() const {return m_ColorLayer;}
+
+		/**
+			Set texel filter used for color lookups, default to TF_NEAREST
+		*/
+		void setColorFilter(TexelFilter value) {m_ColorFilter=value;}
+		TexelFilter getColorFilter() const {return m_ColorFilter;}
+
+		/**
+			Get extent of height raster, z range is set from min/max height.
+		*/
+		osg::BoundingBoxd getBoundingBox() const;
+	private:
+		int _getLandcoverID(const osg::Vec4 &value) const;
+		RasterLayer m_HeightLayer;
+		RasterLayer m_LandcoverLayer;
+		RasterLayer m_ColorLayer;
+		TexelFilter m_ColorFilter;
+		CoverageData m_CoverageData;
+	};
+}
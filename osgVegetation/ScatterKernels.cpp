@@ -0,0 +1,254 @@
+#include "ScatterKernels.h"
+#include "BillboardLayer.h"
+#ifdef OSGV_USE_AVX2
+	#include <immintrin.h>
+#elif defined(OSGV_USE_SSE2)
+	#include <emmintrin.h>
+#endif
+
+namespace osgVegetation
+{
+	namespace
+	{
+		//maps upper 24 bits to [0,1)
+		const float UNIT_SCALE = 1.0f / 16777216.0f;
+
+		inline unsigned int mixBits(unsigned int h)
+		{
+			h ^= h >> 16;
+			h *= 0x85ebca6bu;
+			h ^= h >> 13;
+			h *= 0xc2b2ae35u;
+			h ^= h >> 16;
+			return h;
+		}
+
+		/**
+			out[i] = a[i]*b[i]
+		*/
+		void multiply(const float* a, const float* b, float* out, unsigned int n)
+		{
+			unsigned int i = 0;
+#ifdef OSGV_USE_AVX2
+			for (; i + 8 <= n; i += 8)
+				_mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+#elif defined(OSGV_USE_SSE2)
+			for (; i + 4 <= n; i += 4)
+				_mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+#endif
+			for (; i < n; i++)
+				out[i] = a[i] * b[i];
+		}
+
+		/**
+			out[i] = terrain[i]*ratio*intensity[i] + (1-ratio)*intensity[i]
+		*/
+		void blend(const float* terrain, const float* intensity, float ratio, float* out, unsigned int n)
+		{
+			const float inv_ratio = 1.0f - ratio;
+			unsigned int i = 0;
+#ifdef OSGV_USE_AVX2
+			const __m256 r = _mm256_set1_ps(ratio);
+			const __m256 ir = _mm256_set1_ps(inv_ratio);
+			for (; i + 8 <= n; i += 8)
+			{
+				const __m256 t = _mm256_loadu_ps(terrain + i);
+				const __m256 in = _mm256_loadu_ps(intensity + i);
+				_mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_mul_ps(t, _mm256_mul_ps(r, in)), _mm256_mul_ps(in, ir)));
+			}
+#elif defined(OSGV_USE_SSE2)
+			const __m128 r = _mm_set1_ps(ratio);
+			const __m128 ir = _mm_set1_ps(inv_ratio);
+			for (; i + 4 <= n; i += 4)
+			{
+				const __m128 t = _mm_loadu_ps(terrain + i);
+				const __m128 in = _mm_loadu_ps(intensity + i);
+				_mm_storeu_ps(out + i, _mm_add_ps(_mm_mul_ps(t, _mm_mul_ps(r, in)), _mm_mul_ps(in, ir)));
+			}
+#endif
+			for (; i < n; i++)
+				out[i] = terrain[i] * (ratio * intensity[i]) + intensity[i] * inv_ratio;
+		}
+
+		/**
+			Replace rgb with (r+g+b)/3
+		*/
+		void toIntensity(float* r, float* g, float* b, unsigned int n)
+		{
+			const float third = 1.0f / 3.0f;
+			unsigned int i = 0;
+#ifdef OSGV_USE_AVX2
+			const __m256 t = _mm256_set1_ps(third);
+			for (; i + 8 <= n; i += 8)
+			{
+				const __m256 sum = _mm256_add_ps(_mm256_add_ps(_mm256_loadu_ps(r + i), _mm256_loadu_ps(g + i)), _mm256_loadu_ps(b + i));
+				const __m256 value = _mm256_mul_ps(sum, t);
+				_mm256_storeu_ps(r + i, value);
+				_mm256_storeu_ps(g + i, value);
+				_mm256_storeu_ps(b + i, value);
+			}
+#elif defined(OSGV_USE_SSE2)
+			const __m128 t = _mm_set1_ps(third);
+			for (; i + 4 <= n; i += 4)
+			{
+				const __m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(r + i), _mm_loadu_ps(g + i)), _mm_loadu_ps(b + i));
+				const __m128 value = _mm_mul_ps(sum, t);
+				_mm_storeu_ps(r + i, value);
+				_mm_storeu_ps(g + i, value);
+				_mm_storeu_ps(b + i, value);
+			}
+#endif
+			for (; i < n; i++)
+			{
+				const float value = (r[i] + g[i] + b[i]) * third;
+				r[i] = value;
+				g[i] = value;
+				b[i] = value;
+			}
+		}
+	}
+
+	BatchRandom::BatchRandom(unsigned int seed)
+	{
+		for (int lane = 0; lane < NUM_LANES; lane++)
+		{
+			for (int w = 0; w < 4; w++)
+				m_State[w][lane] = mixBits(seed + 0x9e3779b9u * static_cast<unsigned int>(lane * 4 + w + 1));
+			//all zero state is a fixed point
+			if ((m_State[0][lane] | m_State[1][lane] | m_State[2][lane] | m_State[3][lane]) == 0)
+				m_State[0][lane] = 1;
+		}
+	}
+
+	void BatchRandom::_next(float min_value, float range, float* out)
+	{
+#ifdef OSGV_USE_AVX2
+		__m256i s0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(m_State[0]));
+		__m256i s1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(m_State[1]));
+		__m256i s2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(m_State[2]));
+		__m256i s3 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(m_State[3]));
+		const __m256i result = _mm256_add_epi32(s0, s3);
+		const __m256i t = _mm256_slli_epi32(s1, 9);
+		s2 = _mm256_xor_si256(s2, s0);
+		s3 = _mm256_xor_si256(s3, s1);
+		s1 = _mm256_xor_si256(s1, s2);
+		s0 = _mm256_xor_si256(s0, s3);
+		s2 = _mm256_xor_si256(s2, t);
+		s3 = _mm256_or_si256(_mm256_slli_epi32(s3, 11), _mm256_srli_epi32(s3, 21));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(m_State[0]), s0);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(m_State[1]), s1);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(m_State[2]), s2);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(m_State[3]), s3);
+		const __m256 u = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(result, 8)), _mm256_set1_ps(UNIT_SCALE));
+		_mm256_storeu_ps(out, _mm256_add_ps(_mm256_set1_ps(min_value), _mm256_mul_ps(_mm256_set1_ps(range), u)));
+#elif defined(OSGV_USE_SSE2)
+		for (int half = 0; half < NUM_LANES; half += 4)
+		{
+			__m128i s0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(m_State[0] + half));
+			__m128i s1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(m_State[1] + half));
+			__m128i s2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(m_State[2] + half));
+			__m128i s3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(m_State[3] + half));
+			const __m128i result = _mm_add_epi32(s0, s3);
+			const __m128i t = _mm_slli_epi32(s1, 9);
+			s2 = _mm_xor_si128(s2, s0);
+			s3 = _mm_xor_si128(s3, s1);
+			s1 = _mm_xor_si128(s1, s2);
+			s0 = _mm_xor_si128(s0, s3);
+			s2 = _mm_xor_si128(s2, t);
+			s3 = _mm_or_si128(_mm_slli_epi32(s3, 11), _mm_srli_epi32(s3, 21));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(m_State[0] + half), s0);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(m_State[1] + half), s1);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(m_State[2] + half), s2);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(m_State[3] + half), s3);
+			const __m128 u = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(result, 8)), _mm_set1_ps(UNIT_SCALE));
+			_mm_storeu_ps(out + half, _mm_add_ps(_mm_set1_ps(min_value), _mm_mul_ps(_mm_set1_ps(range), u)));
+		}
+#else
+		for (int lane = 0; lane < NUM_LANES; lane++)
+		{
+			unsigned int& s0 = m_State[0][lane];
+			unsigned int& s1 = m_State[1][lane];
+			unsigned int& s2 = m_State[2][lane];
+			unsigned int& s3 = m_State[3][lane];
+			const unsigned int result = s0 + s3;
+			const unsigned int t = s1 << 9;
+			s2 ^= s0;
+			s3 ^= s1;
+			s1 ^= s2;
+			s0 ^= s3;
+			s2 ^= t;
+			s3 = (s3 << 11) | (s3 >> 21);
+			const float u = static_cast<float>(static_cast<int>(result >> 8)) * UNIT_SCALE;
+			out[lane] = min_value + range * u;
+		}
+#endif
+	}
+
+	void BatchRandom::uniform(float min_value, float max_value, float* out, unsigned int n)
+	{
+		const float range = max_value - min_value;
+		unsigned int i = 0;
+		for (; i + NUM_LANES <= n; i += NUM_LANES)
+			_next(min_value, range, out + i);
+		if (i < n)
+		{
+			float tail[NUM_LANES];
+			_next(min_value, range, tail);
+			for (unsigned int j = 0; i + j < n; j++)
+				out[i + j] = tail[j];
+		}
+	}
+
+	void BillboardAttributeBatch::clear()
+	{
+		TerrainR.clear();
+		TerrainG.clear();
+		TerrainB.clear();
+	}
+
+	void BillboardAttributeBatch::addSample(const osg::Vec4 &terrain_color)
+	{
+		TerrainR.push_back(terrain_color.r());
+		TerrainG.push_back(terrain_color.g());
+		TerrainB.push_back(terrain_color.b());
+	}
+
+	void ScatterKernels::generatePositions(BatchRandom &rng, float size_x, float size_y, unsigned int n, CandidateBatch &candidates)
+	{
+		candidates.X.resize(n);
+		candidates.Y.resize(n);
+		if (n == 0)
+			return;
+		rng.uniform(0.0f, size_x, &candidates.X[0], n);
+		rng.uniform(0.0f, size_y, &candidates.Y[0], n);
+	}
+
+	void ScatterKernels::synthesizeBillboardAttributes(BatchRandom &rng, const BillboardLayer &layer, BillboardAttributeBatch &batch)
+	{
+		const unsigned int n = batch.size();
+		batch.Width.resize(n);
+		batch.Height.resize(n);
+		batch.ColorR.resize(n);
+		batch.ColorG.resize(n);
+		batch.ColorB.resize(n);
+		batch.Scale.resize(n);
+		batch.Intensity.resize(n);
+		if (n == 0)
+			return;
+
+		rng.uniform(layer.ColorIntensity.x(), layer.ColorIntensity.y(), &batch.Intensity[0], n);
+		rng.uniform(layer.Scale.x(), layer.Scale.y(), &batch.Scale[0], n);
+		rng.uniform(layer.Width.x(), layer.Width.y(), &batch.Width[0], n);
+		rng.uniform(layer.Height.x(), layer.Height.y(), &batch.Height[0], n);
+		multiply(&batch.Width[0], &batch.Scale[0], &batch.Width[0], n);
+		multiply(&batch.Height[0], &batch.Scale[0], &batch.Height[0], n);
+
+		if (layer.UseTerrainIntensity)
+			toIntensity(&batch.TerrainR[0], &batch.TerrainG[0], &batch.TerrainB[0], n);
+
+		const float ratio = static_cast<float>(layer.TerrainColorRatio);
+		blend(&batch.TerrainR[0], &batch.Intensity[0], ratio, &batch.ColorR[0], n);
+		blend(&batch.TerrainG[0], &batch.Intensity[0], ratio, &batch.ColorG[0], n);
+		blend(&batch.TerrainB[0], &batch.Intensity[0], ratio, &batch.ColorB[0], n);
+	}
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include "Common.h"
+#include <osg/Vec4>
+#include <vector>
+
+namespace osgVegetation
+{
+	struct BillboardLayer;
+
+	/**
+		Random number generator with eight independent xoshiro128+ streams (lanes) that are
+		advanced in parallel, ie. one AVX2 register or two SSE2 registers per state word.
+		The scalar fallback advance the same lanes so all code paths produce identical sequences.
+	*/
+	class osgvExport BatchRandom
+	{
+	public:
+		enum {NUM_LANES = 8};
+
+		BatchRandom(unsigned int seed);
+
+		/**
+			Fill out with n uniform numbers in [min_value, max_value). Numbers are consumed in
+			blocks of NUM_LANES, i.e. the tail of the last block is discarded.
+		*/
+		void uniform(float min_value, float max_value, float* out, unsigned int n);
+	private:
+		//advance all lanes and write NUM_LANES numbers to out
+		void _next(float min_value, float range, float* out);
+		//state word major, lane minor
+		unsigned int m_State[4][NUM_LANES];
+	};
+
+	/**
+		Candidate positions relative to tile origin, structure of arrays
+	*/
+	struct CandidateBatch
+	{
+		std::vector<float> X;
+		std::vector<float> Y;
+	};
+
+	/**
+		Per-instance billboard attributes for a batch of accepted samples, structure of arrays.
+		The caller add terrain colors (addSample), synthesizeBillboardAttributes fill the rest.
+	*/
+	struct BillboardAttributeBatch
+	{
+		//input
+		std::vector<float> TerrainR;
+		std::vector<float> TerrainG;
+		std::vector<float> TerrainB;
+
+		//output
+		std::vector<float> Width;
+		std::vector<float> Height;
+		std::vector<float> ColorR;
+		std::vector<float> ColorG;
+		std::vector<float> ColorB;
+
+		//intermediate
+		std::vector<float> Scale;
+		std::vector<float> Intensity;
+
+		void clear();
+		void addSample(const osg::Vec4 &terrain_color);
+		unsigned int size() const {return static_cast<unsigned int>(TerrainR.size());}
+		osg::Vec4 getColor(unsigned int i) const {return osg::Vec4(ColorR[i], ColorG[i], ColorB[i], 1.0f);}
+	};
+
+	/**
+		Batch kernels used by the scatterers, SSE2/AVX2 with scalar fallback (see Common.h).
+	*/
+	class osgvExport ScatterKernels
+	{
+	public:
+		/**
+			Generate n uniform candidate positions inside [0,size_x) x [0,size_y)
+		*/
+		static void generatePositions(BatchRandom &rng, float size_x, float size_y, unsigned int n, CandidateBatch &candidates);
+
+		/**
+			Generate width, height and color for all samples in batch using layer intervals,
+			same model as the scalar implementation: color = terrain*ratio*intensity + (1-ratio)*intensity
+		*/
+		static void synthesizeBillboardAttributes(BatchRandom &rng, const BillboardLayer &layer, BillboardAttributeBatch &batch);
+	};
+}
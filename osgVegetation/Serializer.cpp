@@ -2,12 +2,31 @@
 #include "tinyxml.h"
 #include "BillboardLayer.h"
 #include "CoverageData.h"
+#include "InstanceImporter.h"
+#include "PlacementRule.h"
 #include "TerrainQuery.h"
+#include "RasterTerrainQuery.h"
+#include "TerrainTileQuery.h"
+#include <osg/Math>
+#include <osgDB/FileUtils>
 #include <sstream>
+#include <map>
 #include <iterator>
 
 namespace osgVegetation
 {
+	namespace
+	{
+		TexelFilter parseTexelFilter(const std::string &filter)
+		{
+			if (filter == "NEAREST")
+				return TF_NEAREST;
+			else if (filter == "BILINEAR")
+				return TF_BILINEAR;
+			OSGV_EXCEPT(std::string("Serializer - Unknown ColorFilter:" + filter).c_str());
+		}
+	}
+
 	std::vector<BillboardData> Serializer::loadBillboardData(const std::string &filename) const
 	{
 		TiXmlDocument *xmlDoc = new TiXmlDocument(filename.c_str());
@@ -37,9 +56,58 @@ namespace osgVegetation
 		return bb_vector;
 	}
 
+	void Serializer::saveBillboardLayerSettings(const std::string &filename, const std::vector<BillboardData> &data, const std::string &out_filename) const
+	{
+		TiXmlDocument *xmlDoc = new TiXmlDocument(filename.c_str());
+		if (!xmlDoc->LoadFile())
+		{
+			delete xmlDoc;
+			OSGV_EXCEPT(std::string("Serializer::saveBillboardLayerSettings - Failed to load file:" + filename).c_str());
+		}
+		TiXmlElement *vd_elem = xmlDoc->FirstChildElement("VegetationData");
+		if (vd_elem == NULL)
+		{
+			delete xmlDoc;
+			OSGV_EXCEPT(std::string("Serializer::saveBillboardLayerSettings - Failed to find tag: VegetationData").c_str());
+		}
+
+		size_t data_index = 0;
+		TiXmlElement *bd_elem = vd_elem->FirstChildElement("BillboardData");
+		while (bd_elem && data_index < data.size())
+		{
+			const BillboardData& bb_data = data[data_index];
+			bd_elem->SetAttribute("TilePixelSize", bb_data.TilePixelSize);
+			TiXmlElement *elem = bd_elem->FirstChildElement("BillboardLayers");
+			size_t layer_index = 0;
+			TiXmlElement *bl_elem = elem ? elem->FirstChildElement("BillboardLayer") : NULL;
+			while (bl_elem && layer_index < bb_data.Layers.size())
+			{
+				bl_elem->SetDoubleAttribute("MinTileSize", bb_data.Layers[layer_index].MinTileSize);
+				bl_elem->SetDoubleAttribute("Density", bb_data.Layers[layer_index].Density);
+				layer_index++;
+				bl_elem = bl_elem->NextSiblingElement("BillboardLayer");
+			}
+			if (layer_index != bb_data.Layers.size() || bl_elem)
+			{
+				delete xmlDoc;
+				OSGV_EXCEPT(std::string("Serializer::saveBillboardLayerSettings - Layers don't match file:" + filename).c_str());
+			}
+			data_index++;
+			bd_elem = bd_elem->NextSiblingElement("BillboardData");
+		}
+
+		const bool saved = xmlDoc->SaveFile(out_filename.c_str());
+		delete xmlDoc;
+		if (!saved)
+			OSGV_EXCEPT(std::string("Serializer::saveBillboardLayerSettings - Failed to save file:" + out_filename).c_str());
+	}
+
 	BillboardData Serializer::loadBillboardData(TiXmlElement *bd_elem) const
 	{
 		BillboardLayerVector layers;
+		//share masks and importers between layers using same file
+		std::map<std::string, osg::ref_ptr<VectorMask> > masks;
+		std::map<std::string, osg::ref_ptr<InstanceImporter> > importers;
 		TiXmlElement *elem = bd_elem->FirstChildElement("BillboardLayers");
 		if (elem)
 		{
@@ -78,6 +146,9 @@ namespace osgVegetation
 
 				bl_elem->QueryBoolAttribute("UseTerrainIntensity", &layer.UseTerrainIntensity);
 				bl_elem->QueryDoubleAttribute("TerrainColorRatio", &layer.TerrainColorRatio);
+				bl_elem->QueryDoubleAttribute("InteriorCullRadius", &layer.InteriorCullRadius);
+				layer.InteriorCullDistance = layer.MinTileSize;
+				bl_elem->QueryDoubleAttribute("InteriorCullDistance", &layer.InteriorCullDistance);
 
 
 				if (!bl_elem->Attribute("CoverageMaterials"))
@@ -89,6 +160,42 @@ namespace osgVegetation
 				std::istream_iterator<std::string> begin(ss);
 				std::istream_iterator<std::string> end;
 				layer.CoverageMaterials = std::vector<std::string>(begin, end);
+
+				if (bl_elem->Attribute("ExclusionMask"))
+				{
+					const std::string mask_file = bl_elem->Attribute("ExclusionMask");
+					if (!masks[mask_file].valid())
+						masks[mask_file] = VectorMask::load(mask_file);
+					layer.ExclusionMask = masks[mask_file];
+				}
+
+				if (bl_elem->Attribute("InclusionMask"))
+				{
+					const std::string mask_file = bl_elem->Attribute("InclusionMask");
+					if (!masks[mask_file].valid())
+						masks[mask_file] = VectorMask::load(mask_file);
+					layer.InclusionMask = masks[mask_file];
+				}
+
+				if (bl_elem->Attribute("ImportFile"))
+				{
+					const std::string import_file = bl_elem->Attribute("ImportFile");
+					if (!importers[import_file].valid())
+					{
+						//bucket size default to layer tile size, memory budget in MB
+						double bucket_size = layer.MinTileSize;
+						int memory_budget = 256;
+						bl_elem->QueryDoubleAttribute("ImportBucketSize", &bucket_size);
+						bl_elem->QueryIntAttribute("ImportMemoryBudget", &memory_budget);
+						importers[import_file] = new InstanceImporter(import_file, bucket_size, static_cast<size_t>(memory_budget)*1024*1024);
+					}
+					layer.Import = importers[import_file];
+					bl_elem->QueryIntAttribute("ImportSpecies", &layer.ImportSpecies);
+					bl_elem->QueryBoolAttribute("RegroundImport", &layer.RegroundImport);
+				}
+
+				if (bl_elem->Attribute("Rule"))
+					layer.Rule = new PlacementRule(bl_elem->Attribute("Rule"));
 				layers.push_back(layer);
 				bl_elem = bl_elem->NextSiblingElement("BillboardLayer");
 			}
@@ -209,6 +316,26 @@ namespace osgVegetation
 		CoverageData cd = loadCoverageData(cd_elem);
 
 		//Here we can add option to load other terrain query implementations
+		//Intersection is default, other queries must be selected explicitly
+		const std::string type = tq_elem->Attribute("Type") ? tq_elem->Attribute("Type") : "Intersection";
+
+		if (type == "Raster" || type == "TerrainTile")
+		{
+			osg::ref_ptr<ITerrainQuery> query;
+			if (type == "Raster")
+				query = loadRasterTerrainQuery(tq_elem, cd);
+			else
+				query = loadTerrainTileQuery(terrain, tq_elem, cd);
+			xmlDoc->Clear();
+			delete xmlDoc;
+			return query;
+		}
+		else if (type != "Intersection")
+			OSGV_EXCEPT(std::string("Serializer::loadTerrainQuery - Unknown Type:" + type).c_str());
+
+		if (terrain == NULL)
+			OSGV_EXCEPT(std::string("Serializer::loadTerrainQuery - No terrain provided, terrain is required by Intersection terrain query").c_str());
+
 		TerrainQuery* tq = new TerrainQuery(terrain, cd);
 
 		if (tq_elem->Attribute("CoverageTextureSuffix"))
@@ -238,6 +365,70 @@ namespace osgVegetation
 			tq->setFlipColorCoordinates(flip);
 		}
 
+		if (tq_elem->Attribute("DecodeCompressedTextures"))
+		{
+			bool decode = true;
+			tq_elem->QueryBoolAttribute("DecodeCompressedTextures", &decode);
+			tq->setDecodeCompressedTextures(decode);
+		}
+
+		if (tq_elem->Attribute("ColorFilter"))
+			tq->setColorFilter(parseTexelFilter(tq_elem->Attribute("ColorFilter")));
+
+		if (tq_elem->Attribute("UseSpatialIndex"))
+		{
+			bool use_index = false;
+			tq_elem->QueryBoolAttribute("UseSpatialIndex", &use_index);
+			tq->setUseSpatialIndex(use_index);
+		}
+
+		if (tq_elem->Attribute("PrefetchQueueSize"))
+		{
+			int queue_size = 0;
+			tq_elem->QueryIntAttribute("PrefetchQueueSize", &queue_size);
+			tq->setPrefetchQueueSize(static_cast<unsigned int>(osg::maximum(queue_size, 0)));
+		}
+
+		if (tq_elem->Attribute("MatchGroundResolution"))
+		{
+			bool match_resolution = false;
+			tq_elem->QueryBoolAttribute("MatchGroundResolution", &match_resolution);
+			tq->setMatchGroundResolution(match_resolution);
+		}
+
+		if (tq_elem->Attribute("TerrainTileSamples"))
+		{
+			int tile_samples = 0;
+			tq_elem->QueryIntAttribute("TerrainTileSamples", &tile_samples);
+			tq->setTerrainTileSamples(static_cast<unsigned int>(osg::maximum(tile_samples, 0)));
+		}
+
+		if (tq_elem->Attribute("SnapToFinest"))
+		{
+			bool snap = false;
+			tq_elem->QueryBoolAttribute("SnapToFinest", &snap);
+			tq->setSnapToFinest(snap);
+		}
+
+		if (tq_elem->Attribute("CoverageTexture"))
+			tq->setCoverageTexture(tq_elem->Attribute("CoverageTexture"));
+
+		//georeferenced coverage textures, File default to global coverage texture
+		TiXmlElement *ce_elem = tq_elem->FirstChildElement("CoverageExtent");
+		while (ce_elem)
+		{
+			const std::string texture = ce_elem->Attribute("File") ? ce_elem->Attribute("File") : tq->getCoverageTexture();
+			if (texture == "")
+				OSGV_EXCEPT(std::string("Serializer::loadTerrainQuery - CoverageExtent without File and no CoverageTexture provided").c_str());
+			double min_x = 0, min_y = 0, max_x = 0, max_y = 0;
+			ce_elem->QueryDoubleAttribute("MinX", &min_x);
+			ce_elem->QueryDoubleAttribute("MinY", &min_y);
+			ce_elem->QueryDoubleAttribute("MaxX", &max_x);
+			ce_elem->QueryDoubleAttribute("MaxY", &max_y);
+			tq->addCoverageExtent(texture, osg::BoundingBoxd(min_x, min_y, 0, max_x, max_y, 0));
+			ce_elem = ce_elem->NextSiblingElement("CoverageExtent");
+		}
+
 		xmlDoc->Clear();
 		// Delete our allocated document and return data
 		delete xmlDoc;
@@ -245,6 +436,70 @@ namespace osgVegetation
 	}
 
 
+	osg::ref_ptr<RasterTerrainQuery> Serializer::loadRasterTerrainQuery(TiXmlElement *tq_elem, const CoverageData &cd) const
+	{
+		osg::ref_ptr<RasterTerrainQuery> rtq = new RasterTerrainQuery(cd);
+
+		TiXmlElement *height_elem = tq_elem->FirstChildElement("HeightRaster");
+		if (height_elem == NULL)
+			OSGV_EXCEPT(std::string("Serializer::loadRasterTerrainQuery - Failed to find tag: HeightRaster").c_str());
+		//heights are raw values, ie. 8-bit DEMs are not normalized
+		rtq->setHeightLayer(loadRasterLayer(height_elem, true));
+
+		if (TiXmlElement *landcover_elem = tq_elem->FirstChildElement("LandcoverRaster"))
+			rtq->setLandcoverLayer(loadRasterLayer(landcover_elem));
+
+		if (TiXmlElement *color_elem = tq_elem->FirstChildElement("ColorRaster"))
+			rtq->setColorLayer(loadRasterLayer(color_elem));
+
+		if (tq_elem->Attribute("ColorFilter"))
+			rtq->setColorFilter(parseTexelFilter(tq_elem->Attribute("ColorFilter")));
+		return rtq;
+	}
+
+	osg::ref_ptr<TerrainTileQuery> Serializer::loadTerrainTileQuery(osg::Node* terrain, TiXmlElement *tq_elem, const CoverageData &cd) const
+	{
+		if (terrain == NULL)
+			OSGV_EXCEPT(std::string("Serializer::loadTerrainTileQuery - No terrain provided").c_str());
+
+		osg::ref_ptr<TerrainTileQuery> ttq = new TerrainTileQuery(terrain, cd);
+		int color_layer = 0;
+		if (tq_elem->QueryIntAttribute("ColorLayer", &color_layer) == TIXML_SUCCESS)
+			ttq->setColorLayer(color_layer);
+
+		int coverage_layer = -1;
+		if (tq_elem->QueryIntAttribute("CoverageLayer", &coverage_layer) == TIXML_SUCCESS)
+			ttq->setCoverageLayer(coverage_layer);
+
+		if (tq_elem->Attribute("ColorFilter"))
+			ttq->setColorFilter(parseTexelFilter(tq_elem->Attribute("ColorFilter")));
+		return ttq;
+	}
+
+	RasterLayer Serializer::loadRasterLayer(TiXmlElement *rl_elem, bool raw_values) const
+	{
+		if (!rl_elem->Attribute("File"))
+			OSGV_EXCEPT(std::string("Serializer::loadRasterLayer - Failed to find attribute: File").c_str());
+		std::string filename = osgDB::findDataFile(rl_elem->Attribute("File"));
+		if (filename == "")
+			filename = rl_elem->Attribute("File");
+
+		double origin_x = 0, origin_y = 0, cell_size = 1;
+		rl_elem->QueryDoubleAttribute("OriginX", &origin_x);
+		rl_elem->QueryDoubleAttribute("OriginY", &origin_y);
+		rl_elem->QueryDoubleAttribute("CellSize", &cell_size);
+		double cell_size_y = cell_size;
+		rl_elem->QueryDoubleAttribute("CellSizeY", &cell_size_y);
+		if (cell_size <= 0 || cell_size_y <= 0)
+			OSGV_EXCEPT(std::string("Serializer::loadRasterLayer - CellSize must be positive:" + filename).c_str());
+
+		int tile_size = 256;
+		rl_elem->QueryIntAttribute("TileSize", &tile_size);
+
+		osg::ref_ptr<TiledRaster> raster = TiledRaster::load(filename, static_cast<unsigned int>(tile_size), raw_values);
+		return RasterLayer(raster.get(), osg::Vec2d(origin_x, origin_y), osg::Vec2d(cell_size, cell_size_y));
+	}
+
 	CoverageData Serializer::loadCoverageData(TiXmlElement *cd_elem) const
 	{
 		CoverageData data;
@@ -266,9 +521,12 @@ namespace osgVegetation
 			mat_elem->QueryIntAttribute("tb", &tb);
 			mat_elem->QueryIntAttribute("ta", &ta);
 
+			int id = -1;
+			mat_elem->QueryIntAttribute("ID", &id);
+
 			const CoverageColor color(float(r) / 255.0, float(g) / 255.0, float(b) / 255.0, float(a) / 255.0);
 			const CoverageColor tolerance(float(tr) / 255.0, float(tg) / 255.0, float(tb) / 255.0, float(ta) / 255.0);
-			data.CoverageMaterials.push_back(CoverageData::CoverageMaterial(name, color, tolerance));
+			data.CoverageMaterials.push_back(CoverageData::CoverageMaterial(name, color, tolerance, id));
 			mat_elem = mat_elem->NextSiblingElement("CoverageMaterial");
 		}
 		return data;
@@ -10,6 +10,9 @@ class TiXmlElement;
 namespace osgVegetation
 {
 	class ITerrainQuery;
+	class RasterTerrainQuery;
+	class TerrainTileQuery;
+	struct RasterLayer;
 
 	class osgvExport Serializer
 	{
@@ -19,7 +22,15 @@ namespace osgVegetation
 		virtual ~Serializer(){}
 		std::vector<BillboardData> loadBillboardData(const std::string &filename) const;
 		BillboardData loadBillboardData(TiXmlElement *bd_elem) const;
+		/**
+			Write layer tile sizes, densities and tile pixel sizes back to billboard config,
+			data must be loaded from filename (same order). Other settings are kept as is.
+		*/
+		void saveBillboardLayerSettings(const std::string &filename, const std::vector<BillboardData> &data, const std::string &out_filename) const;
 		osg::ref_ptr<ITerrainQuery> loadTerrainQuery(osg::Node* terrain, const std::string &filename) const;
+		osg::ref_ptr<RasterTerrainQuery> loadRasterTerrainQuery(TiXmlElement *tq_elem, const CoverageData &cd) const;
+		RasterLayer loadRasterLayer(TiXmlElement *rl_elem, bool raw_values = false) const;
+		osg::ref_ptr<TerrainTileQuery> loadTerrainTileQuery(osg::Node* terrain, TiXmlElement *tq_elem, const CoverageData &cd) const;
 		CoverageData loadCoverageData(TiXmlElement *cd_elem) const;
 		EnvironmentSettings loadEnvironmentSettings(const std::string &filename) const;
 		EnvironmentSettings loadEnvironmentSettingsImpl(TiXmlElement *es_elem) const;
@@ -11,8 +11,11 @@
 #include <osgDB/FileNameUtils>
 #include <osgUtil/LineSegmentIntersector>
 #include <osgUtil/IntersectionVisitor>
-#include <osgSim/LineOfSight>
+#include <OpenThreads/Thread>
+#include <OpenThreads/Condition>
+#include <OpenThreads/ScopedLock>
 #include <iostream>
+#include <deque>
 #include "VegetationUtils.h"
 
 namespace osgVegetation
@@ -38,115 +41,562 @@ namespace osgVegetation
 		}
 	};
 
+	/**
+		Thread safe paged terrain cache shared by query and prefetch thread.
+		Nodes are never released during reads, only on explicit clear. Bounds of loaded
+		nodes are computed before they are published, intersection traversals from both
+		threads then only read the shared nodes.
+	*/
+	class TerrainTileCache : public osgUtil::IntersectionVisitor::ReadCallback
+	{
+	public:
+#if OSG_VERSION_GREATER_OR_EQUAL(3,5,1)
+		virtual osg::ref_ptr<osg::Node> readNodeFile(const std::string& filename)
+#else
+		virtual osg::Node* readNodeFile( const std::string& filename )
+#endif
+		{
+			{
+				OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_Mutex);
+				NodeMap::iterator iter = m_Nodes.find(filename);
+				if (iter != m_Nodes.end())
+					return iter->second.get();
+			}
+			//load without lock so that the other thread is not blocked
+			osg::ref_ptr<osg::Node> node = osgDB::readNodeFile(filename);
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_Mutex);
+			//keep first loaded node if both threads loaded the same file
+			std::pair<NodeMap::iterator, bool> result = m_Nodes.insert(std::make_pair(filename, node));
+			//bounds are lazily computed (also for drawables), compute them before the node is shared
+			if (result.second && node.valid())
+				node->getBound();
+			return result.first->second.get();
+		}
+
+		void clear()
+		{
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_Mutex);
+			m_Nodes.clear();
+		}
+
+		size_t getNumNodes()
+		{
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_Mutex);
+			return m_Nodes.size();
+		}
+	private:
+		typedef std::map<std::string, osg::ref_ptr<osg::Node> > NodeMap;
+		NodeMap m_Nodes;
+		OpenThreads::Mutex m_Mutex;
+	};
+
+	/**
+		Background thread that execute TerrainQuery prefetch requests
+	*/
+	class TerrainPrefetchThread : public OpenThreads::Thread
+	{
+	public:
+		TerrainPrefetchThread(TerrainQuery* tq) : m_TerrainQuery(tq),
+			m_Done(false)
+		{
+
+		}
+
+		void add(const osg::BoundingBoxd &bb, unsigned int max_queue_size)
+		{
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_Mutex);
+			m_Queue.push_back(bb);
+			//drop oldest requests, these tiles are most likely already processed
+			while (m_Queue.size() > max_queue_size)
+				m_Queue.pop_front();
+			m_Condition.signal();
+		}
+
+		void stop()
+		{
+			{
+				OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_Mutex);
+				m_Done = true;
+				m_Queue.clear();
+				m_Condition.broadcast();
+			}
+			join();
+		}
+
+		virtual void run()
+		{
+			while (true)
+			{
+				osg::BoundingBoxd bb;
+				{
+					OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_Mutex);
+					while (m_Queue.empty() && !m_Done)
+						m_Condition.wait(&m_Mutex);
+					if (m_Done)
+						return;
+					bb = m_Queue.front();
+					m_Queue.pop_front();
+				}
+				m_TerrainQuery->_prefetchTile(bb);
+			}
+		}
+	private:
+		TerrainQuery* m_TerrainQuery;
+		std::deque<osg::BoundingBoxd> m_Queue;
+		OpenThreads::Mutex m_Mutex;
+		OpenThreads::Condition m_Condition;
+		bool m_Done;
+	};
+
+	/**
+		Intersection visitor selecting level of detail from ground resolution, the coarsest LOD
+		child is used as long as its estimated resolution is finer than the target resolution.
+	*/
+	class ResolutionIntersectionVisitor : public osgUtil::IntersectionVisitor
+	{
+	public:
+		ResolutionIntersectionVisitor() : m_Resolution(0),
+			m_TileSamples(256)
+		{
+
+		}
+
+		void setResolution(double value) {m_Resolution = value;}
+		void setTileSamples(unsigned int value) {m_TileSamples = value;}
+
+		virtual void apply(osg::LOD& lod)
+		{
+			if (_useCoarsest(lod))
+				_traverseCoarsest(lod);
+			else
+				osgUtil::IntersectionVisitor::apply(lod);
+		}
+
+		virtual void apply(osg::PagedLOD& plod)
+		{
+			if (_useCoarsest(plod))
+				_traverseCoarsest(plod);
+			else
+				osgUtil::IntersectionVisitor::apply(plod);
+		}
+	private:
+		bool _useCoarsest(const osg::LOD& lod) const
+		{
+			if (m_Resolution <= 0 || m_TileSamples == 0 || lod.getNumChildren() == 0)
+				return false;
+			//estimate coarse child resolution from node extent
+			const double coarse_resolution = 2.0 * lod.getBound().radius() / static_cast<double>(m_TileSamples);
+			return coarse_resolution <= m_Resolution;
+		}
+
+		void _traverseCoarsest(osg::LOD& lod)
+		{
+			if (!enter(lod))
+				return;
+			//only loaded children are considered, coarse levels are expected to be loaded
+			unsigned int coarsest = 0;
+			for (unsigned int i = 1; i < lod.getNumChildren(); i++)
+			{
+				const bool coarser = lod.getRangeMode() == osg::LOD::DISTANCE_FROM_EYE_POINT ?
+					lod.getMaxRange(i) > lod.getMaxRange(coarsest) : lod.getMinRange(i) < lod.getMinRange(coarsest);
+				if (coarser)
+					coarsest = i;
+			}
+			lod.getChild(coarsest)->accept(*this);
+			leave();
+		}
+		double m_Resolution;
+		unsigned int m_TileSamples;
+	};
+
 	TerrainQuery::TerrainQuery(osg::Node* terrain, const CoverageData &cd) : m_Terrain(terrain),
-		m_CoverageData(cd),
+		m_MeshCache(NULL),
+		m_PrefetchThread(NULL),
+		m_PrefetchQueueSize(0),
+		m_GroundResolution(0),
+		m_MatchGroundResolution(false),
+		m_TerrainTileSamples(256),
+		m_SnapToFinest(false),
+		m_LastCoverageExtent(0),
 		m_CoverageTextureSuffix("_coverage.png"),
+		m_ColorTextureSuffix(".rgb"),
+		m_CoverageData(cd),
 		m_FlipCoverageCoordinates(false),
 		m_FlipColorCoordinates(false),
-		m_ColorTextureSuffix(".rgb")
+		m_ColorFilter(TF_NEAREST),
+		m_DecodeCompressedTextures(true),
+		m_UseSpatialIndex(false)
 	{
-		m_MeshCache = new osgSim::DatabaseCacheReadCallback;
-		//m_MeshCache->setMaximumNumOfFilesToCache(50);
+		m_MeshCache = new TerrainTileCache;
 		m_IntersectionVisitor.setReadCallback(m_MeshCache);
 		m_IntersectionVisitor.setLODSelectionMode(osgUtil::IntersectionVisitor::USE_HIGHEST_LEVEL_OF_DETAIL);
+		m_ResolutionVisitor = new ResolutionIntersectionVisitor;
+		m_ResolutionVisitor->setReadCallback(m_MeshCache);
+		m_ResolutionVisitor->setLODSelectionMode(osgUtil::IntersectionVisitor::USE_HIGHEST_LEVEL_OF_DETAIL);
+	}
+
+	TerrainQuery::~TerrainQuery()
+	{
+		if (m_PrefetchThread)
+		{
+			m_PrefetchThread->stop();
+			delete m_PrefetchThread;
+		}
+	}
+
+	void TerrainQuery::prefetch(const osg::BoundingBoxd &bb)
+	{
+		if (m_PrefetchQueueSize == 0)
+			return;
+		if (m_PrefetchThread == NULL)
+		{
+			//compute lazy bounds of the terrain graph before it is traversed from two threads
+			m_Terrain->getBound();
+			m_PrefetchThread = new TerrainPrefetchThread(this);
+			m_PrefetchThread->start();
+		}
+		m_PrefetchThread->add(bb, m_PrefetchQueueSize);
+	}
+
+	void TerrainQuery::_prefetchTile(const osg::BoundingBoxd &bb)
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_PrefetchMutex);
+		osgUtil::IntersectionVisitor iv;
+		iv.setReadCallback(m_MeshCache);
+		iv.setLODSelectionMode(osgUtil::IntersectionVisitor::USE_HIGHEST_LEVEL_OF_DETAIL);
+
+		//sparse ray grid is enough to touch terrain pages and textures covering the tile
+		const int num_samples = 4;
+		for (int i = 0; i < num_samples; i++)
+		{
+			for (int j = 0; j < num_samples; j++)
+			{
+				const osg::Vec3d start_location(bb.xMin() + (bb.xMax() - bb.xMin()) * (i + 0.5) / num_samples,
+					bb.yMin() + (bb.yMax() - bb.yMin()) * (j + 0.5) / num_samples, -10000);
+				const osg::Vec3d end_location = start_location + osg::Vec3(0.0f, 0.0f, 20000);
+				osg::ref_ptr<osgUtil::LineSegmentIntersector> intersector = new osgUtil::LineSegmentIntersector(start_location, end_location);
+				iv.setIntersector(intersector.get());
+				m_Terrain->accept(iv);
+				if (!intersector->containsIntersections())
+					continue;
+
+				osg::Vec3 tc;
+				osg::Texture* texture = _getTexture(*intersector->getIntersections().begin(), tc);
+				if (texture && texture->getImage(0))
+				{
+					std::string color_filename;
+					std::string coverage_filename;
+					_getImageFilenames(texture->getImage(0), color_filename, coverage_filename);
+					if (color_filename != "")
+						_prefetchImage(color_filename);
+					if (coverage_filename != "")
+						_prefetchImage(coverage_filename);
+				}
+			}
+		}
+	}
+
+	void TerrainQuery::_prefetchImage(const std::string &filename)
+	{
+		{
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_ImageCacheMutex);
+			if (m_ImageCache.find(filename) != m_ImageCache.end())
+				return;
+		}
+		osg::ref_ptr<osg::Image> image = osgDB::readImageFile(filename);
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_ImageCacheMutex);
+		m_ImageCache.insert(std::make_pair(filename, image));
+	}
+
+	void TerrainQuery::_clearCaches()
+	{
+		//wait for any running prefetch request
+		OpenThreads::ScopedLock<OpenThreads::Mutex> prefetch_lock(m_PrefetchMutex);
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_ImageCacheMutex);
+		std::cout << "Image cache cleared\n";
+		m_ImageCache.clear();
+		m_SamplerCache.clear();
+		std::cout << "Clear DB cache\n";
+		m_MeshCache->clear();
 	}
 
 	bool TerrainQuery::getTerrainData(osg::Vec3d& location, osg::Vec4 &texture_color, std::string &coverage_name, CoverageColor &coverage_color, osg::Vec3d &inter)
+	{
+		if (m_MeshCache->getNumNodes() > 2000) //keep paged terrain memory bounded
+		{
+			OpenThreads::ScopedLock<OpenThreads::Mutex> prefetch_lock(m_PrefetchMutex);
+			m_MeshCache->clear();
+		}
+
+		osgUtil::IntersectionVisitor* iv = &m_IntersectionVisitor;
+		if (_useGroundResolution())
+		{
+			m_ResolutionVisitor->setResolution(m_GroundResolution);
+			m_ResolutionVisitor->setTileSamples(m_TerrainTileSamples);
+			iv = m_ResolutionVisitor.get();
+		}
+
+		osgUtil::LineSegmentIntersector::Intersection intersection;
+		if (_intersect(location, *iv, intersection))
+			return _processIntersection(intersection, texture_color, coverage_name, coverage_color, inter);
+		return false;
+	}
+
+	bool TerrainQuery::refineHeight(osg::Vec3d &position)
+	{
+		if (!m_SnapToFinest || !_useGroundResolution())
+			return true;
+
+		osgUtil::LineSegmentIntersector::Intersection intersection;
+		if (!_intersect(position, m_IntersectionVisitor, intersection))
+			return false;
+		position = intersection.getWorldIntersectPoint();
+		return true;
+	}
+
+	bool TerrainQuery::getTerrainNormal(const osg::Vec3d &location, double step, osg::Vec3d &normal)
+	{
+		osgUtil::IntersectionVisitor* iv = &m_IntersectionVisitor;
+		if (_useGroundResolution())
+		{
+			m_ResolutionVisitor->setResolution(osg::maximum(m_GroundResolution, step));
+			m_ResolutionVisitor->setTileSamples(m_TerrainTileSamples);
+			iv = m_ResolutionVisitor.get();
+		}
+
+		osgUtil::LineSegmentIntersector::Intersection intersection;
+		if (!_intersect(location, *iv, intersection))
+			return false;
+		normal = intersection.getWorldIntersectNormal();
+		normal.normalize();
+		return true;
+	}
+
+	bool TerrainQuery::getCoverage(const osg::Vec3d &location, std::string &coverage_name)
+	{
+		CoverageColor coverage_color;
+		if (!_sampleCoverageExtents(location, coverage_color))
+			return false;
+		coverage_name = m_CoverageData.getCoverageMaterialName(coverage_color);
+		return true;
+	}
+
+	void TerrainQuery::addCoverageExtent(const std::string &coverage_texture, const osg::BoundingBoxd &extent)
+	{
+		if (extent.xMax() <= extent.xMin() || extent.yMax() <= extent.yMin())
+			OSGV_EXCEPT(std::string("TerrainQuery::addCoverageExtent - Invalid extent for texture:" + coverage_texture).c_str());
+		CoverageExtent ce;
+		ce.Texture = coverage_texture;
+		ce.Extent = extent;
+		m_CoverageExtents.push_back(ce);
+	}
+
+	bool TerrainQuery::_sampleCoverageExtents(const osg::Vec3d &location, CoverageColor &coverage_color)
+	{
+		if (m_CoverageExtents.size() == 0)
+			return false;
+
+		const CoverageExtent* coverage_extent = NULL;
+		for (size_t i = 0; i < m_CoverageExtents.size() && coverage_extent == NULL; i++)
+		{
+			const size_t index = (m_LastCoverageExtent + i) % m_CoverageExtents.size();
+			const osg::BoundingBoxd& extent = m_CoverageExtents[index].Extent;
+			if (location.x() >= extent.xMin() && location.x() <= extent.xMax() &&
+				location.y() >= extent.yMin() && location.y() <= extent.yMax())
+			{
+				coverage_extent = &m_CoverageExtents[index];
+				m_LastCoverageExtent = index;
+			}
+		}
+		if (coverage_extent == NULL)
+			return false;
+
+		osg::Image* image = _loadImage(coverage_extent->Texture);
+		if (image == NULL)
+			return false;
+
+		const osg::BoundingBoxd& extent = coverage_extent->Extent;
+		osg::Vec2 coverage_tc((location.x() - extent.xMin()) / (extent.xMax() - extent.xMin()),
+			(location.y() - extent.yMin()) / (extent.yMax() - extent.yMin()));
+		if (m_FlipCoverageCoordinates)
+			coverage_tc.set(coverage_tc.x(), 1.0 - coverage_tc.y());
+		coverage_color = _getSampler(image, TF_NEAREST)->sample(coverage_tc);
+		return true;
+	}
+
+	bool TerrainQuery::_intersect(const osg::Vec3d &location, osgUtil::IntersectionVisitor &iv, osgUtil::LineSegmentIntersector::Intersection &result)
 	{
 		osg::Vec3d start_location(location.x(),location.y(), -10000);
-		osg::ref_ptr<osgUtil::LineSegmentIntersector> intersector =	new osgUtil::LineSegmentIntersector(start_location,start_location + osg::Vec3(0.0f,0.0f,20000));
-		m_IntersectionVisitor.setIntersector(intersector.get());
-		m_Terrain->accept(m_IntersectionVisitor);
+		const osg::Vec3d end_location = start_location + osg::Vec3(0.0f,0.0f,20000);
+		if (m_UseSpatialIndex)
+			return _intersectIndex(start_location, end_location, iv, result);
+
+		osg::ref_ptr<osgUtil::LineSegmentIntersector> intersector =	new osgUtil::LineSegmentIntersector(start_location, end_location);
+		iv.setIntersector(intersector.get());
+		m_Terrain->accept(iv);
 		if (intersector->containsIntersections())
 		{
-			osgUtil::LineSegmentIntersector::Intersections& intersections = intersector->getIntersections();
-			for(osgUtil::LineSegmentIntersector::Intersections::iterator itr = intersections.begin(); itr != intersections.end(); ++itr)
-			{
-				const osgUtil::LineSegmentIntersector::Intersection& intersection = *itr;
-				osg::Vec3 tc;
-				osg::Texture* texture = _getTexture(intersection,tc);
+			result = *intersector->getIntersections().begin();
+			return true;
+		}
+		return false;
+	}
+
+	bool TerrainQuery::_intersectIndex(const osg::Vec3d &start, const osg::Vec3d &end, osgUtil::IntersectionVisitor &iv, osgUtil::LineSegmentIntersector::Intersection &result)
+	{
+		if (!m_SpatialIndex.valid())
+		{
+			m_SpatialIndex = new TerrainSpatialIndex(m_Terrain);
+			std::cout << "TerrainQuery - Spatial index built with " << m_SpatialIndex->getNumEntries() << " entries\n";
+		}
 
-				if(texture && texture->getImage(0))
+		std::vector<const TerrainSpatialIndex::Entry*> entries;
+		m_SpatialIndex->query(start.x(), start.y(), entries);
+		bool found = false;
+		for (size_t i = 0; i < entries.size(); i++)
+		{
+			const TerrainSpatialIndex::Entry* entry = entries[i];
+			//intersect in entry local space, affine transforms preserve segment ratio
+			osg::Vec3d local_start = start;
+			osg::Vec3d local_end = end;
+			if (entry->InverseMatrix.valid())
+			{
+				local_start = start * (*entry->InverseMatrix);
+				local_end = end * (*entry->InverseMatrix);
+			}
+			osg::ref_ptr<osgUtil::LineSegmentIntersector> intersector = new osgUtil::LineSegmentIntersector(local_start, local_end);
+			iv.setIntersector(intersector.get());
+			entry->Node->accept(iv);
+			if (intersector->containsIntersections())
+			{
+				const osgUtil::LineSegmentIntersector::Intersection& intersection = *intersector->getIntersections().begin();
+				if (!found || intersection.ratio < result.ratio)
 				{
-					std::string tex_filename = osgDB::getSimpleFileName(texture->getImage(0)->getFileName());
-				    //check if dds, if so we will try to load alternative image file because we have no utils to decompress dds
-					if(osgDB::getFileExtension(tex_filename) == "dds")
+					result = intersection;
+					//convert intersection back to terrain space
+					osg::NodePath node_path = entry->ParentPath;
+					node_path.insert(node_path.end(), intersection.nodePath.begin(), intersection.nodePath.end());
+					result.nodePath = node_path;
+					if (entry->Matrix.valid())
 					{
-						tex_filename = osgDB::getNameLessExtension(tex_filename) + m_ColorTextureSuffix;
-
-						//std::cout << tex_filename <<"\n";
-						osg::Image* image = _loadImage(tex_filename);
-						if(image)
-						{
-							osg::Vec3 color_tc = tc;
-						if(m_FlipColorCoordinates)
-								color_tc.set(color_tc.x(),1.0 - color_tc.y(),color_tc.z());
-							texture_color = image->getColor(color_tc);
-					}
-					else
-							return false;
+						result.matrix = intersection.matrix.valid() ?
+							new osg::RefMatrix((*intersection.matrix) * (*entry->Matrix)) : entry->Matrix.get();
 					}
-					else
-						texture_color = texture->getImage(0)->getColor(tc);
+					found = true;
+				}
+			}
+		}
+		return found;
+	}
 
-					if (m_CoverageTexture != "" || m_CoverageTextureSuffix != "")
-					{
-						//get material texture
-						std::string mat_image_filename;
-						if (m_CoverageTexture != "")
-							mat_image_filename = m_CoverageTexture;
-						else
-							mat_image_filename = osgDB::getNameLessExtension(osgDB::getSimpleFileName(tex_filename)) + m_CoverageTextureSuffix;
-
-						osg::Image* image = _loadImage(mat_image_filename);
-						if(image)
-						{
-							osg::Vec3 coverage_tc = tc;
-						if (m_FlipCoverageCoordinates)
-								coverage_tc.set(coverage_tc.x(), 1.0 - coverage_tc.y(), coverage_tc.z());
-
-						//tc2 = osg::clampTo(tc2, osg::Vec3(0,0,0),osg::Vec3(1,1,1));
-						tc.set(osg::clampTo(static_cast<double>(tc.x()), 0.0, 1.0),
-							osg::clampTo(static_cast<double>(tc.y()), 0.0, 1.0), static_cast<double>(tc.z()));
-							coverage_color = image->getColor(coverage_tc);
-						coverage_name = m_CoverageData.getCoverageMaterialName(coverage_color);
-					}
-					else
-							return false;
-					}
-					else
-					{
-						coverage_name = m_CoverageData.getCoverageMaterialName(texture_color);
-						//coverage_name = "WOODS";
-					}
+	bool TerrainQuery::_processIntersection(const osgUtil::LineSegmentIntersector::Intersection& intersection, osg::Vec4 &texture_color, std::string &coverage_name, CoverageColor &coverage_color, osg::Vec3d &inter)
+	{
+		osg::Vec3 tc;
+		osg::Texture* texture = _getTexture(intersection,tc);
+
+		if(texture && texture->getImage(0))
+		{
+			osg::Image* tex_image = texture->getImage(0);
+			std::string color_filename;
+			std::string coverage_filename;
+			_getImageFilenames(tex_image, color_filename, coverage_filename);
+			if(color_filename != "")
+			{
+				//std::cout << color_filename <<"\n";
+				osg::Image* image = _loadImage(color_filename);
+				if(image)
+				{
+					osg::Vec3 color_tc = tc;
+					if(m_FlipColorCoordinates)
+						color_tc.set(color_tc.x(),1.0 - color_tc.y(),color_tc.z());
+					texture_color = _getSampler(image, m_ColorFilter, _getMipmapLevel(intersection, image))->sample(osg::Vec2(color_tc.x(), color_tc.y()));
+				}
+				else
+					return false;
+			}
+			else
+				texture_color = _getSampler(tex_image, m_ColorFilter, _getMipmapLevel(intersection, tex_image))->sample(osg::Vec2(tc.x(), tc.y()));
+
+			if (_sampleCoverageExtents(intersection.getWorldIntersectPoint(), coverage_color))
+			{
+				//georeferenced coverage, same lookup as getCoverage
+				coverage_name = m_CoverageData.getCoverageMaterialName(coverage_color);
+			}
+			else if (coverage_filename != "")
+			{
+				//get material texture
+				osg::Image* image = _loadImage(coverage_filename);
+				if(image)
+				{
+					osg::Vec3 coverage_tc = tc;
+					if (m_FlipCoverageCoordinates)
+						coverage_tc.set(coverage_tc.x(), 1.0 - coverage_tc.y(), coverage_tc.z());
+
+					//tc2 = osg::clampTo(tc2, osg::Vec3(0,0,0),osg::Vec3(1,1,1));
+					tc.set(osg::clampTo(static_cast<double>(tc.x()), 0.0, 1.0),
+						osg::clampTo(static_cast<double>(tc.y()), 0.0, 1.0), static_cast<double>(tc.z()));
+					coverage_color = _getSampler(image, TF_NEAREST)->sample(osg::Vec2(coverage_tc.x(), coverage_tc.y()));
+					coverage_name = m_CoverageData.getCoverageMaterialName(coverage_color);
 				}
-				inter = intersection.getWorldIntersectPoint();
-				return true;
+				else
+					return false;
+			}
+			else
+			{
+				coverage_name = m_CoverageData.getCoverageMaterialName(texture_color);
+				//coverage_name = "WOODS";
 			}
 		}
-		return false;
+		inter = intersection.getWorldIntersectPoint();
+		return true;
 	}
 
-	osg::Image* TerrainQuery::_loadImage(const std::string &filename)
+	void TerrainQuery::_getImageFilenames(const osg::Image* tex_image, std::string &color_filename, std::string &coverage_filename) const
 	{
-		osg::Image* image = NULL;
-		ImageCacheMap::iterator iter = m_ImageCache.find(filename);
-		if(iter != m_ImageCache.end())
+		std::string tex_filename = osgDB::getSimpleFileName(tex_image->getFileName());
+		//check if dds, if the data is BCn compressed we can sample it directly,
+		//otherwise we try to load alternative image file
+		color_filename = "";
+		const bool decode_dds = m_DecodeCompressedTextures && tex_image->data() &&
+			(!tex_image->isCompressed() || BCnDecoder::isSupportedFormat(tex_image->getPixelFormat()));
+		if(osgDB::getFileExtension(tex_filename) == "dds" && !decode_dds)
 		{
-			image = iter->second.get();
+			tex_filename = osgDB::getNameLessExtension(tex_filename) + m_ColorTextureSuffix;
+			color_filename = tex_filename;
 		}
-		else
+
+		coverage_filename = "";
+		if (m_CoverageTexture != "")
+			coverage_filename = m_CoverageTexture;
+		else if (m_CoverageTextureSuffix != "")
+			coverage_filename = osgDB::getNameLessExtension(osgDB::getSimpleFileName(tex_filename)) + m_CoverageTextureSuffix;
+	}
+
+	osg::Image* TerrainQuery::_loadImage(const std::string &filename)
+	{
+		osg::Image* image = NULL;
+		bool cached = false;
+		size_t cache_size = 0;
 		{
-			if(m_ImageCache.size() > 100) //Hack to release some memory
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_ImageCacheMutex);
+			ImageCacheMap::iterator iter = m_ImageCache.find(filename);
+			if(iter != m_ImageCache.end())
 			{
-				std::cout << "Image cache cleared\n";
-				m_ImageCache.clear();
-				std::cout << "Clear DB cache\n";
-				m_MeshCache->clearDatabaseCache();
+				image = iter->second.get();
+				cached = true;
 			}
+			cache_size = m_ImageCache.size();
+		}
 
-			m_ImageCache[filename] = osgDB::readImageFile(filename);
-			image = m_ImageCache[filename].get();
+		if(!cached)
+		{
+			if(cache_size > 100) //Hack to release some memory
+				_clearCaches();
+
+			osg::ref_ptr<osg::Image> loaded_image = osgDB::readImageFile(filename);
+			OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_ImageCacheMutex);
+			//prefetch thread may have added the image while loading
+			image = m_ImageCache.insert(std::make_pair(filename, loaded_image)).first->second.get();
 		}
 		if(!image)
 		{
@@ -156,6 +606,34 @@ namespace osgVegetation
 		return image;
 	}
 
+	unsigned int TerrainQuery::_getMipmapLevel(const osgUtil::LineSegmentIntersector::Intersection& intersection, const osg::Image* image) const
+	{
+		if (!_useGroundResolution() || !intersection.drawable.valid() || image->s() <= 0)
+			return 0;
+
+		//approximate texel footprint, assume texture cover the whole (square) drawable
+		const double texel_size = 1.4142 * intersection.drawable->getBound().radius() / static_cast<double>(image->s());
+		if (texel_size <= 0 || m_GroundResolution <= texel_size)
+			return 0;
+		return static_cast<unsigned int>(floor(log(m_GroundResolution / texel_size) / log(2.0)));
+	}
+
+	ImageSampler* TerrainQuery::_getSampler(osg::Image* image, TexelFilter filter, unsigned int mipmap_level)
+	{
+		const SamplerCacheMap::key_type key(image, std::make_pair(filter, mipmap_level));
+		SamplerCacheMap::iterator iter = m_SamplerCache.find(key);
+		if(iter != m_SamplerCache.end())
+			return iter->second.get();
+
+		//samplers keep terrain images alive, release them when cache grow
+		if(m_SamplerCache.size() > 200)
+			m_SamplerCache.clear();
+
+		ImageSampler* sampler = new ImageSampler(image, filter, mipmap_level);
+		m_SamplerCache[key] = sampler;
+		return sampler;
+	}
+
 	osg::Texture* TerrainQuery::_getTexture(const osgUtil::LineSegmentIntersector::Intersection& intersection,osg::Vec3& tc) const
 	{
 		osg::Geometry* geometry = intersection.drawable.valid() ? intersection.drawable->asGeometry() : 0;
@@ -5,15 +5,23 @@
 #include <osg/Node>
 #include <osg/Texture>
 #include <osg/ref_ptr>
+#include <osg/BoundingBox>
 #include <osgUtil/LineSegmentIntersector>
+#include <OpenThreads/Mutex>
+#include <map>
+#include <vector>
 #include "ITerrainQuery.h"
 #include "CoverageColor.h"
 #include "CoverageData.h"
-
-namespace osgSim {class DatabaseCacheReadCallback;}
+#include "ImageSampler.h"
+#include "TerrainSpatialIndex.h"
 
 namespace osgVegetation
 {
+	class TerrainTileCache;
+	class TerrainPrefetchThread;
+	class ResolutionIntersectionVisitor;
+
 	/*
 		Standard terrain query implementation.
 	*/
@@ -21,16 +29,48 @@ namespace osgVegetation
 	{
 	public:
 		TerrainQuery(osg::Node* terrain,const CoverageData &cd);
+		virtual ~TerrainQuery();
 
 		//ITerrainQuery interface
 		/**
 			Get terrain data for provided location
 		*/
 		bool getTerrainData(osg::Vec3d& location, osg::Vec4 &texture_color, std::string &coverage_name, CoverageColor &coverage_color, osg::Vec3d &inter);
+
+		/**
+			Queue request to load terrain pages and textures covering bb in a background thread,
+			only active if prefetch queue size is larger than zero.
+		*/
+		void prefetch(const osg::BoundingBoxd &bb);
+
+		/**
+			Set target ground resolution for following queries, only used if
+			ground resolution matching is enabled (see setMatchGroundResolution).
+		*/
+		void setGroundResolution(double resolution) {m_GroundResolution=resolution;}
+
+		/**
+			Snap position to finest terrain level, only active if ground resolution matching
+			and snap to finest are enabled.
+		*/
+		bool refineHeight(osg::Vec3d &position);
+
+		/**
+			Get terrain normal from intersected terrain geometry, the terrain level of detail
+			follow the ground resolution setting.
+		*/
+		bool getTerrainNormal(const osg::Vec3d &location, double step, osg::Vec3d &normal);
+
+		/**
+			Get coverage from georeferenced coverage textures (see addCoverageExtent) without
+			terrain intersection. Return false if no coverage extent contains location.
+		*/
+		bool getCoverage(const osg::Vec3d &location, std::string &coverage_name);
 	
 	public:
 		/**
-			Set suffix used to generate alternative color texture filename when terrain texture is stored as dds.
+			Set suffix used to generate alternative color texture filename when terrain texture is stored as dds
+			and can't be decoded (see setDecodeCompressedTextures).
 			The suffix is appended to extension-less terrain base texture filename.
 		*/
 		void setColorTextureSuffix(const std::string &value) {m_ColorTextureSuffix=value;}
@@ -81,15 +121,145 @@ namespace osgVegetation
 			Flip color texture coordinates
 		*/
 		bool getFlipColorCoordinates() const {return m_FlipColorCoordinates;}
+
+		/**
+			Set texel filter used for color texture lookups, coverage lookups always use nearest filter.
+			Default to TF_NEAREST
+		*/
+		void setColorFilter(TexelFilter value) {m_ColorFilter=value;}
+
+		/**
+			Get texel filter used for color texture lookups.
+		*/
+		TexelFilter getColorFilter() const {return m_ColorFilter;}
+
+		/**
+			Sample BCn (DXT1/3/5) compressed terrain textures directly, blocks are decoded on demand.
+			If false, or if the compressed format is unsupported, the alternative color texture
+			is used (see setColorTextureSuffix). Default to true.
+		*/
+		void setDecodeCompressedTextures(bool value) {m_DecodeCompressedTextures=value;}
+
+		/**
+			Get if BCn compressed terrain textures should be sampled directly.
+		*/
+		bool getDecodeCompressedTextures() const {return m_DecodeCompressedTextures;}
+
+		/**
+			Use 2D grid index over terrain leaf nodes so that each ray is only tested against
+			nodes whose XY footprint contains the query location. The index is built on first query
+			and the terrain graph is expected to be static. Default to false.
+		*/
+		void setUseSpatialIndex(bool value) {m_UseSpatialIndex=value;}
+
+		/**
+			Get if spatial index is used
+		*/
+		bool getUseSpatialIndex() const {return m_UseSpatialIndex;}
+
+		/**
+			Set max number of pending prefetch requests, when the queue is full the oldest
+			requests are dropped. Zero (default) disable prefetching.
+		*/
+		void setPrefetchQueueSize(unsigned int value) {m_PrefetchQueueSize=value;}
+
+		/**
+			Get max number of pending prefetch requests
+		*/
+		unsigned int getPrefetchQueueSize() const {return m_PrefetchQueueSize;}
+
+		/**
+			Match terrain level of detail and color texture mipmap level to the ground resolution
+			requested by the scatterer instead of always using the finest terrain, ie. sparse layers
+			don't need to page in full resolution terrain tiles. Default to false.
+		*/
+		void setMatchGroundResolution(bool value) {m_MatchGroundResolution=value;}
+
+		/**
+			Get if ground resolution matching is enabled
+		*/
+		bool getMatchGroundResolution() const {return m_MatchGroundResolution;}
+
+		/**
+			Set number of samples (height/texture resolution) across a terrain tile, used to
+			estimate terrain tile ground resolution from its extent. Default to 256.
+		*/
+		void setTerrainTileSamples(unsigned int value) {m_TerrainTileSamples=value;}
+
+		/**
+			Get number of samples across a terrain tile
+		*/
+		unsigned int getTerrainTileSamples() const {return m_TerrainTileSamples;}
+
+		/**
+			When ground resolution matching is enabled, snap final instance positions to finest
+			terrain level (see refineHeight). Default to false.
+		*/
+		void setSnapToFinest(bool value) {m_SnapToFinest=value;}
+
+		/**
+			Get if final instance positions are snapped to finest terrain level
+		*/
+		bool getSnapToFinest() const {return m_SnapToFinest;}
+
+		/**
+			Georeference coverage texture, texture coordinates are then derived from location XY
+			instead of terrain texture coordinates, ie. (0,0) at extent min and (1,1) at extent max
+			(flipped v if FlipCoverageCoordinates is set). Add one extent for a global coverage texture or
+			one extent per terrain tile coverage texture. Coverage lookups inside georeferenced
+			extents don't need terrain intersection (see getCoverage).
+			@param coverage_texture Coverage texture filename
+			@param extent Texture extent in terrain space, only XY is used
+		*/
+		void addCoverageExtent(const std::string &coverage_texture, const osg::BoundingBoxd &extent);
+
+		/**
+			Remove all georeferenced coverage textures
+		*/
+		void clearCoverageExtents() {m_CoverageExtents.clear(); m_LastCoverageExtent = 0;}
 	private:
+		friend class TerrainPrefetchThread;
+		void _prefetchTile(const osg::BoundingBoxd &bb);
+		void _prefetchImage(const std::string &filename);
+		void _getImageFilenames(const osg::Image* tex_image, std::string &color_filename, std::string &coverage_filename) const;
+		void _clearCaches();
+		bool _intersect(const osg::Vec3d &location, osgUtil::IntersectionVisitor &iv, osgUtil::LineSegmentIntersector::Intersection &result);
+		bool _intersectIndex(const osg::Vec3d &start, const osg::Vec3d &end, osgUtil::IntersectionVisitor &iv, osgUtil::LineSegmentIntersector::Intersection &result);
+		bool _useGroundResolution() const {return m_MatchGroundResolution && m_GroundResolution > 0;}
+		bool _sampleCoverageExtents(const osg::Vec3d &location, CoverageColor &coverage_color);
+		unsigned int _getMipmapLevel(const osgUtil::LineSegmentIntersector::Intersection& intersection, const osg::Image* image) const;
+		bool _processIntersection(const osgUtil::LineSegmentIntersector::Intersection& intersection, osg::Vec4 &texture_color, std::string &coverage_name, CoverageColor &coverage_color, osg::Vec3d &inter);
 		osg::Image* _loadImage(const std::string &filename);
+		ImageSampler* _getSampler(osg::Image* image, TexelFilter filter, unsigned int mipmap_level = 0);
 		osg::Texture* _getTexture(const osgUtil::LineSegmentIntersector::Intersection& intersection,osg::Vec3& tc) const;
 
 		osg::Node* m_Terrain;
 		osgUtil::IntersectionVisitor m_IntersectionVisitor;
 		typedef std::map<std::string,osg::ref_ptr<osg::Image> > ImageCacheMap;
 		ImageCacheMap m_ImageCache;
-		osgSim::DatabaseCacheReadCallback* m_MeshCache;
+		typedef std::map<std::pair<const osg::Image*, std::pair<TexelFilter, unsigned int> >, osg::ref_ptr<ImageSampler> > SamplerCacheMap;
+		SamplerCacheMap m_SamplerCache;
+		//owned by intersection visitor
+		TerrainTileCache* m_MeshCache;
+		//guard image cache, shared with prefetch thread
+		OpenThreads::Mutex m_ImageCacheMutex;
+		//held by prefetch thread while processing a request, caches are only cleared when holding this
+		OpenThreads::Mutex m_PrefetchMutex;
+		TerrainPrefetchThread* m_PrefetchThread;
+		unsigned int m_PrefetchQueueSize;
+		osg::ref_ptr<ResolutionIntersectionVisitor> m_ResolutionVisitor;
+		double m_GroundResolution;
+		bool m_MatchGroundResolution;
+		unsigned int m_TerrainTileSamples;
+		bool m_SnapToFinest;
+		struct CoverageExtent
+		{
+			std::string Texture;
+			osg::BoundingBoxd Extent;
+		};
+		std::vector<CoverageExtent> m_CoverageExtents;
+		//index of last matching extent, consecutive queries are usually close
+		size_t m_LastCoverageExtent;
 		std::string m_CoverageTextureSuffix;
 		std::string m_CoverageTexture;
 		std::string m_ColorTextureSuffix;
@@ -97,5 +267,9 @@ namespace osgVegetation
 		CoverageData m_CoverageData;
 		bool m_FlipCoverageCoordinates;
 		bool m_FlipColorCoordinates;
+		TexelFilter m_ColorFilter;
+		bool m_DecodeCompressedTextures;
+		bool m_UseSpatialIndex;
+		osg::ref_ptr<TerrainSpatialIndex> m_SpatialIndex;
 	};
 }
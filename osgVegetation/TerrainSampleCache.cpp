@@ -0,0 +1,291 @@
+#include "TerrainSampleCache.h"
+#include "TiledRaster.h"
+#include <osg/Image>
+#include <osg/Math>
+#include <osgDB/FileUtils>
+#include <osgDB/Registry>
+#include <OpenThreads/ScopedLock>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <map>
+
+namespace osgVegetation
+{
+	namespace
+	{
+		/**
+			64-bit FNV-1a hash
+		*/
+		class ContentHash
+		{
+		public:
+			ContentHash() : m_Hash(14695981039346656037ULL) {}
+
+			void add(const void* data, size_t size)
+			{
+				const unsigned char* bytes = static_cast<const unsigned char*>(data);
+				for (size_t i = 0; i < size; i++)
+				{
+					m_Hash ^= bytes[i];
+					m_Hash *= 1099511628211ULL;
+				}
+			}
+
+			void addFile(const std::string &filename)
+			{
+				std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+				if (!in)
+					OSGV_EXCEPT(std::string("TerrainSampleCache::computeKey - Failed to open file:" + filename).c_str());
+				char buffer[64 * 1024];
+				while (in)
+				{
+					in.read(buffer, sizeof(buffer));
+					add(buffer, static_cast<size_t>(in.gcount()));
+				}
+			}
+
+			std::string toString() const
+			{
+				std::stringstream ss;
+				ss << std::hex << std::setw(16) << std::setfill('0') << m_Hash;
+				return ss.str();
+			}
+		private:
+			unsigned long long m_Hash;
+		};
+
+		bool GetFileStamp(const std::string &filename, unsigned long long &size, long long &mtime)
+		{
+			struct stat info;
+			if (stat(filename.c_str(), &info) != 0)
+				return false;
+			size = static_cast<unsigned long long>(info.st_size);
+			mtime = static_cast<long long>(info.st_mtime);
+			return true;
+		}
+	}
+
+	std::string TerrainSampleCache::computeKey(const std::vector<std::string> &files, const osg::BoundingBoxd &bb, double cell_size)
+	{
+		ContentHash hash;
+		for (size_t i = 0; i < files.size(); i++)
+			hash.addFile(files[i]);
+		const double grid[7] = {bb.xMin(), bb.yMin(), bb.zMin(), bb.xMax(), bb.yMax(), bb.zMax(), cell_size};
+		hash.add(grid, sizeof(grid));
+		return hash.toString();
+	}
+
+	bool TerrainSampleCache::exists(const std::string &prefix)
+	{
+		//coverage names are written last and mark a complete cache
+		return osgDB::fileExists(prefix + "_height.osgvr") &&
+			osgDB::fileExists(prefix + "_color.osgvr") &&
+			osgDB::fileExists(prefix + "_coverage.osgvr") &&
+			osgDB::fileExists(prefix + "_grid.txt") &&
+			osgDB::fileExists(prefix + "_coverage.txt") &&
+			_inputsUnchanged(prefix);
+	}
+
+	void TerrainSampleCache::saveInputs(const std::string &prefix, const std::vector<std::string> &files)
+	{
+		const std::string filename = prefix + "_inputs.txt";
+		std::ofstream out(filename.c_str());
+		if (!out)
+			OSGV_EXCEPT(std::string("TerrainSampleCache::saveInputs - Failed to open file:" + filename).c_str());
+		for (size_t i = 0; i < files.size(); i++)
+		{
+			unsigned long long size = 0;
+			long long mtime = 0;
+			//files that don't exist (ie. remote) can't be tracked
+			if (GetFileStamp(files[i], size, mtime))
+				out << size << " " << mtime << " " << files[i] << "\n";
+		}
+		if (!out)
+			OSGV_EXCEPT(std::string("TerrainSampleCache::saveInputs - Failed to write file:" + filename).c_str());
+	}
+
+	bool TerrainSampleCache::_inputsUnchanged(const std::string &prefix)
+	{
+		std::ifstream in((prefix + "_inputs.txt").c_str());
+		if (!in)
+			return false;
+		unsigned long long size = 0;
+		long long mtime = 0;
+		std::string filename;
+		while (in >> size >> mtime)
+		{
+			in.get();
+			std::getline(in, filename);
+			unsigned long long current_size = 0;
+			long long current_mtime = 0;
+			if (!GetFileStamp(filename, current_size, current_mtime) || current_size != size || current_mtime != mtime)
+			{
+				std::cout << "TerrainSampleCache - Input file changed:" << filename << "\n";
+				return false;
+			}
+		}
+		return in.eof();
+	}
+
+	void TerrainInputRecorder::start()
+	{
+		if (m_Started)
+			return;
+		m_Previous = osgDB::Registry::instance()->getFindFileCallback();
+		osgDB::Registry::instance()->setFindFileCallback(this);
+		m_Started = true;
+	}
+
+	void TerrainInputRecorder::stop()
+	{
+		if (!m_Started)
+			return;
+		m_Started = false;
+		//keep this alive until the registry reference is released
+		osg::ref_ptr<TerrainInputRecorder> self = this;
+		osgDB::Registry::instance()->setFindFileCallback(m_Previous.get());
+		m_Previous = NULL;
+	}
+
+	void TerrainInputRecorder::addFile(const std::string &filename)
+	{
+		if (filename == "")
+			return;
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_Mutex);
+		m_Files.insert(filename);
+	}
+
+	std::vector<std::string> TerrainInputRecorder::getFiles() const
+	{
+		OpenThreads::ScopedLock<OpenThreads::Mutex> lock(m_Mutex);
+		return std::vector<std::string>(m_Files.begin(), m_Files.end());
+	}
+
+	std::string TerrainInputRecorder::findDataFile(const std::string& filename, const osgDB::Options* options, osgDB::CaseSensitivity case_sensitivity)
+	{
+		const std::string found = m_Previous.valid() ? m_Previous->findDataFile(filename, options, case_sensitivity) :
+			osgDB::Registry::instance()->findDataFileImplementation(filename, options, case_sensitivity);
+		addFile(found);
+		return found;
+	}
+
+	void TerrainSampleCache::_getGrid(const osg::BoundingBoxd &bb, double cell_size, int &num_x, int &num_y)
+	{
+		if (cell_size <= 0)
+			OSGV_EXCEPT(std::string("TerrainSampleCache - Cell size must be positive").c_str());
+		num_x = static_cast<int>(ceil((bb.xMax() - bb.xMin()) / cell_size));
+		num_y = static_cast<int>(ceil((bb.yMax() - bb.yMin()) / cell_size));
+		if (num_x <= 0 || num_y <= 0)
+			OSGV_EXCEPT(std::string("TerrainSampleCache - Empty bounding box").c_str());
+	}
+
+	void TerrainSampleCache::bake(ITerrainQuery* tq, const osg::BoundingBoxd &bb, double cell_size, const std::string &prefix, unsigned int tile_size)
+	{
+		int num_x, num_y;
+		_getGrid(bb, cell_size, num_x, num_y);
+
+		osg::ref_ptr<osg::Image> height_image = new osg::Image();
+		height_image->allocateImage(num_x, num_y, 1, GL_LUMINANCE, GL_FLOAT);
+		osg::ref_ptr<osg::Image> color_image = new osg::Image();
+		color_image->allocateImage(num_x, num_y, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+		osg::ref_ptr<osg::Image> coverage_image = new osg::Image();
+		coverage_image->allocateImage(num_x, num_y, 1, GL_LUMINANCE, GL_UNSIGNED_BYTE);
+
+		//coverage ids are assigned in the order materials are found, 0 is reserved for no coverage
+		std::map<std::string, unsigned char> coverage_ids;
+		std::vector<std::string> coverage_names;
+
+		std::cout << "Baking terrain sample cache " << num_x << "x" << num_y << "...\n";
+		const float no_data = std::numeric_limits<float>::quiet_NaN();
+		for (int y = 0; y < num_y; y++)
+		{
+			float* height_row = reinterpret_cast<float*>(height_image->data(0, y));
+			unsigned char* color_row = color_image->data(0, y);
+			unsigned char* coverage_row = coverage_image->data(0, y);
+			for (int x = 0; x < num_x; x++)
+			{
+				osg::Vec3d location(bb.xMin() + (x + 0.5) * cell_size, bb.yMin() + (y + 0.5) * cell_size, 0);
+				osg::Vec4 color(0, 0, 0, 0);
+				std::string coverage_name;
+				CoverageColor coverage_color;
+				osg::Vec3d inter;
+				height_row[x] = no_data;
+				coverage_row[x] = 0;
+				if (tq->getTerrainData(location, color, coverage_name, coverage_color, inter))
+				{
+					height_row[x] = static_cast<float>(inter.z());
+					if (coverage_name != "")
+					{
+						std::map<std::string, unsigned char>::const_iterator iter = coverage_ids.find(coverage_name);
+						if (iter == coverage_ids.end())
+						{
+							if (coverage_names.size() >= 255)
+								OSGV_EXCEPT(std::string("TerrainSampleCache::bake - Too many coverage materials").c_str());
+							coverage_names.push_back(coverage_name);
+							iter = coverage_ids.insert(std::make_pair(coverage_name, static_cast<unsigned char>(coverage_names.size()))).first;
+						}
+						coverage_row[x] = iter->second;
+					}
+				}
+				for (int c = 0; c < 4; c++)
+					color_row[x * 4 + c] = static_cast<unsigned char>(osg::clampBetween(color[c], 0.0f, 1.0f) * 255.0f + 0.5f);
+			}
+			if (y % 100 == 0)
+				std::cout << "Row " << y << " of " << num_y << "\n";
+		}
+
+		if (!TiledRaster::create(*height_image, prefix + "_height.osgvr", tile_size) ||
+			!TiledRaster::create(*color_image, prefix + "_color.osgvr", tile_size) ||
+			!TiledRaster::create(*coverage_image, prefix + "_coverage.osgvr", tile_size))
+			OSGV_EXCEPT(std::string("TerrainSampleCache::bake - Failed to write cache:" + prefix).c_str());
+
+		std::ofstream grid((prefix + "_grid.txt").c_str());
+		grid << std::setprecision(17) << bb.xMin() << " " << bb.yMin() << " " << cell_size << "\n";
+		grid.close();
+
+		std::ofstream names((prefix + "_coverage.txt").c_str());
+		for (size_t i = 0; i < coverage_names.size(); i++)
+			names << coverage_names[i] << "\n";
+		names.close();
+		if (grid.fail() || names.fail())
+			OSGV_EXCEPT(std::string("TerrainSampleCache::bake - Failed to write cache:" + prefix).c_str());
+	}
+
+	osg::ref_ptr<RasterTerrainQuery> TerrainSampleCache::load(const std::string &prefix)
+	{
+		std::ifstream names((prefix + "_coverage.txt").c_str());
+		if (!names)
+			OSGV_EXCEPT(std::string("TerrainSampleCache::load - Failed to find cache:" + prefix).c_str());
+
+		CoverageData cd;
+		std::string name;
+		while (std::getline(names, name))
+		{
+			if (name != "")
+				cd.CoverageMaterials.push_back(CoverageData::CoverageMaterial(name, CoverageColor(0, 0, 0, 0), CoverageColor(0, 0, 0, 0), static_cast<int>(cd.CoverageMaterials.size()) + 1));
+		}
+
+		osg::ref_ptr<TiledRaster> height = TiledRaster::load(prefix + "_height.osgvr");
+		osg::ref_ptr<TiledRaster> color = TiledRaster::load(prefix + "_color.osgvr");
+		osg::ref_ptr<TiledRaster> coverage = TiledRaster::load(prefix + "_coverage.osgvr");
+
+		osg::ref_ptr<RasterTerrainQuery> rtq = new RasterTerrainQuery(cd);
+		std::ifstream grid((prefix + "_grid.txt").c_str());
+		double origin_x = 0, origin_y = 0, cell_size = 0;
+		if (!(grid >> origin_x >> origin_y >> cell_size) || cell_size <= 0)
+			OSGV_EXCEPT(std::string("TerrainSampleCache::load - Invalid grid description:" + prefix).c_str());
+		const osg::Vec2d origin(origin_x, origin_y);
+		const osg::Vec2d cell(cell_size, cell_size);
+		rtq->setHeightLayer(RasterLayer(height.get(), origin, cell));
+		rtq->setColorLayer(RasterLayer(color.get(), origin, cell));
+		rtq->setLandcoverLayer(RasterLayer(coverage.get(), origin, cell));
+		return rtq;
+	}
+}
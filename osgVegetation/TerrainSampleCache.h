@@ -0,0 +1,95 @@
+#pragma once
+#include "Common.h"
+#include <osg/BoundingBox>
+#include <osg/ref_ptr>
+#include <osgDB/Callbacks>
+#include <OpenThreads/Mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include "ITerrainQuery.h"
+#include "RasterTerrainQuery.h"
+
+namespace osgVegetation
+{
+	/**
+		Persistent terrain sample cache.
+		Terrain query answers (height, color and coverage) are baked on a regular grid into
+		tiled raster files that are memory mapped on later runs, i.e the terrain scene graph
+		is not touched when a cache exists. The cache is loaded as a RasterTerrainQuery.
+
+		Cache files (prefix is typically derived from computeKey):
+		prefix_height.osgvr   float heights, NaN where query failed
+		prefix_color.osgvr    RGBA8 terrain color
+		prefix_coverage.osgvr 8-bit coverage id, 0 means no coverage
+		prefix_grid.txt       grid origin and cell size
+		prefix_coverage.txt   coverage material names, line n hold name of id n
+		prefix_inputs.txt     size, modification time and path of input files, see saveInputs
+	*/
+	class osgvExport TerrainSampleCache
+	{
+	public:
+		/**
+			Compute cache key (hex string) from content of files (ie. terrain and terrain query config)
+			and grid description. Note that only the provided files are hashed, files read by the terrain
+			query (paged tiles, textures and rasters) are tracked by saveInputs.
+		*/
+		static std::string computeKey(const std::vector<std::string> &files, const osg::BoundingBoxd &bb, double cell_size);
+
+		/**
+			Check if a complete cache exist for prefix and that its input files are unchanged
+		*/
+		static bool exists(const std::string &prefix);
+
+		/**
+			Save size and modification time of files read while baking (ie. from TerrainInputRecorder),
+			the cache is only valid while these files are unchanged. Call after bake, throws on failure.
+		*/
+		static void saveInputs(const std::string &prefix, const std::vector<std::string> &files);
+
+		/**
+			Bake cache by sampling terrain query at cell centers of grid covering bb.
+			Throws on failure.
+		*/
+		static void bake(ITerrainQuery* tq, const osg::BoundingBoxd &bb, double cell_size, const std::string &prefix, unsigned int tile_size = 256);
+
+		/**
+			Load cache as terrain query, throws on failure.
+		*/
+		static osg::ref_ptr<RasterTerrainQuery> load(const std::string &prefix);
+	private:
+		static void _getGrid(const osg::BoundingBoxd &bb, double cell_size, int &num_x, int &num_y);
+		static bool _inputsUnchanged(const std::string &prefix);
+	};
+
+	/**
+		Record files resolved through osgDB::findDataFile while started, ie. terrain files, paged tiles,
+		coverage textures and rasters read by a terrain query (osgDB plugins resolve files before reading).
+		The recorder is installed as osgDB::Registry find file callback, any previous callback is kept.
+	*/
+	class osgvExport TerrainInputRecorder : public osgDB::FindFileCallback
+	{
+	public:
+		TerrainInputRecorder() : m_Started(false) {}
+
+		void start();
+		void stop();
+
+		/**
+			Add file opened without osgDB
+		*/
+		void addFile(const std::string &filename);
+
+		std::vector<std::string> getFiles() const;
+
+		//osgDB::FindFileCallback
+		std::string findDataFile(const std::string& filename, const osgDB::Options* options, osgDB::CaseSensitivity case_sensitivity);
+	protected:
+		virtual ~TerrainInputRecorder() {}
+	private:
+		osg::ref_ptr<osgDB::FindFileCallback> m_Previous;
+		bool m_Started;
+		mutable OpenThreads::Mutex m_Mutex;
+		std::set<std::string> m_Files;
+	};
+}
@@ -0,0 +1,136 @@
+#include "TerrainSpatialIndex.h"
+#include <osg/NodeVisitor>
+#include <osg/Drawable>
+#include <osg/Geode>
+#include <osg/LOD>
+#include <osg/Transform>
+#include <osg/Version>
+#include <cmath>
+
+namespace osgVegetation
+{
+	/**
+		Collect leaf nodes and their world matrices
+	*/
+	class TerrainSpatialIndexBuilder : public osg::NodeVisitor
+	{
+	public:
+		TerrainSpatialIndexBuilder(TerrainSpatialIndex* index) : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN),
+			m_Index(index)
+		{
+
+		}
+
+		virtual void apply(osg::Geode& geode)
+		{
+			_add(geode);
+		}
+
+		virtual void apply(osg::LOD& lod)
+		{
+			//also cover PagedLOD, let the intersection visitor select level
+			_add(lod);
+		}
+
+#if OSG_VERSION_GREATER_OR_EQUAL(3,4,0)
+		//drawables are nodes and can be children of any group, geode drawables are covered by the geode
+		virtual void apply(osg::Drawable& drawable)
+		{
+			_add(drawable);
+		}
+#endif
+	private:
+		void _add(osg::Node& node)
+		{
+			osg::NodePath parent_path = getNodePath();
+			parent_path.pop_back();
+			m_Index->_addEntry(&node, osg::computeLocalToWorld(parent_path), parent_path);
+		}
+		TerrainSpatialIndex* m_Index;
+	};
+
+	TerrainSpatialIndex::TerrainSpatialIndex(osg::Node* terrain) : m_NumCellsX(0),
+		m_NumCellsY(0),
+		m_CellSizeX(1),
+		m_CellSizeY(1)
+	{
+		TerrainSpatialIndexBuilder builder(this);
+		terrain->accept(builder);
+		_buildGrid();
+	}
+
+	void TerrainSpatialIndex::_addEntry(osg::Node* node, const osg::Matrixd &matrix, const osg::NodePath &parent_path)
+	{
+		const osg::BoundingSphere& bs = node->getBound();
+		if (!bs.valid())
+			return;
+
+		Entry entry;
+		entry.Node = node;
+		entry.ParentPath = parent_path;
+		if (!matrix.isIdentity())
+		{
+			entry.Matrix = new osg::RefMatrix(matrix);
+			entry.InverseMatrix = new osg::RefMatrix(osg::Matrixd::inverse(matrix));
+		}
+
+		//world bounds from transformed bounding cube of local sphere
+		const osg::Vec3d center = bs.center();
+		const double radius = bs.radius();
+		for (int i = 0; i < 8; i++)
+		{
+			const osg::Vec3d corner(center.x() + ((i & 1) ? radius : -radius),
+				center.y() + ((i & 2) ? radius : -radius),
+				center.z() + ((i & 4) ? radius : -radius));
+			entry.Bounds.expandBy(corner * matrix);
+		}
+		m_Bounds.expandBy(entry.Bounds);
+		m_Entries.push_back(entry);
+	}
+
+	void TerrainSpatialIndex::_buildGrid()
+	{
+		m_Cells.clear();
+		if (m_Entries.size() == 0)
+			return;
+
+		//aim for about one entry per cell
+		const double size_x = osg::maximum(m_Bounds.xMax() - m_Bounds.xMin(), 1e-6);
+		const double size_y = osg::maximum(m_Bounds.yMax() - m_Bounds.yMin(), 1e-6);
+		const double cell_size = sqrt(size_x * size_y / static_cast<double>(m_Entries.size()));
+		m_NumCellsX = osg::clampBetween(static_cast<int>(ceil(size_x / cell_size)), 1, 1024);
+		m_NumCellsY = osg::clampBetween(static_cast<int>(ceil(size_y / cell_size)), 1, 1024);
+		m_CellSizeX = size_x / m_NumCellsX;
+		m_CellSizeY = size_y / m_NumCellsY;
+		m_Cells.resize(m_NumCellsX * m_NumCellsY);
+
+		for (size_t i = 0; i < m_Entries.size(); i++)
+		{
+			const osg::BoundingBoxd& bb = m_Entries[i].Bounds;
+			const int x0 = osg::clampBetween(static_cast<int>((bb.xMin() - m_Bounds.xMin()) / m_CellSizeX), 0, m_NumCellsX - 1);
+			const int x1 = osg::clampBetween(static_cast<int>((bb.xMax() - m_Bounds.xMin()) / m_CellSizeX), 0, m_NumCellsX - 1);
+			const int y0 = osg::clampBetween(static_cast<int>((bb.yMin() - m_Bounds.yMin()) / m_CellSizeY), 0, m_NumCellsY - 1);
+			const int y1 = osg::clampBetween(static_cast<int>((bb.yMax() - m_Bounds.yMin()) / m_CellSizeY), 0, m_NumCellsY - 1);
+			for (int y = y0; y <= y1; y++)
+				for (int x = x0; x <= x1; x++)
+					m_Cells[y * m_NumCellsX + x].push_back(static_cast<unsigned int>(i));
+		}
+	}
+
+	void TerrainSpatialIndex::query(double x, double y, std::vector<const Entry*> &entries) const
+	{
+		entries.clear();
+		if (m_Cells.size() == 0 || x < m_Bounds.xMin() || x > m_Bounds.xMax() || y < m_Bounds.yMin() || y > m_Bounds.yMax())
+			return;
+
+		const int cx = osg::clampBetween(static_cast<int>((x - m_Bounds.xMin()) / m_CellSizeX), 0, m_NumCellsX - 1);
+		const int cy = osg::clampBetween(static_cast<int>((y - m_Bounds.yMin()) / m_CellSizeY), 0, m_NumCellsY - 1);
+		const std::vector<unsigned int>& cell = m_Cells[cy * m_NumCellsX + cx];
+		for (size_t i = 0; i < cell.size(); i++)
+		{
+			const Entry& entry = m_Entries[cell[i]];
+			if (x >= entry.Bounds.xMin() && x <= entry.Bounds.xMax() && y >= entry.Bounds.yMin() && y <= entry.Bounds.yMax())
+				entries.push_back(&entry);
+		}
+	}
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include "Common.h"
+#include <osg/Referenced>
+#include <osg/ref_ptr>
+#include <osg/Node>
+#include <osg/Matrix>
+#include <osg/BoundingBox>
+#include <vector>
+
+namespace osgVegetation
+{
+	/**
+		2D grid index over terrain leaf nodes used to localise vertical ray intersections.
+		Leafs are Geodes, LOD/PagedLOD nodes (level of detail selection is left to the
+		intersection visitor, paged children are never indexed) and, with OSG 3.4 or later,
+		drawables placed directly below groups or transforms. Each entry store
+		accumulated world matrix and parent node path so that intersections done in
+		entry local space can be converted back to terrain space.
+	*/
+	class osgvExport TerrainSpatialIndex : public osg::Referenced
+	{
+	public:
+		struct Entry
+		{
+			osg::ref_ptr<osg::Node> Node;
+			//NULL if identity
+			osg::ref_ptr<osg::RefMatrix> Matrix;
+			osg::ref_ptr<osg::RefMatrix> InverseMatrix;
+			//path from terrain root to entry parent
+			osg::NodePath ParentPath;
+			osg::BoundingBoxd Bounds;
+		};
+
+		/**
+			Build index for terrain, the terrain graph should not change after index is built.
+		*/
+		TerrainSpatialIndex(osg::Node* terrain);
+
+		/**
+			Get entries whose XY footprint contains location
+		*/
+		void query(double x, double y, std::vector<const Entry*> &entries) const;
+
+		unsigned int getNumEntries() const {return static_cast<unsigned int>(m_Entries.size());}
+
+		/**
+			Get index extent, i.e union of all entry bounds
+		*/
+		const osg::BoundingBoxd& getBounds() const {return m_Bounds;}
+
+	private:
+		friend class TerrainSpatialIndexBuilder;
+		void _addEntry(osg::Node* node, const osg::Matrixd &matrix, const osg::NodePath &parent_path);
+		void _buildGrid();
+		std::vector<Entry> m_Entries;
+		std::vector<std::vector<unsigned int> > m_Cells;
+		osg::BoundingBoxd m_Bounds;
+		int m_NumCellsX;
+		int m_NumCellsY;
+		double m_CellSizeX;
+		double m_CellSizeY;
+	};
+}
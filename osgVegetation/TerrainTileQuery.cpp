@@ -0,0 +1,218 @@
+#include "TerrainTileQuery.h"
+#include <osg/PagedLOD>
+#include <osg/NodeVisitor>
+#include <osgTerrain/Terrain>
+#include <osgTerrain/Layer>
+#include <osgTerrain/Locator>
+#include <osgSim/LineOfSight>
+
+namespace osgVegetation
+{
+	namespace
+	{
+		class FindTerrainTileVisitor : public osg::NodeVisitor
+		{
+		public:
+			FindTerrainTileVisitor() : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN),
+				Found(false)
+			{
+
+			}
+
+			virtual void apply(osg::Group& group)
+			{
+				if (dynamic_cast<osgTerrain::TerrainTile*>(&group))
+					Found = true;
+				if (!Found)
+					traverse(group);
+			}
+			bool Found;
+		};
+
+		/**
+			Get locator for layer, fallback to tile locator if layer is missing locator
+		*/
+		osgTerrain::Locator* getLayerLocator(osgTerrain::TerrainTile* tile, osgTerrain::Layer* layer)
+		{
+			if (layer && layer->getLocator())
+				return layer->getLocator();
+			if (tile->getLocator())
+				return tile->getLocator();
+			return tile->getElevationLayer() ? tile->getElevationLayer()->getLocator() : NULL;
+		}
+
+		osgTerrain::ImageLayer* getImageLayer(osgTerrain::Layer* layer)
+		{
+			osgTerrain::ImageLayer* image_layer = dynamic_cast<osgTerrain::ImageLayer*>(layer);
+			if (image_layer)
+				return image_layer;
+			//use first image layer of composite layers
+			osgTerrain::CompositeLayer* composite = dynamic_cast<osgTerrain::CompositeLayer*>(layer);
+			if (composite)
+			{
+				for (unsigned int i = 0; i < composite->getNumLayers(); i++)
+				{
+					image_layer = getImageLayer(composite->getLayer(i));
+					if (image_layer)
+						return image_layer;
+				}
+			}
+			return NULL;
+		}
+
+		bool containsXY(const osg::BoundingSphere &bs, const osg::Vec3d &location)
+		{
+			if (!bs.valid())
+				return false;
+			const double dx = location.x() - bs.center().x();
+			const double dy = location.y() - bs.center().y();
+			return dx * dx + dy * dy <= bs.radius() * bs.radius();
+		}
+	}
+
+	TerrainTileQuery::TerrainTileQuery(osg::Node* terrain, const CoverageData &cd) : m_Terrain(terrain),
+		m_CoverageData(cd),
+		m_ColorLayer(0),
+		m_CoverageLayer(-1),
+		m_ColorFilter(TF_NEAREST)
+	{
+		m_TileCache = new osgSim::DatabaseCacheReadCallback;
+	}
+
+	bool TerrainTileQuery::hasTerrainTiles(osg::Node* terrain)
+	{
+		if (terrain == NULL)
+			return false;
+		FindTerrainTileVisitor ftv;
+		terrain->accept(ftv);
+		return ftv.Found;
+	}
+
+	void TerrainTileQuery::_findTile(osg::Node* node, const osg::Vec3d &location, int depth, TileSearch &result)
+	{
+		osgTerrain::TerrainTile* tile = dynamic_cast<osgTerrain::TerrainTile*>(node);
+		if (tile)
+		{
+			osgTerrain::Locator* locator = getLayerLocator(tile, NULL);
+			osg::Vec3d local;
+			if (locator == NULL || !locator->convertModelToLocal(location, local) ||
+				local.x() < 0.0 || local.x() > 1.0 || local.y() < 0.0 || local.y() > 1.0)
+				return;
+
+			//prefer tile level if provided, fallback to graph depth
+			const int level = tile->getTileID().valid() ? tile->getTileID().level : depth;
+			if (level >= result.Level && tile->getElevationLayer())
+			{
+				result.Tile = tile;
+				result.Level = level;
+			}
+		}
+
+		osg::PagedLOD* plod = dynamic_cast<osg::PagedLOD*>(node);
+		if (plod)
+		{
+			//descend all children, including those not loaded yet, to find the highest level of detail
+			for (unsigned int i = 0; i < plod->getNumFileNames() || i < plod->getNumChildren(); i++)
+			{
+				osg::ref_ptr<osg::Node> child;
+				if (i < plod->getNumChildren())
+					child = plod->getChild(i);
+				else if (plod->getFileName(i) != "")
+					child = m_TileCache->readNodeFile(plod->getDatabasePath() + plod->getFileName(i));
+				if (child.valid() && containsXY(child->getBound(), location))
+					_findTile(child.get(), location, depth + 1, result);
+			}
+			return;
+		}
+
+		osg::Group* group = node->asGroup();
+		if (group)
+		{
+			for (unsigned int i = 0; i < group->getNumChildren(); i++)
+			{
+				osg::Node* child = group->getChild(i);
+				if (containsXY(child->getBound(), location))
+					_findTile(child, location, depth + 1, result);
+			}
+		}
+	}
+
+	bool TerrainTileQuery::getTerrainData(osg::Vec3d& location, osg::Vec4 &color, std::string &coverage_name, CoverageColor &coverage_color, osg::Vec3d &inter)
+	{
+		TileSearch search;
+		_findTile(m_Terrain, location, 0, search);
+		if (!search.Tile.valid())
+			return false;
+
+		osgTerrain::TerrainTile* tile = search.Tile.get();
+		osgTerrain::Layer* elevation_layer = tile->getElevationLayer();
+		osgTerrain::Locator* master_locator = getLayerLocator(tile, NULL);
+		osgTerrain::Locator* elevation_locator = getLayerLocator(tile, elevation_layer);
+
+		osg::Vec3d elevation_local;
+		if (!elevation_locator->convertModelToLocal(location, elevation_local))
+			return false;
+
+		float height = 0;
+		if (!elevation_layer->getInterpolatedValue(elevation_local.x(), elevation_local.y(), height))
+			return false;
+
+		//same vertical scale as osgTerrain::GeometryTechnique
+		if (tile->getTerrain())
+			height *= tile->getTerrain()->getVerticalScale();
+
+		osg::Vec3d master_local;
+		if (!master_locator->convertModelToLocal(location, master_local))
+			return false;
+		master_local.z() = height;
+		if (!master_locator->convertLocalToModel(master_local, inter))
+			return false;
+
+		color.set(1, 1, 1, 1);
+		if (m_ColorLayer >= 0)
+			_sampleLayer(tile, static_cast<unsigned int>(m_ColorLayer), location, m_ColorFilter, color);
+
+		coverage_color = color;
+		if (m_CoverageLayer >= 0)
+		{
+			coverage_color = CoverageColor(0, 0, 0, 0);
+			_sampleLayer(tile, static_cast<unsigned int>(m_CoverageLayer), location, TF_NEAREST, coverage_color);
+		}
+		coverage_name = m_CoverageData.getCoverageMaterialName(coverage_color);
+		return true;
+	}
+
+	bool TerrainTileQuery::_sampleLayer(osgTerrain::TerrainTile* tile, unsigned int layer_index, const osg::Vec3d &location, TexelFilter filter, osg::Vec4 &color)
+	{
+		if (layer_index >= tile->getNumColorLayers())
+			return false;
+
+		osgTerrain::ImageLayer* layer = getImageLayer(tile->getColorLayer(layer_index));
+		if (layer == NULL || layer->getImage() == NULL)
+			return false;
+
+		osgTerrain::Locator* locator = getLayerLocator(tile, layer);
+		osg::Vec3d local;
+		if (locator == NULL || !locator->convertModelToLocal(location, local))
+			return false;
+
+		color = _getSampler(layer->getImage(), filter)->sample(osg::Vec2(local.x(), local.y()));
+		return true;
+	}
+
+	ImageSampler* TerrainTileQuery::_getSampler(osg::Image* image, TexelFilter filter)
+	{
+		const SamplerCacheMap::key_type key(image, filter);
+		SamplerCacheMap::iterator iter = m_SamplerCache.find(key);
+		if (iter != m_SamplerCache.end())
+			return iter->second.get();
+
+		//samplers keep tile images alive, release them when cache grow
+		if (m_SamplerCache.size() > 200)
+			m_SamplerCache.clear();
+
+		ImageSampler* sampler = new ImageSampler(image, filter);
+		m_SamplerCache[key] = sampler;
+		return sampler;
+	}
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include "Common.h"
+#include <osg/Vec3d>
+#include <osg/Vec4>
+#include <osg/Node>
+#include <osg/ref_ptr>
+#include <osgTerrain/TerrainTile>
+#include <map>
+#include "ITerrainQuery.h"
+#include "CoverageColor.h"
+#include "CoverageData.h"
+#include "ImageSampler.h"
+
+namespace osgSim {class DatabaseCacheReadCallback;}
+
+namespace osgVegetation
+{
+	/**
+		Terrain query for osgTerrain databases (ie. VirtualPlanetBuilder output).
+		Instead of intersecting generated terrain geometry the finest osgTerrain::TerrainTile
+		covering the location is located (paged tiles are loaded on demand) and height,
+		color and coverage are sampled directly from the tile elevation and color layers
+		through the tile/layer locators. Transforms above terrain tiles are not supported.
+	*/
+	class osgvExport TerrainTileQuery : public ITerrainQuery
+	{
+	public:
+		TerrainTileQuery(osg::Node* terrain, const CoverageData &cd);
+
+		//ITerrainQuery interface
+		/**
+			Get terrain data for provided location
+		*/
+		bool getTerrainData(osg::Vec3d& location, osg::Vec4 &texture_color, std::string &coverage_name, CoverageColor &coverage_color, osg::Vec3d &inter);
+	public:
+		/**
+			Check if terrain include any osgTerrain::TerrainTile (only loaded children are checked)
+		*/
+		static bool hasTerrainTiles(osg::Node* terrain);
+
+		/**
+			Set color layer index used for terrain color, default to 0
+		*/
+		void setColorLayer(int value) {m_ColorLayer=value;}
+		int getColorLayer() const {return m_ColorLayer;}
+
+		/**
+			Set color layer index holding color coded coverage (landcover) image.
+			If negative (default) coverage is resolved from terrain color.
+		*/
+		void setCoverageLayer(int value) {m_CoverageLayer=value;}
+		int getCoverageLayer() const {return m_CoverageLayer;}
+
+		/**
+			Set texel filter used for color lookups, coverage lookups always use nearest filter.
+			Default to TF_NEAREST
+		*/
+		void setColorFilter(TexelFilter value) {m_ColorFilter=value;}
+		TexelFilter getColorFilter() const {return m_ColorFilter;}
+	private:
+		struct TileSearch
+		{
+			TileSearch() : Level(-1) {}
+			//paged tiles can be released by the tile cache during the search
+			osg::ref_ptr<osgTerrain::TerrainTile> Tile;
+			int Level;
+		};
+		void _findTile(osg::Node* node, const osg::Vec3d &location, int depth, TileSearch &result);
+		bool _sampleLayer(osgTerrain::TerrainTile* tile, unsigned int layer_index, const osg::Vec3d &location, TexelFilter filter, osg::Vec4 &color);
+		ImageSampler* _getSampler(osg::Image* image, TexelFilter filter);
+
+		osg::Node* m_Terrain;
+		osg::ref_ptr<osgSim::DatabaseCacheReadCallback> m_TileCache;
+		typedef std::map<std::pair<const osg::Image*, TexelFilter>, osg::ref_ptr<ImageSampler> > SamplerCacheMap;
+		SamplerCacheMap m_SamplerCache;
+		CoverageData m_CoverageData;
+		int m_ColorLayer;
+		int m_CoverageLayer;
+		TexelFilter m_ColorFilter;
+	};
+}
@@ -0,0 +1,334 @@
+#include "TiledRaster.h"
+#include <osgDB/ReadFile>
+#include <osgDB/FileUtils>
+#include <osgDB/FileNameUtils>
+#include <osg/Math>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include <float.h>
+
+namespace osgVegetation
+{
+	namespace
+	{
+		const char TILED_RASTER_MAGIC[8] = {'O','S','G','V','T','R','S','T'};
+		const unsigned int TILED_RASTER_VERSION = 1;
+
+		/**
+			File header, 64 bytes
+		*/
+		struct TiledRasterHeader
+		{
+			char Magic[8];
+			unsigned int Version;
+			unsigned int Width;
+			unsigned int Height;
+			unsigned int TileSize;
+			unsigned int NumTilesX;
+			unsigned int NumTilesY;
+			unsigned int PixelFormat;
+			unsigned int DataType;
+			unsigned int TexelSize;
+			float MinValue;
+			float MaxValue;
+			unsigned int Reserved[3];
+		};
+
+		int getNumComponents(GLenum pixel_format)
+		{
+			switch (pixel_format)
+			{
+			case GL_LUMINANCE:
+			case GL_RED:
+			case GL_ALPHA:
+				return 1;
+			case GL_RGB:
+			case GL_BGR:
+				return 3;
+			case GL_RGBA:
+			case GL_BGRA:
+			case GL_LUMINANCE_ALPHA:
+				return 4;
+			default:
+				return 0;
+			}
+		}
+
+		/**
+			Read single channel value without normalization
+		*/
+		float readRawValue(const unsigned char* data, GLenum data_type)
+		{
+			switch (data_type)
+			{
+			case GL_BYTE: return static_cast<float>(*reinterpret_cast<const char*>(data));
+			case GL_UNSIGNED_BYTE: return static_cast<float>(*data);
+			case GL_SHORT: return static_cast<float>(*reinterpret_cast<const short*>(data));
+			case GL_UNSIGNED_SHORT: return static_cast<float>(*reinterpret_cast<const unsigned short*>(data));
+			case GL_INT: return static_cast<float>(*reinterpret_cast<const int*>(data));
+			case GL_UNSIGNED_INT: return static_cast<float>(*reinterpret_cast<const unsigned int*>(data));
+			case GL_FLOAT: return *reinterpret_cast<const float*>(data);
+			case GL_DOUBLE: return static_cast<float>(*reinterpret_cast<const double*>(data));
+			default:
+				OSGV_EXCEPT(std::string("TiledRaster::create - Unsupported data type").c_str());
+			}
+		}
+
+		template<typename FETCH>
+		osg::Vec4 fetchTexel(const unsigned char* texel)
+		{
+			return FETCH::fetch(texel);
+		}
+	}
+
+	TiledRaster::TiledRaster() : m_TileData(NULL),
+		m_Width(0),
+		m_Height(0),
+		m_NumTilesX(0),
+		m_TileShift(0),
+		m_TileMask(0),
+		m_TileBytes(0),
+		m_TexelSize(0),
+		m_PixelFormat(GL_LUMINANCE),
+		m_DataType(GL_FLOAT),
+		m_MinValue(0),
+		m_MaxValue(0),
+		m_FetchFunc(NULL)
+	{
+
+	}
+
+	TiledRaster::~TiledRaster()
+	{
+
+	}
+
+	bool TiledRaster::open(const std::string &filename)
+	{
+		osg::ref_ptr<MemoryMappedFile> file = new MemoryMappedFile();
+		if (!file->open(filename) || file->getSize() < sizeof(TiledRasterHeader))
+			return false;
+
+		TiledRasterHeader header;
+		memcpy(&header, file->getData(), sizeof(TiledRasterHeader));
+		if (memcmp(header.Magic, TILED_RASTER_MAGIC, sizeof(header.Magic)) != 0 || header.Version != TILED_RASTER_VERSION)
+			return false;
+
+		if (header.TileSize == 0 || (header.TileSize & (header.TileSize - 1)) != 0)
+			return false;
+
+		FetchFunc fetch = NULL;
+		const int num_comp = getNumComponents(header.PixelFormat);
+		if (header.DataType == GL_UNSIGNED_BYTE && num_comp == 1) fetch = &fetchTexel<TexelFetchL8>;
+		else if (header.DataType == GL_UNSIGNED_BYTE && num_comp == 3) fetch = &fetchTexel<TexelFetchRGB8>;
+		else if (header.DataType == GL_UNSIGNED_BYTE && num_comp == 4) fetch = &fetchTexel<TexelFetchRGBA8>;
+		else if (header.DataType == GL_FLOAT && num_comp == 1) fetch = &fetchTexel<TexelFetchL32F>;
+		else if (header.DataType == GL_FLOAT && num_comp == 3) fetch = &fetchTexel<TexelFetchRGB32F>;
+		else if (header.DataType == GL_FLOAT && num_comp == 4) fetch = &fetchTexel<TexelFetchRGBA32F>;
+		if (fetch == NULL)
+			return false;
+
+		//header values are not trusted, texel fetch and tile addressing must stay inside the mapping
+		const unsigned int component_size = header.DataType == GL_FLOAT ? sizeof(float) : 1;
+		if (header.TexelSize != num_comp * component_size)
+			return false;
+		if (header.Width == 0 || header.Height == 0 || header.Width > INT_MAX || header.Height > INT_MAX)
+			return false;
+		if (header.Width > static_cast<double>(header.NumTilesX) * header.TileSize || header.Height > static_cast<double>(header.NumTilesY) * header.TileSize)
+			return false;
+
+		const size_t tile_bytes = static_cast<size_t>(header.TileSize) * header.TileSize * header.TexelSize;
+		//computed in double so that large tile counts can't wrap around
+		const double total_size = sizeof(TiledRasterHeader) + static_cast<double>(tile_bytes) * header.NumTilesX * header.NumTilesY;
+		if (static_cast<double>(file->getSize()) < total_size)
+			return false;
+
+		m_File = file;
+		m_TileData = file->getData() + sizeof(TiledRasterHeader);
+		m_Width = static_cast<int>(header.Width);
+		m_Height = static_cast<int>(header.Height);
+		m_NumTilesX = static_cast<int>(header.NumTilesX);
+		m_TileShift = 0;
+		while ((1u << m_TileShift) < header.TileSize)
+			m_TileShift++;
+		m_TileMask = static_cast<int>(header.TileSize) - 1;
+		m_TileBytes = tile_bytes;
+		m_TexelSize = header.TexelSize;
+		m_PixelFormat = header.PixelFormat;
+		m_DataType = header.DataType;
+		m_MinValue = header.MinValue;
+		m_MaxValue = header.MaxValue;
+		m_FetchFunc = fetch;
+		return true;
+	}
+
+	bool TiledRaster::create(const osg::Image &image, const std::string &filename, unsigned int tile_size, bool raw_values)
+	{
+		if (tile_size == 0 || (tile_size & (tile_size - 1)) != 0)
+			OSGV_EXCEPT(std::string("TiledRaster::create - Tile size must be power of two").c_str());
+
+		if (image.isCompressed() || image.s() <= 0 || image.t() <= 0)
+			OSGV_EXCEPT(std::string("TiledRaster::create - Unsupported image:" + image.getFileName()).c_str());
+
+		//select storage format
+		const GLenum src_format = image.getPixelFormat();
+		const GLenum src_type = image.getDataType();
+		const int src_comp = getNumComponents(src_format);
+		if (src_comp == 0)
+			OSGV_EXCEPT(std::string("TiledRaster::create - Unsupported pixel format:" + image.getFileName()).c_str());
+
+		enum ConvertMode {CM_COPY, CM_RAW_FLOAT, CM_COLOR};
+		ConvertMode mode;
+		GLenum pixel_format;
+		GLenum data_type;
+		if (ImageSampler::isSpecialisedFormat(src_format, src_type) && !(raw_values && src_comp == 1 && src_type != GL_FLOAT))
+		{
+			mode = CM_COPY;
+			pixel_format = src_format;
+			data_type = src_type;
+		}
+		else if (src_comp == 1)
+		{
+			mode = CM_RAW_FLOAT;
+			pixel_format = GL_LUMINANCE;
+			data_type = GL_FLOAT;
+		}
+		else
+		{
+			mode = CM_COLOR;
+			pixel_format = GL_RGBA;
+			data_type = src_type == GL_UNSIGNED_BYTE ? GL_UNSIGNED_BYTE : GL_FLOAT;
+		}
+		const unsigned int texel_size = static_cast<unsigned int>(getNumComponents(pixel_format) * (data_type == GL_FLOAT ? sizeof(float) : 1));
+		const unsigned int src_texel_size = image.getPixelSizeInBits() / 8;
+
+		TiledRasterHeader header;
+		memset(&header, 0, sizeof(TiledRasterHeader));
+		memcpy(header.Magic, TILED_RASTER_MAGIC, sizeof(header.Magic));
+		header.Version = TILED_RASTER_VERSION;
+		header.Width = static_cast<unsigned int>(image.s());
+		header.Height = static_cast<unsigned int>(image.t());
+		header.TileSize = tile_size;
+		header.NumTilesX = (header.Width + tile_size - 1) / tile_size;
+		header.NumTilesY = (header.Height + tile_size - 1) / tile_size;
+		header.PixelFormat = pixel_format;
+		header.DataType = data_type;
+		header.TexelSize = texel_size;
+		header.MinValue = FLT_MAX;
+		header.MaxValue = -FLT_MAX;
+
+		std::ofstream out(filename.c_str(), std::ios::out | std::ios::binary);
+		if (!out)
+			return false;
+
+		//header is rewritten with final min/max value when all tiles are done
+		out.write(reinterpret_cast<const char*>(&header), sizeof(TiledRasterHeader));
+
+		std::vector<unsigned char> tile(static_cast<size_t>(tile_size) * tile_size * texel_size);
+		for (unsigned int ty = 0; ty < header.NumTilesY; ty++)
+		{
+			for (unsigned int tx = 0; tx < header.NumTilesX; tx++)
+			{
+				std::fill(tile.begin(), tile.end(), 0);
+				const unsigned int x0 = tx * tile_size;
+				const unsigned int y0 = ty * tile_size;
+				const unsigned int x1 = osg::minimum(x0 + tile_size, header.Width);
+				const unsigned int y1 = osg::minimum(y0 + tile_size, header.Height);
+				for (unsigned int y = y0; y < y1; y++)
+				{
+					unsigned char* dst = &tile[static_cast<size_t>(y - y0) * tile_size * texel_size];
+					const unsigned char* src = image.data(0, y);
+					for (unsigned int x = x0; x < x1; x++)
+					{
+						float value = 0;
+						if (mode == CM_COPY)
+						{
+							memcpy(dst, src + x * src_texel_size, texel_size);
+							value = data_type == GL_FLOAT ? *reinterpret_cast<const float*>(dst) : static_cast<float>(dst[0]) / 255.0f;
+						}
+						else if (mode == CM_RAW_FLOAT)
+						{
+							value = readRawValue(src + x * src_texel_size, src_type);
+							memcpy(dst, &value, sizeof(float));
+						}
+						else
+						{
+							const osg::Vec4 color = image.getColor(x, y);
+							value = color.r();
+							if (data_type == GL_FLOAT)
+								memcpy(dst, color.ptr(), 4 * sizeof(float));
+							else
+							{
+								for (int c = 0; c < 4; c++)
+									dst[c] = static_cast<unsigned char>(osg::clampBetween(color[c], 0.0f, 1.0f) * 255.0f + 0.5f);
+							}
+						}
+						//NaN marks missing data and is not included in value range
+						if (!osg::isNaN(value))
+						{
+							header.MinValue = osg::minimum(header.MinValue, value);
+							header.MaxValue = osg::maximum(header.MaxValue, value);
+						}
+						dst += texel_size;
+					}
+				}
+				out.write(reinterpret_cast<const char*>(&tile[0]), static_cast<std::streamsize>(tile.size()));
+			}
+		}
+		out.seekp(0);
+		out.write(reinterpret_cast<const char*>(&header), sizeof(TiledRasterHeader));
+		out.close();
+		return !out.fail();
+	}
+
+	osg::ref_ptr<TiledRaster> TiledRaster::load(const std::string &filename, unsigned int tile_size, bool raw_values)
+	{
+		std::string tiled_filename = filename;
+		if (osgDB::getLowerCaseFileExtension(filename) != "osgvr")
+		{
+			tiled_filename = filename + ".osgvr";
+			bool convert = !osgDB::fileExists(tiled_filename);
+			if (!convert && raw_values)
+			{
+				//convert again if previously stored as normalized L8
+				osg::ref_ptr<TiledRaster> existing = new TiledRaster();
+				convert = !existing->open(tiled_filename) || (existing->getPixelFormat() == GL_LUMINANCE && existing->getDataType() != GL_FLOAT);
+			}
+			if (convert)
+			{
+				osg::ref_ptr<osg::Image> image = osgDB::readRefImageFile(filename);
+				if (!image.valid())
+					OSGV_EXCEPT(std::string("TiledRaster::load - Failed to load image:" + filename).c_str());
+				if (!create(*image, tiled_filename, tile_size, raw_values))
+					OSGV_EXCEPT(std::string("TiledRaster::load - Failed to write tiled raster:" + tiled_filename).c_str());
+			}
+		}
+		osg::ref_ptr<TiledRaster> raster = new TiledRaster();
+		if (!raster->open(tiled_filename))
+			OSGV_EXCEPT(std::string("TiledRaster::load - Failed to open tiled raster:" + tiled_filename).c_str());
+		return raster;
+	}
+
+	osg::Vec4 TiledRaster::getColor(double x, double y, TexelFilter filter) const
+	{
+		if (filter == TF_NEAREST)
+			return getColor(static_cast<int>(floor(x + 0.5)), static_cast<int>(floor(y + 0.5)));
+
+		const double fx = floor(x);
+		const double fy = floor(y);
+		const int x0 = static_cast<int>(fx);
+		const int y0 = static_cast<int>(fy);
+		const float wx = static_cast<float>(x - fx);
+		const float wy = static_cast<float>(y - fy);
+		const osg::Vec4 c00 = getColor(x0, y0);
+		const osg::Vec4 c10 = getColor(x0 + 1, y0);
+		const osg::Vec4 c01 = getColor(x0, y0 + 1);
+		const osg::Vec4 c11 = getColor(x0 + 1, y0 + 1);
+		const osg::Vec4 bottom = c00 + (c10 - c00) * wx;
+		const osg::Vec4 top = c01 + (c11 - c01) * wx;
+		return bottom + (top - bottom) * wy;
+	}
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include "Common.h"
+#include <osg/Referenced>
+#include <osg/ref_ptr>
+#include <osg/Image>
+#include <osg/Vec4>
+#include <string>
+#include "ImageSampler.h"
+#include "MemoryMappedFile.h"
+
+namespace osgVegetation
+{
+	/**
+		Read only raster stored in a tiled layout and accessed through a memory mapped file.
+		Only tiles that are touched are paged in by the OS, i.e raster size is not limited by available memory.
+		Texels are stored in one of the formats supported by the specialised texel fetch functions
+		(L8, RGB8, RGBA8, float L, RGB and RGBA), other formats are converted when the tiled file is created.
+		Row 0 is the first row of the source osg::Image.
+
+		File layout: 64 byte header followed by all tiles in row major order,
+		each tile is TileSize x TileSize texels, edge tiles are padded.
+	*/
+	class osgvExport TiledRaster : public osg::Referenced
+	{
+	public:
+		TiledRaster();
+
+		/**
+			Open tiled raster file.
+			@return false if file is missing or not a valid tiled raster
+		*/
+		bool open(const std::string &filename);
+
+		/**
+			Create tiled raster file from image.
+			Single channel 8-bit images are stored as L8 (normalized by getColor, ie. landcover ids),
+			other single channel images of non float type are stored as float without normalization.
+			@param tile_size Tile width and height in texels, must be power of two.
+			@param raw_values Store all single channel images as float without normalization (ie. raw DEM heights)
+			@return false if the file could not be written
+		*/
+		static bool create(const osg::Image &image, const std::string &filename, unsigned int tile_size = 256, bool raw_values = false);
+
+		/**
+			Load raster, files with extension .osgvr are opened directly, other files are loaded
+			with osgDB and converted to a tiled file (filename + .osgvr) the first time they are used.
+			Remove the tiled file to force conversion if the source is updated.
+			Throws on failure.
+			@param raw_values See create, converted files stored without raw values are converted again
+		*/
+		static osg::ref_ptr<TiledRaster> load(const std::string &filename, unsigned int tile_size = 256, bool raw_values = false);
+
+		int getWidth() const {return m_Width;}
+		int getHeight() const {return m_Height;}
+		GLenum getPixelFormat() const {return m_PixelFormat;}
+		GLenum getDataType() const {return m_DataType;}
+
+		/**
+			Min/max value of first component, normalized in the same way as getColor
+		*/
+		float getMinValue() const {return m_MinValue;}
+		float getMaxValue() const {return m_MaxValue;}
+
+		/**
+			Get pointer to texel, coordinates are clamped to raster size.
+		*/
+		const unsigned char* getTexel(int x, int y) const
+		{
+			x = x < 0 ? 0 : (x >= m_Width ? m_Width - 1 : x);
+			y = y < 0 ? 0 : (y >= m_Height ? m_Height - 1 : y);
+			const size_t tile = static_cast<size_t>((y >> m_TileShift) * m_NumTilesX + (x >> m_TileShift));
+			const size_t texel = static_cast<size_t>(((y & m_TileMask) << m_TileShift) + (x & m_TileMask));
+			return m_TileData + tile * m_TileBytes + texel * m_TexelSize;
+		}
+
+		/**
+			Get texel color, normalized in the same way as osg::Image::getColor
+		*/
+		osg::Vec4 getColor(int x, int y) const {return m_FetchFunc(getTexel(x, y));}
+
+		/**
+			Get filtered color at continuous texel coordinate, texel centers are located at integer coordinates.
+		*/
+		osg::Vec4 getColor(double x, double y, TexelFilter filter) const;
+	protected:
+		virtual ~TiledRaster();
+	private:
+		typedef osg::Vec4 (*FetchFunc)(const unsigned char* texel);
+		osg::ref_ptr<MemoryMappedFile> m_File;
+		const unsigned char* m_TileData;
+		int m_Width;
+		int m_Height;
+		int m_NumTilesX;
+		int m_TileShift;
+		int m_TileMask;
+		size_t m_TileBytes;
+		size_t m_TexelSize;
+		GLenum m_PixelFormat;
+		GLenum m_DataType;
+		float m_MinValue;
+		float m_MaxValue;
+		FetchFunc m_FetchFunc;
+	};
+}
@@ -0,0 +1,387 @@
+#include "VectorMask.h"
+#include <osg/Math>
+#include <osgDB/FileUtils>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <cmath>
+
+namespace osgVegetation
+{
+	namespace
+	{
+		//max number of children per R-tree node
+		const unsigned int RTREE_NODE_SIZE = 16;
+
+		struct CompareCenterX
+		{
+			template<class T> bool operator()(const T &lhs, const T &rhs) const
+			{
+				return lhs.Bounds.center().x() < rhs.Bounds.center().x();
+			}
+		};
+
+		struct CompareCenterY
+		{
+			template<class T> bool operator()(const T &lhs, const T &rhs) const
+			{
+				return lhs.Bounds.center().y() < rhs.Bounds.center().y();
+			}
+		};
+
+		bool intersectsXY(const osg::BoundingBoxd &a, const osg::BoundingBoxd &b)
+		{
+			return a.xMin() <= b.xMax() && a.xMax() >= b.xMin() && a.yMin() <= b.yMax() && a.yMax() >= b.yMin();
+		}
+	}
+
+	VectorMask::VectorMask() : m_Dirty(false)
+	{
+
+	}
+
+	osg::ref_ptr<VectorMask> VectorMask::load(const std::string &filename)
+	{
+		std::string path = osgDB::findDataFile(filename);
+		if (path == "")
+			path = filename;
+		std::ifstream file(path.c_str());
+		if (!file.good())
+			OSGV_EXCEPT(std::string("VectorMask::load - Failed to open file:" + filename).c_str());
+
+		osg::ref_ptr<VectorMask> mask = new VectorMask;
+		std::string line;
+		int line_number = 0;
+		while (std::getline(file, line))
+		{
+			line_number++;
+			std::stringstream ss(line);
+			std::string type;
+			if (!(ss >> type) || type[0] == '#')
+				continue;
+
+			double buffer = 0;
+			if (type == "POLYLINE" && !(ss >> buffer))
+				OSGV_EXCEPT(std::string("VectorMask::load - Missing polyline buffer in file:" + filename).c_str());
+			else if (type != "POLYLINE" && type != "POLYGON")
+				OSGV_EXCEPT(std::string("VectorMask::load - Unknown shape type:" + type + " in file:" + filename).c_str());
+
+			std::vector<osg::Vec2d> points;
+			double x, y;
+			while (ss >> x >> y)
+				points.push_back(osg::Vec2d(x, y));
+
+			if (type == "POLYGON")
+				mask->addPolygon(points);
+			else
+				mask->addPolyline(points, buffer);
+		}
+		return mask;
+	}
+
+	void VectorMask::addPolygon(const std::vector<osg::Vec2d> &points)
+	{
+		if (points.size() < 3)
+			OSGV_EXCEPT(std::string("VectorMask::addPolygon - Polygon need at least three points").c_str());
+		Shape shape;
+		shape.Points = points;
+		shape.Buffer = 0;
+		shape.Polygon = true;
+		_addShape(shape);
+	}
+
+	void VectorMask::addPolyline(const std::vector<osg::Vec2d> &points, double buffer)
+	{
+		if (points.size() < 1 || buffer <= 0)
+			OSGV_EXCEPT(std::string("VectorMask::addPolyline - Polyline need at least one point and positive buffer").c_str());
+		Shape shape;
+		shape.Points = points;
+		shape.Buffer = buffer;
+		shape.Polygon = false;
+		_addShape(shape);
+	}
+
+	void VectorMask::_addShape(const Shape &shape)
+	{
+		m_Shapes.push_back(shape);
+		Shape& added = m_Shapes.back();
+		for (size_t i = 0; i < added.Points.size(); i++)
+		{
+			added.Bounds.expandBy(osg::Vec3d(added.Points[i].x() - added.Buffer, added.Points[i].y() - added.Buffer, 0));
+			added.Bounds.expandBy(osg::Vec3d(added.Points[i].x() + added.Buffer, added.Points[i].y() + added.Buffer, 0));
+		}
+		m_Bounds.expandBy(added.Bounds);
+		m_Dirty = true;
+	}
+
+	void VectorMask::_sortSTR(std::vector<RTreeEntry> &entries)
+	{
+		//sort-tile-recursive, vertical slices sorted by x then each slice by y
+		const unsigned int num_nodes = static_cast<unsigned int>((entries.size() + RTREE_NODE_SIZE - 1) / RTREE_NODE_SIZE);
+		const unsigned int num_slices = static_cast<unsigned int>(ceil(sqrt(static_cast<double>(num_nodes))));
+		const size_t slice_size = num_slices * RTREE_NODE_SIZE;
+		std::sort(entries.begin(), entries.end(), CompareCenterX());
+		for (size_t i = 0; i < entries.size(); i += slice_size)
+		{
+			const size_t end = osg::minimum(i + slice_size, entries.size());
+			std::sort(entries.begin() + i, entries.begin() + end, CompareCenterY());
+		}
+	}
+
+	void VectorMask::_build() const
+	{
+		m_Nodes.clear();
+		m_Items.clear();
+		m_Children.clear();
+		m_Dirty = false;
+		if (m_Shapes.size() == 0)
+			return;
+
+		std::vector<RTreeEntry> entries(m_Shapes.size());
+		for (size_t i = 0; i < m_Shapes.size(); i++)
+		{
+			entries[i].Bounds = m_Shapes[i].Bounds;
+			entries[i].Index = static_cast<unsigned int>(i);
+		}
+
+		//pack leafs and then parent levels until we reach a single root, the root is last node
+		bool leaf = true;
+		while (leaf || entries.size() > 1)
+		{
+			_sortSTR(entries);
+			std::vector<unsigned int>& targets = leaf ? m_Items : m_Children;
+			std::vector<RTreeEntry> parents;
+			for (size_t i = 0; i < entries.size(); i += RTREE_NODE_SIZE)
+			{
+				RTreeNode node;
+				node.First = static_cast<unsigned int>(targets.size());
+				node.Count = static_cast<unsigned int>(osg::minimum(entries.size() - i, static_cast<size_t>(RTREE_NODE_SIZE)));
+				node.Leaf = leaf;
+				for (unsigned int j = 0; j < node.Count; j++)
+				{
+					node.Bounds.expandBy(entries[i + j].Bounds);
+					targets.push_back(entries[i + j].Index);
+				}
+				RTreeEntry parent;
+				parent.Bounds = node.Bounds;
+				parent.Index = static_cast<unsigned int>(m_Nodes.size());
+				parents.push_back(parent);
+				m_Nodes.push_back(node);
+			}
+			entries = parents;
+			leaf = false;
+		}
+	}
+
+	void VectorMask::query(const osg::BoundingBoxd &bb, std::vector<unsigned int> &shapes) const
+	{
+		shapes.clear();
+		if (m_Dirty)
+			_build();
+		if (m_Nodes.size() == 0)
+			return;
+
+		std::vector<unsigned int> stack;
+		stack.push_back(static_cast<unsigned int>(m_Nodes.size() - 1));
+		while (stack.size() > 0)
+		{
+			const RTreeNode& node = m_Nodes[stack.back()];
+			stack.pop_back();
+			if (!intersectsXY(node.Bounds, bb))
+				continue;
+			for (unsigned int i = node.First; i < node.First + node.Count; i++)
+			{
+				if (!node.Leaf)
+					stack.push_back(m_Children[i]);
+				else if (intersectsXY(m_Shapes[m_Items[i]].Bounds, bb))
+					shapes.push_back(m_Items[i]);
+			}
+		}
+	}
+
+	bool VectorMask::contains(const osg::Vec3d &location, const std::vector<unsigned int> &shapes) const
+	{
+		const osg::Vec2d p(location.x(), location.y());
+		for (size_t i = 0; i < shapes.size(); i++)
+		{
+			if (_containsPoint(m_Shapes[shapes[i]], p))
+				return true;
+		}
+		return false;
+	}
+
+	bool VectorMask::contains(const osg::Vec3d &location) const
+	{
+		std::vector<unsigned int> shapes;
+		query(osg::BoundingBoxd(location, location), shapes);
+		return contains(location, shapes);
+	}
+
+	bool VectorMask::containsBox(const osg::BoundingBoxd &bb, const std::vector<unsigned int> &shapes) const
+	{
+		for (size_t i = 0; i < shapes.size(); i++)
+		{
+			if (_containsBox(m_Shapes[shapes[i]], bb))
+				return true;
+		}
+		return false;
+	}
+
+	bool VectorMask::intersectsBox(const osg::BoundingBoxd &bb, const std::vector<unsigned int> &shapes) const
+	{
+		for (size_t i = 0; i < shapes.size(); i++)
+		{
+			if (_intersectsBox(m_Shapes[shapes[i]], bb))
+				return true;
+		}
+		return false;
+	}
+
+	bool VectorMask::_intersectsBox(const Shape &shape, const osg::BoundingBoxd &bb) const
+	{
+		if (!intersectsXY(shape.Bounds, bb))
+			return false;
+
+		if (shape.Polygon)
+		{
+			//box corner inside polygon, polygon vertex inside box or crossing edges
+			if (_insidePolygon(shape.Points, osg::Vec2d(bb.xMin(), bb.yMin())))
+				return true;
+			const size_t num_points = shape.Points.size();
+			for (size_t i = 0; i < num_points; i++)
+			{
+				const osg::Vec2d& p = shape.Points[i];
+				if (p.x() >= bb.xMin() && p.x() <= bb.xMax() && p.y() >= bb.yMin() && p.y() <= bb.yMax())
+					return true;
+				if (_segmentIntersectsBox(p, shape.Points[(i + 1) % num_points], bb))
+					return true;
+			}
+			return false;
+		}
+
+		//test segments against box expanded by buffer
+		const osg::BoundingBoxd expanded(bb.xMin() - shape.Buffer, bb.yMin() - shape.Buffer, bb.zMin(),
+			bb.xMax() + shape.Buffer, bb.yMax() + shape.Buffer, bb.zMax());
+		for (size_t i = 0; i < shape.Points.size(); i++)
+		{
+			const osg::Vec2d& a = shape.Points[i];
+			const osg::Vec2d& b = shape.Points[osg::minimum(i + 1, shape.Points.size() - 1)];
+			if (a.x() >= expanded.xMin() && a.x() <= expanded.xMax() && a.y() >= expanded.yMin() && a.y() <= expanded.yMax())
+				return true;
+			if (_segmentIntersectsBox(a, b, expanded))
+				return true;
+		}
+		return false;
+	}
+
+	bool VectorMask::_containsPoint(const Shape &shape, const osg::Vec2d &p) const
+	{
+		const osg::BoundingBoxd& bounds = shape.Bounds;
+		if (p.x() < bounds.xMin() || p.x() > bounds.xMax() || p.y() < bounds.yMin() || p.y() > bounds.yMax())
+			return false;
+
+		if (shape.Polygon)
+			return _insidePolygon(shape.Points, p);
+
+		if (shape.Points.size() == 1)
+			return (p - shape.Points[0]).length() <= shape.Buffer;
+		for (size_t i = 1; i < shape.Points.size(); i++)
+		{
+			if (_distanceToSegment(shape.Points[i - 1], shape.Points[i], p) <= shape.Buffer)
+				return true;
+		}
+		return false;
+	}
+
+	bool VectorMask::_containsBox(const Shape &shape, const osg::BoundingBoxd &bb) const
+	{
+		const osg::BoundingBoxd& bounds = shape.Bounds;
+		if (bb.xMin() < bounds.xMin() || bb.xMax() > bounds.xMax() || bb.yMin() < bounds.yMin() || bb.yMax() > bounds.yMax())
+			return false;
+
+		const osg::Vec2d corners[4] = {osg::Vec2d(bb.xMin(), bb.yMin()), osg::Vec2d(bb.xMax(), bb.yMin()),
+			osg::Vec2d(bb.xMax(), bb.yMax()), osg::Vec2d(bb.xMin(), bb.yMax())};
+		if (shape.Polygon)
+		{
+			//all corners inside and no polygon edge entering the box
+			for (int i = 0; i < 4; i++)
+			{
+				if (!_insidePolygon(shape.Points, corners[i]))
+					return false;
+			}
+			const size_t num_points = shape.Points.size();
+			for (size_t i = 0; i < num_points; i++)
+			{
+				if (_segmentIntersectsBox(shape.Points[i], shape.Points[(i + 1) % num_points], bb))
+					return false;
+			}
+			return true;
+		}
+
+		//segment capsules are convex, box is inside if all corners are inside same capsule
+		for (size_t i = 0; i < shape.Points.size(); i++)
+		{
+			const osg::Vec2d& a = shape.Points[i];
+			const osg::Vec2d& b = shape.Points[osg::minimum(i + 1, shape.Points.size() - 1)];
+			bool inside = true;
+			for (int j = 0; j < 4 && inside; j++)
+				inside = _distanceToSegment(a, b, corners[j]) <= shape.Buffer;
+			if (inside)
+				return true;
+		}
+		return false;
+	}
+
+	bool VectorMask::_insidePolygon(const std::vector<osg::Vec2d> &points, const osg::Vec2d &p)
+	{
+		//crossing number test
+		bool inside = false;
+		const size_t num_points = points.size();
+		for (size_t i = 0, j = num_points - 1; i < num_points; j = i++)
+		{
+			const osg::Vec2d& a = points[i];
+			const osg::Vec2d& b = points[j];
+			if ((a.y() > p.y()) != (b.y() > p.y()) &&
+				p.x() < (b.x() - a.x()) * (p.y() - a.y()) / (b.y() - a.y()) + a.x())
+				inside = !inside;
+		}
+		return inside;
+	}
+
+	double VectorMask::_distanceToSegment(const osg::Vec2d &a, const osg::Vec2d &b, const osg::Vec2d &p)
+	{
+		const osg::Vec2d ab = b - a;
+		const double length2 = ab.length2();
+		if (length2 <= 0)
+			return (p - a).length();
+		const double t = osg::clampBetween(((p - a) * ab) / length2, 0.0, 1.0);
+		return (p - (a + ab * t)).length();
+	}
+
+	bool VectorMask::_segmentIntersectsBox(const osg::Vec2d &a, const osg::Vec2d &b, const osg::BoundingBoxd &bb)
+	{
+		//Liang-Barsky clipping against open box, touching the boundary is not an intersection
+		double t0 = 0;
+		double t1 = 1;
+		const osg::Vec2d d = b - a;
+		const double p[4] = {-d.x(), d.x(), -d.y(), d.y()};
+		const double q[4] = {a.x() - bb.xMin(), bb.xMax() - a.x(), a.y() - bb.yMin(), bb.yMax() - a.y()};
+		for (int i = 0; i < 4; i++)
+		{
+			if (p[i] == 0)
+			{
+				if (q[i] <= 0)
+					return false;
+			}
+			else
+			{
+				const double t = q[i] / p[i];
+				if (p[i] < 0)
+					t0 = osg::maximum(t0, t);
+				else
+					t1 = osg::minimum(t1, t);
+			}
+		}
+		return t0 < t1;
+	}
+}
@@ -0,0 +1,120 @@
+#pragma once
+#include "Common.h"
+#include <osg/Referenced>
+#include <osg/ref_ptr>
+#include <osg/Vec2d>
+#include <osg/Vec3d>
+#include <osg/BoundingBox>
+#include <string>
+#include <vector>
+
+namespace osgVegetation
+{
+	/**
+		Vector mask built from polygons and buffered polylines (ie. roads, runways and
+		building footprints), used to exclude or include vegetation without painting
+		high resolution coverage textures. Shapes are indexed in a STR packed R-tree so that
+		each tile can pre-filter relevant shapes (see query) before testing samples.
+		All coordinates are in terrain space, only XY is used.
+	*/
+	class osgvExport VectorMask : public osg::Referenced
+	{
+	public:
+		VectorMask();
+
+		/**
+			Load mask from text file, one shape per line:
+			POLYGON x1 y1 x2 y2 x3 y3 ...
+			POLYLINE buffer x1 y1 x2 y2 ...
+			Empty lines and lines starting with # are ignored. Throws on failure.
+		*/
+		static osg::ref_ptr<VectorMask> load(const std::string &filename);
+
+		/**
+			Add polygon, the ring is implicitly closed. Holes can be expressed
+			as separate polygons in exclusion masks only, ie. they are not subtracted.
+		*/
+		void addPolygon(const std::vector<osg::Vec2d> &points);
+
+		/**
+			Add polyline covering all locations closer than buffer to the line
+		*/
+		void addPolyline(const std::vector<osg::Vec2d> &points, double buffer);
+
+		unsigned int getNumShapes() const {return static_cast<unsigned int>(m_Shapes.size());}
+
+		/**
+			Get indices of shapes whose bounds intersect bb (XY only)
+		*/
+		void query(const osg::BoundingBoxd &bb, std::vector<unsigned int> &shapes) const;
+
+		/**
+			Check if location is inside any of the provided shapes (ie. from query)
+		*/
+		bool contains(const osg::Vec3d &location, const std::vector<unsigned int> &shapes) const;
+
+		/**
+			Check if location is inside any shape
+		*/
+		bool contains(const osg::Vec3d &location) const;
+
+		/**
+			Check if bb (XY) is completely inside one of the provided shapes. Conservative,
+			boxes only covered by the union of several shapes return false.
+		*/
+		bool containsBox(const osg::BoundingBoxd &bb, const std::vector<unsigned int> &shapes) const;
+
+		/**
+			Check if bb (XY) overlap any of the provided shapes. Polyline shapes are tested
+			conservatively, ie. box may be reported as intersecting if close to the buffer.
+		*/
+		bool intersectsBox(const osg::BoundingBoxd &bb, const std::vector<unsigned int> &shapes) const;
+
+		/**
+			Get union of all shape bounds
+		*/
+		const osg::BoundingBoxd& getBounds() const {return m_Bounds;}
+	private:
+		struct Shape
+		{
+			std::vector<osg::Vec2d> Points;
+			//zero for polygons
+			double Buffer;
+			bool Polygon;
+			osg::BoundingBoxd Bounds;
+		};
+
+		struct RTreeNode
+		{
+			osg::BoundingBoxd Bounds;
+			//range in m_Items (leafs) or m_Children
+			unsigned int First;
+			unsigned int Count;
+			bool Leaf;
+		};
+
+		struct RTreeEntry
+		{
+			osg::BoundingBoxd Bounds;
+			unsigned int Index;
+		};
+
+		void _addShape(const Shape &shape);
+		void _build() const;
+		static void _sortSTR(std::vector<RTreeEntry> &entries);
+		static bool _insidePolygon(const std::vector<osg::Vec2d> &points, const osg::Vec2d &p);
+		static double _distanceToSegment(const osg::Vec2d &a, const osg::Vec2d &b, const osg::Vec2d &p);
+		static bool _segmentIntersectsBox(const osg::Vec2d &a, const osg::Vec2d &b, const osg::BoundingBoxd &bb);
+		bool _containsPoint(const Shape &shape, const osg::Vec2d &p) const;
+		bool _containsBox(const Shape &shape, const osg::BoundingBoxd &bb) const;
+		bool _intersectsBox(const Shape &shape, const osg::BoundingBoxd &bb) const;
+
+		std::vector<Shape> m_Shapes;
+		osg::BoundingBoxd m_Bounds;
+		//index is built on first query
+		mutable std::vector<RTreeNode> m_Nodes;
+		mutable std::vector<unsigned int> m_Items;
+		mutable std::vector<unsigned int> m_Children;
+		mutable bool m_Dirty;
+	};
+}
@@ -0,0 +1,363 @@
+#include "VegetationBVH.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace osgVegetation
+{
+	namespace
+	{
+		const unsigned int BVH_LEAF_SIZE = 4;
+		const char BVH_MAGIC[4] = {'V', 'B', 'V', 'H'};
+		const unsigned int BVH_VERSION = 1;
+
+		struct BVHFileHeader
+		{
+			char Magic[4];
+			unsigned int Version;
+			double Origin[3];
+			unsigned int NumInstances;
+			unsigned int NumNodes;
+		};
+
+		class CentroidPredicate
+		{
+		public:
+			CentroidPredicate(int axis) : m_Axis(axis) {}
+			bool operator()(const VegetationInstance &lhs, const VegetationInstance &rhs) const
+			{
+				return _get(lhs) < _get(rhs);
+			}
+		private:
+			float _get(const VegetationInstance &instance) const
+			{
+				if(m_Axis == 0)
+					return instance.X;
+				if(m_Axis == 1)
+					return instance.Y;
+				return instance.Z + instance.Height * 0.5f;
+			}
+			int m_Axis;
+		};
+	}
+
+	VegetationBVH::VegetationBVH(const osg::Vec3d &origin, std::vector<VegetationInstance> &instances) : m_Origin(origin)
+	{
+		m_Instances.swap(instances);
+		if(m_Instances.size() > 0)
+		{
+			m_Nodes.reserve(2 * (m_Instances.size() / BVH_LEAF_SIZE + 1));
+			_build(0, static_cast<unsigned int>(m_Instances.size()));
+		}
+	}
+
+	void VegetationBVH::_getBounds(const VegetationInstance &instance, float* min_v, float* max_v)
+	{
+		min_v[0] = instance.X - instance.Radius;
+		min_v[1] = instance.Y - instance.Radius;
+		min_v[2] = instance.Z;
+		max_v[0] = instance.X + instance.Radius;
+		max_v[1] = instance.Y + instance.Radius;
+		max_v[2] = instance.Z + instance.Height;
+	}
+
+	unsigned int VegetationBVH::_build(unsigned int first, unsigned int count)
+	{
+		const unsigned int node_index = static_cast<unsigned int>(m_Nodes.size());
+		m_Nodes.push_back(Node());
+		Node node;
+		float c_min[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+		float c_max[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+		for(int k = 0; k < 3; k++)
+		{
+			node.Min[k] = FLT_MAX;
+			node.Max[k] = -FLT_MAX;
+		}
+		for(unsigned int i = first; i < first + count; i++)
+		{
+			float min_v[3];
+			float max_v[3];
+			_getBounds(m_Instances[i], min_v, max_v);
+			for(int k = 0; k < 3; k++)
+			{
+				node.Min[k] = std::min(node.Min[k], min_v[k]);
+				node.Max[k] = std::max(node.Max[k], max_v[k]);
+				const float center = (min_v[k] + max_v[k]) * 0.5f;
+				c_min[k] = std::min(c_min[k], center);
+				c_max[k] = std::max(c_max[k], center);
+			}
+		}
+
+		if(count <= BVH_LEAF_SIZE)
+		{
+			node.Start = first;
+			node.Count = count;
+			m_Nodes[node_index] = node;
+			return node_index;
+		}
+
+		//median split along largest centroid extent
+		int axis = 0;
+		for(int k = 1; k < 3; k++)
+		{
+			if(c_max[k] - c_min[k] > c_max[axis] - c_min[axis])
+				axis = k;
+		}
+		const unsigned int half = count / 2;
+		std::nth_element(m_Instances.begin() + first, m_Instances.begin() + first + half, m_Instances.begin() + first + count, CentroidPredicate(axis));
+		_build(first, half);
+		node.Start = _build(first + half, count - half);
+		node.Count = 0;
+		m_Nodes[node_index] = node;
+		return node_index;
+	}
+
+	bool VegetationBVH::_intersectNode(const Node &node, const osg::Vec3d &start, const osg::Vec3d &inv_dir, double max_t)
+	{
+		double t_min = 0;
+		double t_max = max_t;
+		for(int k = 0; k < 3; k++)
+		{
+			double t0 = (node.Min[k] - start[k]) * inv_dir[k];
+			double t1 = (node.Max[k] - start[k]) * inv_dir[k];
+			if(t0 > t1)
+				std::swap(t0, t1);
+			t_min = std::max(t_min, t0);
+			t_max = std::min(t_max, t1);
+			if(t_min > t_max)
+				return false;
+		}
+		return true;
+	}
+
+	bool VegetationBVH::_intersectCylinder(const VegetationInstance &instance, const osg::Vec3d &start, const osg::Vec3d &dir, double &t)
+	{
+		//segment interval inside infinite vertical cylinder
+		double t_min = 0;
+		double t_max = t;
+		const double dx = start.x() - instance.X;
+		const double dy = start.y() - instance.Y;
+		const double r2 = instance.Radius * instance.Radius;
+		const double a = dir.x() * dir.x() + dir.y() * dir.y();
+		const double c = dx * dx + dy * dy - r2;
+		if(a < 1e-12)
+		{
+			//vertical segment
+			if(c > 0)
+				return false;
+		}
+		else
+		{
+			const double b = dx * dir.x() + dy * dir.y();
+			const double disc = b * b - a * c;
+			if(disc < 0)
+				return false;
+			const double sq = sqrt(disc);
+			t_min = std::max(t_min, (-b - sq) / a);
+			t_max = std::min(t_max, (-b + sq) / a);
+		}
+
+		//clip by height interval, caps are hit when entering through this interval
+		if(fabs(dir.z()) < 1e-12)
+		{
+			if(start.z() < instance.Z || start.z() > instance.Z + instance.Height)
+				return false;
+		}
+		else
+		{
+			double t0 = (instance.Z - start.z()) / dir.z();
+			double t1 = (instance.Z + instance.Height - start.z()) / dir.z();
+			if(t0 > t1)
+				std::swap(t0, t1);
+			t_min = std::max(t_min, t0);
+			t_max = std::min(t_max, t1);
+		}
+		if(t_min > t_max)
+			return false;
+		t = t_min;
+		return true;
+	}
+
+	int VegetationBVH::intersectSegment(const osg::Vec3d &start, const osg::Vec3d &end, double &max_t) const
+	{
+		if(m_Nodes.size() == 0)
+			return -1;
+		const osg::Vec3d dir = end - start;
+		const osg::Vec3d inv_dir(1.0 / dir.x(), 1.0 / dir.y(), 1.0 / dir.z());
+		int hit = -1;
+		unsigned int stack[64];
+		int stack_size = 0;
+		stack[stack_size++] = 0;
+		while(stack_size > 0)
+		{
+			const unsigned int node_index = stack[--stack_size];
+			const Node& node = m_Nodes[node_index];
+			if(!_intersectNode(node, start, inv_dir, max_t))
+				continue;
+			if(node.Count > 0)
+			{
+				for(unsigned int i = node.Start; i < node.Start + node.Count; i++)
+				{
+					double t = max_t;
+					if(_intersectCylinder(m_Instances[i], start, dir, t))
+					{
+						//closer hits shrink the segment
+						max_t = t;
+						hit = static_cast<int>(i);
+					}
+				}
+			}
+			else if(stack_size + 2 <= 64)
+			{
+				stack[stack_size++] = node.Start;
+				stack[stack_size++] = node_index + 1;
+			}
+		}
+		return hit;
+	}
+
+	void VegetationBVH::queryBox(const osg::BoundingBoxd &bb, std::vector<unsigned int> &indices) const
+	{
+		if(m_Nodes.size() == 0)
+			return;
+		unsigned int stack[64];
+		int stack_size = 0;
+		stack[stack_size++] = 0;
+		while(stack_size > 0)
+		{
+			const unsigned int node_index = stack[--stack_size];
+			const Node& node = m_Nodes[node_index];
+			if(node.Min[0] > bb.xMax() || node.Max[0] < bb.xMin() ||
+				node.Min[1] > bb.yMax() || node.Max[1] < bb.yMin() ||
+				node.Min[2] > bb.zMax() || node.Max[2] < bb.zMin())
+				continue;
+			if(node.Count > 0)
+			{
+				for(unsigned int i = node.Start; i < node.Start + node.Count; i++)
+				{
+					float min_v[3];
+					float max_v[3];
+					_getBounds(m_Instances[i], min_v, max_v);
+					if(min_v[0] <= bb.xMax() && max_v[0] >= bb.xMin() &&
+						min_v[1] <= bb.yMax() && max_v[1] >= bb.yMin() &&
+						min_v[2] <= bb.zMax() && max_v[2] >= bb.zMin())
+						indices.push_back(i);
+				}
+			}
+			else if(stack_size + 2 <= 64)
+			{
+				stack[stack_size++] = node.Start;
+				stack[stack_size++] = node_index + 1;
+			}
+		}
+	}
+
+	double VegetationBVH::_distance2(const Node &node, const osg::Vec3d &position)
+	{
+		const double dx = std::max(0.0, std::max(node.Min[0] - position.x(), position.x() - node.Max[0]));
+		const double dy = std::max(0.0, std::max(node.Min[1] - position.y(), position.y() - node.Max[1]));
+		return dx * dx + dy * dy;
+	}
+
+	void VegetationBVH::nearest(const osg::Vec3d &position, unsigned int n, double max_distance2, std::vector<std::pair<double, unsigned int> > &result) const
+	{
+		result.clear();
+		if(m_Nodes.size() == 0 || n == 0)
+			return;
+		unsigned int stack[64];
+		int stack_size = 0;
+		stack[stack_size++] = 0;
+		while(stack_size > 0)
+		{
+			const double limit = result.size() == n ? result.back().first : max_distance2;
+			const unsigned int node_index = stack[--stack_size];
+			const Node& node = m_Nodes[node_index];
+			//node bounds include radius, axis distance is never closer than this
+			if(_distance2(node, position) > limit)
+				continue;
+			if(node.Count > 0)
+			{
+				for(unsigned int i = node.Start; i < node.Start + node.Count; i++)
+				{
+					const double dx = m_Instances[i].X - position.x();
+					const double dy = m_Instances[i].Y - position.y();
+					const double d2 = dx * dx + dy * dy;
+					if(d2 > (result.size() == n ? result.back().first : max_distance2))
+						continue;
+					const std::pair<double, unsigned int> entry(d2, i);
+					result.insert(std::upper_bound(result.begin(), result.end(), entry), entry);
+					if(result.size() > n)
+						result.pop_back();
+				}
+			}
+			else if(stack_size + 2 <= 64)
+			{
+				//visit closest child first
+				const unsigned int left = node_index + 1;
+				const unsigned int right = node.Start;
+				if(_distance2(m_Nodes[left], position) < _distance2(m_Nodes[right], position))
+				{
+					stack[stack_size++] = right;
+					stack[stack_size++] = left;
+				}
+				else
+				{
+					stack[stack_size++] = left;
+					stack[stack_size++] = right;
+				}
+			}
+		}
+	}
+
+	void VegetationBVH::save(const std::string &filename) const
+	{
+		BVHFileHeader header;
+		memcpy(header.Magic, BVH_MAGIC, 4);
+		header.Version = BVH_VERSION;
+		header.Origin[0] = m_Origin.x();
+		header.Origin[1] = m_Origin.y();
+		header.Origin[2] = m_Origin.z();
+		header.NumInstances = static_cast<unsigned int>(m_Instances.size());
+		header.NumNodes = static_cast<unsigned int>(m_Nodes.size());
+
+		FILE* file = fopen(filename.c_str(), "wb");
+		if(file == NULL)
+			OSGV_EXCEPT(std::string("VegetationBVH::save - Failed to open file:" + filename).c_str());
+		bool ok = fwrite(&header, sizeof(BVHFileHeader), 1, file) == 1;
+		if(ok && m_Instances.size() > 0)
+			ok = fwrite(&m_Instances[0], sizeof(VegetationInstance), m_Instances.size(), file) == m_Instances.size();
+		if(ok && m_Nodes.size() > 0)
+			ok = fwrite(&m_Nodes[0], sizeof(Node), m_Nodes.size(), file) == m_Nodes.size();
+		fclose(file);
+		if(!ok)
+			OSGV_EXCEPT(std::string("VegetationBVH::save - Failed to write file:" + filename).c_str());
+	}
+
+	VegetationBVH* VegetationBVH::load(const std::string &filename)
+	{
+		FILE* file = fopen(filename.c_str(), "rb");
+		if(file == NULL)
+			OSGV_EXCEPT(std::string("VegetationBVH::load - Failed to open file:" + filename).c_str());
+		BVHFileHeader header;
+		bool ok = fread(&header, sizeof(BVHFileHeader), 1, file) == 1 &&
+			memcmp(header.Magic, BVH_MAGIC, 4) == 0 && header.Version == BVH_VERSION;
+
+		osg::ref_ptr<VegetationBVH> bvh = new VegetationBVH;
+		if(ok)
+		{
+			bvh->m_Origin.set(header.Origin[0], header.Origin[1], header.Origin[2]);
+			bvh->m_Instances.resize(header.NumInstances);
+			bvh->m_Nodes.resize(header.NumNodes);
+			if(header.NumInstances > 0)
+				ok = fread(&bvh->m_Instances[0], sizeof(VegetationInstance), header.NumInstances, file) == header.NumInstances;
+			if(ok && header.NumNodes > 0)
+				ok = fread(&bvh->m_Nodes[0], sizeof(Node), header.NumNodes, file) == header.NumNodes;
+		}
+		fclose(file);
+		if(!ok)
+			OSGV_EXCEPT(std::string("VegetationBVH::load - Invalid file:" + filename).c_str());
+		return bvh.release();
+	}
+}
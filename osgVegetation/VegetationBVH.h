@@ -0,0 +1,93 @@
+#pragma once
+#include "Common.h"
+#include <osg/Referenced>
+#include <osg/BoundingBox>
+#include <osg/Vec3d>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace osgVegetation
+{
+	/**
+		Instance record used by vegetation spatial queries, position relative to tile origin.
+		Instances are approximated by a vertical cylinder from position to position + height.
+	*/
+	struct VegetationInstance
+	{
+		float X;
+		float Y;
+		float Z;
+		float Radius;
+		float Height;
+		//global layer index, see ScatterInstanceSink
+		unsigned int Layer;
+	};
+
+	/**
+		Bounding volume hierarchy over the instances of one query tile, stored as flat arrays
+		(nodes in depth first order, left child follow its parent) that are written and read
+		as is. Queries are done in tile space, ie. relative to getOrigin().
+	*/
+	class osgvExport VegetationBVH : public osg::Referenced
+	{
+	public:
+		struct Node
+		{
+			float Min[3];
+			float Max[3];
+			//leaf: first instance, internal: index of right child
+			unsigned int Start;
+			//number of instances, zero for internal nodes
+			unsigned int Count;
+		};
+
+		/**
+			Build hierarchy, instances are reordered
+			@param origin Tile origin (terrain space)
+			@param instances Instances relative to origin, swapped into this object
+		*/
+		VegetationBVH(const osg::Vec3d &origin, std::vector<VegetationInstance> &instances);
+
+		/**
+			Load from file written by save, throws if file can't be read
+		*/
+		static VegetationBVH* load(const std::string &filename);
+		void save(const std::string &filename) const;
+
+		const osg::Vec3d& getOrigin() const {return m_Origin;}
+		const std::vector<VegetationInstance>& getInstances() const {return m_Instances;}
+		const std::vector<Node>& getNodes() const {return m_Nodes;}
+
+		/**
+			Find first instance hit by segment start + t*(end-start), t in [0, max_t]
+			@param max_t In: max segment parameter, out: parameter of hit if found
+			@return instance index or -1
+		*/
+		int intersectSegment(const osg::Vec3d &start, const osg::Vec3d &end, double &max_t) const;
+
+		/**
+			Get indices of instances with bounds overlapping bb
+		*/
+		void queryBox(const osg::BoundingBoxd &bb, std::vector<unsigned int> &indices) const;
+
+		/**
+			Get n nearest instances by horizontal distance to instance axis
+			@param max_distance2 Squared search radius, ie. distance of n:th instance found in other tiles
+			@param result Squared distance and instance index, sorted by distance
+		*/
+		void nearest(const osg::Vec3d &position, unsigned int n, double max_distance2, std::vector<std::pair<double, unsigned int> > &result) const;
+	protected:
+		VegetationBVH() {}
+		virtual ~VegetationBVH() {}
+	private:
+		unsigned int _build(unsigned int first, unsigned int count);
+		static void _getBounds(const VegetationInstance &instance, float* min_v, float* max_v);
+		static bool _intersectCylinder(const VegetationInstance &instance, const osg::Vec3d &start, const osg::Vec3d &dir, double &t);
+		static bool _intersectNode(const Node &node, const osg::Vec3d &start, const osg::Vec3d &inv_dir, double max_t);
+		static double _distance2(const Node &node, const osg::Vec3d &position);
+		osg::Vec3d m_Origin;
+		std::vector<VegetationInstance> m_Instances;
+		std::vector<Node> m_Nodes;
+	};
+}
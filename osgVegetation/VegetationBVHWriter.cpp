@@ -0,0 +1,65 @@
+#include "VegetationBVHWriter.h"
+#include <osgDB/FileNameUtils>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+
+namespace osgVegetation
+{
+	VegetationBVHWriter::VegetationBVHWriter(const std::string &filename, double tile_size) : m_FileName(filename),
+		m_TileSize(tile_size),
+		m_MaxRadius(0),
+		m_NumInstances(0)
+	{
+		if(tile_size <= 0)
+			OSGV_EXCEPT(std::string("VegetationBVHWriter::VegetationBVHWriter - Invalid tile size for file:" + filename).c_str());
+	}
+
+	std::string VegetationBVHWriter::getTileFileName(const std::string &index_file, int x, int y)
+	{
+		std::stringstream ss;
+		ss << osgDB::getNameLessExtension(index_file) << "_X" << x << "_Y" << y << ".vbvh";
+		return ss.str();
+	}
+
+	void VegetationBVHWriter::addInstance(const osg::Vec3d &position, float radius, float height, unsigned int layer)
+	{
+		const TileKey key(static_cast<int>(floor(position.x() / m_TileSize)), static_cast<int>(floor(position.y() / m_TileSize)));
+		VegetationInstance instance;
+		instance.X = static_cast<float>(position.x() - key.first * m_TileSize);
+		instance.Y = static_cast<float>(position.y() - key.second * m_TileSize);
+		instance.Z = static_cast<float>(position.z());
+		instance.Radius = radius;
+		instance.Height = height;
+		instance.Layer = layer;
+		m_Tiles[key].push_back(instance);
+		m_MaxRadius = std::max(m_MaxRadius, radius);
+		m_NumInstances++;
+	}
+
+	void VegetationBVHWriter::write()
+	{
+		std::cout << "VegetationBVHWriter - Writing " << m_NumInstances << " instances to " << m_Tiles.size() << " tiles\n";
+		for(std::map<TileKey, std::vector<VegetationInstance> >::iterator iter = m_Tiles.begin(); iter != m_Tiles.end(); ++iter)
+		{
+			const osg::Vec3d origin(iter->first.first * m_TileSize, iter->first.second * m_TileSize, 0);
+			osg::ref_ptr<VegetationBVH> bvh = new VegetationBVH(origin, iter->second);
+			bvh->save(getTileFileName(m_FileName, iter->first.first, iter->first.second));
+		}
+
+		//index: tile size, max instance radius and existing tile keys
+		FILE* file = fopen(m_FileName.c_str(), "w");
+		if(file == NULL)
+			OSGV_EXCEPT(std::string("VegetationBVHWriter::write - Failed to open file:" + m_FileName).c_str());
+		fprintf(file, "VBVI 1\n%.17g %.9g %u\n", m_TileSize, m_MaxRadius, static_cast<unsigned int>(m_Tiles.size()));
+		for(std::map<TileKey, std::vector<VegetationInstance> >::const_iterator iter = m_Tiles.begin(); iter != m_Tiles.end(); ++iter)
+			fprintf(file, "%d %d\n", iter->first.first, iter->first.second);
+		const bool ok = ferror(file) == 0;
+		fclose(file);
+		if(!ok)
+			OSGV_EXCEPT(std::string("VegetationBVHWriter::write - Failed to write file:" + m_FileName).c_str());
+		m_Tiles.clear();
+	}
+}
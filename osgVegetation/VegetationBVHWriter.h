@@ -0,0 +1,50 @@
+#pragma once
+#include "Common.h"
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "QuadTreeScatterer.h"
+#include "VegetationBVH.h"
+
+namespace osgVegetation
+{
+	/**
+		Instance sink that exports all scattered instances to a tiled BVH database for
+		simulation queries, see VegetationQuery. Instances are bucketed in a world anchored
+		grid of query tiles and written when generation is done, one BVH file per tile
+		next to an index file listing tile size and existing tiles.
+	*/
+	class osgvExport VegetationBVHWriter : public ScatterInstanceSink
+	{
+	public:
+		/**
+			@param filename Index file, tile files are named <filename without extension>_X<x>_Y<y>.vbvh
+			@param tile_size Query tile size in terrain units
+		*/
+		VegetationBVHWriter(const std::string &filename, double tile_size);
+
+		//ScatterInstanceSink
+		void addInstance(const osg::Vec3d &position, float radius, float height, unsigned int layer);
+
+		/**
+			Build and write tile hierarchies and index, throws if files can't be written.
+			Buffered instances are released.
+		*/
+		void write();
+
+		unsigned int getNumInstances() const {return m_NumInstances;}
+
+		/**
+			File name of tile x, y for index file
+		*/
+		static std::string getTileFileName(const std::string &index_file, int x, int y);
+	private:
+		typedef std::pair<int, int> TileKey;
+		std::string m_FileName;
+		double m_TileSize;
+		float m_MaxRadius;
+		unsigned int m_NumInstances;
+		std::map<TileKey, std::vector<VegetationInstance> > m_Tiles;
+	};
+}
@@ -0,0 +1,145 @@
+#include "VegetationDensityGrid.h"
+#include <osgDB/FileNameUtils>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace osgVegetation
+{
+	std::string VegetationDensityGrid::getRasterFileName(const std::string &index_file)
+	{
+		return osgDB::getNameLessExtension(index_file) + ".osgvr";
+	}
+
+	VegetationDensityGrid* VegetationDensityGrid::load(const std::string &filename)
+	{
+		FILE* file = fopen(filename.c_str(), "r");
+		if(file == NULL)
+			OSGV_EXCEPT(std::string("VegetationDensityGrid::load - Failed to open file:" + filename).c_str());
+		char magic[8] = {0};
+		unsigned int version = 0;
+		osg::ref_ptr<VegetationDensityGrid> grid = new VegetationDensityGrid();
+		const bool ok = fscanf(file, "%4s %u", magic, &version) == 2 && strcmp(magic, "VDGI") == 0 && version == 1 &&
+			fscanf(file, "%lf %lf %lf", &grid->m_Origin.x(), &grid->m_Origin.y(), &grid->m_CellSize) == 3 && grid->m_CellSize > 0;
+		fclose(file);
+		if(!ok)
+			OSGV_EXCEPT(std::string("VegetationDensityGrid::load - Invalid index file:" + filename).c_str());
+
+		grid->m_Raster = new TiledRaster();
+		const std::string raster_file = getRasterFileName(filename);
+		if(!grid->m_Raster->open(raster_file) || grid->m_Raster->getPixelFormat() != GL_RGBA || grid->m_Raster->getDataType() != GL_FLOAT)
+			OSGV_EXCEPT(std::string("VegetationDensityGrid::load - Failed to open cell raster:" + raster_file).c_str());
+		return grid.release();
+	}
+
+	VegetationDensityGrid::Cell VegetationDensityGrid::getCell(int x, int y) const
+	{
+		Cell cell;
+		if(x < 0 || y < 0 || x >= getWidth() || y >= getHeight())
+			return cell;
+		const float* texel = reinterpret_cast<const float*>(m_Raster->getTexel(x, y));
+		cell.Bottom = texel[0];
+		cell.Top = texel[1];
+		cell.StemDensity = texel[2];
+		cell.Cover = texel[3];
+		return cell;
+	}
+
+	VegetationDensityGrid::Integral VegetationDensityGrid::integrate(const osg::Vec3d &start, const osg::Vec3d &end) const
+	{
+		Integral result;
+		const osg::Vec3d dir = end - start;
+		const double length = dir.length();
+		if(length == 0)
+			return result;
+
+		//grid space, segment parameter t in [0, 1]
+		const double gx = (start.x() - m_Origin.x()) / m_CellSize;
+		const double gy = (start.y() - m_Origin.y()) / m_CellSize;
+		const double gdx = dir.x() / m_CellSize;
+		const double gdy = dir.y() / m_CellSize;
+		const int width = getWidth();
+		const int height = getHeight();
+
+		//clip segment to grid
+		double t0 = 0;
+		double t1 = 1;
+		const double g_start[2] = {gx, gy};
+		const double g_dir[2] = {gdx, gdy};
+		const double g_size[2] = {static_cast<double>(width), static_cast<double>(height)};
+		for(int axis = 0; axis < 2; axis++)
+		{
+			if(g_dir[axis] == 0)
+			{
+				if(g_start[axis] < 0 || g_start[axis] >= g_size[axis])
+					return result;
+				continue;
+			}
+			const double ta = -g_start[axis] / g_dir[axis];
+			const double tb = (g_size[axis] - g_start[axis]) / g_dir[axis];
+			t0 = std::max(t0, std::min(ta, tb));
+			t1 = std::min(t1, std::max(ta, tb));
+		}
+		if(t0 >= t1)
+			return result;
+
+		int cx = osg::clampBetween(static_cast<int>(floor(gx + gdx * t0)), 0, width - 1);
+		int cy = osg::clampBetween(static_cast<int>(floor(gy + gdy * t0)), 0, height - 1);
+		const int step_x = gdx > 0 ? 1 : -1;
+		const int step_y = gdy > 0 ? 1 : -1;
+		const double delta_x = gdx != 0 ? 1.0 / fabs(gdx) : DBL_MAX;
+		const double delta_y = gdy != 0 ? 1.0 / fabs(gdy) : DBL_MAX;
+		double next_x = gdx != 0 ? ((cx + (step_x > 0 ? 1 : 0)) - gx) / gdx : DBL_MAX;
+		double next_y = gdy != 0 ? ((cy + (step_y > 0 ? 1 : 0)) - gy) / gdy : DBL_MAX;
+
+		double t = t0;
+		while(t < t1)
+		{
+			const double t_next = std::min(t1, std::min(next_x, next_y));
+			const Cell cell = getCell(cx, cy);
+			if(cell.StemDensity > 0 || cell.Cover > 0)
+			{
+				//clip cell interval to canopy slab
+				double a = t;
+				double b = t_next;
+				if(dir.z() == 0)
+				{
+					if(start.z() < cell.Bottom || start.z() > cell.Top)
+						b = a;
+				}
+				else
+				{
+					const double ta = (cell.Bottom - start.z()) / dir.z();
+					const double tb = (cell.Top - start.z()) / dir.z();
+					a = std::max(a, std::min(ta, tb));
+					b = std::min(b, std::max(ta, tb));
+				}
+				if(b > a)
+				{
+					const double l = (b - a) * length;
+					result.Length += l;
+					result.StemDensity += l * cell.StemDensity;
+					result.Cover += l * cell.Cover;
+				}
+			}
+			if(t_next >= t1)
+				break;
+			if(next_x < next_y)
+			{
+				cx += step_x;
+				next_x += delta_x;
+			}
+			else
+			{
+				cy += step_y;
+				next_y += delta_y;
+			}
+			if(cx < 0 || cy < 0 || cx >= width || cy >= height)
+				break;
+			t = t_next;
+		}
+		return result;
+	}
+}
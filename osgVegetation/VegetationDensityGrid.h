@@ -0,0 +1,82 @@
+#pragma once
+#include "Common.h"
+#include <osg/Referenced>
+#include <osg/ref_ptr>
+#include <osg/Vec2d>
+#include <osg/Vec3d>
+#include <string>
+#include "TiledRaster.h"
+
+namespace osgVegetation
+{
+	/**
+		Coarse 2.5D vegetation density grid for sensor and line of sight models, written
+		by VegetationDensityGridWriter. Each cell stores canopy bottom and top height
+		(terrain space), stem density and crown cover. The cell data is a float RGBA
+		TiledRaster (memory mapped, only touched tiles are paged in), georeferencing
+		is stored in a small text index file.
+	*/
+	class osgvExport VegetationDensityGrid : public osg::Referenced
+	{
+	public:
+		struct Cell
+		{
+			Cell() : Bottom(0), Top(0), StemDensity(0), Cover(0) {}
+			//lowest instance base
+			float Bottom;
+			//highest instance top
+			float Top;
+			//stems per square unit
+			float StemDensity;
+			//crown area / cell area, clamped to one
+			float Cover;
+		};
+
+		/**
+			Segment integral, only the parts of the segment inside cell canopy slabs
+			(Bottom to Top) contribute
+		*/
+		struct Integral
+		{
+			Integral() : Length(0), StemDensity(0), Cover(0) {}
+			//length inside canopy
+			double Length;
+			//integral of stem density, ie. expected stems per unit width of a ray tube
+			double StemDensity;
+			//integral of cover, ie. attenuation = exp(-k * Cover)
+			double Cover;
+		};
+
+		/**
+			Load grid from index file, throws on failure
+		*/
+		static VegetationDensityGrid* load(const std::string &filename);
+
+		/**
+			File name of cell raster for index file
+		*/
+		static std::string getRasterFileName(const std::string &index_file);
+
+		const osg::Vec2d& getOrigin() const {return m_Origin;}
+		double getCellSize() const {return m_CellSize;}
+		int getWidth() const {return m_Raster->getWidth();}
+		int getHeight() const {return m_Raster->getHeight();}
+
+		/**
+			Get cell data, empty cell if outside grid
+		*/
+		Cell getCell(int x, int y) const;
+
+		/**
+			Integrate density along segment, cells are traversed with a 2D DDA
+		*/
+		Integral integrate(const osg::Vec3d &start, const osg::Vec3d &end) const;
+	protected:
+		VegetationDensityGrid() : m_CellSize(1) {}
+		virtual ~VegetationDensityGrid() {}
+	private:
+		osg::ref_ptr<TiledRaster> m_Raster;
+		osg::Vec2d m_Origin;
+		double m_CellSize;
+	};
+}
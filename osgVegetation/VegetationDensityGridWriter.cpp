@@ -0,0 +1,81 @@
+#include "VegetationDensityGridWriter.h"
+#include "VegetationDensityGrid.h"
+#include "TiledRaster.h"
+#include <osg/Image>
+#include <osg/Math>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+
+namespace osgVegetation
+{
+	VegetationDensityGridWriter::VegetationDensityGridWriter(const std::string &filename, const osg::BoundingBoxd &bb, double cell_size) : m_FileName(filename),
+		m_Origin(bb.xMin(), bb.yMin()),
+		m_CellSize(cell_size),
+		m_Width(0),
+		m_Height(0)
+	{
+		if(cell_size <= 0 || !bb.valid())
+			OSGV_EXCEPT(std::string("VegetationDensityGridWriter::VegetationDensityGridWriter - Invalid area or cell size for file:" + filename).c_str());
+		m_Width = std::max(1, static_cast<int>(ceil((bb.xMax() - bb.xMin()) / cell_size)));
+		m_Height = std::max(1, static_cast<int>(ceil((bb.yMax() - bb.yMin()) / cell_size)));
+		m_Cells.resize(static_cast<size_t>(m_Width) * m_Height, osg::Vec4(FLT_MAX, -FLT_MAX, 0, 0));
+	}
+
+	void VegetationDensityGridWriter::addInstance(const osg::Vec3d &position, float radius, float height, unsigned int /*layer*/)
+	{
+		//cells are released by write
+		if(m_Cells.empty())
+			return;
+		const int x = static_cast<int>(floor((position.x() - m_Origin.x()) / m_CellSize));
+		const int y = static_cast<int>(floor((position.y() - m_Origin.y()) / m_CellSize));
+		if(x < 0 || y < 0 || x >= m_Width || y >= m_Height)
+			return;
+		osg::Vec4& cell = m_Cells[static_cast<size_t>(y) * m_Width + x];
+		cell[0] = std::min(cell[0], static_cast<float>(position.z()));
+		cell[1] = std::max(cell[1], static_cast<float>(position.z() + height));
+		cell[2] += 1.0f;
+		cell[3] += static_cast<float>(osg::PI) * radius * radius;
+	}
+
+	void VegetationDensityGridWriter::write()
+	{
+		if(m_Cells.empty())
+			OSGV_EXCEPT(std::string("VegetationDensityGridWriter::write - Grid already written to file:" + m_FileName).c_str());
+		std::cout << "VegetationDensityGridWriter - Writing " << m_Width << "x" << m_Height << " cells\n";
+		const float cell_area = static_cast<float>(m_CellSize * m_CellSize);
+		osg::ref_ptr<osg::Image> image = new osg::Image();
+		image->allocateImage(m_Width, m_Height, 1, GL_RGBA, GL_FLOAT);
+		for(int y = 0; y < m_Height; y++)
+		{
+			float* dst = reinterpret_cast<float*>(image->data(0, y));
+			for(int x = 0; x < m_Width; x++)
+			{
+				const osg::Vec4& cell = m_Cells[static_cast<size_t>(y) * m_Width + x];
+				const bool empty = cell[2] == 0;
+				dst[0] = empty ? 0.0f : cell[0];
+				dst[1] = empty ? 0.0f : cell[1];
+				dst[2] = cell[2] / cell_area;
+				dst[3] = std::min(1.0f, cell[3] / cell_area);
+				dst += 4;
+			}
+		}
+		std::vector<osg::Vec4>().swap(m_Cells);
+
+		const std::string raster_file = VegetationDensityGrid::getRasterFileName(m_FileName);
+		if(!TiledRaster::create(*image, raster_file))
+			OSGV_EXCEPT(std::string("VegetationDensityGridWriter::write - Failed to write file:" + raster_file).c_str());
+
+		//index: georeferencing of cell raster
+		FILE* file = fopen(m_FileName.c_str(), "w");
+		if(file == NULL)
+			OSGV_EXCEPT(std::string("VegetationDensityGridWriter::write - Failed to open file:" + m_FileName).c_str());
+		fprintf(file, "VDGI 1\n%.17g %.17g %.17g\n", m_Origin.x(), m_Origin.y(), m_CellSize);
+		const bool ok = ferror(file) == 0;
+		fclose(file);
+		if(!ok)
+			OSGV_EXCEPT(std::string("VegetationDensityGridWriter::write - Failed to write file:" + m_FileName).c_str());
+	}
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include "Common.h"
+#include <osg/BoundingBox>
+#include <osg/Vec2d>
+#include <osg/Vec4>
+#include <string>
+#include <vector>
+#include "QuadTreeScatterer.h"
+
+namespace osgVegetation
+{
+	/**
+		Instance sink that accumulates scattered instances into a VegetationDensityGrid.
+		Cells are kept in memory during generation (16 bytes per cell) and written
+		when generation is done. Instances outside the grid are ignored.
+	*/
+	class osgvExport VegetationDensityGridWriter : public ScatterInstanceSink
+	{
+	public:
+		/**
+			@param filename Index file, cells are written to VegetationDensityGrid::getRasterFileName(filename)
+			@param bb Grid area (terrain space)
+			@param cell_size Cell size in terrain units
+		*/
+		VegetationDensityGridWriter(const std::string &filename, const osg::BoundingBoxd &bb, double cell_size);
+
+		//ScatterInstanceSink
+		void addInstance(const osg::Vec3d &position, float radius, float height, unsigned int layer);
+
+		/**
+			Write cell raster and index, throws if files can't be written or are already written.
+			Accumulated cells are released, instances added afterwards are ignored.
+		*/
+		void write();
+	private:
+		std::string m_FileName;
+		osg::Vec2d m_Origin;
+		double m_CellSize;
+		int m_Width;
+		int m_Height;
+		//bottom, top, stem count, crown area
+		std::vector<osg::Vec4> m_Cells;
+	};
+}
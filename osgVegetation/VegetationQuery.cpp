@@ -0,0 +1,212 @@
+#include "VegetationQuery.h"
+#include "VegetationBVHWriter.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace osgVegetation
+{
+	VegetationQuery::VegetationQuery(const std::string &index_file, unsigned int max_cached_tiles) : m_IndexFile(index_file),
+		m_TileSize(0),
+		m_MaxRadius(0),
+		m_MaxCachedTiles(std::max(1u, max_cached_tiles)),
+		m_AccessCounter(0)
+	{
+		FILE* file = fopen(index_file.c_str(), "r");
+		if(file == NULL)
+			OSGV_EXCEPT(std::string("VegetationQuery::VegetationQuery - Failed to open file:" + index_file).c_str());
+		char magic[8] = {0};
+		unsigned int version = 0;
+		unsigned int num_tiles = 0;
+		bool ok = fscanf(file, "%4s %u", magic, &version) == 2 && strcmp(magic, "VBVI") == 0 && version == 1 &&
+			fscanf(file, "%lf %f %u", &m_TileSize, &m_MaxRadius, &num_tiles) == 3 && m_TileSize > 0;
+		for(unsigned int i = 0; ok && i < num_tiles; i++)
+		{
+			TileKey key;
+			ok = fscanf(file, "%d %d", &key.first, &key.second) == 2;
+			m_TileKeys.insert(key);
+		}
+		fclose(file);
+		if(!ok)
+			OSGV_EXCEPT(std::string("VegetationQuery::VegetationQuery - Invalid index file:" + index_file).c_str());
+	}
+
+	VegetationBVH* VegetationQuery::_getTile(const TileKey &key)
+	{
+		//empty tiles are never written, skip without touching disk
+		if(m_TileKeys.find(key) == m_TileKeys.end())
+			return NULL;
+		m_AccessCounter++;
+		std::map<TileKey, CacheEntry>::iterator iter = m_Cache.find(key);
+		if(iter != m_Cache.end())
+		{
+			iter->second.LastAccess = m_AccessCounter;
+			return iter->second.BVH.get();
+		}
+
+		//evict least recently used tile
+		if(m_Cache.size() >= m_MaxCachedTiles)
+		{
+			std::map<TileKey, CacheEntry>::iterator oldest = m_Cache.begin();
+			for(std::map<TileKey, CacheEntry>::iterator c_iter = m_Cache.begin(); c_iter != m_Cache.end(); ++c_iter)
+			{
+				if(c_iter->second.LastAccess < oldest->second.LastAccess)
+					oldest = c_iter;
+			}
+			m_Cache.erase(oldest);
+		}
+		CacheEntry& entry = m_Cache[key];
+		entry.BVH = VegetationBVH::load(VegetationBVHWriter::getTileFileName(m_IndexFile, key.first, key.second));
+		entry.LastAccess = m_AccessCounter;
+		return entry.BVH.get();
+	}
+
+	VegetationQuery::Result VegetationQuery::_createResult(const VegetationBVH &bvh, unsigned int index, double distance)
+	{
+		const VegetationInstance& instance = bvh.getInstances()[index];
+		Result result;
+		result.Position = bvh.getOrigin() + osg::Vec3d(instance.X, instance.Y, instance.Z);
+		result.Radius = instance.Radius;
+		result.Height = instance.Height;
+		result.Layer = instance.Layer;
+		result.Distance = distance;
+		return result;
+	}
+
+	bool VegetationQuery::intersect(const osg::Vec3d &start, const osg::Vec3d &end, Result &result)
+	{
+		const osg::Vec3d dir = end - start;
+		//instances overlap neighbour tiles by their radius
+		const int ring = 1 + static_cast<int>(m_MaxRadius / m_TileSize);
+		int cx = static_cast<int>(floor(start.x() / m_TileSize));
+		int cy = static_cast<int>(floor(start.y() / m_TileSize));
+		const int ex = static_cast<int>(floor(end.x() / m_TileSize));
+		const int ey = static_cast<int>(floor(end.y() / m_TileSize));
+		const int step_x = dir.x() > 0 ? 1 : -1;
+		const int step_y = dir.y() > 0 ? 1 : -1;
+		const double delta_x = dir.x() != 0 ? m_TileSize / fabs(dir.x()) : DBL_MAX;
+		const double delta_y = dir.y() != 0 ? m_TileSize / fabs(dir.y()) : DBL_MAX;
+		double next_x = dir.x() != 0 ? ((cx + (step_x > 0 ? 1 : 0)) * m_TileSize - start.x()) / dir.x() : DBL_MAX;
+		double next_y = dir.y() != 0 ? ((cy + (step_y > 0 ? 1 : 0)) * m_TileSize - start.y()) / dir.y() : DBL_MAX;
+
+		std::set<TileKey> visited;
+		double best_t = 1.0;
+		bool hit = false;
+		while(true)
+		{
+			for(int dy = -ring; dy <= ring; dy++)
+			{
+				for(int dx = -ring; dx <= ring; dx++)
+				{
+					const TileKey key(cx + dx, cy + dy);
+					if(!visited.insert(key).second)
+						continue;
+					osg::ref_ptr<VegetationBVH> bvh = _getTile(key);
+					if(!bvh.valid())
+						continue;
+					double t = best_t;
+					const int index = bvh->intersectSegment(start - bvh->getOrigin(), end - bvh->getOrigin(), t);
+					if(index >= 0 && t <= best_t)
+					{
+						best_t = t;
+						hit = true;
+						result = _createResult(*bvh, static_cast<unsigned int>(index), t * dir.length());
+					}
+				}
+			}
+			//tiles not visited yet can't hold hits before the current cell exit
+			const double t_exit = std::min(next_x, next_y);
+			if((hit && best_t <= t_exit) || (cx == ex && cy == ey) || t_exit > 1.0)
+				break;
+			if(next_x < next_y)
+			{
+				cx += step_x;
+				next_x += delta_x;
+			}
+			else
+			{
+				cy += step_y;
+				next_y += delta_y;
+			}
+		}
+		return hit;
+	}
+
+	void VegetationQuery::_queryTileBox(const TileKey &key, const osg::BoundingBoxd &bb, std::vector<Result> &results)
+	{
+		osg::ref_ptr<VegetationBVH> bvh = _getTile(key);
+		if(!bvh.valid())
+			return;
+		std::vector<unsigned int> indices;
+		bvh->queryBox(osg::BoundingBoxd(bb._min - bvh->getOrigin(), bb._max - bvh->getOrigin()), indices);
+		for(size_t i = 0; i < indices.size(); i++)
+			results.push_back(_createResult(*bvh, indices[i], 0));
+	}
+
+	void VegetationQuery::queryBox(const osg::BoundingBoxd &bb, std::vector<Result> &results)
+	{
+		const int x0 = static_cast<int>(floor((bb.xMin() - m_MaxRadius) / m_TileSize));
+		const int y0 = static_cast<int>(floor((bb.yMin() - m_MaxRadius) / m_TileSize));
+		const int x1 = static_cast<int>(floor((bb.xMax() + m_MaxRadius) / m_TileSize));
+		const int y1 = static_cast<int>(floor((bb.yMax() + m_MaxRadius) / m_TileSize));
+		for(int y = y0; y <= y1; y++)
+		{
+			for(int x = x0; x <= x1; x++)
+				_queryTileBox(TileKey(x, y), bb, results);
+		}
+	}
+
+	void VegetationQuery::nearest(const osg::Vec3d &position, unsigned int n, double max_distance, std::vector<Result> &results)
+	{
+		results.clear();
+		if(n == 0 || max_distance <= 0)
+			return;
+
+		//candidate tiles sorted by distance to tile rectangle
+		const int x0 = static_cast<int>(floor((position.x() - max_distance) / m_TileSize));
+		const int y0 = static_cast<int>(floor((position.y() - max_distance) / m_TileSize));
+		const int x1 = static_cast<int>(floor((position.x() + max_distance) / m_TileSize));
+		const int y1 = static_cast<int>(floor((position.y() + max_distance) / m_TileSize));
+		std::vector<std::pair<double, TileKey> > tiles;
+		for(int y = y0; y <= y1; y++)
+		{
+			for(int x = x0; x <= x1; x++)
+			{
+				const TileKey key(x, y);
+				if(m_TileKeys.find(key) == m_TileKeys.end())
+					continue;
+				const double dx = std::max(0.0, std::max(x * m_TileSize - position.x(), position.x() - (x + 1) * m_TileSize));
+				const double dy = std::max(0.0, std::max(y * m_TileSize - position.y(), position.y() - (y + 1) * m_TileSize));
+				tiles.push_back(std::make_pair(dx * dx + dy * dy, key));
+			}
+		}
+		std::sort(tiles.begin(), tiles.end());
+
+		std::vector<std::pair<double, Result> > best;
+		std::vector<std::pair<double, unsigned int> > tile_result;
+		for(size_t i = 0; i < tiles.size(); i++)
+		{
+			const double limit = best.size() == n ? best.back().first : max_distance * max_distance;
+			if(tiles[i].first > limit)
+				break;
+			osg::ref_ptr<VegetationBVH> bvh = _getTile(tiles[i].second);
+			if(!bvh.valid())
+				continue;
+			bvh->nearest(position - bvh->getOrigin(), n, limit, tile_result);
+			for(size_t j = 0; j < tile_result.size(); j++)
+			{
+				//merge into sorted list, ties keep first found
+				size_t pos = best.size();
+				while(pos > 0 && best[pos - 1].first > tile_result[j].first)
+					pos--;
+				best.insert(best.begin() + pos, std::make_pair(tile_result[j].first, _createResult(*bvh, tile_result[j].second, sqrt(tile_result[j].first))));
+				if(best.size() > n)
+					best.pop_back();
+			}
+		}
+		for(size_t i = 0; i < best.size(); i++)
+			results.push_back(best[i].second);
+	}
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include "Common.h"
+#include <osg/Referenced>
+#include <osg/BoundingBox>
+#include <osg/ref_ptr>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include "VegetationBVH.h"
+
+namespace osgVegetation
+{
+	/**
+		Runtime spatial queries against exported vegetation instances (see VegetationBVHWriter),
+		ie. line of sight and collision tests in simulations. Works directly on the BVH files
+		without touching the render graph. Tiles are loaded on first use and kept in a least
+		recently used cache. Instances are vertical cylinders (radius, height from base).
+		Not thread safe, use one object per thread.
+	*/
+	class osgvExport VegetationQuery : public osg::Referenced
+	{
+	public:
+		struct Result
+		{
+			Result() : Radius(0), Height(0), Layer(0), Distance(0) {}
+			//base position, terrain space
+			osg::Vec3d Position;
+			float Radius;
+			float Height;
+			unsigned int Layer;
+			//intersect: distance from segment start, nearest: horizontal distance to axis
+			double Distance;
+		};
+
+		/**
+			@param index_file Index file written by VegetationBVHWriter, throws if not readable
+			@param max_cached_tiles Max number of loaded tiles
+		*/
+		VegetationQuery(const std::string &index_file, unsigned int max_cached_tiles = 64);
+
+		/**
+			Find first instance hit by segment
+			@return true if hit
+		*/
+		bool intersect(const osg::Vec3d &start, const osg::Vec3d &end, Result &result);
+
+		/**
+			Get all instances with bounds overlapping bb
+		*/
+		void queryBox(const osg::BoundingBoxd &bb, std::vector<Result> &results);
+
+		/**
+			Get up to n nearest instances within max_distance (horizontal distance to axis),
+			sorted by distance
+		*/
+		void nearest(const osg::Vec3d &position, unsigned int n, double max_distance, std::vector<Result> &results);
+
+		double getTileSize() const {return m_TileSize;}
+		unsigned int getNumTiles() const {return static_cast<unsigned int>(m_TileKeys.size());}
+		unsigned int getNumLoadedTiles() const {return static_cast<unsigned int>(m_Cache.size());}
+	protected:
+		virtual ~VegetationQuery() {}
+	private:
+		typedef std::pair<int, int> TileKey;
+		struct CacheEntry
+		{
+			CacheEntry() : LastAccess(0) {}
+			osg::ref_ptr<VegetationBVH> BVH;
+			unsigned int LastAccess;
+		};
+		VegetationBVH* _getTile(const TileKey &key);
+		void _queryTileBox(const TileKey &key, const osg::BoundingBoxd &bb, std::vector<Result> &results);
+		static Result _createResult(const VegetationBVH &bvh, unsigned int index, double distance);
+
+		std::string m_IndexFile;
+		double m_TileSize;
+		float m_MaxRadius;
+		unsigned int m_MaxCachedTiles;
+		unsigned int m_AccessCounter;
+		std::set<TileKey> m_TileKeys;
+		std::map<TileKey, CacheEntry> m_Cache;
+	};
+}
@@ -2,6 +2,7 @@
 #include "BillboardData.h"
 #include <osg/Texture2D>
 #include <osg/Image>
+#include <osg/Math>
 #include <osg/Texture2DArray>
 #include <osgDB/ReadFile>
 
@@ -49,4 +50,75 @@ namespace osgVegetation
 		}
 		return tex;
 	}
+
+	unsigned long Utils::hilbertIndex(int order, unsigned int x, unsigned int y)
+	{
+		const unsigned long n = 1ul << order;
+		unsigned long d = 0;
+		for (unsigned long s = n / 2; s > 0; s /= 2)
+		{
+			const unsigned long rx = (x & s) > 0 ? 1 : 0;
+			const unsigned long ry = (y & s) > 0 ? 1 : 0;
+			d += s * s * ((3 * rx) ^ ry);
+			//rotate quadrant
+			if (ry == 0)
+			{
+				if (rx == 1)
+				{
+					x = static_cast<unsigned int>(n - 1 - x);
+					y = static_cast<unsigned int>(n - 1 - y);
+				}
+				const unsigned int t = x;
+				x = y;
+				y = t;
+			}
+		}
+		return d;
+	}
+
+	void Utils::getHilbertChildOrder(int child_level, int final_level, const int* child_x, const int* child_y, int* order)
+	{
+		//evaluate curve at final level to get a consistent order through the whole tree
+		const int shift = osg::maximum(final_level - child_level, 0);
+		const int curve_order = osg::maximum(final_level, child_level);
+		unsigned long index[4];
+		for (int i = 0; i < 4; i++)
+		{
+			index[i] = hilbertIndex(curve_order, static_cast<unsigned int>(child_x[i]) << shift, static_cast<unsigned int>(child_y[i]) << shift);
+			order[i] = i;
+		}
+		//insertion sort
+		for (int i = 1; i < 4; i++)
+		{
+			const int current = order[i];
+			int j = i - 1;
+			while (j >= 0 && index[order[j]] > index[current])
+			{
+				order[j + 1] = order[j];
+				j--;
+			}
+			order[j + 1] = current;
+		}
+	}
+
+	unsigned int Utils::getTileSeed(unsigned int seed, int level, int x, int y, unsigned int layer)
+	{
+		//FNV-1a over key followed by murmur finalizer to spread nearby keys
+		const unsigned int key[5] = {seed, static_cast<unsigned int>(level), static_cast<unsigned int>(x), static_cast<unsigned int>(y), layer};
+		unsigned int h = 2166136261u;
+		for (int i = 0; i < 5; i++)
+		{
+			for (int j = 0; j < 4; j++)
+			{
+				h ^= (key[i] >> (j * 8)) & 0xffu;
+				h *= 16777619u;
+			}
+		}
+		h ^= h >> 16;
+		h *= 0x85ebca6bu;
+		h ^= h >> 13;
+		h *= 0xc2b2ae35u;
+		h ^= h >> 16;
+		return h;
+	}
 }
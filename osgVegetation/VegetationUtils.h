@@ -18,5 +18,33 @@ namespace osgVegetation
 			This function will also save texture index into the texture array for each layer (_TextureIndex)
 		*/
 		static osg::ref_ptr<osg::Texture2DArray> loadTextureArray(BillboardData &data);
+
+		/**
+			Get distance along Hilbert curve for cell (x,y) in a grid with (1 << order) cells on each side.
+		*/
+		static unsigned long hilbertIndex(int order, unsigned int x, unsigned int y);
+
+		/**
+			Get processing order for the four quadtree children of a tile, children are sorted by
+			Hilbert index at final level so that consecutive tiles are spatially adjacent and
+			terrain pages/textures loaded for one tile are likely to be reused by the next.
+			@param child_level Quadtree level of the children
+			@param final_level Finest quadtree level
+			@param child_x Child x indices (array of four)
+			@param child_y Child y indices (array of four)
+			@param order Output, child indices in processing order (array of four)
+		*/
+		static void getHilbertChildOrder(int child_level, int final_level, const int* child_x, const int* child_y, int* order);
+
+		/**
+			Get random seed for a tile layer, only depends on the arguments so that a tile
+			get the same content regardless of build area and processing order.
+			@param seed Base seed
+			@param level Quadtree level of the tile
+			@param x Tile x index
+			@param y Tile y index
+			@param layer Layer index
+		*/
+		static unsigned int getTileSeed(unsigned int seed, int level, int x, int y, unsigned int layer);
 	};
 }
@@ -101,6 +101,8 @@ int main( int argc, char **argv )
 	spruce.TerrainColorRatio = 1.0;
 	spruce.UseTerrainIntensity = false;
 	spruce.CoverageMaterials.push_back(WOODS);
+	//draw baked billboard impostors of the same trees beyond the last mesh LOD
+	spruce.ImpostorDistance = 800;
 
 	//Create mesh data that hold all mesh layers
 	osgVegetation::MeshData tree_data;